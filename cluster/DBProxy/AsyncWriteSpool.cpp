@@ -0,0 +1,869 @@
+#include <fcntl.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sstream>
+#include "FPLog.h"
+#include "msec.h"
+#include "jenkins.h"
+#include "DataRouterErrorInfo.h"
+#include "AsyncWriteSpool.h"
+
+#define ASYNC_WRITE_SPOOL_MAX_RECORD_SIZE (64 * 1024 * 1024)
+#define ASYNC_WRITE_SPOOL_MAX_BACKOFF_SECONDS 30
+#define ASYNC_WRITE_SPOOL_WINDOW_BATCHES 64
+
+//========================================//
+//- Record Encoding
+//========================================//
+static void appendUInt32(std::string& buf, uint32_t value)
+{
+	buf.append((const char*)&value, sizeof(value));
+}
+
+static void appendInt64(std::string& buf, int64_t value)
+{
+	buf.append((const char*)&value, sizeof(value));
+}
+
+static void appendString(std::string& buf, const std::string& value)
+{
+	appendUInt32(buf, (uint32_t)value.length());
+	buf.append(value);
+}
+
+template<typename T>
+static bool readValue(const char*& pos, const char* end, T& value)
+{
+	if (end - pos < (ssize_t)sizeof(T))
+		return false;
+
+	memcpy(&value, pos, sizeof(T));
+	pos += sizeof(T);
+	return true;
+}
+
+static bool readString(const char*& pos, const char* end, std::string& value)
+{
+	uint32_t length;
+	if (!readValue(pos, end, length) || end - pos < (ssize_t)length)
+		return false;
+
+	value.assign(pos, length);
+	pos += length;
+	return true;
+}
+
+static void encodeRecord(const AsyncWriteSpool::Record& record, std::string& data)
+{
+	std::string body;
+	appendInt64(body, record.appendMsec);
+	appendInt64(body, record.hintId);
+	appendString(body, record.tableName);
+	appendString(body, record.cluster);
+	appendString(body, record.sql);
+	appendUInt32(body, (uint32_t)record.params.size());
+	for (auto& param: record.params)
+		appendString(body, param);
+
+	data.clear();
+	appendUInt32(data, (uint32_t)body.length());
+	appendUInt32(data, jenkins_hash(body.data(), body.length(), 0));
+	data.append(body);
+}
+
+static bool decodeRecord(const std::string& body, AsyncWriteSpool::Record& record)
+{
+	const char* pos = body.data();
+	const char* end = pos + body.length();
+
+	uint32_t paramCount;
+	if (!readValue(pos, end, record.appendMsec) || !readValue(pos, end, record.hintId)
+		|| !readString(pos, end, record.tableName) || !readString(pos, end, record.cluster) || !readString(pos, end, record.sql)
+		|| !readValue(pos, end, paramCount))
+		return false;
+
+	record.params.resize(paramCount);
+	for (uint32_t i = 0; i < paramCount; i++)
+		if (!readString(pos, end, record.params[i]))
+			return false;
+
+	return pos == end;
+}
+
+//-- Return 1: record read; 0: no complete record before limit; -1: corrupted.
+static int readRecordAt(int fd, size_t offset, size_t limit, AsyncWriteSpool::Record& record, size_t& recordBytes)
+{
+	uint32_t header[2];
+	if (offset + sizeof(header) > limit)
+		return 0;
+
+	if (pread(fd, header, sizeof(header), offset) != (ssize_t)sizeof(header))
+		return 0;
+
+	if (header[0] > ASYNC_WRITE_SPOOL_MAX_RECORD_SIZE)
+		return -1;
+
+	if (offset + sizeof(header) + header[0] > limit)
+		return 0;
+
+	std::string body(header[0], '\0');
+	if (pread(fd, &body[0], header[0], offset + sizeof(header)) != (ssize_t)header[0])
+		return 0;
+
+	if (jenkins_hash(body.data(), body.length(), 0) != header[1] || !decodeRecord(body, record))
+		return -1;
+
+	recordBytes = sizeof(header) + header[0];
+	return 1;
+}
+
+//========================================//
+//- Async Write Spool
+//========================================//
+std::mutex AsyncWriteSpool::_mutex;
+std::condition_variable AsyncWriteSpool::_condition;
+std::string AsyncWriteSpool::_directory;
+bool AsyncWriteSpool::_fsync = false;
+size_t AsyncWriteSpool::_segmentSize = 64 * 1024 * 1024;
+size_t AsyncWriteSpool::_maxSize = 1024 * 1024 * 1024;
+size_t AsyncWriteSpool::_batchSize = 256;
+
+int AsyncWriteSpool::_writeFd = -1;
+uint64_t AsyncWriteSpool::_writeSegment = 0;
+size_t AsyncWriteSpool::_writeOffset = 0;
+uint64_t AsyncWriteSpool::_readSegment = 0;
+size_t AsyncWriteSpool::_readOffset = 0;
+size_t AsyncWriteSpool::_spoolSize = 0;
+uint64_t AsyncWriteSpool::_pendingCount = 0;
+bool AsyncWriteSpool::_drainSignaled = false;
+
+std::thread AsyncWriteSpool::_drainer;
+std::atomic<bool> AsyncWriteSpool::_running(false);
+std::function<TableManagerPtr ()> AsyncWriteSpool::_tableManagerProvider;
+
+std::atomic<int64_t> AsyncWriteSpool::_drainingMsec(0);
+std::atomic<uint64_t> AsyncWriteSpool::_appendedCount(0);
+std::atomic<uint64_t> AsyncWriteSpool::_drainedCount(0);
+std::atomic<uint64_t> AsyncWriteSpool::_droppedCount(0);
+std::atomic<uint64_t> AsyncWriteSpool::_retryCount(0);
+std::atomic<uint64_t> AsyncWriteSpool::_corruptedCount(0);
+std::atomic<uint64_t> AsyncWriteSpool::_skippedBytes(0);
+
+std::string AsyncWriteSpool::segmentPath(uint64_t segment)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/spool.%012llu", (unsigned long long)segment);
+	return _directory + name;
+}
+
+bool AsyncWriteSpool::openWriteSegment(uint64_t segment)
+{
+	std::string path = segmentPath(segment);
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (fd < 0)
+	{
+		LOG_ERROR("Open async write spool segment %s failed. errno: %d", path.c_str(), errno);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st))
+	{
+		LOG_ERROR("Stat async write spool segment %s failed. errno: %d", path.c_str(), errno);
+		close(fd);
+		return false;
+	}
+
+	if (_writeFd >= 0)
+		close(_writeFd);
+
+	_writeFd = fd;
+	_writeSegment = segment;
+	_writeOffset = (size_t)st.st_size;
+	return true;
+}
+
+bool AsyncWriteSpool::loadCheckpoint()
+{
+	std::string path = _directory + "/spool.checkpoint";
+	FILE* fp = fopen(path.c_str(), "r");
+	if (!fp)
+		return (errno == ENOENT);
+
+	unsigned long long segment = 0;
+	unsigned long long offset = 0;
+	bool status = (fscanf(fp, "%llu %llu", &segment, &offset) == 2);
+	fclose(fp);
+
+	if (!status)
+	{
+		LOG_ERROR("Invalid async write spool checkpoint %s.", path.c_str());
+		return false;
+	}
+
+	_readSegment = (uint64_t)segment;
+	_readOffset = (size_t)offset;
+	return true;
+}
+
+bool AsyncWriteSpool::saveCheckpoint(uint64_t segment, size_t offset)
+{
+	std::string path = _directory + "/spool.checkpoint";
+	std::string tmpPath = path + ".tmp";
+
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		LOG_ERROR("Open async write spool checkpoint %s failed. errno: %d", tmpPath.c_str(), errno);
+		return false;
+	}
+
+	std::string content = std::to_string(segment);
+	content.append(" ").append(std::to_string(offset)).append("\n");
+
+	bool status = (write(fd, content.data(), content.length()) == (ssize_t)content.length());
+	if (status && _fsync)
+		status = (fsync(fd) == 0);
+
+	close(fd);
+
+	if (status)
+		status = (rename(tmpPath.c_str(), path.c_str()) == 0);
+
+	if (!status)
+		LOG_ERROR("Save async write spool checkpoint %s failed. errno: %d", path.c_str(), errno);
+
+	return status;
+}
+
+bool AsyncWriteSpool::scanSegment(uint64_t segment, bool truncateTail)
+{
+	std::string path = segmentPath(segment);
+	int fd = open(path.c_str(), truncateTail ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+	{
+		LOG_ERROR("Open async write spool segment %s failed. errno: %d", path.c_str(), errno);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st))
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t limit = (size_t)st.st_size;
+	size_t offset = (segment == _readSegment) ? _readOffset : 0;
+	while (true)
+	{
+		Record record;
+		size_t recordBytes;
+		int rev = readRecordAt(fd, offset, limit, record, recordBytes);
+		if (rev <= 0)
+		{
+			if (offset < limit)
+			{
+				if (truncateTail)
+				{
+					LOG_WARN("Truncate incomplete tail of async write spool segment %s at %llu, %llu bytes dropped.",
+						path.c_str(), (unsigned long long)offset, (unsigned long long)(limit - offset));
+					if (ftruncate(fd, offset))
+						LOG_ERROR("Truncate async write spool segment %s failed. errno: %d", path.c_str(), errno);
+				}
+				else
+				{
+					_corruptedCount++;
+					_skippedBytes += limit - offset;
+					LOG_ERROR("Async write spool segment %s is corrupted at %llu, the rest %llu bytes will be skipped.",
+						path.c_str(), (unsigned long long)offset, (unsigned long long)(limit - offset));
+				}
+			}
+			break;
+		}
+
+		offset += recordBytes;
+		_spoolSize += recordBytes;
+		_pendingCount += 1;
+	}
+
+	close(fd);
+	return true;
+}
+
+bool AsyncWriteSpool::config(const std::string& directory, bool fsync, int segmentMB, int maxMB, int batchSize)
+{
+	if (directory.empty())
+		return false;
+
+	std::lock_guard<std::mutex> lck (_mutex);
+
+	if (mkdir(directory.c_str(), 0700) && errno != EEXIST)
+	{
+		LOG_ERROR("Create async write spool directory %s failed. errno: %d", directory.c_str(), errno);
+		return false;
+	}
+
+	_directory = directory;
+	_fsync = fsync;
+	_segmentSize = (size_t)(segmentMB > 0 ? segmentMB : 1) * 1024 * 1024;
+	_maxSize = (size_t)(maxMB > 0 ? maxMB : 1) * 1024 * 1024;
+	_batchSize = (size_t)(batchSize > 0 ? batchSize : 1);
+
+	bool checkpointed = false;
+	{
+		std::string path = _directory + "/spool.checkpoint";
+		checkpointed = (access(path.c_str(), F_OK) == 0);
+	}
+	if (!loadCheckpoint())
+		return false;
+
+	//-- Find the existed segments.
+	uint64_t firstSegment = UINT64_MAX;
+	uint64_t lastSegment = 0;
+	DIR* dir = opendir(_directory.c_str());
+	if (!dir)
+	{
+		LOG_ERROR("Open async write spool directory %s failed. errno: %d", _directory.c_str(), errno);
+		return false;
+	}
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		unsigned long long segment;
+		char tail;
+		if (sscanf(entry->d_name, "spool.%llu%c", &segment, &tail) == 1)
+		{
+			if (segment < firstSegment)
+				firstSegment = segment;
+			if (segment > lastSegment)
+				lastSegment = segment;
+		}
+	}
+	closedir(dir);
+
+	if (firstSegment == UINT64_MAX)
+	{
+		firstSegment = _readSegment;
+		lastSegment = _readSegment;
+	}
+	else if (!checkpointed)
+	{
+		_readSegment = firstSegment;
+		_readOffset = 0;
+	}
+
+	//-- Segments before checkpoint were drained.
+	for (uint64_t segment = firstSegment; segment < _readSegment; segment++)
+		unlink(segmentPath(segment).c_str());
+
+	if (lastSegment < _readSegment)
+		lastSegment = _readSegment;
+
+	for (uint64_t segment = _readSegment; segment <= lastSegment; segment++)
+	{
+		if (access(segmentPath(segment).c_str(), F_OK))
+			continue;
+
+		if (!scanSegment(segment, segment == lastSegment))
+			return false;
+	}
+
+	if (!openWriteSegment(lastSegment))
+		return false;
+
+	LOG_INFO("Async write spool %s loaded. %llu records pending.", _directory.c_str(), (unsigned long long)_pendingCount);
+	return true;
+}
+
+void AsyncWriteSpool::start(std::function<TableManagerPtr ()> tableManagerProvider)
+{
+	if (!enabled() || _running)
+		return;
+
+	_tableManagerProvider = tableManagerProvider;
+	_running = true;
+	_drainer = std::thread(&AsyncWriteSpool::drain);
+}
+
+void AsyncWriteSpool::stop()
+{
+	if (!_running)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_running = false;
+		_condition.notify_all();
+	}
+	_drainer.join();
+}
+
+int AsyncWriteSpool::append(Record& record)
+{
+	std::string data;
+	encodeRecord(record, data);
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	if (_writeFd < 0)
+		return ErrorInfo::disabledCode;
+
+	if (_spoolSize + data.length() > _maxSize)
+		return ErrorInfo::serverBusyCode;
+
+	if (_writeOffset > 0 && _writeOffset + data.length() > _segmentSize)
+	{
+		if (!openWriteSegment(_writeSegment + 1))
+			return ErrorInfo::internalErrorCode;
+	}
+
+	ssize_t written = write(_writeFd, data.data(), data.length());
+	if (written != (ssize_t)data.length())
+	{
+		LOG_ERROR("Append to async write spool segment %s failed. errno: %d", segmentPath(_writeSegment).c_str(), errno);
+		if (written > 0 && ftruncate(_writeFd, _writeOffset))
+			LOG_ERROR("Rollback async write spool segment %s failed. errno: %d", segmentPath(_writeSegment).c_str(), errno);
+
+		return ErrorInfo::internalErrorCode;
+	}
+
+	int code = 0;
+	if (_fsync && fdatasync(_writeFd))
+	{
+		LOG_ERROR("Sync async write spool segment %s failed. errno: %d", segmentPath(_writeSegment).c_str(), errno);
+		if (ftruncate(_writeFd, _writeOffset) == 0)
+			return ErrorInfo::internalErrorCode;
+
+		//-- Keep the offset matching the file. The record may be drained, though the caller is answered with error.
+		LOG_ERROR("Rollback async write spool segment %s failed. errno: %d", segmentPath(_writeSegment).c_str(), errno);
+		code = ErrorInfo::internalErrorCode;
+	}
+
+	_writeOffset += data.length();
+	_spoolSize += data.length();
+	_pendingCount += 1;
+	_appendedCount++;
+
+	_drainSignaled = true;
+	_condition.notify_one();
+	return code;
+}
+
+void AsyncWriteSpool::signal()
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	_drainSignaled = true;
+	_condition.notify_one();
+}
+
+bool AsyncWriteSpool::retryable(unsigned int mySQLErrno)
+{
+	//-- Client errors (connection lost, etc.), lock wait timeout, deadlock, and read only (master is switching).
+	return (mySQLErrno >= 2000 || mySQLErrno == 1205 || mySQLErrno == 1213 || mySQLErrno == 1290);
+}
+
+bool AsyncWriteSpool::readRecords(std::vector<Record>& records, uint64_t& segment, size_t& offset)
+{
+	uint64_t writeSegment;
+	size_t writeOffset;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		writeSegment = _writeSegment;
+		writeOffset = _writeOffset;
+	}
+
+	while (records.size() < _batchSize)
+	{
+		std::string path = segmentPath(segment);
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			if (segment >= writeSegment)
+				break;
+
+			segment += 1;
+			offset = 0;
+			continue;
+		}
+
+		size_t limit = writeOffset;
+		if (segment < writeSegment)
+		{
+			struct stat st;
+			limit = fstat(fd, &st) ? 0 : (size_t)st.st_size;
+		}
+
+		bool exhausted = false;
+		while (records.size() < _batchSize)
+		{
+			Record record;
+			size_t recordBytes;
+			int rev = readRecordAt(fd, offset, limit, record, recordBytes);
+			if (rev == 0)
+			{
+				exhausted = true;
+				break;
+			}
+
+			if (rev < 0)
+			{
+				if (segment >= writeSegment)
+				{
+					//-- Seal the active segment, or the corrupted record will be read again and again.
+					std::lock_guard<std::mutex> lck (_mutex);
+					if (_writeSegment == segment && !openWriteSegment(segment + 1))
+						break;
+
+					writeSegment = _writeSegment;
+					writeOffset = _writeOffset;
+				}
+
+				struct stat st;
+				limit = fstat(fd, &st) ? offset : (size_t)st.st_size;
+
+				_corruptedCount++;
+				_skippedBytes += (limit > offset) ? limit - offset : 0;
+				LOG_ERROR("Async write spool segment %s is corrupted at %llu, the rest %llu bytes are skipped.",
+					path.c_str(), (unsigned long long)offset, (unsigned long long)(limit > offset ? limit - offset : 0));
+
+				exhausted = true;
+				break;
+			}
+
+			record.segment = segment;
+			record.offset = offset;
+			offset += recordBytes;
+			records.push_back(std::move(record));
+		}
+		close(fd);
+
+		if (!exhausted || segment >= writeSegment)
+			break;
+
+		segment += 1;
+		offset = 0;
+	}
+
+	return !records.empty();
+}
+
+void AsyncWriteSpool::dispatch(TableManagerPtr tableManager, WindowPtr window, std::map<DatabaseTaskQueue*, Lane>& lanes)
+{
+	int64_t now = slack_mono_msec();
+	std::set<DatabaseTaskQueue*> closedLanes;		//-- The later records of these lanes wait, to keep the order.
+	std::map<DatabaseTaskQueue*, AsyncWriteBatchTaskPtr> batches;
+
+	for (auto& lanePair: lanes)
+		if (lanePair.second.busy || lanePair.second.retryMsec > now)
+			closedLanes.insert(lanePair.first);
+
+	std::lock_guard<std::mutex> lck (window->mutex);
+	for (auto& record: window->records)
+	{
+		if (record.status != Pending || record.dispatched)
+			continue;
+
+		if (!record.target)
+		{
+			std::string sql = record.sql;
+			DatabaseTaskQueuePtr taskQueue = tableManager->writeTaskQueue(record.hintId, record.tableName, record.cluster, sql, record.databaseName);
+			if (!taskQueue)
+			{
+				record.status = Dropped;
+				window->unfinished -= 1;
+				LOG_ERROR("Async write dropped. Target database or table not found. Table: %s, cluster: %s, hintId: %lld, sql: [%s]",
+					record.tableName.c_str(), record.cluster.c_str(), (long long)record.hintId, record.sql.c_str());
+				continue;
+			}
+			record.routedSql.swap(sql);
+			record.target = taskQueue.get();
+		}
+
+		if (closedLanes.find(record.target) != closedLanes.end())
+			continue;
+
+		AsyncWriteBatchTaskPtr& batch = batches[record.target];
+		if (!batch)
+			batch = std::make_shared<AsyncWriteBatchTask>(window, record.target);
+
+		batch->addRecord(&record);
+		record.dispatched = true;
+
+		if (batch->size() >= _batchSize)
+			closedLanes.insert(record.target);
+	}
+
+	for (auto& batchPair: batches)
+	{
+		lanes[batchPair.first].busy = true;
+		batchPair.first->queue.push(batchPair.second, false);
+		batchPair.first->masterDB->wakeUp();
+	}
+}
+
+bool AsyncWriteSpool::advanceCheckpoint(uint64_t segment, size_t offset, uint64_t drained, uint64_t dropped)
+{
+	if (!saveCheckpoint(segment, offset))
+		return false;
+
+	std::lock_guard<std::mutex> lck (_mutex);
+
+	for (uint64_t drainedSegment = _readSegment; drainedSegment < segment; drainedSegment++)
+	{
+		std::string path = segmentPath(drainedSegment);
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0)
+		{
+			size_t remained = ((size_t)st.st_size > _readOffset) ? (size_t)st.st_size - _readOffset : 0;
+			_spoolSize = (_spoolSize > remained) ? _spoolSize - remained : 0;
+		}
+		unlink(path.c_str());
+		_readOffset = 0;
+	}
+
+	size_t consumed = (offset > _readOffset) ? offset - _readOffset : 0;
+	_spoolSize = (_spoolSize > consumed) ? _spoolSize - consumed : 0;
+	_readSegment = segment;
+	_readOffset = offset;
+
+	_drainedCount += drained;
+	_droppedCount += dropped;
+	_pendingCount = (_pendingCount > drained + dropped) ? _pendingCount - drained - dropped : 0;
+	return true;
+}
+
+void AsyncWriteSpool::drain()
+{
+	uint64_t segment;		//-- read cursor
+	size_t offset;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		segment = _readSegment;
+		offset = _readOffset;
+	}
+
+	uint64_t checkpointSegment = segment;
+	size_t checkpointOffset = offset;
+	uint64_t drained = 0;		//-- Finished, but not checkpointed.
+	uint64_t dropped = 0;
+
+	WindowPtr window = std::make_shared<Window>();
+	std::map<DatabaseTaskQueue*, Lane> lanes;
+	TableManagerPtr routedTableManager;
+	size_t capacity = _batchSize * ASYNC_WRITE_SPOOL_WINDOW_BATCHES;
+
+	while (_running)
+	{
+		std::vector<Record> records;
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lck (window->mutex);
+				if (window->unfinished >= capacity)
+					break;
+			}
+
+			if (!readRecords(records, segment, offset))
+				break;
+
+			std::lock_guard<std::mutex> lck (window->mutex);
+			for (auto& record: records)
+				window->records.push_back(std::move(record));
+
+			window->unfinished += records.size();
+			records.clear();
+		}
+
+		int64_t now = slack_mono_msec();
+		bool busy = false;
+		{
+			std::lock_guard<std::mutex> lck (window->mutex);
+			for (auto& finished: window->finishedBatches)
+			{
+				Lane& lane = lanes[finished.first];
+				lane.busy = false;
+
+				if (finished.second)
+				{
+					//-- Master unavailable, or retryable error. Retry the pending records of this lane later.
+					_retryCount++;
+					lane.backoffSeconds = lane.backoffSeconds ? lane.backoffSeconds * 2 : 1;
+					if (lane.backoffSeconds > ASYNC_WRITE_SPOOL_MAX_BACKOFF_SECONDS)
+						lane.backoffSeconds = ASYNC_WRITE_SPOOL_MAX_BACKOFF_SECONDS;
+
+					lane.retryMsec = now + lane.backoffSeconds * 1000;
+				}
+				else
+				{
+					lane.backoffSeconds = 0;
+					lane.retryMsec = 0;
+				}
+			}
+			window->finishedBatches.clear();
+
+			while (window->records.size())
+			{
+				Record& record = window->records.front();
+				if (record.status == Pending || record.dispatched)
+					break;
+
+				if (record.status == Done)
+					drained++;
+				else
+					dropped++;
+
+				window->records.pop_front();
+			}
+
+			for (auto& lanePair: lanes)
+				if (lanePair.second.busy)
+					busy = true;
+		}
+
+		uint64_t newSegment = segment;
+		size_t newOffset = offset;
+		if (window->records.size())
+		{
+			newSegment = window->records.front().segment;
+			newOffset = window->records.front().offset;
+		}
+
+		if ((newSegment != checkpointSegment || newOffset != checkpointOffset) && advanceCheckpoint(newSegment, newOffset, drained, dropped))
+		{
+			checkpointSegment = newSegment;
+			checkpointOffset = newOffset;
+			drained = 0;
+			dropped = 0;
+		}
+		_drainingMsec = window->records.size() ? window->records.front().appendMsec : 0;
+
+		TableManagerPtr tableManager = _tableManagerProvider();
+		if (tableManager != routedTableManager && !busy)
+		{
+			std::lock_guard<std::mutex> lck (window->mutex);
+			for (auto& record: window->records)
+			{
+				record.target = NULL;
+				record.routedSql.clear();
+			}
+
+			lanes.clear();
+			routedTableManager = tableManager;
+		}
+
+		if (routedTableManager && tableManager == routedTableManager)
+			dispatch(routedTableManager, window, lanes);
+
+		int64_t waitMsec = 1000;
+		for (auto& lanePair: lanes)
+			if (!lanePair.second.busy && lanePair.second.retryMsec > now && lanePair.second.retryMsec - now < waitMsec)
+				waitMsec = lanePair.second.retryMsec - now;
+
+		std::unique_lock<std::mutex> lck (_mutex);
+		if (_running && !_drainSignaled)
+			_condition.wait_for(lck, std::chrono::milliseconds(waitMsec));
+
+		_drainSignaled = false;
+	}
+}
+
+std::string AsyncWriteSpool::statusInJSON()
+{
+	if (!enabled())
+		return "{\"enabled\":false}";
+
+	std::ostringstream oss;
+	int64_t drainingMsec = _drainingMsec;
+	int64_t lag = drainingMsec ? exact_real_msec() - drainingMsec : 0;
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	oss<<"{\"enabled\":true";
+	oss<<",\"pendingRecords\":"<<_pendingCount;
+	oss<<",\"spoolBytes\":"<<_spoolSize;
+	oss<<",\"segments\":"<<(_writeSegment - _readSegment + 1);
+	oss<<",\"drainLagMsec\":"<<(lag > 0 ? lag : 0);
+	oss<<",\"appended\":"<<_appendedCount;
+	oss<<",\"drained\":"<<_drainedCount;
+	oss<<",\"dropped\":"<<_droppedCount;
+	oss<<",\"retries\":"<<_retryCount;
+	oss<<",\"corruptedRecords\":"<<_corruptedCount;
+	oss<<",\"skippedBytes\":"<<_skippedBytes<<"}";
+	return oss.str();
+}
+
+//========================================//
+//- Async Write Batch Task
+//========================================//
+AsyncWriteBatchTask::~AsyncWriteBatchTask()
+{
+	bool failed = false;
+	{
+		std::lock_guard<std::mutex> lck (_window->mutex);
+		for (auto record: _records)
+		{
+			record->dispatched = false;
+			if (record->status == AsyncWriteSpool::Pending)
+			{
+				failed = true;
+				continue;
+			}
+
+			//-- Only the position is used after finished.
+			_window->unfinished -= 1;
+			std::string().swap(record->sql);
+			std::string().swap(record->routedSql);
+			std::vector<std::string>().swap(record->params);
+		}
+		_window->finishedBatches.push_back(std::make_pair(_target, failed));
+	}
+	AsyncWriteSpool::signal();
+}
+
+void AsyncWriteBatchTask::processTask(MySQLClient *mySQL) throw ()
+{
+	for (auto recordPtr: _records)
+	{
+		AsyncWriteSpool::Record& record = *recordPtr;
+		try
+		{
+			if (!prepareConnection(mySQL))
+				return;		//-- The rest records will be retried in the next dispatching.
+
+			QueryResult result;
+			bool status;
+
+			if (record.params.empty())
+				status = mySQL->query(record.databaseName, record.routedSql, result);
+			else
+			{
+				ParamsQueryTask assembler(record.routedSql, record.tableName, record.cluster, std::vector<std::string>(record.params), nullptr);
+				if (!assembler.assemble(mySQL))
+				{
+					record.status = AsyncWriteSpool::Dropped;
+					LOG_ERROR("Async write dropped. Assemble sql failed. Table: %s, sql: [%s]", record.tableName.c_str(), record.sql.c_str());
+					continue;
+				}
+				status = mySQL->query(record.databaseName, assembler.sql(), result);
+			}
+
+			if (status)
+				record.status = AsyncWriteSpool::Done;
+			else if (AsyncWriteSpool::retryable(mySQL->lastErrno()))
+				return;
+			else
+			{
+				record.status = AsyncWriteSpool::Dropped;
+				LOG_ERROR("Async write dropped. Table: %s, database: %s, sql: [%s], %s", record.tableName.c_str(),
+					record.databaseName.c_str(), record.routedSql.c_str(), result.errorInfo.c_str());
+			}
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR("Async write exception: %s. Table: %s, sql: [%s]", e.what(), record.tableName.c_str(), record.sql.c_str());
+			return;
+		}
+	}
+}
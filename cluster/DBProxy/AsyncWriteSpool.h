@@ -0,0 +1,154 @@
+#ifndef Async_Write_Spool_H
+#define Async_Write_Spool_H
+
+#include <set>
+#include <map>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include "TableManager.h"
+
+//========================================//
+//- Async Write Spool
+//========================================//
+/*
+	Accepted writes are appended to local segment files: <directory>/spool.<sequence>.
+	Record: uint32 body length | uint32 body checksum | body.
+	The drainer reads the records into a bounded window. Each target DatabaseTaskQueue has its own lane:
+	at most one ordered batch of its records is in flight, and a failed lane backs off alone. Only the unfinished
+	records are limited by the window capacity, so the finished records queued behind a backing off lane do not
+	stop the other lanes. Their payloads are released, and they are popped when the lane catches up.
+	The checkpoint is the oldest unfinished record. So the order per sub-table is kept, and the delivery is at least once.
+	When the configuration changed, the in-flight batches are waited, then the pending records are routed again.
+
+	A corrupted record is skipped with the rest of its segment. If it is in the active segment,
+	the new records are appended to the next segment.
+*/
+class AsyncWriteSpool
+{
+public:
+	struct Record
+	{
+		int64_t appendMsec;
+		int64_t hintId;
+		std::string tableName;
+		std::string cluster;
+		std::string sql;
+		std::vector<std::string> params;	//-- rest params after preassembled.
+
+		//-- Used by drainer.
+		uint64_t segment;
+		size_t offset;
+		std::string routedSql;
+		std::string databaseName;
+		DatabaseTaskQueue* target;		//-- Owned by the TableManager used to route.
+		bool dispatched;
+		int status;
+
+		Record(): appendMsec(0), hintId(0), segment(0), offset(0), target(NULL), dispatched(false), status(0) {}
+	};
+
+	enum RecordStatus
+	{
+		Pending = 0,
+		Done,
+		Dropped,
+	};
+
+	struct Window
+	{
+		std::mutex mutex;
+		std::deque<Record> records;		//-- Appended and popped by the drainer only, so the in-flight records are never moved.
+		std::list<std::pair<DatabaseTaskQueue*, bool>> finishedBatches;		//-- target, failed
+		size_t unfinished;				//-- Pending records in the window.
+
+		Window(): unfinished(0) {}
+	};
+	typedef std::shared_ptr<Window> WindowPtr;
+
+	struct Lane
+	{
+		bool busy;
+		int backoffSeconds;
+		int64_t retryMsec;
+
+		Lane(): busy(false), backoffSeconds(0), retryMsec(0) {}
+	};
+
+private:
+	static std::mutex _mutex;
+	static std::condition_variable _condition;
+	static std::string _directory;
+	static bool _fsync;
+	static size_t _segmentSize;
+	static size_t _maxSize;
+	static size_t _batchSize;
+
+	static int _writeFd;
+	static uint64_t _writeSegment;
+	static size_t _writeOffset;
+	static uint64_t _readSegment;		//-- checkpoint
+	static size_t _readOffset;			//-- checkpoint
+	static size_t _spoolSize;
+	static uint64_t _pendingCount;
+	static bool _drainSignaled;
+
+	static std::thread _drainer;
+	static std::atomic<bool> _running;
+	static std::function<TableManagerPtr ()> _tableManagerProvider;
+
+	static std::atomic<int64_t> _drainingMsec;		//-- append time of the oldest record in draining.
+	static std::atomic<uint64_t> _appendedCount;
+	static std::atomic<uint64_t> _drainedCount;
+	static std::atomic<uint64_t> _droppedCount;
+	static std::atomic<uint64_t> _retryCount;
+	static std::atomic<uint64_t> _corruptedCount;
+	static std::atomic<uint64_t> _skippedBytes;
+
+	static std::string segmentPath(uint64_t segment);
+	static bool openWriteSegment(uint64_t segment);
+	static bool loadCheckpoint();
+	static bool saveCheckpoint(uint64_t segment, size_t offset);
+	static bool scanSegment(uint64_t segment, bool truncateTail);
+	static bool readRecords(std::vector<Record>& records, uint64_t& segment, size_t& offset);
+	static void dispatch(TableManagerPtr tableManager, WindowPtr window, std::map<DatabaseTaskQueue*, Lane>& lanes);
+	static bool advanceCheckpoint(uint64_t segment, size_t offset, uint64_t drained, uint64_t dropped);
+	static void drain();
+
+public:
+	static bool config(const std::string& directory, bool fsync, int segmentMB, int maxMB, int batchSize);
+	static inline bool enabled() { return _writeFd >= 0; }
+	static void start(std::function<TableManagerPtr ()> tableManagerProvider);
+	static void stop();
+
+	//-- Return 0 if appended, else error code.
+	static int append(Record& record);
+	static bool retryable(unsigned int mySQLErrno);
+	static void signal();
+	static std::string statusInJSON();
+};
+
+//========================================//
+//- Async Write Batch Task
+//========================================//
+class AsyncWriteBatchTask: public TaskPackage
+{
+	AsyncWriteSpool::WindowPtr _window;
+	DatabaseTaskQueue* _target;
+	std::vector<AsyncWriteSpool::Record*> _records;
+
+public:
+	AsyncWriteBatchTask(AsyncWriteSpool::WindowPtr window, DatabaseTaskQueue* target): TaskPackage(std::string(), nullptr), _window(window), _target(target) {}
+	virtual ~AsyncWriteBatchTask();
+
+	inline void addRecord(AsyncWriteSpool::Record* record) { _records.push_back(record); }
+	inline size_t size() { return _records.size(); }
+	virtual void processTask(MySQLClient *mySQL) throw ();
+};
+typedef std::shared_ptr<AsyncWriteBatchTask> AsyncWriteBatchTaskPtr;
+
+#endif
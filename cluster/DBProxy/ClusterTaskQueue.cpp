@@ -0,0 +1,222 @@
+#include <sstream>
+#include <algorithm>
+#include "FPLog.h"
+#include "StringUtil.h"
+#include "ClusterTaskQueue.h"
+
+using namespace fpnn;
+
+//=============================================//
+//-	Lane
+//=============================================//
+TaskPackagePtr ClusterTaskQueue::Lane::pop(bool readTask, const std::string& database)
+{
+	std::atomic<int>& running = readTask ? runningReads : runningWrites;
+	if (maxConcurrency && running >= maxConcurrency)
+		return nullptr;
+
+	TaskPackagePtr task = readTask ? queue.readQueue()->pop(database) : queue.writeQueue()->pop(database);
+	if (task)
+		running++;
+
+	return task;
+}
+
+void ClusterTaskQueue::Lane::finished(TaskPackage* task)
+{
+	if (task->readQueued())
+		runningReads--;
+	else
+		runningWrites--;
+
+	executedCount++;
+
+	int64_t latency = slack_mono_msec() - task->enqueuedTime();
+	int64_t average = latencyMsec;
+	while (!latencyMsec.compare_exchange_weak(average, average ? average + (latency - average) / 8 : latency));
+}
+
+std::string ClusterTaskQueue::Lane::statusInJSON()
+{
+	std::ostringstream oss;
+	oss<<"{\"cluster\":\""<<cluster<<"\"";
+	oss<<",\"readQueueSize\":"<<queue.readQueueSize();
+	oss<<",\"writeQueueSize\":"<<queue.writeQueueSize();
+	oss<<",\"runningReads\":"<<runningReads;
+	oss<<",\"runningWrites\":"<<runningWrites;
+	oss<<",\"maxConcurrency\":"<<maxConcurrency;
+	oss<<",\"maxQueueLength\":"<<maxQueueLength;
+	oss<<",\"executed\":"<<executedCount;
+	oss<<",\"latencyMsec\":"<<latencyMsec;
+	if (SojournMonitor::enabled())
+	{
+		oss<<",\"readOverloadLevel\":"<<queue.readMonitor().overloadLevel();
+		oss<<",\"writeOverloadLevel\":"<<queue.writeMonitor().overloadLevel();
+		oss<<",\"readShed\":"<<queue.readMonitor().shedCount();
+		oss<<",\"writeShed\":"<<queue.writeMonitor().shedCount();
+	}
+	oss<<"}";
+	return oss.str();
+}
+
+//=============================================//
+//-	Cluster Task Queue
+//=============================================//
+bool ClusterTaskQueue::_enabled = false;
+ClusterTaskQueue::Quota ClusterTaskQueue::_defaultQuota = { 0, 0 };
+std::map<std::string, ClusterTaskQueue::Quota> ClusterTaskQueue::_quotas;
+
+void ClusterTaskQueue::config(int maxConcurrency, int maxQueueLength, const std::string& quotas)
+{
+	_enabled = true;
+	_defaultQuota.maxConcurrency = maxConcurrency > 0 ? maxConcurrency : 0;
+	_defaultQuota.maxQueueLength = maxQueueLength > 0 ? (size_t)maxQueueLength : 0;
+
+	std::vector<std::string> items;
+	StringUtil::split(quotas, " ,", items);
+	for (auto& item: items)
+	{
+		std::vector<std::string> fields;
+		StringUtil::split(item, ":", fields);
+		if (fields.size() != 3)
+		{
+			LOG_ERROR("Invalid cluster quota: %s", item.c_str());
+			continue;
+		}
+
+		Quota& quota = _quotas[fields[0]];
+		quota.maxConcurrency = std::max(atoi(fields[1].c_str()), 0);
+		quota.maxQueueLength = (size_t)std::max(atoi(fields[2].c_str()), 0);
+	}
+}
+
+ClusterTaskQueue::Lane* ClusterTaskQueue::lane(const std::string& cluster)
+{
+	if (!_enabled)
+		return &_defaultLane;
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	auto iter = _laneMap.find(cluster);
+	if (iter != _laneMap.end())
+		return iter->second.get();
+
+	auto quotaIter = _quotas.find(cluster);
+	const Quota& quota = (quotaIter != _quotas.end()) ? quotaIter->second : _defaultQuota;
+
+	Lane* lane = new Lane(cluster, quota.maxConcurrency, quota.maxQueueLength);
+	_laneMap[cluster].reset(lane);
+	_lanes.push_back(lane);
+	return lane;
+}
+
+void ClusterTaskQueue::push(Lane* lane, TaskPackagePtr task, bool readTask)
+{
+	if (_enabled)
+		task->setEnqueuedTime(slack_mono_msec());
+
+	lane->queue.push(task, readTask);
+}
+
+TaskPackagePtr ClusterTaskQueue::popLanes(bool writable, const std::string& database)
+{
+	if (!_enabled)
+		return writable ? _defaultLane.queue.pop(database) : _defaultLane.queue.readQueue()->pop(database);
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	size_t count = _lanes.size();
+	if (count == 0)
+		return nullptr;
+
+	size_t start = _cursor++;
+
+	//-- The writes are preferred, as the RWTaskQueue.
+	for (int readTask = writable ? 0 : 1; readTask < 2; readTask++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			TaskPackagePtr task = _lanes[(start + i) % count]->pop(readTask, database);
+			if (task)
+				return task;
+		}
+	}
+	return nullptr;
+}
+
+void ClusterTaskQueue::finished(TaskPackagePtr& task)
+{
+	if (!_enabled || !task)
+		return;
+
+	Lane* lane = NULL;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		auto iter = _laneMap.find(task->cluster());
+		if (iter != _laneMap.end())
+			lane = iter->second.get();
+	}
+
+	if (lane)
+		lane->finished(task.get());
+}
+
+TaskPackagePtr ClusterTaskQueue::takeQueued()
+{
+	if (!_enabled)
+		return _defaultLane.queue.pop();
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	for (Lane* lane: _lanes)
+	{
+		TaskPackagePtr task = lane->queue.pop();
+		if (task)
+			return task;
+	}
+	return nullptr;
+}
+
+size_t ClusterTaskQueue::size()
+{
+	return readQueueSize() + writeQueueSize();
+}
+
+size_t ClusterTaskQueue::readQueueSize()
+{
+	if (!_enabled)
+		return _defaultLane.queue.readQueueSize();
+
+	size_t count = 0;
+	std::lock_guard<std::mutex> lck (_mutex);
+	for (Lane* lane: _lanes)
+		count += lane->queue.readQueueSize();
+
+	return count;
+}
+
+size_t ClusterTaskQueue::writeQueueSize()
+{
+	if (!_enabled)
+		return _defaultLane.queue.writeQueueSize();
+
+	size_t count = 0;
+	std::lock_guard<std::mutex> lck (_mutex);
+	for (Lane* lane: _lanes)
+		count += lane->queue.writeQueueSize();
+
+	return count;
+}
+
+std::string ClusterTaskQueue::statusInJSON()
+{
+	std::ostringstream oss;
+	oss<<"[";
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	for (size_t i = 0; i < _lanes.size(); i++)
+	{
+		if (i)
+			oss<<",";
+		oss<<_lanes[i]->statusInJSON();
+	}
+	oss<<"]";
+	return oss.str();
+}
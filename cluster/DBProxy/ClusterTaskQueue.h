@@ -0,0 +1,108 @@
+#ifndef Cluster_Task_Queue_h
+#define Cluster_Task_Queue_h
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "TaskQueue.h"
+
+//---------------------------------------------//
+//-	Cluster Task Queue
+//---------------------------------------------//
+/*
+	Bulkheads for the clusters sharing a database group. Each cluster has its own lane of read & write queues,
+	the lanes are popped by round robin, and the lanes reaching the concurrency quota are skipped.
+	When disabled, all tasks are in the default lane, same as a RWTaskQueue.
+*/
+class ClusterTaskQueue: public IMySQLTaskQueue
+{
+public:
+	struct Lane
+	{
+		std::string cluster;
+		RWTaskQueue queue;
+		int maxConcurrency;				//-- For the reads and the writes respectively. 0 means unlimited.
+		size_t maxQueueLength;			//-- 0 means unlimited.
+		std::atomic<int> runningReads;
+		std::atomic<int> runningWrites;
+		std::atomic<uint64_t> executedCount;
+		std::atomic<int64_t> latencyMsec;		//-- Moving average, from enqueued to finished.
+
+		Lane(const std::string& cluster_, int maxConcurrency_, size_t maxQueueLength_): cluster(cluster_),
+			maxConcurrency(maxConcurrency_), maxQueueLength(maxQueueLength_), runningReads(0), runningWrites(0),
+			executedCount(0), latencyMsec(0) {}
+
+		inline bool full() { return maxQueueLength && queue.size() >= maxQueueLength; }
+		TaskPackagePtr pop(bool readTask, const std::string& database);
+		void finished(TaskPackage* task);
+		std::string statusInJSON();
+	};
+
+private:
+	class ReadQueue: public IMySQLTaskQueue
+	{
+		ClusterTaskQueue* _owner;
+
+	public:
+		ReadQueue(ClusterTaskQueue* owner): _owner(owner) {}
+		virtual ~ReadQueue() {}
+
+		virtual bool empty() { return _owner->readQueueSize() == 0; }
+		virtual size_t size() { return _owner->readQueueSize(); }
+		virtual void clear() {}
+
+		virtual TaskPackagePtr pop() throw () { return _owner->popLanes(false, std::string()); }
+		virtual TaskPackagePtr pop(const std::string& database) throw () { return _owner->popLanes(false, database); }
+		virtual void finished(TaskPackagePtr& task) { _owner->finished(task); }
+	};
+
+	struct Quota
+	{
+		int maxConcurrency;
+		size_t maxQueueLength;
+	};
+
+	std::mutex _mutex;
+	std::map<std::string, std::unique_ptr<Lane>> _laneMap;
+	std::vector<Lane*> _lanes;
+	size_t _cursor;
+	Lane _defaultLane;
+	ReadQueue _readQueue;
+
+	static bool _enabled;
+	static Quota _defaultQuota;
+	static std::map<std::string, Quota> _quotas;
+
+	TaskPackagePtr popLanes(bool writable, const std::string& database);
+
+public:
+	ClusterTaskQueue(): _cursor(0), _defaultLane(std::string(), 0, 0), _readQueue(this) {}
+	virtual ~ClusterTaskQueue() {}
+
+	virtual bool empty() { return size() == 0; }
+	virtual size_t size();
+	virtual size_t readQueueSize();
+	virtual size_t writeQueueSize();
+	virtual void clear() {}	//-- do nothing. Because many thread pool will sharing this queue.
+
+	virtual TaskPackagePtr pop() throw () { return popLanes(true, std::string()); }
+	virtual TaskPackagePtr pop(const std::string& database) throw () { return popLanes(true, database); }
+	virtual void finished(TaskPackagePtr& task);
+	TaskPackagePtr takeQueued();		//-- Pops without the concurrency quota, for migrating the queued tasks.
+
+	Lane* lane(const std::string& cluster);		//-- The lanes are kept until the queue is destroyed.
+	void push(Lane* lane, TaskPackagePtr task, bool readTask);
+	inline void push(TaskPackagePtr task, bool readTask) { push(lane(task->cluster()), task, readTask); }
+
+	IMySQLTaskQueue* readQueue() { return &_readQueue; }
+	std::string statusInJSON();
+
+	//-- quotas: "cluster:maxConcurrency:maxQueueLength" items, separated by comma.
+	static void config(int maxConcurrency, int maxQueueLength, const std::string& quotas);
+	static inline bool enabled() { return _enabled; }
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef Configuration_Cache_H
+#define Configuration_Cache_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "TableManagerBuilder.h"
+
+struct ServerInfoRecord		//-- Mapping to server_info table in database. Confused user & password are kept as loaded.
+{
+	int serverId;
+	int masterId;
+	std::string host;
+	int port;
+	std::string username;
+	std::string password;
+	int timeout;
+	std::string databaseName;
+	std::string zone;		//-- Only loaded when the proxy zone is configured.
+};
+
+//========================================//
+//- Configuration Cache
+//========================================//
+/*
+	Rows of the config tables from the last loading, keyed by the stepwise id columns.
+	The incremental reloading only fetches the changed rows, and rebuilds the tables they affected.
+	The cache can be saved as a local snapshot file, which serves the startup before the config database is reachable.
+*/
+class ConfigurationCache
+{
+public:
+	enum TableType
+	{
+		ServerInfoTable = 0,
+		TableInfoTable,
+		SplitTableInfoTable,
+		SplitRangeInfoTable,
+		TableTypeCount
+	};
+
+	int64_t updateTime;
+	int64_t splitSpan;
+	int64_t numberBase;
+	int64_t changeLogId;		//-- The last applied id of config_change_log.
+	int64_t fullLoadedMsec;		//-- Time of the last full loading.
+
+private:
+	static bool _serverZoneEnabled;
+
+public:
+
+	std::map<int64_t, ServerInfoRecord> servers;			//-- server_id => row
+	std::map<int64_t, TableInfo> tables;					//-- id => row
+	std::map<int64_t, TableSplittingInfo> splitTables;		//-- id => row
+	std::map<int64_t, RangeSplittingInfo> splitRanges;		//-- id => row
+
+	ConfigurationCache(): updateTime(0), splitSpan(0), numberBase(0), changeLogId(0), fullLoadedMsec(0) {}
+
+	static const char* tableName(TableType type);
+	static const char* keyField(TableType type);
+	static const char* fields(TableType type);		//-- Selected fields, key field first.
+	static bool tableType(const std::string& tableName, TableType& type);
+	static void enableServerZone() { _serverZoneEnabled = true; }		//-- Selects the zone column of server_info.
+
+	//-- affectedTables: the tables whose routes are changed by the row. Only filled for table_info & split_table_info.
+	int64_t loadRow(TableType type, const std::vector<std::string>& row, std::set<TableInfoKey>* affectedTables = NULL);
+	void eraseRow(TableType type, int64_t id, std::set<TableInfoKey>* affectedTables = NULL);
+	int64_t maxId(TableType type) const;
+	size_t rowCount() const;
+
+	void clear();
+
+	//-- Snapshot file. The cache is unchanged when loading failed.
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);
+};
+
+#endif
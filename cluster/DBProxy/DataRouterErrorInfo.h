@@ -15,6 +15,7 @@ namespace ErrorInfo
 	const int internalErrorCode = errorBase + 500;
 	const int MySQLExceptionCode = errorBase + 502;
 	const int unconfiguredCode = errorBase + 503;
+	const int unavailableCode = errorBase + 504;
 	const int serverBusyCode = errorBase + 513;
 
 	const char* const raiser_MySQL = "mysql";
@@ -55,6 +56,11 @@ namespace ErrorInfo
 		return FPAWriter::errorAnswer(quest, serverBusyCode, "Corresponding query queue caught limitation.", raiser_DataRouter);
 	}
 
+	inline FPAnswerPtr rateLimitedAnswer(FPQuestPtr quest)
+	{
+		return FPAWriter::errorAnswer(quest, serverBusyCode, "Rate limit exceeded.", raiser_DataRouter);
+	}
+
 	inline FPAnswerPtr MySQLExceptionAnswer(FPQuestPtr quest, int mysql_errno, const char* mysql_error, const char* mysql_sqlstate)
 	{
 		std::string ex("[MySQL Exception] errno: ");
@@ -22,20 +22,23 @@ class DataRouterQuestProcessor: public IQuestProcessor
 	FPZKClientPtr _fpzk;
 #endif
 
-	FPAnswerPtr normalQuery(const FPQuestPtr quest, int64_t hintId, std::string& tableName, const std::string& cluster, const std::string& sql, bool master, bool onlyHashTable = false);
-	FPAnswerPtr paramsQuery(const FPQuestPtr quest, int64_t hintId, std::string& tableName, const std::string& cluster, const std::string& sql, const std::vector<std::string>& params, bool master, bool onlyHashTable = false);
+	FPAnswerPtr pretreatParamsQuery(const FPQuestPtr quest, const std::string& sql, const std::vector<std::string>& params, bool selectOnly,
+		std::string& tableName, std::string& semisql, std::vector<std::string>& restParams, bool& forceMasterTask, SQLTemplatePtr* sqlTemplate = NULL);
+	FPAnswerPtr normalQuery(const FPQuestPtr quest, const ConnectionInfo& ci, int64_t hintId, std::string& tableName, const std::string& cluster, const std::string& sql, bool master, const std::string& session, bool onlyHashTable = false);
+	FPAnswerPtr paramsQuery(const FPQuestPtr quest, const ConnectionInfo& ci, int64_t hintId, std::string& tableName, const std::string& cluster, const std::string& sql, const std::vector<std::string>& params, bool master, const std::string& session, bool onlyHashTable = false);
 	
-	AggregatedTaskPtr generateAggregatedTask(std::shared_ptr<TableManager> tm, const FPQuestPtr quest, const std::string& tableName, const std::string& cluster, const std::vector<int64_t>& hintIds, std::set<int64_t>& equivalentTableIds);
-	AggregatedTaskPtr generateAggregatedTask(std::shared_ptr<TableManager> tm, const FPQuestPtr quest, const std::string& tableName, const std::string& cluster, const std::vector<std::string>& hintStrings, std::set<int64_t>& equivalentTableIds);
+	AggregatedTaskPtr generateAggregatedTask(TableManager* tm, const FPQuestPtr quest, const std::string& tableName, const std::string& cluster, const std::vector<int64_t>& hintIds, std::set<int64_t>& equivalentTableIds);
+	AggregatedTaskPtr generateAggregatedTask(TableManager* tm, const FPQuestPtr quest, const std::string& tableName, const std::string& cluster, const std::vector<std::string>& hintStrings, std::set<int64_t>& equivalentTableIds);
 	
 	template<typename T>
-	FPAnswerPtr sharedingQuery(const FPQuestPtr quest, const std::vector<T>& hintIds, std::string& tableName, const std::string& cluster, const std::string& sql, bool master, bool onlyHashTable = false);
+	FPAnswerPtr sharedingQuery(const FPQuestPtr quest, const ConnectionInfo& ci, const std::vector<T>& hintIds, std::string& tableName, const std::string& cluster, const std::string& sql, bool master, bool onlyHashTable = false);
 	template<typename T>
-	FPAnswerPtr sharedingParamsQuery(const FPQuestPtr quest, const std::vector<T>& hintIds, std::string& tableName, const std::string& cluster, const std::string& sql, const std::vector<std::string>& params, bool master, bool onlyHashTable = false);
+	FPAnswerPtr sharedingParamsQuery(const FPQuestPtr quest, const ConnectionInfo& ci, const std::vector<T>& hintIds, std::string& tableName, const std::string& cluster, const std::string& sql, const std::vector<std::string>& params, bool master, bool onlyHashTable = false);
 	
-	FPAnswerPtr sharedingAllTablesQuery(const FPQuestPtr quest, std::string& tableName, const std::string& cluster, const std::string& sql, bool master);
-	FPAnswerPtr sharedingAllTablesParamsQuery(const FPQuestPtr quest, std::string& tableName, const std::string& cluster, const std::string& sql, const std::vector<std::string>& params, bool master);
-	void uniformTransactionQuery(const FPQuestPtr quest, TransactionTaskPtr task);
+	FPAnswerPtr sharedingAllTablesQuery(const FPQuestPtr quest, const ConnectionInfo& ci, std::string& tableName, const std::string& cluster, const std::string& sql, bool master);
+	FPAnswerPtr sharedingAllTablesParamsQuery(const FPQuestPtr quest, const ConnectionInfo& ci, std::string& tableName, const std::string& cluster, const std::string& sql, const std::vector<std::string>& params, bool master);
+	void uniformTransactionQuery(const FPQuestPtr quest, const ConnectionInfo& ci, TransactionTaskPtr task);
+	void multiQueryItem(TableManager* tm, MultiQueryTaskPtr multiTask, int index, int64_t hintId, std::string& tableName, const std::string& cluster, std::string& sql, std::vector<std::string>& params, bool master, const std::string& session, int qosClass);
 
 public:
 	FPAnswerPtr query(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
@@ -48,6 +51,9 @@ public:
 	FPAnswerPtr refresh(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
 	FPAnswerPtr transaction(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
 	FPAnswerPtr sTransaction(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr multiQuery(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr xaTransaction(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
+	FPAnswerPtr asyncWrite(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci);
 
 	virtual std::string infos();
 
@@ -63,6 +69,9 @@ public:
 		registerMethod("refresh", &DataRouterQuestProcessor::refresh);
 		registerMethod("transaction", &DataRouterQuestProcessor::transaction);
 		registerMethod("sTransaction", &DataRouterQuestProcessor::sTransaction);
+		registerMethod("multiQuery", &DataRouterQuestProcessor::multiQuery);
+		registerMethod("xaTransaction", &DataRouterQuestProcessor::xaTransaction);
+		registerMethod("asyncWrite", &DataRouterQuestProcessor::asyncWrite);
 
 		SQLParser::init();
 		
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <sstream>
+#include "msec.h"
+#include "FPLog.h"
+#include "MySQLClient.h"
+#include "GTIDTracker.h"
+
+bool GTIDTracker::_enabled = false;
+int GTIDTracker::_waitTimeoutMsec = 50;
+int64_t GTIDTracker::_sessionTTLMsec = 60 * 1000;
+
+std::mutex GTIDTracker::_mutex;
+std::unordered_map<std::string, GTIDTracker::Session> GTIDTracker::_sessions;
+int64_t GTIDTracker::_nextSweepMsec = 0;
+
+std::mutex GTIDTracker::_executedMutex;
+std::unordered_map<std::string, std::unordered_map<std::string, int64_t>> GTIDTracker::_executed;
+
+std::atomic<uint64_t> GTIDTracker::_recordedCount(0);
+std::atomic<uint64_t> GTIDTracker::_untrackedCount(0);
+std::atomic<uint64_t> GTIDTracker::_cachedCount(0);
+std::atomic<uint64_t> GTIDTracker::_waitedCount(0);
+std::atomic<uint64_t> GTIDTracker::_fallbackCount(0);
+
+void GTIDTracker::config(int waitTimeoutMsec, int sessionTTLSeconds)
+{
+	_enabled = true;
+	_waitTimeoutMsec = waitTimeoutMsec > 0 ? waitTimeoutMsec : 0;
+	_sessionTTLMsec = (int64_t)(sessionTTLSeconds > 0 ? sessionTTLSeconds : 1) * 1000;
+
+	MySQLClient::enableGTIDTracking();
+}
+
+//-- OWN_GTID is a single transaction, such as "uuid:23". The intervals, as "uuid:21-23", take the end.
+bool GTIDTracker::parse(const std::string& gtid, Position& position)
+{
+	size_t end = gtid.find(',');
+	if (end == std::string::npos)
+		end = gtid.length();
+
+	size_t colon = gtid.find(':');
+	if (colon == std::string::npos || colon >= end)
+		return false;
+
+	size_t begin = gtid.find_first_not_of(" \t\r\n");
+	size_t last = gtid.find_last_of(":-", end - 1);
+
+	position.uuid = gtid.substr(begin, colon - begin);
+	position.number = atoll(gtid.c_str() + last + 1);
+	return position.uuid.length() && position.number > 0;
+}
+
+void GTIDTracker::record(const std::string& session, int masterServerId, MySQLClient* mySQL)
+{
+	Position position;
+	std::string gtid;
+	if (mySQL->ownGTID(gtid) && parse(gtid, position))
+		_recordedCount++;
+	else
+	{
+		//-- Empty position: the reads of the session are executed by the master, until the next tracked write or expired.
+		position = Position();
+		_untrackedCount++;
+	}
+
+	update(session, masterServerId, position);
+}
+
+void GTIDTracker::recordUntracked(const std::string& session, int masterServerId)
+{
+	_untrackedCount++;
+	update(session, masterServerId, Position());
+}
+
+void GTIDTracker::update(const std::string& session, int masterServerId, const Position& position)
+{
+	int64_t now = slack_mono_msec();
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	if (now >= _nextSweepMsec)
+	{
+		for (auto iter = _sessions.begin(); iter != _sessions.end(); )
+		{
+			if (iter->second.expireMsec <= now)
+				iter = _sessions.erase(iter);
+			else
+				iter++;
+		}
+		_nextSweepMsec = now + 1000;
+	}
+
+	Session& sessionInfo = _sessions[session];
+	sessionInfo.expireMsec = now + _sessionTTLMsec;
+
+	Position& current = sessionInfo.positions[masterServerId];
+	if (position.uuid.empty() || current.uuid != position.uuid || current.number < position.number)
+		current = position;
+}
+
+bool GTIDTracker::required(const std::string& session, int masterServerId, Position& position)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	auto iter = _sessions.find(session);
+	if (iter == _sessions.end())
+		return false;
+
+	if (iter->second.expireMsec <= slack_mono_msec())
+	{
+		_sessions.erase(iter);
+		return false;
+	}
+
+	auto posIter = iter->second.positions.find(masterServerId);
+	if (posIter == iter->second.positions.end())
+		return false;
+
+	position = posIter->second;
+	return true;
+}
+
+bool GTIDTracker::caughtUp(const std::string& session, int masterServerId, MySQLClient* mySQL)
+{
+	Position position;
+	if (!required(session, masterServerId, position))
+		return true;
+
+	if (position.uuid.empty())
+	{
+		_fallbackCount++;
+		return false;
+	}
+
+	std::string endpoint = mySQL->endpoint();
+	{
+		std::lock_guard<std::mutex> lck (_executedMutex);
+		auto iter = _executed.find(endpoint);
+		if (iter != _executed.end())
+		{
+			auto numIter = iter->second.find(position.uuid);
+			if (numIter != iter->second.end() && numIter->second >= position.number)
+			{
+				_cachedCount++;
+				return true;
+			}
+		}
+	}
+
+	//-- The whole interval is waited, so the confirmed position covers all earlier transactions of the master.
+	bool executed = false;
+	std::string gtidSet(position.uuid);
+	gtidSet.append(":1-").append(std::to_string(position.number));
+
+	if (!mySQL->waitForExecutedGTIDSet(gtidSet, _waitTimeoutMsec, executed) || !executed)
+	{
+		_fallbackCount++;
+		return false;
+	}
+
+	_waitedCount++;
+
+	std::lock_guard<std::mutex> lck (_executedMutex);
+	int64_t& number = _executed[endpoint][position.uuid];
+	if (number < position.number)
+		number = position.number;
+
+	return true;
+}
+
+std::string GTIDTracker::statusInJSON()
+{
+	size_t sessionCount;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		sessionCount = _sessions.size();
+	}
+
+	std::ostringstream oss;
+	oss<<"{\"enabled\":"<<(_enabled ? "true" : "false");
+	oss<<",\"sessions\":"<<sessionCount;
+	oss<<",\"recorded\":"<<_recordedCount;
+	oss<<",\"untracked\":"<<_untrackedCount;
+	oss<<",\"cached\":"<<_cachedCount;
+	oss<<",\"waited\":"<<_waitedCount;
+	oss<<",\"masterFallback\":"<<_fallbackCount;
+	oss<<"}";
+	return oss.str();
+}
@@ -0,0 +1,377 @@
+#include <sstream>
+#include "FPLog.h"
+#include "msec.h"
+#include "StringUtil.h"
+#include "SQLParser.h"
+#include "GroupCommit.h"
+#include "GTIDTracker.h"
+#include "DataRouterErrorInfo.h"
+
+//========================================//
+//- Group Commit Task
+//========================================//
+GroupCommitTask::GroupCommitTask(GroupCommitCollector* collector, QueryTaskPtr task): TaskPackage(task->cluster(), nullptr),
+	_sealed(false), _collector(collector)
+{
+	_sealTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GroupCommitCollector::windowMsec());
+	_databaseName = task->databaseName();
+	_tasks.push_back(task);
+}
+
+void GroupCommitTask::processTask(MySQLClient *mySQL) throw ()
+{
+	if (_tasks.size() == 1)
+	{
+		_tasks[0]->processTask(mySQL);
+		return;
+	}
+
+	try
+	{
+		if (!prepareConnection(mySQL))
+		{
+			for (auto& task: _tasks)
+				task->finish("Database connection lost.");
+			return;
+		}
+
+		std::vector<QueryTaskPtr> tasks;
+		for (auto& task: _tasks)
+		{
+			if (task->assemble(mySQL))
+				tasks.push_back(task);
+			else
+				task->finish(ErrorInfo::invalidParametersCode, "Invalid parameters.");
+		}
+
+		std::vector<std::string> sqls;
+		std::vector<std::vector<size_t>> owners;
+		size_t combinableCount = 0;
+		size_t mergedCount = combine(tasks, sqls, owners, combinableCount);
+
+		std::vector<QueryResultPtr> results;
+		std::string error;
+		MySQLClient::GroupTransactionStatus status = MySQLClient::GroupRolledBack;
+		if (tasks.size() > 1)
+			status = mySQL->groupTransaction(_databaseName, sqls, results, error);
+
+		if (status == MySQLClient::GroupCommitted)
+		{
+			//-- All members are committed in one transaction, with the same GTID.
+			for (auto& task: tasks)
+				if (task->session().length())
+					GTIDTracker::record(task->session(), task->masterServerId(), mySQL);
+
+			//-- Each caller of a merged statement gets the affected rows of the merged statement.
+			for (size_t i = 0; i < sqls.size(); i++)
+				for (size_t taskIndex: owners[i])
+					tasks[taskIndex]->finish(results[i]);
+
+			_collector->executed(tasks.size(), status);
+			_collector->combined(combinableCount, mergedCount);
+			return;
+		}
+
+		if (status == MySQLClient::GroupCommitUnknown)
+		{
+			//-- Executing them again may apply the writes twice.
+			_collector->executed(tasks.size(), status);
+			LOG_ERROR("Group commit failed, %d statements may be committed. Database: %s, error: %s", (int)tasks.size(), _databaseName.c_str(), error.c_str());
+
+			std::string errorInfo("Group commit failed, the write may be committed. ");
+			errorInfo.append(error);
+			for (auto& task: tasks)
+			{
+				if (task->session().length())
+					GTIDTracker::recordUntracked(task->session(), task->masterServerId());
+
+				task->finish(ErrorInfo::MySQLExceptionCode, errorInfo.c_str());
+			}
+			return;
+		}
+
+		if (tasks.size() > 1)
+		{
+			_collector->executed(tasks.size(), status);
+			LOG_WARN("Group commit failed, fall back to execute %d statements individually. Database: %s.", (int)tasks.size(), _databaseName.c_str());
+		}
+
+		for (auto& task: tasks)
+			task->processTask(mySQL);
+	}
+	catch (const std::exception &e)
+	{
+		for (auto& task: _tasks)
+			task->finish(e.what());
+	}
+}
+
+size_t GroupCommitTask::combine(const std::vector<QueryTaskPtr>& tasks, std::vector<std::string>& sqls,
+	std::vector<std::vector<size_t>>& owners, size_t& combinableCount)
+{
+	struct CombinedUpdate
+	{
+		size_t sqlIndex;
+		AdditiveUpdate update;
+	};
+
+	std::vector<CombinedUpdate> updates;		//-- Additive updates after the latest uncombinable statement.
+	std::map<std::string, size_t> targets;		//-- key: update template, value: index in updates.
+	size_t mergedCount = 0;
+
+	auto flush = [&sqls, &owners, &updates, &targets]() {
+		for (auto& combined: updates)
+			if (owners[combined.sqlIndex].size() > 1)
+				sqls[combined.sqlIndex] = combined.update.buildSQL();
+
+		updates.clear();
+		targets.clear();
+	};
+
+	for (size_t i = 0; i < tasks.size(); i++)
+	{
+		AdditiveUpdate update;
+		if (!GroupCommitCollector::counterCombining(tasks[i]->tableName()) || !SQLParser::parseAdditiveUpdate(tasks[i]->sql(), update))
+		{
+			//-- The later statements can not be moved before this one.
+			flush();
+
+			sqls.push_back(tasks[i]->sql());
+			owners.push_back(std::vector<size_t>{i});
+			continue;
+		}
+
+		combinableCount++;
+		std::string key = update.key();
+
+		auto iter = targets.find(key);
+		if (iter != targets.end())
+		{
+			CombinedUpdate& target = updates[iter->second];
+
+			//-- Merging moves this update before the updates behind the target.
+			bool conflicted = false;
+			for (size_t k = iter->second + 1; k < updates.size(); k++)
+				if (updates[k].update.conflict(update))
+				{
+					conflicted = true;
+					break;
+				}
+
+			if (!conflicted && target.update.merge(update))
+			{
+				owners[target.sqlIndex].push_back(i);
+				mergedCount++;
+				continue;
+			}
+		}
+
+		targets[key] = updates.size();
+		updates.push_back(CombinedUpdate{sqls.size(), update});
+
+		sqls.push_back(tasks[i]->sql());
+		owners.push_back(std::vector<size_t>{i});
+	}
+
+	flush();
+	return mergedCount;
+}
+
+//========================================//
+//- Group Commit Collector
+//========================================//
+std::set<std::string> GroupCommitCollector::_tables;
+std::set<std::string> GroupCommitCollector::_counterTables;
+int GroupCommitCollector::_windowMsec = 2;
+size_t GroupCommitCollector::_maxStatements = 32;
+
+std::mutex GroupCommitCollector::_timerMutex;
+std::condition_variable GroupCommitCollector::_timerCondition;
+std::multimap<std::chrono::steady_clock::time_point, GroupCommitTaskPtr> GroupCommitCollector::_timers;
+std::thread GroupCommitCollector::_sealThread;
+std::atomic<bool> GroupCommitCollector::_sealing(false);
+bool GroupCommitCollector::_willExit = false;
+
+void GroupCommitCollector::config(const std::string& tables, const std::string& counterTables, int windowMsec, int maxSize)
+{
+	std::set<std::string> tableSet;
+	fpnn::StringUtil::split(tables, " ,", tableSet);
+	_tables.swap(tableSet);
+
+	std::set<std::string> counterTableSet;
+	fpnn::StringUtil::split(counterTables, " ,", counterTableSet);
+	_counterTables.swap(counterTableSet);
+
+	_windowMsec = (windowMsec > 0) ? windowMsec : 0;
+	_maxStatements = (maxSize > 1) ? (size_t)maxSize : 1;
+}
+
+void GroupCommitCollector::start()
+{
+	if (!configured() || _windowMsec == 0 || _maxStatements == 1 || _sealThread.joinable())
+		return;
+
+	_willExit = false;
+	_sealThread = std::thread(&GroupCommitCollector::sealThread);
+	_sealing = true;
+}
+
+void GroupCommitCollector::stop()
+{
+	if (!_sealThread.joinable())
+		return;
+
+	_sealing = false;
+	{
+		std::lock_guard<std::mutex> lck (_timerMutex);
+		_willExit = true;
+		_timerCondition.notify_all();
+	}
+	_sealThread.join();
+}
+
+void GroupCommitCollector::sealThread()
+{
+	std::unique_lock<std::mutex> lck (_timerMutex);
+	while (true)
+	{
+		if (_timers.empty())
+		{
+			if (_willExit)
+				break;
+
+			_timerCondition.wait(lck);
+			continue;
+		}
+
+		auto iter = _timers.begin();
+		if (!_willExit && iter->first > std::chrono::steady_clock::now())
+		{
+			_timerCondition.wait_until(lck, iter->first);
+			continue;
+		}
+
+		GroupCommitTaskPtr group = iter->second;
+		_timers.erase(iter);
+
+		lck.unlock();
+		group->_collector->seal(group);
+		lck.lock();
+	}
+}
+
+void GroupCommitCollector::seal(GroupCommitTaskPtr group)
+{
+	bool dispatch = false;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		if (!group->_sealed)
+		{
+			group->_sealed = true;
+			dispatch = true;
+
+			auto iter = _openGroups.find(group->_databaseName);
+			if (iter != _openGroups.end() && iter->second == group)
+				_openGroups.erase(iter);
+		}
+	}
+
+	if (dispatch)
+		_dispatcher(group);
+
+	//-- The last access to this collector. The owner DatabaseTaskQueue is deletable after it.
+	_timedGroups--;
+}
+
+GroupCommitTaskPtr GroupCommitCollector::add(QueryTaskPtr task)
+{
+	GroupCommitTaskPtr group;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+
+		auto iter = _openGroups.find(task->databaseName());
+		if (iter != _openGroups.end())
+		{
+			group = iter->second;
+			group->_tasks.push_back(task);
+
+			if (group->_tasks.size() < _maxStatements)
+				return nullptr;
+
+			group->_sealed = true;
+			_openGroups.erase(iter);
+			return group;
+		}
+
+		group = std::make_shared<GroupCommitTask>(this, task);
+		if (!_sealing || !_dispatcher)
+		{
+			group->_sealed = true;
+			return group;
+		}
+
+		_openGroups[task->databaseName()] = group;
+		_timedGroups++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lck (_timerMutex);
+		if (!_willExit)
+		{
+			_timers.insert(std::make_pair(group->_sealTime, group));
+			_timerCondition.notify_one();
+			return nullptr;
+		}
+	}
+
+	//-- The seal thread is exited.
+	seal(group);
+	return nullptr;
+}
+
+void GroupCommitCollector::executed(size_t taskCount, MySQLClient::GroupTransactionStatus status)
+{
+	if (status == MySQLClient::GroupCommitted)
+	{
+		_groupCount++;
+		_groupedTaskCount += taskCount;
+	}
+	else if (status == MySQLClient::GroupRolledBack)
+		_fallbackCount++;
+	else
+		_uncertainCount++;
+}
+
+void GroupCommitCollector::combined(size_t combinableCount, size_t mergedCount)
+{
+	_combinableCount += combinableCount;
+	_mergedCount += mergedCount;
+}
+
+std::string GroupCommitCollector::statusInJSON()
+{
+	uint64_t combinableCount = _combinableCount;
+	uint64_t mergedCount = _mergedCount;
+	int64_t now = slack_mono_msec();
+	double mergesPerSecond = 0;
+
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		if (_lastStatusMsec && now > _lastStatusMsec)
+			mergesPerSecond = (mergedCount - _lastMergedCount) * 1000.0 / (now - _lastStatusMsec);
+
+		_lastStatusMsec = now;
+		_lastMergedCount = mergedCount;
+	}
+
+	std::ostringstream oss;
+	oss<<"{\"groups\":"<<_groupCount;
+	oss<<",\"groupedStatements\":"<<_groupedTaskCount;
+	oss<<",\"fallbacks\":"<<_fallbackCount;
+	oss<<",\"uncertainCommits\":"<<_uncertainCount;
+	oss<<",\"combinableUpdates\":"<<combinableCount;
+	oss<<",\"mergedUpdates\":"<<mergedCount;
+	oss<<",\"mergeRatio\":"<<(combinableCount ? (double)mergedCount / combinableCount : 0.0);
+	oss<<",\"mergesPerSecond\":"<<mergesPerSecond<<"}";
+	return oss.str();
+}
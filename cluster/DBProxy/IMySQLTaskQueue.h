@@ -13,6 +13,9 @@ class IMySQLTaskQueue
 		virtual void clear() = 0;
 
 		virtual std::shared_ptr<TaskPackage> pop() throw () = 0;
+		//-- Prefers the tasks for the current database of the worker's connection.
+		virtual std::shared_ptr<TaskPackage> pop(const std::string& database) throw () { return pop(); }
+		virtual void finished(std::shared_ptr<TaskPackage>& task) {}		//-- Called by the workers after the popped task is processed.
 	};
 
 #endif
@@ -1,11 +1,14 @@
+#include <stdio.h>
+#include <string.h>
 #include "FPLog.h"
 #include "DataRouterErrorInfo.h"
 #include "MySQLClient.h"
 
 using namespace fpnn;
 
-std::mutex MySQLClient::_mutex;
 std::string MySQLClient::_default_connection_charset("utf8");
+std::atomic<uint64_t> MySQLClient::_selectDBCount(0);
+bool MySQLClient::_trackGTIDs = false;
 
 void MySQLClient::MySQLClientInit()
 {
@@ -24,7 +27,7 @@ void MySQLClient::setDefaultConnectionCharacterSetName(const std::string& connCh
 }
 
 MySQLClient::MySQLClient(const std::string &host, int port, const std::string &username, const std::string &password, const std::string &database, int timeout_seconds)
-	: _client(0), _host(host), _port(port), _username(username), _password(password), _database(database), _timeout_seconds(timeout_seconds), _lastOperated(0)
+	: _client(0), _host(host), _port(port), _username(username), _password(password), _database(database), _timeout_seconds(timeout_seconds), _lastOperated(0), _gtidTrackedThreadId(0), _xaDetachedThreadId(0), _connectErrno(0)
 {	
 	//mysql_thread_init();
 	connect();
@@ -60,17 +63,76 @@ bool MySQLClient::connect(const char *connection_charset_name)
 		mysql_options(_client, MYSQL_OPT_WRITE_TIMEOUT, &timeOut);
 	}
 
-	_mutex.lock();
+	//-- mysql_library_init() is called by MySQLClientInit(), so the connections can be established in parallel.
 	MYSQL *retClient = mysql_real_connect(_client, _host.c_str(), _username.c_str(), _password.c_str(), _database.length() ? _database.c_str() : NULL, _port, NULL, 0);
-	_mutex.unlock();
 	
 	if (!retClient)
 	{
+		_connectErrno = mysql_errno(_client);
 		cleanup();
 		return false;
 	}
 	
+	_connectErrno = 0;
 	mysql_set_character_set(_client, connection_charset_name);
+	if (_trackGTIDs)
+		trackGTIDs();
+
+	time(&_lastOperated);
+	return true;
+}
+
+void MySQLClient::trackGTIDs()
+{
+	std::string error;
+	if (executeStatement("SET SESSION session_track_gtids = OWN_GTID", error))
+		_gtidTrackedThreadId = mysql_thread_id(_client);
+	else
+		LOG_WARN("Enable GTID tracking for %s:%d failed. Error: %s", _host.c_str(), _port, error.c_str());
+}
+
+bool MySQLClient::ownGTID(std::string& gtid)
+{
+	if (!_client)
+		return false;
+
+	const char* data;
+	size_t length;
+	if (mysql_session_track_get_first(_client, SESSION_TRACK_GTIDS, &data, &length) == 0)
+	{
+		gtid.assign(data, length);
+		return true;
+	}
+
+	if (_trackGTIDs && mysql_thread_id(_client) != _gtidTrackedThreadId)
+		trackGTIDs();
+
+	return false;
+}
+
+bool MySQLClient::waitForExecutedGTIDSet(const std::string& gtidSet, int timeoutMsec, bool& executed)
+{
+	char timeout[32];
+	snprintf(timeout, sizeof(timeout), "%d.%03d", timeoutMsec / 1000, timeoutMsec % 1000);
+
+	std::string sql("SELECT WAIT_FOR_EXECUTED_GTID_SET('");
+	sql.append(gtidSet).append("', ").append(timeout).append(")");
+
+	if (mysql_real_query(_client, sql.data(), sql.length()))
+	{
+		cleanCheck(mysql_errno(_client));
+		return false;
+	}
+
+	MYSQL_RES *res = mysql_store_result(_client);
+	if (!res)
+		return false;
+
+	//-- 0: executed, 1: timeout.
+	MYSQL_ROW row = mysql_fetch_row(res);
+	executed = (row && row[0] && strcmp(row[0], "0") == 0);
+	mysql_free_result(res);
+
 	time(&_lastOperated);
 	return true;
 }
@@ -133,11 +195,30 @@ FPAnswerPtr MySQLClient::generateExceptionAnswer(const FPQuestPtr quest, int ind
 	return FPAWriter::errorAnswer(quest, ErrorInfo::MySQLExceptionCode, ex, ErrorInfo::raiser_MySQL);
 }
 
+std::string MySQLClient::exceptionInfo()
+{
+	std::string ex("[MySQL Exception] errno: ");
+	ex.append(std::to_string(mysql_errno(_client))).append(", error: '");
+	ex.append(mysql_error(_client)).append("', sql status: '");
+	ex.append(mysql_sqlstate(_client)).append("'");
+
+	return ex;
+}
+
+bool MySQLClient::recordException(QueryResult &result)
+{
+	result.errorInfo = exceptionInfo();
+
+	LOG_ERROR("Exception: mysql_errno: %d, mysql_error: %s, mysql_sqlstate: %s", mysql_errno(_client), mysql_error(_client), mysql_sqlstate(_client));
+	return false;
+}
+
 bool MySQLClient::adjustCurrentDatabase(const std::string& database)
 {
 	if (_database == database)
 		return true;
 		
+	_selectDBCount++;
 	if (!mysql_select_db(_client, database.c_str()))
 	{
 		_database = database;
@@ -223,14 +304,12 @@ bool MySQLClient::query(const std::string& database, const std::string& sql, Que
 
 	if (!adjustCurrentDatabase(database))
 	{
-		LOG_ERROR("Exception: mysql_errno: %d, mysql_error: %s, mysql_sqlstate: %s", mysql_errno(_client), mysql_error(_client), mysql_sqlstate(_client));
-		return false;
+		return recordException(result);
 	}
 
 	if (mysql_real_query(_client, sql.data(), sql.length()))
 	{
-		LOG_ERROR("Exception: mysql_errno: %d, mysql_error: %s, mysql_sqlstate: %s", mysql_errno(_client), mysql_error(_client), mysql_sqlstate(_client));
-		return false;
+		return recordException(result);
 	}
 	
 	time(&_lastOperated);
@@ -239,8 +318,7 @@ bool MySQLClient::query(const std::string& database, const std::string& sql, Que
 	{
 		if (mysql_errno(_client))
 		{
-			LOG_ERROR("Exception: mysql_errno: %d, mysql_error: %s, mysql_sqlstate: %s", mysql_errno(_client), mysql_error(_client), mysql_sqlstate(_client));
-			return false;
+			return recordException(result);
 		}
 		else if (mysql_field_count(_client) == 0)
 		{
@@ -252,8 +330,7 @@ bool MySQLClient::query(const std::string& database, const std::string& sql, Que
 		}
 		else
 		{
-			LOG_ERROR("Exception: mysql_errno: %d, mysql_error: %s, mysql_sqlstate: %s", mysql_errno(_client), mysql_error(_client), mysql_sqlstate(_client));
-			return false;
+			return recordException(result);
 		}
 	}
 	
@@ -335,3 +412,230 @@ FPAnswerPtr MySQLClient::transaction(const std::string& database, const std::vec
 
 	return FPAWriter::emptyAnswer(quest);
 }
+
+MySQLClient::GroupTransactionStatus MySQLClient::groupTransaction(const std::string& database, const std::vector<std::string>& sqls,
+	std::vector<QueryResultPtr>& results, std::string& error)
+{
+	results.clear();
+
+	//-- Auto reconnect in the middle will execute the rest statements out of the transaction.
+	bool reconnect = false;
+	mysql_options(_client, MYSQL_OPT_RECONNECT, &reconnect);
+
+	GroupTransactionStatus status = GroupCommitted;
+	unsigned int mySQLErrno = 0;
+
+	if (!adjustCurrentDatabase(database))
+	{
+		error = exceptionInfo();
+		mySQLErrno = mysql_errno(_client);
+		status = GroupRolledBack;
+	}
+	else if (!executeStatement("START TRANSACTION", error))
+	{
+		mySQLErrno = mysql_errno(_client);
+		status = GroupRolledBack;
+	}
+
+	for (size_t i = 0; status == GroupCommitted && i < sqls.size(); i++)
+	{
+		QueryResultPtr result(new QueryResult);
+		if (query(database, sqls[i], *result))
+		{
+			results.push_back(result);
+			continue;
+		}
+
+		error = result->errorInfo;
+		mySQLErrno = mysql_errno(_client);
+		status = mysql_rollback(_client) ? GroupCommitUnknown : GroupRolledBack;
+	}
+
+	if (status == GroupCommitted && mysql_commit(_client))
+	{
+		//-- The commit may be applied by the server before the connection lost.
+		error = exceptionInfo();
+		mySQLErrno = mysql_errno(_client);
+		LOG_ERROR("Group transaction commit failed. mysql_errno: %d, mysql_error: %s", mysql_errno(_client), mysql_error(_client));
+
+		mysql_rollback(_client);
+		status = GroupCommitUnknown;
+	}
+
+	if (status != GroupCommitted)
+		results.clear();
+
+	reconnect = true;
+	mysql_options(_client, MYSQL_OPT_RECONNECT, &reconnect);
+
+	if (status != GroupCommitted)
+		cleanCheck(mySQLErrno);
+
+	return status;
+}
+
+//=============================================//
+//-	XA Transaction
+//=============================================//
+bool MySQLClient::executeStatement(const std::string& sql, std::string& error)
+{
+	if (mysql_real_query(_client, sql.data(), sql.length()))
+	{
+		error = exceptionInfo();
+		return false;
+	}
+
+	MYSQL_RES *res = mysql_store_result(_client);
+	if (res)
+		mysql_free_result(res);
+	else if (mysql_errno(_client))
+	{
+		error = exceptionInfo();
+		return false;
+	}
+
+	time(&_lastOperated);
+	return true;
+}
+
+//-- Before MySQL 8.0.29, or xa_detach_on_prepare = OFF, the prepared branch is attached to the preparing session,
+//-- and can not be committed or rolled back by the other connections in the pool.
+bool MySQLClient::xaDetachOnPrepare(std::string& error)
+{
+	unsigned long threadId = mysql_thread_id(_client);
+	if (threadId == _xaDetachedThreadId)
+		return true;
+
+	const std::string sql("SELECT @@SESSION.xa_detach_on_prepare");
+	if (mysql_real_query(_client, sql.data(), sql.length()))
+	{
+		error = "XA transaction requires MySQL 8.0.29 or later, with xa_detach_on_prepare = ON. ";
+		error.append(exceptionInfo());
+		return false;
+	}
+
+	MYSQL_RES *res = mysql_store_result(_client);
+	if (!res)
+	{
+		error = exceptionInfo();
+		return false;
+	}
+
+	MySQLResultGuard guard(res);
+	MYSQL_ROW row = mysql_fetch_row(res);
+	if (!row || !row[0] || (strcmp(row[0], "1") != 0 && strcmp(row[0], "ON") != 0))
+	{
+		error = "XA transaction requires xa_detach_on_prepare = ON.";
+		return false;
+	}
+
+	_xaDetachedThreadId = threadId;
+	return true;
+}
+
+bool MySQLClient::xaPrepare(const std::string& xid, const std::vector<std::string>& databases, const std::vector<std::string>& sqls,
+	bool onePhase, int& failedIndex, std::string& error)
+{
+	failedIndex = -1;
+
+	//-- The one phase commit is finished by the preparing session.
+	if (!onePhase && !xaDetachOnPrepare(error))
+	{
+		LOG_ERROR("XA branch %s refused by %s:%d. %s", xid.c_str(), _host.c_str(), _port, error.c_str());
+		return false;
+	}
+
+	//-- Auto reconnect in a branch will execute the rest statements out of the XA transaction.
+	bool reconnect = false;
+	mysql_options(_client, MYSQL_OPT_RECONNECT, &reconnect);
+
+	bool status = executeStatement(std::string("XA START ").append(xid), error);
+	if (status)
+	{
+		for (size_t i = 0; i < sqls.size(); i++)
+		{
+			if (!adjustCurrentDatabase(databases[i]))
+			{
+				error = exceptionInfo();
+				status = false;
+			}
+			else
+				status = executeStatement(sqls[i], error);
+
+			if (!status)
+			{
+				failedIndex = (int)i;
+				break;
+			}
+		}
+
+		std::string ignored;
+		if (status)
+			status = executeStatement(std::string("XA END ").append(xid), error);
+		else
+			executeStatement(std::string("XA END ").append(xid), ignored);
+
+		if (status)
+		{
+			if (onePhase)
+				status = executeStatement(std::string("XA COMMIT ").append(xid).append(" ONE PHASE"), error);
+			else
+				status = executeStatement(std::string("XA PREPARE ").append(xid), error);
+		}
+
+		if (!status)
+			executeStatement(std::string("XA ROLLBACK ").append(xid), ignored);
+	}
+
+	reconnect = true;
+	mysql_options(_client, MYSQL_OPT_RECONNECT, &reconnect);
+
+	if (!status)
+		cleanCheck(mysql_errno(_client));
+
+	return status;
+}
+
+bool MySQLClient::xaCommit(const std::string& xid, std::string& error)
+{
+	if (executeStatement(std::string("XA COMMIT ").append(xid), error))
+		return true;
+
+	cleanCheck(mysql_errno(_client));
+	return false;
+}
+
+bool MySQLClient::xaRollback(const std::string& xid, std::string& error)
+{
+	if (executeStatement(std::string("XA ROLLBACK ").append(xid), error))
+		return true;
+
+	cleanCheck(mysql_errno(_client));
+	return false;
+}
+
+bool MySQLClient::xaRecover(std::vector<std::pair<std::string, std::string>>& xids, std::string& error)
+{
+	QueryResult result;
+	if (!query(_database, "XA RECOVER", result))
+	{
+		error = result.errorInfo;
+		cleanCheck(mysql_errno(_client));
+		return false;
+	}
+
+	//-- columns: formatID, gtrid_length, bqual_length, data
+	for (auto& row: result.rows)
+	{
+		if (row.size() < 4)
+			continue;
+
+		size_t gtridLength = (size_t)atoi(row[1].c_str());
+		size_t bqualLength = (size_t)atoi(row[2].c_str());
+		if (gtridLength + bqualLength > row[3].length())
+			continue;
+
+		xids.push_back(std::make_pair(row[3].substr(0, gtridLength), row[3].substr(gtridLength, bqualLength)));
+	}
+	return true;
+}
@@ -9,6 +9,8 @@
 /*===============================================================================
 FUNCTION DEFINITIONS: Thread Pool Functions: Class CThreadPool
 =============================================================================== */
+std::atomic<uint64_t> MySQLTaskThreadPool::_executedTaskCount(0);
+
 /*===========================================================================
 
 FUNCTION: ThreadPool::Init
@@ -82,6 +84,31 @@ bool MySQLTaskThreadPool::init(int32_t initCount, int32_t perAppendCount, int32_
 	return true;
 }
 
+void MySQLTaskThreadPool::adoptConnections(std::list<MySQLClient*>& clients)
+{
+	std::unique_lock<std::mutex> lck(_mutex);
+	_warmedClients.splice(_warmedClients.end(), clients);
+}
+
+MySQLClient* MySQLTaskThreadPool::takeConnection()
+{
+	//-- The warmed connections are created by other threads.
+	mysql_thread_init();
+
+	{
+		std::unique_lock<std::mutex> lck(_mutex);
+		if (_warmedClients.size())
+		{
+			MySQLClient* mySQL = _warmedClients.front();
+			_warmedClients.pop_front();
+			return mySQL;
+		}
+	}
+
+	return new MySQLClient(_dbInfo->host, _dbInfo->port, _dbInfo->username,
+		_dbInfo->password, _dbInfo->databaseName, _dbInfo->timeout);
+}
+
 /*===========================================================================
 
 FUNCTION: ThreadPool::WakeUp
@@ -188,8 +215,7 @@ RETURN VALUE:
 ===========================================================================*/
 void MySQLTaskThreadPool::process()
 {
-	MySQLClient *mySQL = new MySQLClient(_dbInfo->host, _dbInfo->port, _dbInfo->username,
-		_dbInfo->password, _dbInfo->databaseName, _dbInfo->timeout);
+	MySQLClient *mySQL = takeConnection();
 
 	AutoDeleteGuard<MySQLClient> adg(mySQL);
 
@@ -198,9 +224,15 @@ void MySQLTaskThreadPool::process()
 		std::shared_ptr<TaskPackage> task;
 		while (true)
 		{
-			task = _taskQueue->pop();
-			if (task)
-				break;
+			//-- Tasks are left to the other instances, or kept until recovered when the circuit breaker is opened.
+			//-- The cross-zone replicas leave the reads to the local instances, unless the reads spill over.
+			bool available = _dbInfo->available() && (!_dbInfo->zoneGate || _dbInfo->zoneGate->open(_taskQueue->size()));
+			if (available)
+			{
+				task = _taskQueue->pop(mySQL->currentDatabase());
+				if (task)
+					break;
+			}
 
 			std::unique_lock<std::mutex> lck(_mutex);
 			if (_willExit)
@@ -208,7 +240,11 @@ void MySQLTaskThreadPool::process()
 				_normalThreadCount -= 1;
 				return;
 			}
-			_condition.wait(lck);
+
+			if (available)
+				_condition.wait(lck);
+			else
+				_condition.wait_for(lck, std::chrono::seconds(1));
 		}
 		
 		{
@@ -221,7 +257,15 @@ void MySQLTaskThreadPool::process()
 			task->processTask(mySQL);
 		} catch (...) {}
 
+		_taskQueue->finished(task);
+		if (task->readQueued())
+			TableManager::readExecuted(_dbInfo->crossZone);
+		if (task->retryPending())
+			TableManager::retry(task);
 		task.reset();
+		_executedTaskCount++;
+		if (!mySQL->authenticationFailed())
+			_dbInfo->reportConnection(mySQL->connected());
 
 		{
 			std::unique_lock<std::mutex> lck(_mutex);
@@ -232,8 +276,7 @@ void MySQLTaskThreadPool::process()
 
 void MySQLTaskThreadPool::temporaryProcess()
 {
-	MySQLClient *mySQL = new MySQLClient(_dbInfo->host, _dbInfo->port, _dbInfo->username,
-		_dbInfo->password, _dbInfo->databaseName, _dbInfo->timeout);
+	MySQLClient *mySQL = takeConnection();
 
 	AutoDeleteGuard<MySQLClient> adg(mySQL);
 
@@ -245,9 +288,12 @@ void MySQLTaskThreadPool::temporaryProcess()
 		std::shared_ptr<TaskPackage> task;
 		while (true)
 		{
-			task = _taskQueue->pop();
-			if (task)
-				break;
+			if (_dbInfo->available() && (!_dbInfo->zoneGate || _dbInfo->zoneGate->open(_taskQueue->size())))
+			{
+				task = _taskQueue->pop(mySQL->currentDatabase());
+				if (task)
+					break;
+			}
 
 			std::unique_lock<std::mutex> lck(_mutex);
 			if (restLatencySeconds <= 0 || _willExit)
@@ -273,7 +319,15 @@ void MySQLTaskThreadPool::temporaryProcess()
 			task->processTask(mySQL);
 		} catch (...) {}
 
+		_taskQueue->finished(task);
+		if (task->readQueued())
+			TableManager::readExecuted(_dbInfo->crossZone);
+		if (task->retryPending())
+			TableManager::retry(task);
 		task.reset();
+		_executedTaskCount++;
+		if (!mySQL->authenticationFailed())
+			_dbInfo->reportConnection(mySQL->connected());
 
 		{
 			std::unique_lock<std::mutex> lck(_mutex);
@@ -376,5 +430,9 @@ void MySQLTaskThreadPool::release()
 	while (_tempThreadCount)
 		 _detachCondition.wait(lck);
 
+	for (MySQLClient* client: _warmedClients)
+		delete client;
+	_warmedClients.clear();
+
 	_inited = false;
 }
@@ -0,0 +1,216 @@
+#include <set>
+#include <sstream>
+#include "msec.h"
+#include "FPLog.h"
+#include "QoSController.h"
+
+//========================================//
+//- Token Bucket
+//========================================//
+TokenBucket::TokenBucket(int rate_, int burst_): rate(rate_), burst(burst_ > 0 ? burst_ : rate_), limitedCount(0)
+{
+	_tokens = burst;
+	_lastMsec = slack_mono_msec();
+}
+
+bool TokenBucket::take()
+{
+	int64_t now = slack_mono_msec();
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	if (now > _lastMsec)
+	{
+		_tokens += (double)(now - _lastMsec) * rate / 1000;
+		if (_tokens > burst)
+			_tokens = burst;
+
+		_lastMsec = now;
+	}
+
+	if (_tokens < 1)
+	{
+		limitedCount++;
+		return false;
+	}
+
+	_tokens -= 1;
+	return true;
+}
+
+void TokenBucket::refund()
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	_tokens += 1;
+	if (_tokens > burst)
+		_tokens = burst;
+}
+
+//========================================//
+//- QoS Controller
+//========================================//
+static const char* ruleTypeNames[] = { "client", "table" };
+
+QoSController::RulesPtr QoSController::_rules;
+std::atomic<bool> QoSController::_configured(false);
+std::atomic<uint64_t> QoSController::_limitedCount(0);
+
+bool QoSController::Rules::addRule(int type, const std::string& target, int rate, int burst, int qosClass)
+{
+	if (type < 0 || type >= RuleTypeCount || target.empty() || rate < 0 || qosClass < QoSInteractive || qosClass >= QoSClassCount)
+		return false;
+
+	QoSRule& rule = rules[type][target];
+	rule.qosClass = qosClass;
+	rule.bucket = rate ? std::make_shared<TokenBucket>(rate, burst) : nullptr;
+	return true;
+}
+
+void QoSController::update(RulesPtr rules)
+{
+	RulesPtr oldRules = std::atomic_load(&_rules);
+	size_t ruleCount = 0;
+
+	for (int type = 0; type < RuleTypeCount; type++)
+	{
+		ruleCount += rules->rules[type].size();
+		if (!oldRules)
+			continue;
+
+		for (auto& rulePair: rules->rules[type])
+		{
+			TokenBucketPtr& bucket = rulePair.second.bucket;
+			if (!bucket)
+				continue;
+
+			auto iter = oldRules->rules[type].find(rulePair.first);
+			if (iter == oldRules->rules[type].end() || !iter->second.bucket)
+				continue;
+
+			if (iter->second.bucket->rate == bucket->rate && iter->second.bucket->burst == bucket->burst)
+				bucket = iter->second.bucket;
+		}
+	}
+
+	std::atomic_store(&_rules, rules);
+	_configured = (ruleCount > 0);
+
+	LOG_INFO("QoS rules updated. Client rules: %d, table rules: %d.", (int)rules->rules[ClientRule].size(), (int)rules->rules[TableRule].size());
+}
+
+bool QoSController::admit(Rules* rules, RuleType type, const std::string& key, int& qosClass, std::vector<TokenBucket*>* taken)
+{
+	auto iter = rules->rules[type].find(key);
+	if (iter == rules->rules[type].end())
+		return true;
+
+	if (iter->second.qosClass > qosClass)
+		qosClass = iter->second.qosClass;
+
+	if (iter->second.bucket)
+	{
+		if (!iter->second.bucket->take())
+		{
+			_limitedCount++;
+			return false;
+		}
+
+		if (taken)
+			taken->push_back(iter->second.bucket.get());
+	}
+	return true;
+}
+
+void QoSController::refund(std::vector<TokenBucket*>& taken)
+{
+	for (TokenBucket* bucket: taken)
+		bucket->refund();
+}
+
+bool QoSController::admitClient(const std::string& client, int& qosClass)
+{
+	if (!_configured)
+		return true;
+
+	RulesPtr rules = std::atomic_load(&_rules);
+	return admit(rules.get(), ClientRule, client, qosClass);
+}
+
+bool QoSController::admitTable(const std::string& tableName, int& qosClass)
+{
+	if (!_configured)
+		return true;
+
+	RulesPtr rules = std::atomic_load(&_rules);
+	return admit(rules.get(), TableRule, tableName, qosClass);
+}
+
+bool QoSController::admit(const std::string& client, const std::string& tableName, int& qosClass)
+{
+	if (!_configured)
+		return true;
+
+	RulesPtr rules = std::atomic_load(&_rules);
+	std::vector<TokenBucket*> taken;
+	if (!admit(rules.get(), ClientRule, client, qosClass, &taken))
+		return false;
+
+	if (!admit(rules.get(), TableRule, tableName, qosClass))
+	{
+		refund(taken);
+		return false;
+	}
+	return true;
+}
+
+bool QoSController::admit(const std::string& client, const std::vector<std::string>& tableNames, int& qosClass)
+{
+	if (!_configured)
+		return true;
+
+	RulesPtr rules = std::atomic_load(&_rules);
+	std::vector<TokenBucket*> taken;
+	if (!admit(rules.get(), ClientRule, client, qosClass, &taken))
+		return false;
+
+	std::set<std::string> checked;
+	for (auto& tableName: tableNames)
+	{
+		if (checked.insert(tableName).second && !admit(rules.get(), TableRule, tableName, qosClass, &taken))
+		{
+			refund(taken);
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string QoSController::statusInJSON()
+{
+	RulesPtr rules = std::atomic_load(&_rules);
+
+	std::ostringstream oss;
+	oss<<"{\"clientRules\":"<<(rules ? rules->rules[ClientRule].size() : 0);
+	oss<<",\"tableRules\":"<<(rules ? rules->rules[TableRule].size() : 0);
+	oss<<",\"limited\":"<<_limitedCount;
+	oss<<",\"limitedRules\":[";
+
+	bool comma = false;
+	for (int type = 0; rules && type < RuleTypeCount; type++)
+	{
+		for (auto& rulePair: rules->rules[type])
+		{
+			if (!rulePair.second.bucket || rulePair.second.bucket->limitedCount == 0)
+				continue;
+
+			if (comma)
+				oss<<",";
+			else
+				comma = true;
+
+			oss<<"{\"type\":\""<<ruleTypeNames[type]<<"\",\"target\":\""<<rulePair.first<<"\"";
+			oss<<",\"limited\":"<<rulePair.second.bucket->limitedCount<<"}";
+		}
+	}
+	oss<<"]}";
+	return oss.str();
+}
@@ -0,0 +1,68 @@
+#ifndef SQL_Lexer_H
+#define SQL_Lexer_H
+
+#include <string>
+
+struct SQLToken
+{
+	enum Type
+	{
+		End,
+		Word,					//-- Keyword, identifier or number.
+		QuotedIdentifier,		//-- `...`
+		String,					//-- '...' or "..."
+		Placeholder,			//-- ?
+		Symbol,					//-- Single char operator or punctuation, includes '.'.
+		Comment					//-- /* ... */, -- ... and # ...
+	};
+
+	Type type;
+	size_t offset;
+	size_t length;
+
+	SQLToken(): type(End), offset(0), length(0) {}
+};
+
+//========================================//
+//- SQL Lexer
+//========================================//
+/*
+	Single pass lexer of MySQL statement. Tokens are pulled on demand, so the callers stop as soon as they found what they want.
+	Quoted strings follow the MySQL rules: backslash escapes and doubled quotes. Unterminated strings, quoted identifiers
+	and comments end at the end of the sql, and are marked by unterminated().
+	The lexer is copyable, a copy can be used for looking ahead.
+*/
+class SQLLexer
+{
+	const char* _header;
+	const char* _s;
+	const char* _end;
+	bool _unterminated;
+
+	void skipQuoted(char quote);
+	bool skipComment();
+
+public:
+	SQLLexer(const std::string& sql): _header(sql.data()), _s(_header), _end(_header + sql.length()), _unterminated(false) {}
+
+	static void init();
+
+	bool next(SQLToken& token);					//-- Comments included. False at the end.
+	bool nextSignificant(SQLToken& token);		//-- Comments skipped.
+	bool nextIsSymbol(char c) const;			//-- Check the next significant token without moving. c is not a lexical mark.
+
+	//-- Only placeholders are returned. quoted: the placeholder is the string literal '?', and offset is of the '?'.
+	bool nextPlaceholder(size_t& offset, bool& quoted);
+
+	inline bool unterminated() const { return _unterminated; }
+
+	//-- Token helpers.
+	bool isKeyword(const SQLToken& token, const char* keyword, size_t len) const;		//-- Case insensitive.
+	inline bool isSymbol(const SQLToken& token, char c) const { return token.type == SQLToken::Symbol && _header[token.offset] == c; }
+	inline bool isIdentifier(const SQLToken& token) const { return token.type == SQLToken::Word || token.type == SQLToken::QuotedIdentifier; }
+	bool identifierEquals(const SQLToken& token, const std::string& name) const;		//-- Case sensitive.
+	std::string identifier(const SQLToken& token) const;		//-- Backticks removed.
+	size_t identifierEnd(const SQLToken& token) const;			//-- Offset after the last char of the name, before the closing backtick.
+};
+
+#endif
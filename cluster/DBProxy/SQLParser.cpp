@@ -1,21 +1,26 @@
+#include <string.h>
+#include <algorithm>
 #include <strings.h>
 #include "StringUtil.h"
 #include "SQLParser.h"
+#include "SQLLexer.h"
 
 static const uint8_t SQL_extractHead = 0x1;
 static const uint8_t SQL_extractTail = 0x2;
 
-static const uint8_t SQL_charBeforeNextWord = 0x4;
-static const uint8_t SQL_charAfterNextWord = 0x8;
-
 static fpnn::StringUtil::CharMarkMap<uint8_t> _charMarkMap;
 
+static inline bool isIdentifierChar(char c)
+{
+	return (isalnum((unsigned char)c) || c == '_' || c == '$');
+}
+
 void SQLParser::init()
 {
 	_charMarkMap.init(" \t\n\r", SQL_extractHead);
 	_charMarkMap.init(" \t\n\r;\0", 6, SQL_extractTail);
-	_charMarkMap.init(" \t,*()\n\r", SQL_charBeforeNextWord);
-	_charMarkMap.init(" \t,*()\n\r\0", 9, SQL_charAfterNextWord);
+
+	SQLLexer::init();
 }
 
 void SQLParser::extractSQL(std::string& sql)
@@ -66,339 +71,510 @@ bool SQLParser::checkStatement(const char* sql, const char* operation, int len)
 		return false;
 }
 
-bool SQLParser::findNextWord(char*& s, std::string* word)
+//=============================================//
+//-	Statement & Table Name
+//=============================================//
+bool SQLParser::readTableReference(SQLLexer& lexer, std::string* tableName, size_t* tableSlot)
 {
+	SQLToken token;
+	if (!lexer.nextSignificant(token) || !lexer.isIdentifier(token))
+		return false;
 
-	while (*s)
+	//-- [db.]table
+	if (lexer.nextIsSymbol('.'))
 	{
-		if (_charMarkMap.check(*s, SQL_charBeforeNextWord))
-		//if (*s == ' ' || *s == '\t' || *s == ',' || *s == '*' || *s == '(' || *s == ')' || *s == '\r' || *s == '\n')
-			s += 1;
-		else
-			break;
+		SQLLexer lookahead(lexer);
+		SQLToken table;
+		lookahead.nextSignificant(table);
+		if (lookahead.nextSignificant(table) && lexer.isIdentifier(table))
+		{
+			token = table;
+			lexer = lookahead;
+		}
 	}
 
-	char* head = s;
-	int len = 0;
+	*tableName = lexer.identifier(token);
+	if (tableName->empty())
+		return false;
 
-	while (*s)
-	{
-		if (isalnum(*s)){
-				//Do s += 1 & len += 1
-		}
-		else if (_charMarkMap.check(*s, SQL_charAfterNextWord))
-		//else if (*s == ' ' || *s == '\t' || *s == ',' || *s == '*' || *s == '(' || *s == ')' || *s == '\r' || *s == '\n' || *s == 0)
-			break;
+	if (tableSlot)
+		*tableSlot = lexer.identifierEnd(token);
 
-		s += 1;
-		len += 1;
+	return true;
+}
+
+bool SQLParser::findTableAfterFrom(SQLLexer& lexer, std::string* tableName, size_t* tableSlot)
+{
+	//-- The 'from' of sub queries in select list are skipped.
+	int depth = 0;
+	SQLToken token;
+	while (lexer.nextSignificant(token))
+	{
+		if (lexer.isSymbol(token, '('))
+			depth += 1;
+		else if (lexer.isSymbol(token, ')'))
+			depth -= 1;
+		else if (depth == 0 && lexer.isKeyword(token, "from", 4))
+			return readTableReference(lexer, tableName, tableSlot);
 	}
+	return false;
+}
 
-	if (len)
+bool SQLParser::findTableAfterKeyword(SQLLexer& lexer, const char* keyword, size_t len, std::string* tableName, size_t* tableSlot)
+{
+	SQLToken token;
+	while (lexer.nextSignificant(token))
 	{
-		word->assign(head, len);
-		return true;
+		if (lexer.isKeyword(token, keyword, len))
+			return readTableReference(lexer, tableName, tableSlot);
 	}
 	return false;
 }
 
-bool SQLParser::addTableNameSuffixForSelect(std::string& sql, const std::string& tableName, const char* suffix)
+bool SQLParser::findTableForDataModificationSQL(SQLLexer& lexer, std::string* tableName, size_t* tableSlot)
 {
-	const int basicOffset = 7; 	//-- 'select' is 6 characters, and a separator follow 'select'.
+	SQLToken token;
+	SQLLexer lookahead(lexer);
+	while (lookahead.nextSignificant(token))
+	{
+		if (lexer.isKeyword(token, "INTO", 4) || lexer.isKeyword(token, "IGNORE", 6) || lexer.isKeyword(token, "DELAYED", 7)
+			|| lexer.isKeyword(token, "LOW_PRIORITY", 12) || lexer.isKeyword(token, "HIGH_PRIORITY", 13))
+		{
+			lexer = lookahead;
+			continue;
+		}
 
-	char* sqlHeader = const_cast<char*>(sql.c_str()); 
-	char* s = sqlHeader + basicOffset;
+		return readTableReference(lexer, tableName, tableSlot);
+	}
+	return false;
+}
 
-	bool found = false;
+bool SQLParser::parseStatement(const std::string& sql, bool selectOnly, bool& forceMasterTask, std::string* tableName, size_t* tableSlot)
+{
+	SQLLexer lexer(sql);
+	SQLToken token;
+	if (!lexer.nextSignificant(token) || token.type != SQLToken::Word)
+		return false;
 
-	while (*s){
-		while (*s)
-		{
-			if (isalnum(*s))
-				break;
-			else if (_charMarkMap.check(*s, SQL_charBeforeNextWord))
-				s += 1;
-			else
-				break;
-		}
+	if (lexer.isKeyword(token, "select", 6))
+	{
+		forceMasterTask = false;
+		return tableName ? findTableAfterFrom(lexer, tableName, tableSlot) : true;
+	}
 
-		char* head = s;
-		int len = 0;
+	if (selectOnly)
+		return false;
 
-		while (*s)
-		{
-			if (isalnum(*s)){
-				//Do s += 1 & len += 1
-			}
-			else if (_charMarkMap.check(*s, SQL_charAfterNextWord))
-			//else if (*s == ' ' || *s == '\t' || *s == ',' || *s == '*' || *s == '(' || *s == ')' || *s == '\r' || *s == '\n' || *s == 0 )
-				break;
+	if (lexer.isKeyword(token, "update", 6) || lexer.isKeyword(token, "insert", 6) || lexer.isKeyword(token, "replace", 7))
+	{
+		forceMasterTask = true;
+		return tableName ? findTableForDataModificationSQL(lexer, tableName, tableSlot) : true;
+	}
 
-			s += 1;
-			len += 1;
-		}
+	if (lexer.isKeyword(token, "delete", 6))
+	{
+		forceMasterTask = true;
+		return tableName ? findTableAfterFrom(lexer, tableName, tableSlot) : true;
+	}
 
-		if (found){
+	if (lexer.isKeyword(token, "desc", 4) || lexer.isKeyword(token, "describe", 8) || lexer.isKeyword(token, "explain", 7))
+	{
+		forceMasterTask = false;
+		return tableName ? readTableReference(lexer, tableName, tableSlot) : true;
+	}
 
-			if(len > 0){
-				std::string sqlTableName(head, len);
-				if (sqlTableName == tableName)
-				{
-					size_t pos = (size_t)(head - sqlHeader);
-					sql.insert(pos + len, suffix);
-					return true;
-				}
-			}
+#ifdef DBProxy_Manager_Version
+	if (lexer.isKeyword(token, "show", 4))
+	{
+		if (!lexer.nextSignificant(token) || !lexer.isKeyword(token, "create", 6)
+			|| !lexer.nextSignificant(token) || !lexer.isKeyword(token, "table", 5))
 			return false;
-		}
 
-		if (len == 4)
-		{
-			if (!strncasecmp(head, "from", len))
-				found = true;
-		}
-		else if(!len) return false;
+		forceMasterTask = false;
+		return tableName ? readTableReference(lexer, tableName, tableSlot) : true;
+	}
+	
+	if (lexer.isKeyword(token, "alter", 5))
+	{
+		forceMasterTask = true;
+		return tableName ? findTableAfterKeyword(lexer, "TABLE", 5, tableName, tableSlot) : true;
 	}
+#endif
+
 	return false;
 }
 
-bool SQLParser::findTableNameOfSelect(const char* sql, int offset, std::string* tableName)
+bool SQLParser::isDataModificationSQL(const std::string& sql)
 {
-	char* s = const_cast<char*>(sql);
-	s += offset;
+	SQLLexer lexer(sql);
+	SQLToken token;
+	if (!lexer.nextSignificant(token))
+		return false;
 
-	bool found = false;
+	return (lexer.isKeyword(token, "update", 6) || lexer.isKeyword(token, "insert", 6)
+		|| lexer.isKeyword(token, "replace", 7) || lexer.isKeyword(token, "delete", 6));
+}
 
-	while (*s){
-		while (*s)
-		{
-			if (isalnum(*s))
-				break;
-			else if (_charMarkMap.check(*s, SQL_charBeforeNextWord))
-			//else if (*s == ' ' || *s == '\t' || *s == ',' || *s == '*' || *s == '(' || *s == ')' || *s == '\r' || *s == '\n')
-				s += 1;
-			else
-				break;
-		}
+bool SQLParser::isReadSQL(const std::string& sql)
+{
+	SQLLexer lexer(sql);
+	SQLToken token;
+	if (!lexer.nextSignificant(token))
+		return false;
 
-		char* head = s;
-		int len = 0;
+	return (lexer.isKeyword(token, "select", 6) || lexer.isKeyword(token, "desc", 4)
+		|| lexer.isKeyword(token, "describe", 8) || lexer.isKeyword(token, "explain", 7));
+}
 
-		while (*s)
-		{
-			if (isalnum(*s)){
-				//Do s += 1 & len += 1
-			}
-			else if (_charMarkMap.check(*s, SQL_charAfterNextWord))
-			//else if (*s == ' ' || *s == '\t' || *s == ',' || *s == '*' || *s == '(' || *s == ')' || *s == '\r' || *s == '\n' || *s == 0 )
-				break;
+bool SQLParser::pretreatSelectSQL(const std::string& sql, bool& forceMasterTask, std::string* tableName)
+{
+#ifdef DBProxy_Manager_Version
+	return pretreatSQL(sql, forceMasterTask, tableName);
+#else
+	return parseStatement(sql, true, forceMasterTask, tableName, NULL);
+#endif
+}
 
-			s += 1;
-			len += 1;
-		}
+bool SQLParser::pretreatSQL(const std::string& sql, bool& forceMasterTask, std::string* tableName)
+{
+	return parseStatement(sql, false, forceMasterTask, tableName, NULL);
+}
+
+bool SQLParser::addTableSuffix(std::string& sql, const std::string& tableName, const char* suffix)
+{
+	if (suffix)
+	{
+		SQLTemplate sqlTemplate;
+		if (!buildSQLTemplate(sql, tableName, sqlTemplate))
+			return false;
 
-		if (found){
+		sqlTemplate.materialize(suffix, sql);
+	}
 
-			if(len > 0){
-				tableName->assign(head, len);
-				return true;
-			}
-			else return false;
-		}
+	return true;
+}
+
+//=============================================//
+//-	SQL Template
+//=============================================//
+bool SQLParser::buildSQLTemplate(const std::string& sql, const std::string& tableName, SQLTemplate& sqlTemplate)
+{
+	if (tableName.empty())
+		return false;
 
-		if (len == 4)
+	bool forceMaster;
+	std::string name;
+	size_t slot;
+	if (!parseStatement(sql, false, forceMaster, &name, &slot) || name != tableName)
+		slot = std::string::npos;
+
+	//-- The occurrences followed by '.' are qualified references, such as table.column & db.table.column.
+	std::vector<size_t> slots;
+	size_t firstSlot = std::string::npos;
+	bool selectStatement = false;
+	bool qualifiable = false;
+	size_t qualifiableSlot = 0;
+
+	SQLLexer lexer(sql);
+	SQLToken token;
+	for (bool first = true; lexer.nextSignificant(token); first = false)
+	{
+		if (first)
+			selectStatement = lexer.isKeyword(token, "select", 6);
+
+		if (qualifiable && lexer.isSymbol(token, '.'))
+			slots.push_back(qualifiableSlot);
+
+		qualifiable = lexer.identifierEquals(token, tableName);
+		if (qualifiable)
 		{
-			if (!strncasecmp(head, "from", len))
-				found = true;
+			qualifiableSlot = lexer.identifierEnd(token);
+			if (firstSlot == std::string::npos)
+				firstSlot = qualifiableSlot;
 		}
-		else if(!len) return false;
 	}
-	return false;
+
+	//-- For the other statements, the first occurrence is the table which the statement operates on.
+	if (slot == std::string::npos)
+	{
+		if (selectStatement || firstSlot == std::string::npos)
+			return false;
+
+		slot = firstSlot;
+	}
+	slots.push_back(slot);
+
+	std::sort(slots.begin(), slots.end());
+	slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+
+	sqlTemplate.sql = sql;
+	sqlTemplate.slots.swap(slots);
+	sqlTemplate.tableSlot = slot;
+	return true;
 }
 
-bool SQLParser::findTableNameAfterFrom(const char* sql, int offset, std::string* tableName)
+void SQLTemplate::materialize(const char* suffix, std::string& out) const
 {
-	char* s = const_cast<char*>(sql);
-	s += offset;
+	size_t suffixLength = strlen(suffix);
 
-	while (findNextWord(s, tableName))
+	std::string result;
+	result.reserve(sql.length() + suffixLength * slots.size());
+
+	size_t begin = 0;
+	for (size_t slot: slots)
 	{
-		if (tableName->length() == 4 && strcasecmp(tableName->c_str(), "from") == 0)
-			return findNextWord(s, tableName);
+		result.append(sql, begin, slot - begin);
+		result.append(suffix, suffixLength);
+		begin = slot;
 	}
-	
-	return false;
+	result.append(sql, begin, std::string::npos);
+
+	out.swap(result);
+}
+
+//=============================================//
+//-	Additive Update
+//=============================================//
+static inline void skipSpaces(const char*& s)
+{
+	while (*s && isspace((unsigned char)*s))
+		s += 1;
 }
 
-bool SQLParser::findTableNameForAlertTable(const char* sql, int offset, std::string* tableName)
+static std::string lowerCase(const std::string& str)
 {
-	char* s = const_cast<char*>(sql);
-	s += offset;
+	std::string lower(str);
+	for (auto& c: lower)
+		c = (char)tolower((unsigned char)c);
 
-	while (findNextWord(s, tableName))
+	return lower;
+}
+
+static bool parseIdentifier(const char*& s, std::string& identifier)
+{
+	if (*s == '`')
 	{
-		if (tableName->length() == 5 && strcasecmp(tableName->c_str(), "TABLE") == 0)
-			return findNextWord(s, tableName);
+		const char* end = strchr(s + 1, '`');
+		if (!end || end == s + 1)
+			return false;
+
+		identifier.assign(s + 1, end - s - 1);
+		s = end + 1;
+		return true;
 	}
-	
-	return false;
+
+	const char* head = s;
+	while (isIdentifierChar(*s))
+		s += 1;
+
+	if (s == head)
+		return false;
+
+	identifier.assign(head, s - head);
+	return true;
 }
 
-bool SQLParser::findTableNameForDesc(const char* sql, int offset, std::string* tableName)
+static bool matchKeyword(const char*& s, const char* keyword, int len)
 {
-	char* s = const_cast<char*>(sql);
-	s += offset;
+	if (strncasecmp(s, keyword, len) || isIdentifierChar(s[len]))
+		return false;
 
-	return findNextWord(s, tableName);
+	s += len;
+	return true;
 }
 
-bool SQLParser::findTableNameForDataModificationSQL(const char* sql, int offset, std::string* tableName)
+std::string AdditiveUpdate::key() const
 {
-	char* s = const_cast<char*>(sql);
-	s += offset;
+	std::string key(head);
+	key.append("\n");
+	for (auto& column: columns)
+		key.append(lowerCase(column)).append(",");
 
-	while (findNextWord(s, tableName))
-	{
-		switch (tableName->length())
-		{
-			case 0:
-				return false;
+	key.append("\n").append(tail);
+	return key;
+}
 
-			case 4:
-				if (strcasecmp(tableName->c_str(), "INTO"))
-					return true;
-				else
-					break;
-
-			case 6:
-				if (strcasecmp(tableName->c_str(), "IGNORE"))
-					return true;
-				else
-					break;
-
-			case 7:
-				if (strcasecmp(tableName->c_str(), "DELAYED"))
-					return true;
-				else
-					break;
-
-			case 12:
-				if (strcasecmp(tableName->c_str(), "LOW_PRIORITY"))
-					return true;
-				else
-					break;
-
-			case 13:
-				if (strcasecmp(tableName->c_str(), "HIGH_PRIORITY"))
-					return true;
-				else
-					break;
-
-			default:
-				return true;
-		}
+std::string AdditiveUpdate::buildSQL() const
+{
+	std::string sql(head);
+	for (size_t i = 0; i < columns.size(); i++)
+	{
+		sql.append(i ? ", `" : " `").append(columns[i]).append("` = `").append(columns[i]).append("`");
+		if (deltas[i] < 0)
+			sql.append(" - ").append(std::to_string(-deltas[i]));
+		else
+			sql.append(" + ").append(std::to_string(deltas[i]));
 	}
-	return false;
+	sql.append(" ").append(tail);
+	return sql;
 }
 
-bool SQLParser::pretreatSelectSQL(const std::string& sql, bool& forceMasterTask, std::string* tableName)
+bool AdditiveUpdate::merge(const AdditiveUpdate& r)
 {
-#ifdef DBProxy_Manager_Version
-	return pretreatSQL(sql, forceMasterTask, tableName);
-#else
-	if (checkStatement(sql.c_str(), "select", 6))
+	for (size_t i = 0; i < deltas.size(); i++)
 	{
-		forceMasterTask = false;
-		//return tableName ? findTableNameAfterFrom(sql.c_str(), 7, tableName) : true;
-		return tableName ? findTableNameOfSelect(sql.c_str(), 7, tableName) : true;
+		int64_t a = deltas[i];
+		int64_t b = r.deltas[i];
+		if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < -INT64_MAX - b))
+			return false;
+
+		//-- A zero delta changes nothing, then MySQL reports 0 affected rows.
+		if (a + b == 0)
+			return false;
 	}
+
+	for (size_t i = 0; i < deltas.size(); i++)
+		deltas[i] += r.deltas[i];
+
+	return true;
+}
+
+bool AdditiveUpdate::conflict(const AdditiveUpdate& r) const
+{
+	if (strcasecmp(tableName.c_str(), r.tableName.c_str()))
+		return false;
+
+	for (auto& column: r.columns)
+		if (tailWords.find(lowerCase(column)) != tailWords.end())
+			return true;
+
+	for (auto& column: columns)
+		if (r.tailWords.find(lowerCase(column)) != r.tailWords.end())
+			return true;
+
 	return false;
-#endif
 }
 
-bool SQLParser::pretreatSQL(const std::string& sql, bool& forceMasterTask, std::string* tableName)
+bool SQLParser::parseAdditiveUpdate(const std::string& sql, AdditiveUpdate& update)
 {
-	if (checkStatement(sql.c_str(), "select", 6))
-	{
-		forceMasterTask = false;
-		//return tableName ? findTableNameAfterFrom(sql.c_str(), 7, tableName) : true;
-		return tableName ? findTableNameOfSelect(sql.c_str(), 7, tableName) : true;
-	}
-	
-	if (checkStatement(sql.c_str(), "update", 6))
-	{
-		forceMasterTask = true;
-		return tableName ? findTableNameForDataModificationSQL(sql.c_str(), 7, tableName) : true;
-	}
-	
-	if (checkStatement(sql.c_str(), "insert", 6))
-	{
-		forceMasterTask = true;
-		return tableName ? findTableNameForDataModificationSQL(sql.c_str(), 7, tableName) : true;
-	}
-	
-	if (checkStatement(sql.c_str(), "replace", 7))
-	{
-		forceMasterTask = true;
-		return tableName ? findTableNameForDataModificationSQL(sql.c_str(), 8, tableName) : true;
-	}
-	
-	if (checkStatement(sql.c_str(), "delete", 6))
-	{
-		forceMasterTask = true;
-		return tableName ? findTableNameAfterFrom(sql.c_str(), 7, tableName) : true;
-	}
-	
-	if (checkStatement(sql.c_str(), "desc", 4))
-	{
-		forceMasterTask = false;
-		return tableName ? findTableNameForDesc(sql.c_str(), 5, tableName) : true;
-	}
-	
-	if (checkStatement(sql.c_str(), "describe", 8))
-	{
-		forceMasterTask = false;
-		return tableName ? findTableNameForDesc(sql.c_str(), 9, tableName) : true;
-	}
+	if (!checkStatement(sql.c_str(), "update", 6))
+		return false;
 
-	if (checkStatement(sql.c_str(), "explain", 7))
-	{
-		forceMasterTask = false;
-		return tableName ? findTableNameForDesc(sql.c_str(), 8, tableName) : true;
-	}
+	const char* base = sql.c_str();
+	const char* s = base + 6;
+	std::string identifier;
 
-#ifdef DBProxy_Manager_Version
-	if (checkStatement(sql.c_str(), "show create table", 17))
+	//-- Only single table: update [db.]table set
+	skipSpaces(s);
+	if (!parseIdentifier(s, update.tableName))
+		return false;
+
+	if (*s == '.')
 	{
-		forceMasterTask = false;
-		return tableName ? findTableNameForDesc(sql.c_str(), 18, tableName) : true;
+		s += 1;
+		if (!parseIdentifier(s, identifier))
+			return false;
+
+		update.tableName.append(".").append(identifier);
 	}
-	
-	if (checkStatement(sql.c_str(), "alter", 5))
+
+	skipSpaces(s);
+	if (!matchKeyword(s, "set", 3))
+		return false;
+
+	update.head.assign(base, s - base);
+	update.columns.clear();
+	update.deltas.clear();
+	update.tailWords.clear();
+
+	//-- col = col +/- N[, ...]
+	const char* whereBegin = NULL;
+	while (!whereBegin)
 	{
-		forceMasterTask = true;
-		return tableName ? findTableNameForAlertTable(sql.c_str(), 6, tableName) : true;
+		std::string column;
+		skipSpaces(s);
+		if (!parseIdentifier(s, column))
+			return false;
+
+		skipSpaces(s);
+		if (*s != '=')
+			return false;
+
+		s += 1;
+		skipSpaces(s);
+		if (!parseIdentifier(s, identifier) || strcasecmp(column.c_str(), identifier.c_str()))
+			return false;
+
+		skipSpaces(s);
+		if (*s != '+' && *s != '-')
+			return false;
+
+		bool negative = (*s == '-');
+		s += 1;
+		skipSpaces(s);
+
+		int64_t delta = 0;
+		int digits = 0;
+		while (isdigit((unsigned char)*s))
+		{
+			if (++digits > 18)
+				return false;
+
+			delta = delta * 10 + (*s - '0');
+			s += 1;
+		}
+		if (digits == 0 || isIdentifierChar(*s) || *s == '.')
+			return false;
+
+		for (auto& existed: update.columns)
+			if (strcasecmp(existed.c_str(), column.c_str()) == 0)
+				return false;
+
+		update.columns.push_back(column);
+		update.deltas.push_back(negative ? -delta : delta);
+
+		skipSpaces(s);
+		if (*s == ',')
+			s += 1;
+		else
+		{
+			whereBegin = s;
+			if (!matchKeyword(s, "where", 5))
+				return false;
+		}
 	}
-#endif
 
-	return false;
-}
+	update.tail.assign(whereBegin);
 
-bool SQLParser::addTableSuffix(std::string& sql, const std::string& tableName, const char* suffix)
-{
-	if (suffix)
+	//-- Collect identifiers of where clause. Quoted strings are skipped.
+	while (*s)
 	{
-		if (checkStatement(sql.c_str(), "select", 6))
-			return addTableNameSuffixForSelect(sql, tableName, suffix);
+		if (*s == '\'' || *s == '"')
+		{
+			char quote = *s;
+			s += 1;
+			while (*s && *s != quote)
+			{
+				if (*s == '\\' && s[1])
+					s += 1;
+				s += 1;
+			}
+
+			if (!*s)
+				return false;
 
-		size_t found = sql.find(tableName);
-		if (found != std::string::npos)
+			s += 1;
+		}
+		else if (*s == '`' || isIdentifierChar(*s))
 		{
-			sql.insert(found + tableName.length(), suffix);
+			if (!parseIdentifier(s, identifier))
+				return false;
+
+			update.tailWords.insert(lowerCase(identifier));
 		}
-		else
+		else if (*s == ';')
 			return false;
+		else
+			s += 1;
 	}
 
+	//-- Sub query, or the where clause depends on the updated columns.
+	if (update.tailWords.find("select") != update.tailWords.end())
+		return false;
+
+	for (auto& column: update.columns)
+		if (update.tailWords.find(lowerCase(column)) != update.tailWords.end())
+			return false;
+
 	return true;
 }
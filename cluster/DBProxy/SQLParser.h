@@ -1,25 +1,62 @@
 #ifndef SQL_PARSER_H
 #define SQL_PARSER_H
 
+#include <set>
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+//-- update <table> set col = col +/- N[, ...] where ...
+struct AdditiveUpdate
+{
+	std::string tableName;
+	std::string head;		//-- "update <table> set"
+	std::string tail;		//-- "where ..."
+	std::vector<std::string> columns;
+	std::vector<int64_t> deltas;
+	std::set<std::string> tailWords;		//-- lower case identifiers in where clause.
+
+	std::string key() const;
+	std::string buildSQL() const;
+	bool merge(const AdditiveUpdate& r);		//-- False if overflow.
+	bool conflict(const AdditiveUpdate& r) const;		//-- True if the where clause of either one references the columns updated by the other.
+};
+
+//-- The SQL with the offsets after each table name occurrence. Rewritten once for each sub-table.
+struct SQLTemplate
+{
+	std::string sql;
+	std::vector<size_t> slots;		//-- ascending
+	size_t tableSlot;				//-- The slot of the table name which the statement operates on.
+
+	SQLTemplate(): tableSlot(0) {}
+
+	void materialize(const char* suffix, std::string& out) const;		//-- Only one allocation.
+};
+typedef std::shared_ptr<SQLTemplate> SQLTemplatePtr;
+
+class SQLLexer;
 
 class SQLParser
 {
-	static bool findNextWord(char*& str, std::string* word);
 	static bool checkStatement(const char* sql, const char* operation, int len);
-	static bool findTableNameAfterFrom(const char* sql, int offset, std::string* tableName);
-	static bool findTableNameForAlertTable(const char* sql, int offset, std::string* tableName);
-	static bool findTableNameForDesc(const char* sql, int offset, std::string* tableName);
-	static bool findTableNameForDataModificationSQL(const char* sql, int offset, std::string* tableName);
-	static bool findTableNameOfSelect(const char* sql, int offset, std::string* tableName);
-	static bool addTableNameSuffixForSelect(std::string& sql, const std::string& tableName, const char* suffix);
+	static bool readTableReference(SQLLexer& lexer, std::string* tableName, size_t* tableSlot);
+	static bool findTableAfterFrom(SQLLexer& lexer, std::string* tableName, size_t* tableSlot);
+	static bool findTableAfterKeyword(SQLLexer& lexer, const char* keyword, size_t len, std::string* tableName, size_t* tableSlot);
+	static bool findTableForDataModificationSQL(SQLLexer& lexer, std::string* tableName, size_t* tableSlot);
+	static bool parseStatement(const std::string& sql, bool selectOnly, bool& forceMasterTask, std::string* tableName, size_t* tableSlot);
 
 public:
 	static void init();
 	static void extractSQL(std::string& sql);
 	static bool addTableSuffix(std::string& sql, const std::string& tableName, const char* suffix);
+	static bool buildSQLTemplate(const std::string& sql, const std::string& tableName, SQLTemplate& sqlTemplate);
 	static bool pretreatSQL(const std::string& sql, bool& forceMasterTask, std::string* tableName = NULL);
 	static bool pretreatSelectSQL(const std::string& sql, bool& forceMasterTask, std::string* tableName = NULL);
+	static bool isDataModificationSQL(const std::string& sql);		//-- update, insert, replace & delete.
+	static bool isReadSQL(const std::string& sql);					//-- select, desc & explain.
+	static bool parseAdditiveUpdate(const std::string& sql, AdditiveUpdate& update);
 };
 
 #endif
@@ -0,0 +1,220 @@
+#include <ctype.h>
+#include <stdint.h>
+#include "SQLScanner.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DBPROXY_SQL_SCANNER_X86
+#endif
+
+static bool _wordCharMap[256];
+static bool _lexicalMarkMap[256];		//-- "?'\"`/-#"
+
+//========================================//
+//- Scalar Kernels
+//========================================//
+static const char* findWordEndScalar(const char* s, const char* end)
+{
+	while (s < end && _wordCharMap[(uint8_t)*s])
+		s += 1;
+
+	return s;
+}
+
+static const char* findLexicalMarkScalar(const char* s, const char* end)
+{
+	while (s < end && !_lexicalMarkMap[(uint8_t)*s])
+		s += 1;
+
+	return s;
+}
+
+static const char* findQuoteOrEscapeScalar(const char* s, const char* end, char quote)
+{
+	while (s < end && *s != quote && *s != '\\')
+		s += 1;
+
+	return s;
+}
+
+#ifdef DBPROXY_SQL_SCANNER_X86
+/*
+	The SIMD kernels scan [s, end) by blocks. When the range is longer than one block, the last partial block
+	is loaded overlapped with the previous bytes, and the bytes before s are masked off.
+	Words are short, so the word ranges shorter than one block are scanned by the scalar kernel.
+	The other ranges shorter than one AVX2 block are passed to the SSE4.2 kernels, which are always available with AVX2.
+*/
+//========================================//
+//- SSE4.2 Kernels
+//========================================//
+static const int SSE42_maskMode = _SIDD_UBYTE_OPS | _SIDD_BIT_MASK;
+
+__attribute__((target("sse4.2")))
+static inline uint32_t wordCharMaskSSE42(__m128i data)
+{
+	const __m128i ranges = _mm_setr_epi8('0', '9', 'A', 'Z', 'a', 'z', '_', '_', '$', '$', (char)0x80, (char)0xff, 0, 0, 0, 0);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_cmpestrm(ranges, 12, data, 16, SSE42_maskMode | _SIDD_CMP_RANGES));
+}
+
+__attribute__((target("sse4.2")))
+static inline uint32_t lexicalMarkMaskSSE42(__m128i data)
+{
+	const __m128i marks = _mm_setr_epi8('?', '\'', '"', '`', '/', '-', '#', 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_cmpestrm(marks, 7, data, 16, SSE42_maskMode | _SIDD_CMP_EQUAL_ANY));
+}
+
+__attribute__((target("sse4.2")))
+static inline uint32_t quoteMaskSSE42(__m128i data, char quote)
+{
+	const __m128i marks = _mm_setr_epi8(quote, '\\', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_cmpestrm(marks, 2, data, 16, SSE42_maskMode | _SIDD_CMP_EQUAL_ANY));
+}
+
+#define SQL_SCANNER_SSE42_LOOP(maskExpr, scalarTail)					\
+	const char* begin = s;												\
+	while (end - s >= 16)												\
+	{																	\
+		__m128i data = _mm_loadu_si128((const __m128i*)s);				\
+		uint32_t mask = (maskExpr);										\
+		if (mask)														\
+			return s + __builtin_ctz(mask);								\
+																		\
+		s += 16;														\
+	}																	\
+	if (s == end || end - begin < 16)									\
+		return scalarTail;												\
+																		\
+	const char* tail = end - 16;										\
+	__m128i data = _mm_loadu_si128((const __m128i*)tail);				\
+	uint32_t mask = (maskExpr) & (0xffffu << (s - tail));				\
+	return mask ? tail + __builtin_ctz(mask) : end;
+
+__attribute__((target("sse4.2")))
+static const char* findWordEndSSE42(const char* s, const char* end)
+{
+	SQL_SCANNER_SSE42_LOOP(~wordCharMaskSSE42(data) & 0xffffu, findWordEndScalar(s, end))
+}
+
+__attribute__((target("sse4.2")))
+static const char* findLexicalMarkSSE42(const char* s, const char* end)
+{
+	SQL_SCANNER_SSE42_LOOP(lexicalMarkMaskSSE42(data), findLexicalMarkScalar(s, end))
+}
+
+__attribute__((target("sse4.2")))
+static const char* findQuoteOrEscapeSSE42(const char* s, const char* end, char quote)
+{
+	SQL_SCANNER_SSE42_LOOP(quoteMaskSSE42(data, quote), findQuoteOrEscapeScalar(s, end, quote))
+}
+
+//========================================//
+//- AVX2 Kernels
+//========================================//
+__attribute__((target("avx2")))
+static inline uint32_t wordCharMaskAVX2(__m256i data)
+{
+	__m256i lower = _mm256_or_si256(data, _mm256_set1_epi8(0x20));
+
+	__m256i word = _mm256_cmpgt_epi8(_mm256_setzero_si256(), data);		//-- bytes >= 0x80
+	word = _mm256_or_si256(word, _mm256_and_si256(_mm256_cmpgt_epi8(data, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), data)));
+	word = _mm256_or_si256(word, _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower)));
+	word = _mm256_or_si256(word, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('_')));
+	word = _mm256_or_si256(word, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('$')));
+
+	return (uint32_t)_mm256_movemask_epi8(word);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t lexicalMarkMaskAVX2(__m256i data)
+{
+	__m256i hit = _mm256_cmpeq_epi8(data, _mm256_set1_epi8('?'));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('\'')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('"')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('`')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('/')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('-')));
+	hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, _mm256_set1_epi8('#')));
+
+	return (uint32_t)_mm256_movemask_epi8(hit);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t quoteMaskAVX2(__m256i data, char quote)
+{
+	__m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(data, _mm256_set1_epi8(quote)), _mm256_cmpeq_epi8(data, _mm256_set1_epi8('\\')));
+	return (uint32_t)_mm256_movemask_epi8(hit);
+}
+
+#define SQL_SCANNER_AVX2_LOOP(maskExpr, shortTail)						\
+	const char* begin = s;												\
+	while (end - s >= 32)												\
+	{																	\
+		__m256i data = _mm256_loadu_si256((const __m256i*)s);			\
+		uint32_t mask = (maskExpr);										\
+		if (mask)														\
+			return s + __builtin_ctz(mask);								\
+																		\
+		s += 32;														\
+	}																	\
+	if (s == end || end - begin < 32)									\
+		return shortTail;												\
+																		\
+	const char* tail = end - 32;										\
+	__m256i data = _mm256_loadu_si256((const __m256i*)tail);			\
+	uint32_t mask = (maskExpr) & (0xffffffffu << (s - tail));			\
+	return mask ? tail + __builtin_ctz(mask) : end;
+
+__attribute__((target("avx2")))
+static const char* findWordEndAVX2(const char* s, const char* end)
+{
+	SQL_SCANNER_AVX2_LOOP(~wordCharMaskAVX2(data), findWordEndScalar(s, end))
+}
+
+__attribute__((target("avx2")))
+static const char* findLexicalMarkAVX2(const char* s, const char* end)
+{
+	SQL_SCANNER_AVX2_LOOP(lexicalMarkMaskAVX2(data), findLexicalMarkSSE42(s, end))
+}
+
+__attribute__((target("avx2")))
+static const char* findQuoteOrEscapeAVX2(const char* s, const char* end, char quote)
+{
+	SQL_SCANNER_AVX2_LOOP(quoteMaskAVX2(data, quote), findQuoteOrEscapeSSE42(s, end, quote))
+}
+#endif
+
+//========================================//
+//- SQL Scanner
+//========================================//
+SQLScanner::ScanFunction SQLScanner::_findWordEnd = findWordEndScalar;
+SQLScanner::ScanFunction SQLScanner::_findLexicalMark = findLexicalMarkScalar;
+SQLScanner::QuoteScanFunction SQLScanner::_findQuoteOrEscape = findQuoteOrEscapeScalar;
+const char* SQLScanner::_kernelName = "scalar";
+
+void SQLScanner::init()
+{
+	for (int c = 0; c < 256; c++)
+		_wordCharMap[c] = (isalnum(c) || c == '_' || c == '$' || c >= 0x80);
+
+	const char* marks = "?'\"`/-#";
+	for (const char* c = marks; *c; c++)
+		_lexicalMarkMap[(uint8_t)*c] = true;
+
+#ifdef DBPROXY_SQL_SCANNER_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		_findWordEnd = findWordEndAVX2;
+		_findLexicalMark = findLexicalMarkAVX2;
+		_findQuoteOrEscape = findQuoteOrEscapeAVX2;
+		_kernelName = "avx2";
+	}
+	else if (__builtin_cpu_supports("sse4.2"))
+	{
+		_findWordEnd = findWordEndSSE42;
+		_findLexicalMark = findLexicalMarkSSE42;
+		_findQuoteOrEscape = findQuoteOrEscapeSSE42;
+		_kernelName = "sse4.2";
+	}
+#endif
+}
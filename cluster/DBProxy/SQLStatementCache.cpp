@@ -0,0 +1,247 @@
+#include <chrono>
+#include <sstream>
+#include "SQLLexer.h"
+#include "SQLStatementCache.h"
+
+//========================================//
+//- Parsed Statement
+//========================================//
+bool ParsedStatement::pretreat(bool selectOnly, bool& forceMasterTask, std::string* table) const
+{
+	if (!(selectOnly ? selectStatement : statement))
+		return false;
+
+	forceMasterTask = forceMaster;
+
+	if (table)
+	{
+		if (!tableFound)
+			return false;
+
+		*table = tableName;
+	}
+	return true;
+}
+
+bool ParsedStatement::preassemble(const std::vector<std::string>& params, std::string& semisql,
+	std::vector<std::string>& restParams, SQLTemplate* sqlTemplate) const
+{
+	if (placeholders.size() != params.size())
+		return false;
+
+	size_t length = sql.length();
+	for (size_t i = 0; i < placeholders.size(); i++)
+		if (!quotedPlaceholders[i])
+			length = length + params[i].length() - 1;
+
+	semisql.clear();
+	semisql.reserve(length);
+	restParams.clear();
+
+	if (sqlTemplate && templateBuilt)
+		sqlTemplate->slots.clear();
+	else
+		sqlTemplate = NULL;
+
+	size_t begin = 0;
+	size_t slotIndex = 0;
+
+	//-- Slots in [begin, end] of sql are moved to semisql.
+	auto moveSlots = [this, sqlTemplate, &semisql, &begin, &slotIndex](size_t end) {
+		if (sqlTemplate == NULL)
+			return;
+
+		for (; slotIndex < slots.size() && slots[slotIndex] <= end; slotIndex++)
+		{
+			sqlTemplate->slots.push_back(semisql.length() + slots[slotIndex] - begin);
+			if (slots[slotIndex] == tableSlot)
+				sqlTemplate->tableSlot = sqlTemplate->slots.back();
+		}
+	};
+
+	for (size_t i = 0; i < placeholders.size(); i++)
+	{
+		size_t pos = placeholders[i];
+
+		moveSlots(pos);
+		semisql.append(sql, begin, pos - begin);
+
+		if (quotedPlaceholders[i])
+		{
+			restParams.push_back(params[i]);
+			semisql.append("?");
+		}
+		else
+			semisql.append(params[i]);
+
+		begin = pos + 1;
+	}
+
+	moveSlots(std::string::npos);
+	semisql.append(sql, begin, std::string::npos);
+
+	if (sqlTemplate)
+		sqlTemplate->sql = semisql;
+
+	return true;
+}
+
+bool ParsedStatement::inlinesTableName(const std::vector<std::string>& params) const
+{
+	if (tableName.empty())
+		return false;
+
+	for (size_t i = 0; i < placeholders.size() && i < params.size(); i++)
+		if (!quotedPlaceholders[i] && params[i].find(tableName) != std::string::npos)
+			return true;
+
+	return false;
+}
+
+//========================================//
+//- SQL Statement Cache
+//========================================//
+size_t SQLStatementCache::_shardCapacity = 0;
+SQLStatementCache::Shard SQLStatementCache::_shards[FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT];
+
+std::atomic<uint64_t> SQLStatementCache::_hitCount(0);
+std::atomic<uint64_t> SQLStatementCache::_missCount(0);
+std::atomic<uint64_t> SQLStatementCache::_evictedCount(0);
+std::atomic<uint64_t> SQLStatementCache::_hitNsecSum(0);
+std::atomic<uint64_t> SQLStatementCache::_parseNsecSum(0);
+
+void SQLStatementCache::config(int capacity)
+{
+	if (capacity > 0)
+		_shardCapacity = ((size_t)capacity + FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT - 1) / FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT;
+	else
+		_shardCapacity = 0;
+}
+
+ParsedStatementPtr SQLStatementCache::parse(const std::string& sql)
+{
+	std::shared_ptr<ParsedStatement> parsed = std::make_shared<ParsedStatement>();
+	parsed->sql = sql;
+
+	size_t firstUnquoted = std::string::npos;
+	size_t pos;
+	bool quoted;
+
+	SQLLexer lexer(sql);
+	while (lexer.nextPlaceholder(pos, quoted))
+	{
+		if (!quoted && firstUnquoted == std::string::npos)
+			firstUnquoted = pos;
+
+		parsed->placeholders.push_back(pos);
+		parsed->quotedPlaceholders.push_back(quoted);
+	}
+
+	bool forceMaster = false;
+	parsed->statement = SQLParser::pretreatSQL(sql, forceMaster);
+	parsed->forceMaster = forceMaster;
+
+	bool selectForceMaster = false;
+	parsed->selectStatement = SQLParser::pretreatSelectSQL(sql, selectForceMaster);
+
+	parsed->tableFound = SQLParser::pretreatSQL(sql, forceMaster, &(parsed->tableName));
+	if (!parsed->tableFound)
+		parsed->tableName.clear();
+
+	SQLTemplate sqlTemplate;
+	if (parsed->tableFound && SQLParser::buildSQLTemplate(sql, parsed->tableName, sqlTemplate))
+	{
+		parsed->templateBuilt = true;
+		parsed->slots.swap(sqlTemplate.slots);
+		parsed->tableSlot = sqlTemplate.tableSlot;
+	}
+
+	//-- Parameters placed before the end of the table name may change the parse results.
+	if (firstUnquoted == std::string::npos)
+		parsed->stable = true;
+	else
+		parsed->stable = parsed->templateBuilt && firstUnquoted >= parsed->tableSlot;
+
+	return parsed;
+}
+
+ParsedStatementPtr SQLStatementCache::fetch(const std::string& sql)
+{
+	if (_shardCapacity == 0)
+		return nullptr;
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	size_t hash = std::hash<std::string>()(sql);
+	Shard& shard = _shards[hash % FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT];
+	{
+		std::lock_guard<std::mutex> lck (shard.mutex);
+		auto iter = shard.index.find(hash);
+		if (iter != shard.index.end() && iter->second->second->sql == sql)
+		{
+			shard.lruList.splice(shard.lruList.begin(), shard.lruList, iter->second);
+			ParsedStatementPtr parsed = iter->second->second;
+
+			_hitCount++;
+			_hitNsecSum += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			return parsed;
+		}
+	}
+
+	ParsedStatementPtr parsed = parse(sql);
+
+	_missCount++;
+	_parseNsecSum += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+
+	std::lock_guard<std::mutex> lck (shard.mutex);
+	auto iter = shard.index.find(hash);
+	if (iter != shard.index.end())		//-- hash collision, or inserted by other thread.
+	{
+		shard.lruList.erase(iter->second);
+		shard.index.erase(iter);
+	}
+
+	shard.lruList.push_front(std::make_pair(hash, parsed));
+	shard.index[hash] = shard.lruList.begin();
+
+	while (shard.lruList.size() > _shardCapacity)
+	{
+		shard.index.erase(shard.lruList.back().first);
+		shard.lruList.pop_back();
+		_evictedCount++;
+	}
+
+	return parsed;
+}
+
+std::string SQLStatementCache::statusInJSON()
+{
+	size_t entries = 0;
+	for (int i = 0; i < FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT; i++)
+	{
+		std::lock_guard<std::mutex> lck (_shards[i].mutex);
+		entries += _shards[i].lruList.size();
+	}
+
+	uint64_t hitCount = _hitCount;
+	uint64_t missCount = _missCount;
+	uint64_t hitNsecSum = _hitNsecSum;
+	uint64_t parseNsecSum = _parseNsecSum;
+
+	//-- Saved: the average parse cost of the hits, minus the lookup cost of the hits.
+	double savedMsec = 0;
+	if (missCount)
+		savedMsec = ((double)parseNsecSum / missCount * hitCount - (double)hitNsecSum) / 1000000.0;
+	if (savedMsec < 0)
+		savedMsec = 0;
+
+	std::ostringstream oss;
+	oss<<"{\"capacity\":"<<(_shardCapacity * FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT);
+	oss<<",\"entries\":"<<entries;
+	oss<<",\"hits\":"<<hitCount;
+	oss<<",\"misses\":"<<missCount;
+	oss<<",\"evicted\":"<<_evictedCount;
+	oss<<",\"hitRate\":"<<((hitCount + missCount) ? (double)hitCount / (hitCount + missCount) : 0.0);
+	oss<<",\"savedMsec\":"<<savedMsec<<"}";
+	return oss.str();
+}
@@ -0,0 +1,82 @@
+#ifndef SQL_Statement_Cache_H
+#define SQL_Statement_Cache_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "SQLParser.h"
+
+#define FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT 16
+
+//========================================//
+//- Parsed Statement
+//========================================//
+/*
+	Parse result of a params query sql, which is the template with '?' placeholders.
+	The results of the template are used for the preassembled sql only when the table name is located
+	before all the unquoted placeholders, else the preassembled sql will be parsed as before.
+*/
+struct ParsedStatement
+{
+	std::string sql;
+	bool stable;				//-- The parse results are valid for the preassembled sql.
+	bool statement;				//-- Result of SQLParser::pretreatSQL without table name.
+	bool selectStatement;		//-- Result of SQLParser::pretreatSelectSQL without table name.
+	bool forceMaster;
+	bool tableFound;
+	std::string tableName;
+	std::vector<size_t> placeholders;		//-- offsets of '?'
+	std::vector<bool> quotedPlaceholders;	//-- '?' placeholders are kept for assembling with escaping.
+	bool templateBuilt;
+	std::vector<size_t> slots;				//-- table suffix slots for tableName.
+	size_t tableSlot;
+
+	ParsedStatement(): stable(false), statement(false), selectStatement(false), forceMaster(false),
+		tableFound(false), templateBuilt(false), tableSlot(0) {}
+
+	//-- Same as SQLParser::pretreatSQL & SQLParser::pretreatSelectSQL. Only for stable statement.
+	bool pretreat(bool selectOnly, bool& forceMasterTask, std::string* table) const;
+
+	//-- Same as ParamsQueryTask::preassemble. If sqlTemplate is not NULL and templateBuilt, it is filled for semisql.
+	bool preassemble(const std::vector<std::string>& params, std::string& semisql, std::vector<std::string>& restParams,
+		SQLTemplate* sqlTemplate = NULL) const;
+
+	//-- The slots of the template miss the table references inside the inlined params, such as "order by ?" with "t.ctime".
+	bool inlinesTableName(const std::vector<std::string>& params) const;
+};
+typedef std::shared_ptr<const ParsedStatement> ParsedStatementPtr;
+
+//========================================//
+//- SQL Statement Cache
+//========================================//
+class SQLStatementCache
+{
+	struct Shard
+	{
+		std::mutex mutex;
+		std::list<std::pair<size_t, ParsedStatementPtr>> lruList;		//-- front: the most recently used. first: sql hash.
+		std::unordered_map<size_t, std::list<std::pair<size_t, ParsedStatementPtr>>::iterator> index;
+	};
+
+	static size_t _shardCapacity;
+	static Shard _shards[FPNN_DBPROXY_SQL_CACHE_SHARD_COUNT];
+
+	static std::atomic<uint64_t> _hitCount;
+	static std::atomic<uint64_t> _missCount;
+	static std::atomic<uint64_t> _evictedCount;
+	static std::atomic<uint64_t> _hitNsecSum;
+	static std::atomic<uint64_t> _parseNsecSum;
+
+	static ParsedStatementPtr parse(const std::string& sql);
+
+public:
+	static void config(int capacity);
+	static inline bool enabled() { return _shardCapacity > 0; }
+
+	//-- Return nullptr if the cache is disabled.
+	static ParsedStatementPtr fetch(const std::string& sql);
+	static std::string statusInJSON();
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "FPLog.h"
+#include "MySQLClient.h"
+#include "TaskPackage.h"
+#include "TableManager.h"
+#include "SharedWorkerPool.h"
+
+//========================================//
+//- Shared Worker Unit
+//========================================//
+SharedWorkerUnit::SharedWorkerUnit(IMySQLTaskQueue* taskQueue, const DatabaseInfo* dbInfo, int maxConnections):
+	_taskQueue(taskQueue), _circuitBreaker(dbInfo->circuitBreaker()), _host(dbInfo->host), _port(dbInfo->port), _username(dbInfo->username), _password(dbInfo->password),
+	_databaseName(dbInfo->databaseName), _timeout(dbInfo->timeout), _crossZone(dbInfo->crossZone), _zoneGate(dbInfo->zoneGate), _maxConnections(maxConnections),
+	_scheduled(0), _running(0), _released(false), _executedCount(0)
+{
+	if (_maxConnections <= 0)
+		_maxConnections = 1;
+}
+
+SharedWorkerUnit::~SharedWorkerUnit()
+{
+	for (MySQLClient* client: _idleClients)
+		delete client;
+}
+
+void SharedWorkerUnit::adoptConnections(std::list<MySQLClient*>& clients)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	_idleClients.splice(_idleClients.end(), clients);
+}
+
+bool SharedWorkerUnit::wakeUp()
+{
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		if (_released || _scheduled >= _maxConnections)
+			return false;
+
+		if (_circuitBreaker && !_circuitBreaker->available())
+			return false;
+
+		//-- The tokens will take the queued tasks before returned.
+		if (_scheduled >= (int)_taskQueue->size())
+			return true;
+
+		_scheduled += 1;
+	}
+
+	SharedWorkerPool::schedule(shared_from_this());
+	return true;
+}
+
+bool SharedWorkerUnit::runOnce()
+{
+	TaskPackagePtr task;
+	MySQLClient* mySQL = NULL;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		//-- The cross-zone replicas leave the reads to the local instances, unless the reads spill over.
+		if (!_released && (!_circuitBreaker || _circuitBreaker->available()) && (!_zoneGate || _zoneGate->open(_taskQueue->size())))
+		{
+			if (_idleClients.size())
+				task = _taskQueue->pop(_idleClients.back()->currentDatabase());
+			else
+				task = _taskQueue->pop();
+		}
+
+		if (!task)
+		{
+			_scheduled -= 1;
+			return false;
+		}
+
+		if (_idleClients.size())
+		{
+			mySQL = _idleClients.back();
+			_idleClients.pop_back();
+		}
+		_running += 1;
+	}
+
+	//-- Connecting is out of the lock. The connection lost will be reconnected by TaskPackage::prepareConnection().
+	if (!mySQL)
+		mySQL = new MySQLClient(_host, _port, _username, _password, _databaseName, _timeout);
+
+	try{
+		task->processTask(mySQL);
+	} catch (...) {}
+
+	_taskQueue->finished(task);
+	if (task->readQueued())
+		TableManager::readExecuted(_crossZone);
+	if (task->retryPending())
+		TableManager::retry(task);
+	task.reset();
+	SharedWorkerPool::taskExecuted();
+	if (_circuitBreaker && !mySQL->authenticationFailed())
+		_circuitBreaker->report(mySQL->connected());
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	_idleClients.push_back(mySQL);
+	_running -= 1;
+	_executedCount += 1;
+
+	if (_released)
+	{
+		_scheduled -= 1;
+		_releasedCondition.notify_all();
+		return false;
+	}
+
+	if (!_taskQueue->empty())
+		return true;
+
+	_scheduled -= 1;
+	return false;
+}
+
+void SharedWorkerUnit::breakerAvailable()
+{
+	for (int i = 0; i < _maxConnections; i++)
+		if (!wakeUp())
+			break;
+}
+
+bool SharedWorkerUnit::isBusy()
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	return _running > 0;
+}
+
+void SharedWorkerUnit::release()
+{
+	std::unique_lock<std::mutex> lck (_mutex);
+	_released = true;
+	while (_running)
+		_releasedCondition.wait(lck);
+}
+
+std::string SharedWorkerUnit::infos()
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+
+	std::ostringstream oss;
+	oss<<"\"sharedWorkerPool\":true";
+	oss<<",\"connections\":"<<(_running + _idleClients.size());
+	oss<<",\"runningTasks\":"<<_running;
+	oss<<",\"scheduled\":"<<_scheduled;
+	oss<<",\"maxConnections\":"<<_maxConnections;
+	oss<<",\"executedTasks\":"<<_executedCount;
+	return oss.str();
+}
+
+//========================================//
+//- Shared Worker Pool
+//========================================//
+std::mutex SharedWorkerPool::_mutex;
+std::condition_variable SharedWorkerPool::_condition;
+std::list<SharedWorkerUnitPtr> SharedWorkerPool::_readyUnits;
+std::vector<std::thread> SharedWorkerPool::_threads;
+bool SharedWorkerPool::_willExit = false;
+int SharedWorkerPool::_maxConnectionsPerInstance = 0;
+std::atomic<int> SharedWorkerPool::_busyThreadCount(0);
+std::atomic<uint64_t> SharedWorkerPool::_executedCount(0);
+
+void SharedWorkerPool::start(int threadCount, int maxConnectionsPerInstance)
+{
+	if (threadCount <= 0 || _threads.size())
+		return;
+
+	//-- A stalled instance holds all its connections in the workers. The cap keeps the stalled ones from taking all threads.
+	int limit = std::max(threadCount / SHARED_WORKER_POOL_MAX_INSTANCE_SHARE, 1);
+	if (maxConnectionsPerInstance <= 0)
+		maxConnectionsPerInstance = std::max(threadCount / SHARED_WORKER_POOL_DEFAULT_INSTANCE_SHARE, 1);
+	else if (maxConnectionsPerInstance > limit)
+	{
+		LOG_WARN("Shared worker pool: max connections per instance %d is too large for %d threads, limited to %d.",
+			maxConnectionsPerInstance, threadCount, limit);
+		maxConnectionsPerInstance = limit;
+	}
+
+	_maxConnectionsPerInstance = maxConnectionsPerInstance;
+	for (int i = 0; i < threadCount; i++)
+		_threads.push_back(std::thread(&SharedWorkerPool::process));
+
+	LOG_INFO("Shared worker pool started. Threads: %d, max connections per instance: %d.", threadCount, maxConnectionsPerInstance);
+}
+
+void SharedWorkerPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_willExit = true;
+		_condition.notify_all();
+	}
+
+	for (auto& th: _threads)
+		th.join();
+
+	_threads.clear();
+	_readyUnits.clear();
+}
+
+void SharedWorkerPool::schedule(SharedWorkerUnitPtr unit)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	_readyUnits.push_back(unit);
+	_condition.notify_one();
+}
+
+void SharedWorkerPool::process()
+{
+	mysql_thread_init();
+
+	while (true)
+	{
+		SharedWorkerUnitPtr unit;
+		{
+			std::unique_lock<std::mutex> lck (_mutex);
+			while (_readyUnits.empty() && !_willExit)
+				_condition.wait(lck);
+
+			if (_readyUnits.empty())
+				break;
+
+			unit = _readyUnits.front();
+			_readyUnits.pop_front();
+		}
+
+		_busyThreadCount++;
+		bool keepToken = unit->runOnce();
+		_busyThreadCount--;
+
+		if (keepToken)
+			schedule(unit);
+	}
+
+	mysql_thread_end();
+}
+
+std::string SharedWorkerPool::statusInJSON()
+{
+	size_t readyUnits;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		readyUnits = _readyUnits.size();
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	//-- Threads of the process. Linux only.
+	int processThreads = -1;
+	std::ifstream procStatus("/proc/self/status");
+	std::string line;
+	while (std::getline(procStatus, line))
+	{
+		if (line.compare(0, 8, "Threads:") == 0)
+		{
+			processThreads = atoi(line.c_str() + 8);
+			break;
+		}
+	}
+
+	std::ostringstream oss;
+	if (enabled())
+	{
+		oss<<"{\"mode\":\"shared\",\"threads\":"<<_threads.size();
+		oss<<",\"busyThreads\":"<<_busyThreadCount;
+		oss<<",\"readyUnits\":"<<readyUnits;
+		oss<<",\"maxConnectionsPerInstance\":"<<_maxConnectionsPerInstance;
+		oss<<",\"executedTasks\":"<<_executedCount;
+	}
+	else
+	{
+		oss<<"{\"mode\":\"perInstance\"";
+		oss<<",\"executedTasks\":"<<MySQLTaskThreadPool::executedTaskCount();
+	}
+
+	oss<<",\"processThreads\":"<<processThreads;
+	oss<<",\"maxRSSKB\":"<<usage.ru_maxrss;
+	oss<<",\"voluntaryContextSwitches\":"<<usage.ru_nvcsw;
+	oss<<",\"involuntaryContextSwitches\":"<<usage.ru_nivcsw<<"}";
+	return oss.str();
+}
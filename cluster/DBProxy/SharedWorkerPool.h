@@ -0,0 +1,103 @@
+#ifndef Shared_Worker_Pool_H
+#define Shared_Worker_Pool_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "IMySQLTaskQueue.h"
+#include "HealthChecker.h"
+
+class MySQLClient;
+struct ZoneGate;
+struct DatabaseInfo;
+
+//-- Max connections per instance: threads / 8 by default, and at most threads / 4.
+#define SHARED_WORKER_POOL_DEFAULT_INSTANCE_SHARE 8
+#define SHARED_WORKER_POOL_MAX_INSTANCE_SHARE 4
+
+//========================================//
+//- Shared Worker Unit
+//========================================//
+/*
+	The DatabaseInfo attached to the shared worker pool. It keeps the idle connections of the instance.
+	The concurrency of the instance is limited by the connections checked out, instead of the threads.
+	Each scheduled unit in the ready list is a token, which is kept by the worker while the task queue is not empty.
+	The tokens are returned while the circuit breaker is open, and the unit is scheduled again when the breaker is available.
+*/
+class SharedWorkerUnit: public CircuitBreakerListener, public std::enable_shared_from_this<SharedWorkerUnit>
+{
+	std::mutex _mutex;
+	std::condition_variable _releasedCondition;
+	IMySQLTaskQueue* _taskQueue;
+	CircuitBreakerPtr _circuitBreaker;
+
+	std::string _host;
+	int _port;
+	std::string _username;
+	std::string _password;
+	std::string _databaseName;
+	int _timeout;
+	bool _crossZone;
+	std::shared_ptr<ZoneGate> _zoneGate;
+
+	std::list<MySQLClient*> _idleClients;
+	int _maxConnections;
+	int _scheduled;			//-- Tokens in the ready list and running.
+	int _running;			//-- Connections checked out.
+	bool _released;
+	uint64_t _executedCount;
+
+public:
+	SharedWorkerUnit(IMySQLTaskQueue* taskQueue, const DatabaseInfo* dbInfo, int maxConnections);
+	~SharedWorkerUnit();
+
+	void adoptConnections(std::list<MySQLClient*>& clients);
+	bool wakeUp();
+	bool runOnce();			//-- Returns true if the token is kept, and the unit should be scheduled again.
+	bool isBusy();
+	virtual void breakerAvailable();
+	void release();			//-- Wait for the running tasks. The task queue is not used after released.
+	std::string infos();
+};
+typedef std::shared_ptr<SharedWorkerUnit> SharedWorkerUnitPtr;
+
+//========================================//
+//- Shared Worker Pool
+//========================================//
+/*
+	One process-wide worker pool for all DatabaseTaskQueues, instead of a thread pool per DatabaseInfo.
+	Workers take the scheduled units in order, run one task with a connection checked out from the unit,
+	and reschedule the unit at the end of the ready list if more tasks are queued.
+*/
+class SharedWorkerPool
+{
+	static std::mutex _mutex;
+	static std::condition_variable _condition;
+	static std::list<SharedWorkerUnitPtr> _readyUnits;
+	static std::vector<std::thread> _threads;
+	static bool _willExit;
+	static int _maxConnectionsPerInstance;
+
+	static std::atomic<int> _busyThreadCount;
+	static std::atomic<uint64_t> _executedCount;
+
+	static void process();
+
+public:
+	static void start(int threadCount, int maxConnectionsPerInstance);		//-- maxConnectionsPerInstance: 0 means default.
+	static void stop();		//-- Call after all units are released.
+	static inline bool enabled() { return _threads.size() > 0; }
+	static inline int maxConnectionsPerInstance() { return _maxConnectionsPerInstance; }
+
+	static void schedule(SharedWorkerUnitPtr unit);
+	static inline void taskExecuted() { _executedCount++; }
+
+	//-- Worker threads, executed tasks, and the process footprint, for both the shared mode and the per instance mode.
+	static std::string statusInJSON();
+};
+
+#endif
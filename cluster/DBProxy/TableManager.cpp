@@ -1,13 +1,16 @@
+#include <chrono>
+#include <thread>
 #include <algorithm>
 #include <sstream>
 #include "FPLog.h"
 #include "SQLParser.h"
 #include "DataRouterErrorInfo.h"
 #include "TableManager.h"
+#include "XATransaction.h"
 //=============================================//
 //-	DatabaseInfo
 //=============================================//
-DatabaseInfo::DatabaseInfo(): port(0), master_id(0), _threadPool(0)
+DatabaseInfo::DatabaseInfo(): port(0), master_id(0), crossZone(false), _threadPool(0)
 {
 }
 
@@ -15,30 +18,79 @@ DatabaseInfo::~DatabaseInfo()
 {
 	if (_threadPool)
 		delete _threadPool;
+
+	if (_sharedWorkerUnit)
+		_sharedWorkerUnit->release();
 }
 
-void DatabaseInfo::enableThreadPool(IMySQLTaskQueue* taskQueue, int32_t initCount, int32_t perAppendCount, int32_t perfectCount, int32_t maxCount, size_t tempThreadLatencySeconds)
+void DatabaseInfo::enableThreadPool(IMySQLTaskQueue* taskQueue, int32_t initCount, int32_t perAppendCount, int32_t perfectCount, int32_t maxCount, size_t tempThreadLatencySeconds,
+	std::list<MySQLClient*>& warmedClients)
 {
-	if (!_threadPool)
+	if (!_circuitBreaker)
+		_circuitBreaker = HealthChecker::circuitBreaker(this);
+
+	if (SharedWorkerPool::enabled())
+	{
+		if (!_sharedWorkerUnit)
+		{
+			_sharedWorkerUnit = std::make_shared<SharedWorkerUnit>(taskQueue, this, SharedWorkerPool::maxConnectionsPerInstance());
+			_sharedWorkerUnit->adoptConnections(warmedClients);
+			if (_circuitBreaker)
+				_circuitBreaker->subscribe(_sharedWorkerUnit);
+		}
+	}
+	else if (!_threadPool)
 	{
 		_threadPool = new MySQLTaskThreadPool(taskQueue, this);
+		_threadPool->adoptConnections(warmedClients);
 		_threadPool->init(initCount, perAppendCount, perfectCount, maxCount, tempThreadLatencySeconds);
 	}
+
+	for (MySQLClient* client: warmedClients)
+		delete client;
+	warmedClients.clear();
 }
 
 std::string DatabaseInfo::threadPoolInfos()
 {
-	if (_threadPool)
+	if (_sharedWorkerUnit)
+		return _sharedWorkerUnit->infos();
+	else if (_threadPool)
 		return _threadPool->infos();
 	else
 		return std::string();
 }
 
+bool ZoneGate::open(size_t readQueueSize) const
+{
+	if (localCount == 0 || TableManager::zoneSpilling(readQueueSize))
+		return true;
+
+	//-- The local instances without circuit breaker are always available.
+	if ((int)localBreakers.size() < localCount)
+		return false;
+
+	for (auto& breaker: localBreakers)
+		if (breaker->available())
+			return false;
+
+	return true;
+}
+
 //=============================================//
 //-	TableManager
 //=============================================//
 size_t TableManager::_perThreadPoolReadQueueMaxLength = 200000;
 size_t TableManager::_perThreadPoolWriteQueueMaxLength = 200000;
+std::string TableManager::_zone;
+size_t TableManager::_zoneSpillQueueLength = 0;
+std::atomic<uint64_t> TableManager::_localZoneReads(0);
+std::atomic<uint64_t> TableManager::_crossZoneReads(0);
+std::mutex TableManager::_retryMutex;
+std::condition_variable TableManager::_retryCondition;
+std::multimap<std::chrono::steady_clock::time_point, QueryTaskPtr> TableManager::_delayedRetries;
+std::thread TableManager::_retryThread;
+bool TableManager::_retryTimerRunning = false;
 
 void TableManager::config(int perThreadPoolReadQueueMaxLength, int perThreadPoolWriteQueueMaxLength)
 {
@@ -46,6 +98,27 @@ void TableManager::config(int perThreadPoolReadQueueMaxLength, int perThreadPool
 	_perThreadPoolWriteQueueMaxLength = (size_t)perThreadPoolWriteQueueMaxLength;
 }
 
+void TableManager::configZone(const std::string& zone, int spillQueueLength)
+{
+	_zone = zone;
+	_zoneSpillQueueLength = spillQueueLength > 0 ? (size_t)spillQueueLength : 0;
+}
+
+std::string TableManager::zoneStatusInJSON()
+{
+	uint64_t localReads = _localZoneReads;
+	uint64_t crossReads = _crossZoneReads;
+	uint64_t total = localReads + crossReads;
+
+	std::ostringstream oss;
+	oss<<"{\"zone\":\""<<_zone<<"\"";
+	oss<<",\"spillQueueLength\":"<<_zoneSpillQueueLength;
+	oss<<",\"localReads\":"<<localReads;
+	oss<<",\"crossZoneReads\":"<<crossReads;
+	oss<<",\"crossZoneRatio\":"<<(total ? (double)crossReads / total : 0.0)<<"}";
+	return oss.str();
+}
+
 TableManager::TableManager(int64_t range_span, int secondary_split_table_number_base, int64_t update_time):
 	_splitSpan(range_span), _secondaryTableNumberBase(secondary_split_table_number_base), _update_time(update_time)
 {
@@ -53,8 +126,9 @@ TableManager::TableManager(int64_t range_span, int secondary_split_table_number_
 
 TableManager::~TableManager()
 {	
-	for (auto& tiPair: _tableInfos)
-		delete tiPair.second;
+	for (auto& clusterPair: _tableInfos)
+		for (auto& tiPair: clusterPair.second)
+			delete tiPair.second;
 
 	for (auto& rtqPair: _rangedTaskQueues)
 	{
@@ -91,18 +165,43 @@ bool TableManager::deletable()
 	return true;
 }
 
-DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, int64_t hintId,
-	const std::string& tableName, const std::string& cluster, std::string& sql, std::string* databaseName)
+TableInfo* TableManager::findTableInfo(const std::string& tableName, const std::string& cluster)
 {
-	TableHint tableHint(tableName, cluster);
+	auto clusterIter = _tableInfos.find(cluster);
+	if (clusterIter == _tableInfos.end())
+		return NULL;
+
+	auto iter = clusterIter->second.find(tableName);
+	if (iter == clusterIter->second.end())
+		return NULL;
+
+	return iter->second;
+}
 
-	auto iter = _tableInfos.find(tableHint);
-	if (iter == _tableInfos.end())
+//-- The template built for the plain sql is kept by the caller, so that the unsuffixed sql can be restored.
+static bool addTableSuffix(const std::string& tableName, std::string& sql, const char* suffix, SQLTemplatePtr* sqlTemplate)
+{
+	if (sqlTemplate && !*sqlTemplate)
+	{
+		SQLTemplatePtr built = std::make_shared<SQLTemplate>();
+		if (!SQLParser::buildSQLTemplate(sql, tableName, *built))
+			return false;
+
+		*sqlTemplate = built;
+	}
+
+	return TaskPackage::setSuffix(tableName, sql, suffix, sqlTemplate ? sqlTemplate->get() : NULL);
+}
+
+DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, int64_t hintId,
+	const std::string& tableName, const std::string& cluster, std::string& sql, std::string* databaseName, SQLTemplatePtr* sqlTemplate)
+{
+	TableInfo* tableInfo = findTableInfo(tableName, cluster);
+	if (tableInfo == NULL)
 	{
 		LOG_ERROR("EXCEPTION: Table '%s' in cluster '%s' not found.", tableName.c_str(), cluster.c_str());
 		return nullptr;
 	}
-	TableInfo* tableInfo = iter->second;
 	
 	DatabaseTaskQueuePtr databaseQueuePtr;
 	if (tableInfo->splitByRange)
@@ -157,7 +256,7 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 						snprintf(suffix, 32, "%ld", suffixId + _secondaryTableNumberBase);
 #endif
 						
-						if (!TaskPackage::setSuffix(tableName, sql, suffix))
+						if (!addTableSuffix(tableName, sql, suffix, sqlTemplate))
 						{
 							LOG_ERROR("Parse SQL [%s] failed. Cannot find the table name [%s] in sql.", sql.c_str(), tableName.c_str());
 							return nullptr;
@@ -189,11 +288,10 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 				hintId = hintId % count;
 		}
 
-		TableTaskHint tth(tableInfo->tableName, cluster, (int)hintId);
-		auto it = _tableTaskQueues.find(tth);
-		if (it != _tableTaskQueues.end())
+		if (hintId >= 0 && hintId < (int64_t)tableInfo->hashRoutes.size() && tableInfo->hashRoutes[hintId].taskQueueIndex >= 0)
 		{
-			databaseQueuePtr = it->second;
+			const HashRoute& route = tableInfo->hashRoutes[hintId];
+			databaseQueuePtr = _hashTaskQueues[route.taskQueueIndex];
 
 			if (count > 1)
 			{
@@ -204,7 +302,7 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 				snprintf(suffix, 32, "_%ld", hintId);
 #endif
 				
-				if (!TaskPackage::setSuffix(tableName, sql, suffix))
+				if (!addTableSuffix(tableName, sql, suffix, sqlTemplate))
 				{
 					LOG_ERROR("Parse SQL [%s] failed. Cannot find the table name [%s] in sql.", sql.c_str(), tableName.c_str());
 					return nullptr;
@@ -212,18 +310,23 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 			}
 
 			if (task)
-				task->setDatabaseName(it->first.databaseName);
+				task->setDatabaseName(_databaseNames[route.databaseNameIndex]);
 			else
-				*databaseName = it->first.databaseName;
+				*databaseName = _databaseNames[route.databaseNameIndex];
 		}
 	}
 
+	//-- Tasks built from the template carry no sql until routed.
+	if (databaseQueuePtr && sqlTemplate && *sqlTemplate && sql.empty())
+		sql = (*sqlTemplate)->sql;
+
 	return databaseQueuePtr;
 }
 
 bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 {
-	DatabaseTaskQueuePtr databaseQueuePtr = findDatabaseTaskQueue(task, hintId, task->tableName(), task->cluster(), task->sql(), NULL);
+	task->setRoute(hintId, master);
+	DatabaseTaskQueuePtr databaseQueuePtr = findDatabaseTaskQueue(task, hintId, task->tableName(), task->cluster(), task->sql(), NULL, &(task->sqlTemplate()));
 
 	if (databaseQueuePtr == nullptr)
 	{
@@ -232,7 +335,22 @@ bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 			task->tableName().c_str(), task->cluster().c_str(), hintId);
 		return false;
 	}
-		
+
+	return enqueue(databaseQueuePtr.get(), master, task);
+}
+
+bool TableManager::enqueue(DatabaseTaskQueue* databaseQueuePtr, bool master, QueryTaskPtr task)
+{
+	task->setTaskQueue(databaseQueuePtr);
+	task->setMasterServerId(databaseQueuePtr->masterDB->serverId);
+
+	ClusterTaskQueue::Lane* lane = databaseQueuePtr->queue.lane(task->cluster());
+	if (lane->full())
+	{
+		task->finish(ErrorInfo::serverBusyCode, "Corresponding query queue caught cluster limitation.");
+		return false;
+	}
+
 	if (!master && databaseQueuePtr->databaseList.size() > 1)
 	{
 		if (databaseQueuePtr->queue.readQueueSize() >= _perThreadPoolReadQueueMaxLength)
@@ -241,20 +359,32 @@ bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 			return false;
 		}
 
-		databaseQueuePtr->queue.push(task, true);
+		if (!databaseQueuePtr->available())
+		{
+			task->finish(ErrorInfo::unavailableCode, "All corresponding database instances are unavailable.");
+			return false;
+		}
+
+		//-- The lower classes are shed first. The interactive reads are shed only above the interactive target.
+		if (lane->queue.readMonitor().shedding(task->qosClass()))
+		{
+			lane->queue.readMonitor().shed(task->qosClass());
+			task->finish(ErrorInfo::serverBusyCode, "Corresponding query queue is overloaded.");
+			return false;
+		}
+
+		databaseQueuePtr->queue.push(lane, task, true);
 		size_t v = ((uint64_t)task.get()/16) % databaseQueuePtr->databaseList.size();
 		
-		for (size_t i = 0; i < databaseQueuePtr->databaseList.size(); i++)
+		//-- The replicas in the same zone are preferred. The other zones are woken when no local replica is available, or the reads are piled up.
+		if (wakeUpReplicas(databaseQueuePtr, v, false))
 		{
-			DatabaseInfoPtr dip = databaseQueuePtr->databaseList[v];
-			if (dip->wakeUp())
-				return true;
+			if (zoneSpilling(databaseQueuePtr->queue.readQueueSize()))
+				wakeUpReplicas(databaseQueuePtr, v, true);
 				
-			v++;
-			if (v == databaseQueuePtr->databaseList.size())
-				v = 0;
+			return true;
 		}
-		return false;
+		return wakeUpReplicas(databaseQueuePtr, v, true);
 	}
 	else
 	{
@@ -264,30 +394,186 @@ bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 			return false;
 		}
 
-		databaseQueuePtr->queue.push(task, false);
+		if (!databaseQueuePtr->masterDB->available())
+		{
+			task->finish(ErrorInfo::unavailableCode, "Corresponding database instance is unavailable.");
+			return false;
+		}
+
+		//-- Only the reads are shed. The writes are limited by the queue length.
+		if (lane->queue.writeMonitor().shedding(task->qosClass()) && !SQLParser::isDataModificationSQL(task->sql()))
+		{
+			lane->queue.writeMonitor().shed(task->qosClass());
+			task->finish(ErrorInfo::serverBusyCode, "Corresponding query queue is overloaded.");
+			return false;
+		}
+
+		if (GroupCommitCollector::enabled(task->tableName()) && SQLParser::isDataModificationSQL(task->sql()))
+		{
+			GroupCommitTaskPtr group = databaseQueuePtr->groupCommitCollector.add(task);
+			if (!group)
+				return true;
+
+			databaseQueuePtr->queue.push(lane, group, false);
+		}
+		else
+			databaseQueuePtr->queue.push(lane, task, false);
+
 		return databaseQueuePtr->masterDB->wakeUp();
 	}
 }
 
+bool TableManager::wakeUpReplicas(DatabaseTaskQueue* databaseQueuePtr, size_t start, bool crossZone)
+{
+	size_t count = databaseQueuePtr->databaseList.size();
+	for (size_t i = 0; i < count; i++)
+	{
+		DatabaseInfoPtr dip = databaseQueuePtr->databaseList[(start + i) % count];
+		if (dip->crossZone == crossZone && dip->wakeUp())
+			return true;
+	}
+	return false;
+}
+
+void TableManager::retry(TaskPackagePtr task)
+{
+	QueryTaskPtr queryTask = std::dynamic_pointer_cast<QueryTask>(task);
+	if (!queryTask || !queryTask->taskQueue())
+		return;
+
+	int delay = queryTask->retryDelayMsec();
+	if (delay > 0)
+	{
+		std::lock_guard<std::mutex> lck (_retryMutex);
+		if (_retryTimerRunning)
+		{
+			queryTask->taskQueue()->delayedRetries++;
+			_delayedRetries.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), queryTask));
+			_retryCondition.notify_one();
+			return;
+		}
+	}
+
+	//-- The read queue is shared by the replicas, so the task may be taken by another instance, or a fresh connection.
+	enqueue(queryTask->taskQueue(), queryTask->master(), queryTask);
+}
+
+void TableManager::startRetryTimer()
+{
+	if (!QueryTask::readRetryDelayed() || _retryThread.joinable())
+		return;
+
+	_retryTimerRunning = true;
+	_retryThread = std::thread(&TableManager::retryThread);
+}
+
+void TableManager::stopRetryTimer()
+{
+	if (!_retryThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lck (_retryMutex);
+		_retryTimerRunning = false;
+		_retryCondition.notify_all();
+	}
+	_retryThread.join();
+}
+
+void TableManager::retryThread()
+{
+	std::unique_lock<std::mutex> lck (_retryMutex);
+	while (true)
+	{
+		if (_delayedRetries.empty())
+		{
+			if (!_retryTimerRunning)
+				break;
+
+			_retryCondition.wait(lck);
+			continue;
+		}
+
+		auto iter = _delayedRetries.begin();
+		if (_retryTimerRunning && iter->first > std::chrono::steady_clock::now())
+		{
+			_retryCondition.wait_until(lck, iter->first);
+			continue;
+		}
+
+		QueryTaskPtr queryTask = iter->second;
+		_delayedRetries.erase(iter);
+
+		lck.unlock();
+		DatabaseTaskQueue* taskQueue = queryTask->taskQueue();
+		enqueue(taskQueue, queryTask->master(), queryTask);
+		taskQueue->delayedRetries--;
+		lck.lock();
+	}
+}
+
+void TableManager::migrateQueuedTasks(TableManager& newTableManager, size_t& migratedCount, size_t& vanishedCount)
+{
+	for (auto& dbQueuePtr: _usedTaskQueues)
+	{
+		if (_takenTaskQueues.find(dbQueuePtr) != _takenTaskQueues.end())
+			continue;
+
+		//-- The popped tasks are not started. The started ones are finished by the retired thread pools.
+		std::vector<TaskPackagePtr> unmigratableTasks;
+		while (true)
+		{
+			TaskPackagePtr task = dbQueuePtr->queue.takeQueued();
+			if (!task)
+				break;
+
+			QueryTaskPtr queryTask = std::dynamic_pointer_cast<QueryTask>(task);
+			if (!queryTask || !queryTask->unroute())
+			{
+				unmigratableTasks.push_back(task);
+				continue;
+			}
+
+			DatabaseTaskQueuePtr newQueuePtr = newTableManager.findDatabaseTaskQueue(queryTask, queryTask->hintId(),
+				queryTask->tableName(), queryTask->cluster(), queryTask->sql(), NULL, &(queryTask->sqlTemplate()));
+
+			if (newQueuePtr == nullptr)
+			{
+				queryTask->finish(ErrorInfo::notFoundCode, "Target database or table not found after config changed.");
+				vanishedCount += 1;
+				continue;
+			}
+
+			enqueue(newQueuePtr.get(), queryTask->master(), queryTask);
+			migratedCount += 1;
+		}
+
+		//-- Group commits, transactions, XA branches and async write batches are kept, and executed by the retired thread pools.
+		if (unmigratableTasks.size())
+		{
+			for (auto& task: unmigratableTasks)
+				dbQueuePtr->queue.push(task, false);
+
+			dbQueuePtr->masterDB->wakeUp();
+		}
+	}
+}
+
 bool TableManager::splitType(const std::string &table_name, const std::string& cluster, bool& splitByRange)
 {
-	TableHint hint(table_name, cluster);
-	auto iter = _tableInfos.find(hint);
-	if (iter == _tableInfos.end())
+	TableInfo* tableInfo = findTableInfo(table_name, cluster);
+	if (tableInfo == NULL)
 		return false;
 
-	splitByRange = iter->second->splitByRange;
+	splitByRange = tableInfo->splitByRange;
 	return true;
 }
 bool TableManager::splitInfo(const std::string &table_name, const std::string& cluster, SplitInfo& info)
 {
-	TableHint tableHint(table_name, cluster);
-	auto iter = _tableInfos.find(tableHint);
-	if (iter == _tableInfos.end())
+	TableInfo* tableInfo = findTableInfo(table_name, cluster);
+	if (tableInfo == NULL)
 		return false;
 
-	TableInfo* tableInfo = iter->second;
-
 	info.splitByRange = tableInfo->splitByRange;
 	if (tableInfo->splitByRange)
 	{
@@ -331,13 +617,10 @@ bool TableManager::databaseCategoryInfo(const std::string& databaseCategory, con
 
 bool TableManager::getAllSplitTablesHintIds(const std::string &table_name, const std::string& cluster, std::set<int64_t>& hintIds)
 {
-	TableHint tableHint(table_name, cluster);
-	auto iter = _tableInfos.find(tableHint);
-	if (iter == _tableInfos.end())
+	TableInfo* tableInfo = findTableInfo(table_name, cluster);
+	if (tableInfo == NULL)
 		return false;
 
-	TableInfo* tableInfo = iter->second;
-
 	if (tableInfo->splitByRange)
 	{
 		if (tableInfo->splitSpan == 0)
@@ -410,13 +693,10 @@ void addIdToMap(int64_t key, int64_t id, std::map<int64_t, std::set<int64_t>>& h
 bool TableManager::reformHintIds(const std::string &table_name, const std::string& cluster, const std::vector<int64_t>& hintIds,
 	std::map<int64_t, std::set<int64_t>>& hintMap, std::set<int64_t>& invalidHintIds)
 {
-	TableHint tableHint(table_name, cluster);
-	auto iter = _tableInfos.find(tableHint);
-	if (iter == _tableInfos.end())
+	TableInfo* tableInfo = findTableInfo(table_name, cluster);
+	if (tableInfo == NULL)
 		return false;
 
-	TableInfo* tableInfo = iter->second;
-
 	std::set<int64_t> positiveHintIds;
 	for (int64_t hintId: hintIds)
 	{
@@ -529,11 +809,76 @@ bool TableManager::transaction(TransactionTaskPtr task)
 		return false;
 	}
 
+	ClusterTaskQueue::Lane* lane = dbTaskQueue->queue.lane(task->cluster());
+	if (lane->full())
+	{
+		task->finish(ErrorInfo::serverBusyCode, "Corresponding query queue caught cluster limitation.");
+		return false;
+	}
+
+	if (!dbTaskQueue->masterDB->available())
+	{
+		task->finish(ErrorInfo::unavailableCode, "Corresponding database instance is unavailable.");
+		return false;
+	}
+
 	task->setDatabaseName(databaseName);
-	dbTaskQueue->queue.push(task, false);
+	task->setMasterServerId(dbTaskQueue->masterDB->serverId);
+	dbTaskQueue->queue.push(lane, task, false);
 	return dbTaskQueue->masterDB->wakeUp();
 }
 
+bool TableManager::xaTransaction(XATransactionPtr xa)
+{
+	for (size_t i = 0; i < xa->_sqls.size(); i++)
+	{
+		std::string databaseName;
+		DatabaseTaskQueuePtr taskQueue = findDatabaseTaskQueue(nullptr, xa->_hintIds[i],
+			xa->_tableNames[i], xa->cluster(), xa->_sqls[i], &databaseName);
+
+		if (!taskQueue)
+		{
+			xa->finish(ErrorInfo::notFoundCode, i, "Target database or table not found.");
+			return false;
+		}
+
+		if (taskQueue->queue.writeQueueSize() >= _perThreadPoolWriteQueueMaxLength || taskQueue->queue.lane(xa->cluster())->full())
+		{
+			xa->finish(ErrorInfo::serverBusyCode, "Corresponding query queue caught limitation.");
+			return false;
+		}
+
+		if (!taskQueue->masterDB->available())
+		{
+			xa->finish(ErrorInfo::unavailableCode, i, "Corresponding database instance is unavailable.");
+			return false;
+		}
+
+		xa->addStatement(taskQueue, databaseName, (int)i);
+	}
+
+	xa->start();
+	return true;
+}
+
+void TableManager::masterTaskQueues(std::vector<DatabaseTaskQueuePtr>& queues)
+{
+	std::set<std::string> masters;
+	for (auto& dtqp: _usedTaskQueues)
+	{
+		std::string endpoint(dtqp->masterDB->host);
+		endpoint.append(":").append(std::to_string(dtqp->masterDB->port));
+
+		if (masters.insert(endpoint).second)
+			queues.push_back(dtqp);
+	}
+}
+
+DatabaseTaskQueuePtr TableManager::writeTaskQueue(int64_t hintId, const std::string& tableName, const std::string& cluster, std::string& sql, std::string& databaseName)
+{
+	return findDatabaseTaskQueue(nullptr, hintId, tableName, cluster, sql, &databaseName);
+}
+
 std::string TableManager::statusInJSON()
 {	
 	std::ostringstream oss;
@@ -553,6 +898,18 @@ std::string TableManager::statusInJSON()
 			oss<<"\"masterDB\":\""<<dtqp->masterDB->host<<":"<<dtqp->masterDB->port<<"\"";
 			oss<<",\"readQueueSize\":"<<dtqp->queue.readQueueSize();
 			oss<<",\"writeQueueSize\":"<<dtqp->queue.writeQueueSize();
+			if (GroupCommitCollector::configured())
+				oss<<",\"groupCommit\":"<<dtqp->groupCommitCollector.statusInJSON();
+			if (ClusterTaskQueue::enabled())
+				oss<<",\"clusters\":"<<dtqp->queue.statusInJSON();
+			else if (SojournMonitor::enabled())
+			{
+				ClusterTaskQueue::Lane* lane = dtqp->queue.lane(std::string());
+				oss<<",\"readOverloadLevel\":"<<lane->queue.readMonitor().overloadLevel();
+				oss<<",\"writeOverloadLevel\":"<<lane->queue.writeMonitor().overloadLevel();
+				oss<<",\"readShed\":"<<lane->queue.readMonitor().shedCount();
+				oss<<",\"writeShed\":"<<lane->queue.writeMonitor().shedCount();
+			}
 		
 			oss<<",\"dbInfos\":";
 			oss<<"[";
@@ -567,6 +924,8 @@ std::string TableManager::statusInJSON()
 					
 				oss<<"{\"dbHost\":\""<<dip->host<<":"<<dip->port<<"\"";
 				oss<<","<<dip->threadPoolInfos();
+				if (dip->circuitBreaker())
+					oss<<",\"circuitBreaker\":"<<dip->circuitBreaker()->infos();
 				oss<<"}";
 			}
 			oss<<"]";
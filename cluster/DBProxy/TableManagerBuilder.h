@@ -3,6 +3,10 @@
 
 #include "TableManager.h"
 
+typedef std::pair<std::string, std::string> TableInfoKey;		//-- cluster, table name
+inline TableInfoKey tableInfoKey(const TableInfo& ti) { return TableInfoKey(ti.cluster, ti.tableName); }
+inline TableInfoKey tableInfoKey(const TableSplittingInfo& tsi) { return TableInfoKey(tsi.cluster, tsi.tableName); }
+
 class TableManagerBuilder
 {
 	struct ConstructureInfo
@@ -26,17 +30,23 @@ class TableManagerBuilder
 		4. add range splitting info => _rangeSplittingInfos
 		
 		5. _dbCollection => _dbTaskQueues
-		6. _tableSplittingInfos + _dbTaskQueues => _tableTaskQueues
+		6. _tableSplittingInfos + _dbTaskQueues => TableInfo::hashRoutes
 		7. _rangeSplittingInfos + _dbTaskQueues => _rangedTaskQueues
-		8. _dbInfos => enable Thread Pool
+		8. _dbInfos => warm up connections, enable Thread Pool
 		9. clean _constructureInfo
+
+		Incremental building: the tables not rebuilt are inherited from the base table manager before step 5,
+		and their hash routes are remapped to the new task queues by the master server ids in step 6.
 	*/
 	
 	int64_t _splitSpan;
 	TableManagerPtr _tableManager;
+	TableManagerPtr _baseTableManager;
+	std::vector<TableInfo*> _inheritedTableInfos;		//-- Owned by _tableInfos.
 	
-	std::unordered_map<TableHint, TableInfo*>	_tableInfos;
-	std::unordered_map<TableTaskHint, DatabaseTaskQueuePtr> _tableTaskQueues;		//-- for hash
+	std::unordered_map<std::string, std::unordered_map<std::string, TableInfo*>>	_tableInfos;		//-- cluster => table name => info
+	std::vector<DatabaseTaskQueuePtr> _hashTaskQueues;		//-- for hash
+	std::vector<std::string> _databaseNames;				//-- for hash
 	std::unordered_map<RangeTaskHint, std::vector<RangeDatabaseNode*>> _rangedTaskQueues;
 	std::set<DatabaseTaskQueuePtr> _usedTaskQueues;
 	
@@ -48,13 +58,33 @@ class TableManagerBuilder
 	static int _perThreadPoolMaxCount;
 	static int _perThreadPoolTempThreadLatencySeconds;
 
+	struct WarmedConnections
+	{
+		std::list<MySQLClient*> clients;
+		int failed;
+		int rejected;			//-- The failed connections rejected by the authentication.
+
+		WarmedConnections(): failed(0), rejected(0) {}
+	};
+
+	static int _warmUpConnections;			//-- Per instance. 0 means disabled.
+	static int _warmUpThreadCount;
+	static int _warmUpSlowMsec;
+
 	bool init_status_check();
 	bool init_step5_dbCollection_to_dbTaskQueues(TableManagerPtr oldTableManager);
 	bool init_step6_tableSplittingInfos_dbTaskQueues_to_tableTaskQueues();
+	bool init_step6_inheritedTableInfos_to_tableTaskQueues(std::map<DatabaseTaskQueuePtr, int>& taskQueueIndexes,
+		std::unordered_map<std::string, int>& databaseNameIndexes);
+	int internHashTaskQueue(std::map<DatabaseTaskQueuePtr, int>& taskQueueIndexes, DatabaseTaskQueuePtr dtq);
+	int internDatabaseName(std::unordered_map<std::string, int>& databaseNameIndexes, const std::string& databaseName);
 	bool init_step7_rangeSplittingInfos_dbTaskQueues_to_rangedTaskQueues();
+	void warmUpConnections(std::map<DatabaseInfo*, WarmedConnections>& warmedConnections);
+	static void attachZoneGate(std::vector<DatabaseInfoPtr>& databaseList);		//-- Before the thread pools are enabled.
 	
 public:
 	static void config(int perThreadPoolInitCount, int perThreadPoolAppendCount, int perThreadPoolPerfectCount, int perThreadPoolMaxCount, int perThreadPoolTempThreadLatencySeconds);
+	static void configWarmUp(int connectionsPerInstance, int threadCount, int slowMsec);
 
 	TableManagerBuilder(int64_t range_span, int secondary_split_table_number_base, int64_t update_time);
 	~TableManagerBuilder();
@@ -63,6 +93,7 @@ public:
 	bool addTableInfo(TableInfo *);
 	void addTableSplittingInfo(TableSplittingInfo *);
 	bool addRangeSplittingInfo(RangeSplittingInfo *);
+	size_t inheritTableInfos(TableManagerPtr baseTableManager, const std::set<TableInfoKey>& rebuiltTables);	//-- Call after addTableInfo().
 
 	TableManagerPtr build(TableManagerPtr oldTableManager = nullptr);
 };
@@ -2,13 +2,17 @@
 #define Task_Package_H
 
 #include "MySQLClient.h"
+#include "SQLParser.h"
 #include "FPMessage.h"
 #include "IQuestProcessor.h"
+#include "QoSController.h"
 
 using namespace fpnn;
 
 #define FPNN_DBPROXY_AGGREGATED_TASK_MUTEX_COUNT 64
 
+struct DatabaseTaskQueue;
+
 //========================================//
 //- Aggregated Task
 //========================================//
@@ -81,6 +85,48 @@ public:
 };
 typedef std::shared_ptr<AggregatedTask> AggregatedTaskPtr;
 
+//========================================//
+//- Multi-Query Task
+//========================================//
+class MultiQueryTask
+{
+	struct ItemResult
+	{
+		int code;
+		std::string error;
+		QueryResultPtr result;
+
+		ItemResult(): code(0) {}
+	};
+
+	std::mutex _mutex;
+	IAsyncAnswerPtr _asyncAnswer;
+	std::vector<ItemResult> _results;
+
+	void finish();
+
+public:
+	MultiQueryTask(IAsyncAnswerPtr asyncAnswer, size_t itemCount): _asyncAnswer(asyncAnswer), _results(itemCount) {}
+	~MultiQueryTask()
+	{
+		finish();
+	}
+
+	void fillResult(int index, QueryResultPtr result)
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_results[index].result = result;
+	}
+
+	void fillError(int index, int code, const std::string& error)
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_results[index].code = code;
+		_results[index].error = error;
+	}
+};
+typedef std::shared_ptr<MultiQueryTask> MultiQueryTaskPtr;
+
 //========================================//
 //- Task Package
 //========================================//
@@ -95,26 +141,54 @@ protected:
 	int _aggregatedTableHintId;
 	AggregatedTaskPtr _aggregatedTask;
 
+	int _multiQueryIndex;
+	MultiQueryTaskPtr _multiQueryTask;
+
+	int64_t _enqueuedTime;		//-- In monotonic milliseconds. Only setted when the sojourn monitor or the cluster bulkheads are enabled.
+	int _qosClass;
+	bool _retryPending;			//-- Enqueued again by the worker after processed.
+	bool _readQueued;			//-- Pushed into the read queue shared by the replicas.
+	std::string _session;		//-- Read-your-writes session. Empty means untracked.
+	int _masterServerId;		//-- The master of the enqueued database group, which the GTIDs of the session are recorded for.
+
 	static int _mySQLRepingInterval;
+
+	bool prepareConnection(MySQLClient *mySQL);
+	void recordGTID(MySQLClient *mySQL);		//-- After the writes are executed, and before answered.
 	
 public:
-	TaskPackage(const std::string& cluster, IAsyncAnswerPtr asyncAnswer): _processed(false), _cluster(cluster), _asyncAnswer(asyncAnswer) {}
+	TaskPackage(const std::string& cluster, IAsyncAnswerPtr asyncAnswer): _processed(false), _cluster(cluster), _asyncAnswer(asyncAnswer), _enqueuedTime(0), _qosClass(0), _retryPending(false), _readQueued(false), _masterServerId(0) {}
 	TaskPackage(int tableHintId, const std::string& cluster, AggregatedTaskPtr aggregatedTask): _processed(false),
-		_cluster(cluster), _aggregatedTableHintId(tableHintId), _aggregatedTask(aggregatedTask) {}
+		_cluster(cluster), _aggregatedTableHintId(tableHintId), _aggregatedTask(aggregatedTask), _enqueuedTime(0), _qosClass(0), _retryPending(false), _readQueued(false), _masterServerId(0) {}
+	TaskPackage(int queryIndex, const std::string& cluster, MultiQueryTaskPtr multiQueryTask): _processed(false),
+		_cluster(cluster), _multiQueryIndex(queryIndex), _multiQueryTask(multiQueryTask), _enqueuedTime(0), _qosClass(0), _retryPending(false), _readQueued(false), _masterServerId(0) {}
 	virtual ~TaskPackage();
 	
 	void setDatabaseName(const std::string& databaseName) { _databaseName = databaseName; }
 	const std::string& cluster() { return _cluster; }
+	inline const std::string& databaseName() { return _databaseName; }
+	inline void setEnqueuedTime(int64_t msec) { _enqueuedTime = msec; }
+	inline int64_t enqueuedTime() { return _enqueuedTime; }
+	inline void setQoSClass(int qosClass) { _qosClass = qosClass; }
+	inline int qosClass() { return _qosClass; }
+	inline bool retryPending() { return _retryPending; }
+	inline void setReadQueued(bool readQueued) { _readQueued = readQueued; }
+	inline bool readQueued() { return _readQueued; }
+	inline void setSession(const std::string& session) { _session = session; }
+	inline const std::string& session() { return _session; }
+	inline void setMasterServerId(int serverId) { _masterServerId = serverId; }
+	inline int masterServerId() { return _masterServerId; }
 	
 	//-- All finish functions are used under unaggregated mode.
 	void finish(const char* errInfo);
 	void finish(int code, const char* errInfo);
 	void finish(FPAnswerPtr answer);
+	void finish(QueryResultPtr result);		//-- For the result executed by others, such as group commit and multi-query.
 
 	virtual void processTask(MySQLClient *mySQL) throw () = 0;
 
 	static void setMySQLRepingInterval(int interval);
-	static bool setSuffix(const std::string& tableName, std::string& sql, const char* suffix); 
+	static bool setSuffix(const std::string& tableName, std::string& sql, const char* suffix, const SQLTemplate* sqlTemplate = NULL);
 };
 typedef std::shared_ptr<TaskPackage> TaskPackagePtr;
 
@@ -126,18 +200,66 @@ class QueryTask: public TaskPackage
 protected:
 	std::string _sql;
 	std::string _tableName;
+	SQLTemplatePtr _sqlTemplate;		//-- If setted, _sql is materialized from it when routing.
+
+	//-- Routing parameters, kept for routing the queued task again when the config is changed.
+	int64_t _hintId;
+	bool _master;
+	bool _routed;
+
+	//-- Read retry on connection lost.
+	DatabaseTaskQueue* _taskQueue;		//-- The enqueued queue. It is kept while the task is executed by its thread pools.
+	int _retries;
+
+	static int _readRetryLimit;			//-- 0 means disabled.
+	static int _readRetryDelayMsec;
+	static TokenBucketPtr _readRetryBudget;		//-- nullptr means unlimited.
+	static std::atomic<uint64_t> _readRetriedCount;
+	static std::atomic<uint64_t> _readRecoveredCount;
+	static std::atomic<uint64_t> _readRetryExhaustedCount;
+
+	bool retryRead(MySQLClient *mySQL);		//-- Returns true if the task will be enqueued again instead of finished.
+	bool fallBackToMaster(MySQLClient *mySQL);		//-- Returns true if the replica is behind the session, and the task will be enqueued to the master.
 
 public:
 	QueryTask(const std::string& sql, const std::string& table_name, const std::string& cluster, IAsyncAnswerPtr asyncAnswer):
-		TaskPackage(cluster, asyncAnswer), _sql(sql), _tableName(table_name) {}
+		TaskPackage(cluster, asyncAnswer), _sql(sql), _tableName(table_name), _hintId(0), _master(false), _routed(false), _taskQueue(NULL), _retries(0) {}
 	QueryTask(const std::string& sql, const std::string& table_name, const std::string& cluster, int tableHintId, AggregatedTaskPtr aggregatedTask):
-		TaskPackage(tableHintId, cluster, aggregatedTask), _sql(sql), _tableName(table_name) {}
+		TaskPackage(tableHintId, cluster, aggregatedTask), _sql(sql), _tableName(table_name), _hintId(0), _master(false), _routed(false), _taskQueue(NULL), _retries(0) {}
+	QueryTask(const std::string& sql, const std::string& table_name, const std::string& cluster, int queryIndex, MultiQueryTaskPtr multiQueryTask):
+		TaskPackage(queryIndex, cluster, multiQueryTask), _sql(sql), _tableName(table_name), _hintId(0), _master(false), _routed(false), _taskQueue(NULL), _retries(0) {}
+	QueryTask(SQLTemplatePtr sqlTemplate, const std::string& table_name, const std::string& cluster, int tableHintId, AggregatedTaskPtr aggregatedTask):
+		TaskPackage(tableHintId, cluster, aggregatedTask), _sql(), _tableName(table_name), _sqlTemplate(sqlTemplate),
+		_hintId(0), _master(false), _routed(false), _taskQueue(NULL), _retries(0) {}
 	virtual ~QueryTask() {}
 
 	inline std::string& tableName() { return _tableName; }
 	inline std::string& sql() { return _sql; }
+	inline SQLTemplatePtr& sqlTemplate() { return _sqlTemplate; }		//-- Filled by routing if a suffix is added to the plain sql.
 
+	inline int64_t hintId() { return _hintId; }
+	inline bool master() { return _master; }
+	inline void setRoute(int64_t hintId, bool master) { _hintId = hintId; _master = master; _routed = true; }
+	inline bool unroute()		//-- Restore the unrouted sql. Returns false if the task is not routed by TableManager::query().
+	{
+		if (!_routed)
+			return false;
+
+		if (_sqlTemplate)
+			_sql.clear();
+		return true;
+	}
+
+	inline void setTaskQueue(DatabaseTaskQueue* taskQueue) { _taskQueue = taskQueue; _retryPending = false; }
+	inline DatabaseTaskQueue* taskQueue() { return _taskQueue; }
+	int retryDelayMsec();		//-- Exponential backoff with full jitter.
+
+	virtual bool assemble(MySQLClient *) { return true; }
 	virtual void processTask(MySQLClient *mySQL) throw ();
+
+	static void configReadRetry(int maxRetries, int delayMsec, int budgetPerSecond);
+	static inline bool readRetryDelayed() { return _readRetryLimit > 0 && _readRetryDelayMsec > 0; }
+	static std::string readRetryStatusInJSON();
 };
 typedef std::shared_ptr<QueryTask> QueryTaskPtr;
 
@@ -146,17 +268,21 @@ typedef std::shared_ptr<QueryTask> QueryTaskPtr;
 //========================================//
 class ParamsQueryTask: public QueryTask
 {
+	bool _assembled;
 	std::vector<std::string> _params;
 
-	bool assemble(MySQLClient *);
-
 public:
 	ParamsQueryTask(const std::string& sql, const std::string& table_name, const std::string& cluster, std::vector<std::string>&& params, IAsyncAnswerPtr asyncAnswer):
-		QueryTask(sql, table_name, cluster, asyncAnswer), _params(std::move(params)) {} //{ _params.swap(params); }
+		QueryTask(sql, table_name, cluster, asyncAnswer), _assembled(false), _params(std::move(params)) {} //{ _params.swap(params); }
 	ParamsQueryTask(const std::string& sql, const std::string& table_name, const std::string& cluster, const std::vector<std::string>& params, int tableHintId, AggregatedTaskPtr aggregatedTask):
-		QueryTask(sql, table_name, cluster, tableHintId, aggregatedTask), _params(params) {}
+		QueryTask(sql, table_name, cluster, tableHintId, aggregatedTask), _assembled(false), _params(params) {}
+	ParamsQueryTask(SQLTemplatePtr sqlTemplate, const std::string& table_name, const std::string& cluster, const std::vector<std::string>& params, int tableHintId, AggregatedTaskPtr aggregatedTask):
+		QueryTask(sqlTemplate, table_name, cluster, tableHintId, aggregatedTask), _assembled(false), _params(params) {}
+	ParamsQueryTask(const std::string& sql, const std::string& table_name, const std::string& cluster, std::vector<std::string>&& params, int queryIndex, MultiQueryTaskPtr multiQueryTask):
+		QueryTask(sql, table_name, cluster, queryIndex, multiQueryTask), _assembled(false), _params(std::move(params)) {}
 	virtual ~ParamsQueryTask() {}
 
+	virtual bool assemble(MySQLClient *mySQL);		//-- Assembled only once, even if called more times.
 	virtual void processTask(MySQLClient *mySQL) throw ();
 
 	static bool preassemble(const std::string& sql, const std::vector<std::string>& params, std::string& semisql, std::vector<std::string>& restParams);
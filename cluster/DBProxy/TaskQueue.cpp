@@ -1,46 +1,281 @@
+#include <sstream>
+#include "MySQLClient.h"
 #include "TaskQueue.h"
 
+//=============================================//
+//-	Sojourn Monitor
+//=============================================//
+int64_t SojournMonitor::_targetMsec = 0;
+int64_t SojournMonitor::_interactiveTargetMsec = 0;
+int64_t SojournMonitor::_intervalMsec = 1000;
+std::atomic<uint64_t> SojournMonitor::_totalShedCount[QoSClassCount] = { {0}, {0}, {0} };
+
+void SojournMonitor::config(int targetMsec, int intervalMsec, int interactiveTargetMsec)
+{
+	_targetMsec = targetMsec > 0 ? targetMsec : 0;
+	_intervalMsec = intervalMsec > 0 ? intervalMsec : 1000;
+	_interactiveTargetMsec = (interactiveTargetMsec >= _targetMsec) ? interactiveTargetMsec : _targetMsec * 4;
+}
+
+void SojournMonitor::dequeued(const TaskPackagePtr& task, bool emptied)
+{
+	if (!enabled() || !task || task->enqueuedTime() == 0)
+		return;
+
+	int64_t now = slack_mono_msec();
+	int64_t sojourn = now - task->enqueuedTime();
+	if (emptied || sojourn < _targetMsec)
+	{
+		if (_aboveTime)
+			_aboveTime = 0;
+		if (_interactiveAboveTime)
+			_interactiveAboveTime = 0;
+		if (_overloadLevel)
+			_overloadLevel = 0;
+		return;
+	}
+
+	int level = 0;
+	int64_t aboveTime = _aboveTime;
+	if (aboveTime == 0)
+		_aboveTime.compare_exchange_strong(aboveTime, now);
+	else if (now - aboveTime >= _intervalMsec * 2)
+		level = 2;
+	else if (now - aboveTime >= _intervalMsec)
+		level = 1;
+
+	if (sojourn >= _interactiveTargetMsec)
+	{
+		int64_t interactiveAboveTime = _interactiveAboveTime;
+		if (interactiveAboveTime == 0)
+			_interactiveAboveTime.compare_exchange_strong(interactiveAboveTime, now);
+		else if (now - interactiveAboveTime >= _intervalMsec)
+			level = 3;
+	}
+	else if (_interactiveAboveTime)
+		_interactiveAboveTime = 0;
+
+	if (_overloadLevel != level)
+		_overloadLevel = level;
+}
+
+std::string SojournMonitor::statusInJSON()
+{
+	std::ostringstream oss;
+	oss<<"{\"enabled\":"<<(enabled() ? "true" : "false");
+	oss<<",\"targetMsec\":"<<_targetMsec;
+	oss<<",\"interactiveTargetMsec\":"<<_interactiveTargetMsec;
+	oss<<",\"intervalMsec\":"<<_intervalMsec;
+	oss<<",\"shedTasks\":"<<(_totalShedCount[QoSInteractive] + _totalShedCount[QoSBatch] + _totalShedCount[QoSBackground]);
+	oss<<",\"shedInteractive\":"<<_totalShedCount[QoSInteractive];
+	oss<<",\"shedBatch\":"<<_totalShedCount[QoSBatch];
+	oss<<",\"shedBackground\":"<<_totalShedCount[QoSBackground]<<"}";
+	return oss.str();
+}
+
 //=============================================//
 //-	Task Queue
 //=============================================//
-TaskPackagePtr TaskQueue::pop() throw ()
+std::atomic<uint32_t> TaskQueue::_weightBounds[QoSClassCount] = { {8}, {11}, {12} };
+size_t TaskQueue::_affinityWindow = 0;
+std::atomic<uint64_t> TaskQueue::_affinityHits(0);
+
+static inline bool popQueue(SafeQueue<TaskPackagePtr>& queue, TaskPackagePtr& task)
 {
-	TaskPackagePtr ret = nullptr;
+	if (queue.empty())
+		return false;
+
 	try
 	{
-		ret = _queue->pop();
+		task = queue.pop();
+		return true;
 	}
 	catch (const SafeQueue<TaskPackagePtr>::EmptyException &e)
 	{
+		return false;
 	}
-	return ret;
 }
 
-//=============================================//
-//-	Read/Write Task Queue
-//=============================================//
-RWTaskQueue::~RWTaskQueue()
+TaskQueue::~TaskQueue()
 {
-	_wqueue.clear();
-	_rqueue.clear();
+	for (int i = 0; i < QoSClassCount; i++)
+		_queues[i].clear();
 }
 
-TaskPackagePtr RWTaskQueue::pop() throw ()
+bool TaskQueue::empty()
 {
-	TaskPackagePtr ret;
-	try
+	if (_deferredCount)
+		return false;
+
+	for (int i = 0; i < QoSClassCount; i++)
+		if (!_queues[i].empty())
+			return false;
+
+	return true;
+}
+
+size_t TaskQueue::size()
+{
+	size_t count = _deferredCount;
+	for (int i = 0; i < QoSClassCount; i++)
+		count += _queues[i].size();
+
+	return count;
+}
+
+TaskPackagePtr TaskQueue::pop() throw ()
+{
+	TaskPackagePtr task = popDeferred(NULL);
+	if (!task)
+		task = popQueued();
+
+	return handOut(task);
+}
+
+//-- database: NULL for the oldest deferred task.
+TaskPackagePtr TaskQueue::popDeferred(const std::string* database)
+{
+	if (_deferredCount == 0)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lck (_deferredMutex);
+	for (auto iter = _deferredTasks.begin(); iter != _deferredTasks.end(); iter++)
 	{
-		ret = _wqueue.pop();
+		if (database && (*iter)->databaseName() != *database)
+			continue;
+
+		TaskPackagePtr task = *iter;
+		if (iter == _deferredTasks.begin())
+			_deferredPasses = 0;
+
+		_deferredTasks.erase(iter);
+		_deferredCount--;
+		return task;
 	}
-	catch (const SafeQueue<TaskPackagePtr>::EmptyException &e)
+	return nullptr;
+}
+
+TaskPackagePtr TaskQueue::pop(const std::string& database) throw ()
+{
+	if (_affinityWindow == 0 || database.empty() || _fifo)
+		return pop();
+
+	if (_deferredCount && ++_deferredPasses > _affinityWindow)
+		return pop();
+
+	TaskPackagePtr task = popDeferred(&database);
+	if (task)
 	{
-		try
-		{
-			ret = _rqueue.pop();
-		}
-		catch (const SafeQueue<TaskPackagePtr>::EmptyException &e)
+		_affinityHits++;
+		return handOut(task);
+	}
+
+	for (size_t i = 0; i < _affinityWindow; i++)
+	{
+		task = popQueued();
+		if (!task)
+			break;
+
+		if (task->databaseName() == database)
 		{
+			_affinityHits++;
+			return handOut(task);
 		}
+
+		std::lock_guard<std::mutex> lck (_deferredMutex);
+		_deferredTasks.push_back(task);
+		_deferredCount++;
+
+		if (_deferredTasks.size() >= _affinityWindow)
+			break;
+	}
+
+	return pop();
+}
+
+TaskPackagePtr TaskQueue::popQueued()
+{
+	if (_fifo)
+	{
+		TaskPackagePtr task;
+		popQueue(_queues[0], task);
+		return task;
+	}
+
+	uint32_t round = _round++ % _weightBounds[QoSClassCount - 1];
+	int selected = 0;
+	while (selected < QoSClassCount - 1 && round >= _weightBounds[selected])
+		selected += 1;
+
+	TaskPackagePtr task;
+	if (!popQueue(_queues[selected], task))
+	{
+		for (int i = 0; i < QoSClassCount; i++)
+			if (i != selected && popQueue(_queues[i], task))
+				break;
+	}
+
+	return task;
+}
+
+bool TaskQueue::setClassWeights(const std::vector<int>& weights)
+{
+	if (weights.size() != QoSClassCount)
+		return false;
+
+	for (int weight: weights)
+		if (weight <= 0)
+			return false;
+
+	uint32_t bound = 0;
+	for (int i = 0; i < QoSClassCount; i++)
+	{
+		bound += (uint32_t)weights[i];
+		_weightBounds[i] = bound;
+	}
+	return true;
+}
+
+std::string TaskQueue::affinityStatusInJSON()
+{
+	std::ostringstream oss;
+	oss<<"{\"window\":"<<_affinityWindow;
+	oss<<",\"hits\":"<<_affinityHits;
+	oss<<",\"selectDB\":"<<MySQLClient::selectDBCount()<<"}";
+	return oss.str();
+}
+
+std::string TaskQueue::classWeightsInJSON()
+{
+	std::ostringstream oss;
+	oss<<"[";
+	for (int i = 0; i < QoSClassCount; i++)
+	{
+		if (i)
+			oss<<",";
+		oss<<(_weightBounds[i] - (i ? _weightBounds[i - 1].load() : 0));
 	}
-	return ret;
+	oss<<"]";
+	return oss.str();
+}
+
+//=============================================//
+//-	Read/Write Task Queue
+//=============================================//
+TaskPackagePtr RWTaskQueue::pop() throw ()
+{
+	TaskPackagePtr task = _wqueue.pop();
+	if (!task)
+		task = _rqueue.pop();
+
+	return task;
+}
+
+TaskPackagePtr RWTaskQueue::pop(const std::string& database) throw ()
+{
+	TaskPackagePtr task = _wqueue.pop(database);
+	if (!task)
+		task = _rqueue.pop(database);
+
+	return task;
 }
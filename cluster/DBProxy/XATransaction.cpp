@@ -0,0 +1,732 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sstream>
+#include "FPLog.h"
+#include "msec.h"
+#include "jenkins.h"
+#include "DataRouterErrorInfo.h"
+#include "GTIDTracker.h"
+#include "XATransaction.h"
+
+using fpnn::FPAWriter;
+
+#define XA_RECOVERY_LOG_COMPACT_SIZE (4 * 1024 * 1024)
+#define XA_RECOVERY_RETRY_INTERVAL_SECONDS 60
+
+//========================================//
+//- XA Recovery Log
+//========================================//
+std::mutex XARecoveryLog::_mutex;
+int XARecoveryLog::_fd = -1;
+std::string XARecoveryLog::_path;
+size_t XARecoveryLog::_logSize = 0;
+std::map<std::string, std::set<std::string>> XARecoveryLog::_pendingCommits;
+
+bool XARecoveryLog::init(const std::string& path)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+	if (fd < 0)
+	{
+		LOG_ERROR("Open XA recovery log %s failed. errno: %d", path.c_str(), errno);
+		return false;
+	}
+
+	std::string content;
+	char buf[4096];
+	ssize_t readBytes;
+	while ((readBytes = read(fd, buf, sizeof(buf))) > 0)
+		content.append(buf, readBytes);
+
+	//-- line format: "C gtrid endpoint ...\n", "R gtrid endpoint\n", "D gtrid\n". Incomplete tail line is ignored.
+	size_t begin = 0;
+	size_t pos;
+	while ((pos = content.find('\n', begin)) != std::string::npos)
+	{
+		if (pos - begin > 2 && content[begin + 1] == ' ')
+		{
+			std::vector<std::string> fields;
+			for (size_t fieldBegin = begin + 2; fieldBegin < pos; )
+			{
+				size_t fieldEnd = content.find(' ', fieldBegin);
+				if (fieldEnd == std::string::npos || fieldEnd > pos)
+					fieldEnd = pos;
+
+				if (fieldEnd > fieldBegin)
+					fields.push_back(content.substr(fieldBegin, fieldEnd - fieldBegin));
+				fieldBegin = fieldEnd + 1;
+			}
+
+			if (fields.size() && content[begin] == 'C')
+				_pendingCommits[fields[0]].insert(fields.begin() + 1, fields.end());
+			else if (fields.size() && content[begin] == 'D')
+				_pendingCommits.erase(fields[0]);
+			else if (fields.size() == 2 && content[begin] == 'R')
+			{
+				auto iter = _pendingCommits.find(fields[0]);
+				if (iter != _pendingCommits.end())
+				{
+					iter->second.erase(fields[1]);
+					if (iter->second.empty())
+						_pendingCommits.erase(iter);
+				}
+			}
+		}
+		begin = pos + 1;
+	}
+
+	_fd = fd;
+	_path = path;
+	_logSize = content.length();
+
+	LOG_INFO("XA recovery log %s loaded. %d commit decisions are pending.", path.c_str(), (int)_pendingCommits.size());
+	return true;
+}
+
+bool XARecoveryLog::appendRecord(char type, const std::string& record, bool sync)
+{
+	std::string line;
+	line.reserve(record.length() + 3);
+	line.append(1, type).append(1, ' ').append(record).append(1, '\n');
+
+	size_t offset = 0;
+	while (offset < line.length())
+	{
+		ssize_t bytes = write(_fd, line.data() + offset, line.length() - offset);
+		if (bytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			LOG_ERROR("Write XA recovery log %s failed. errno: %d", _path.c_str(), errno);
+			return false;
+		}
+		offset += (size_t)bytes;
+	}
+	_logSize += line.length();
+
+	if (sync && fdatasync(_fd) != 0)
+	{
+		LOG_ERROR("Sync XA recovery log %s failed. errno: %d", _path.c_str(), errno);
+		return false;
+	}
+	return true;
+}
+
+bool XARecoveryLog::rewrite()
+{
+	std::string content;
+	for (auto& pending: _pendingCommits)
+	{
+		content.append("C ").append(pending.first);
+		for (auto& endpoint: pending.second)
+			content.append(1, ' ').append(endpoint);
+		content.append(1, '\n');
+	}
+
+	std::string tmpPath(_path);
+	tmpPath.append(".tmp");
+
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		LOG_ERROR("Create XA recovery log %s failed. errno: %d", tmpPath.c_str(), errno);
+		return false;
+	}
+
+	bool status = (write(fd, content.data(), content.length()) == (ssize_t)content.length()) && (fsync(fd) == 0);
+	close(fd);
+
+	if (!status || rename(tmpPath.c_str(), _path.c_str()) != 0)
+	{
+		LOG_ERROR("Compact XA recovery log %s failed. errno: %d", _path.c_str(), errno);
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	fd = open(_path.c_str(), O_RDWR | O_APPEND, 0600);
+	if (fd < 0)
+	{
+		LOG_FATAL("Reopen XA recovery log %s failed. errno: %d", _path.c_str(), errno);
+		return false;
+	}
+
+	close(_fd);
+	_fd = fd;
+	_logSize = content.length();
+	return true;
+}
+
+void XARecoveryLog::checkCompaction()
+{
+	if (_logSize > XA_RECOVERY_LOG_COMPACT_SIZE)
+		rewrite();
+}
+
+bool XARecoveryLog::logCommitDecision(const std::string& gtrid, const std::set<std::string>& endpoints)
+{
+	std::string record(gtrid);
+	for (auto& endpoint: endpoints)
+		record.append(1, ' ').append(endpoint);
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	if (!appendRecord('C', record, true))
+		return false;
+
+	_pendingCommits[gtrid] = endpoints;
+	return true;
+}
+
+void XARecoveryLog::logCompleted(const std::string& gtrid)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	if (!appendRecord('D', gtrid, false))
+		return;
+
+	_pendingCommits.erase(gtrid);
+	checkCompaction();
+}
+
+void XARecoveryLog::logResolved(const std::string& gtrid, const std::string& endpoint)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	auto iter = _pendingCommits.find(gtrid);
+	if (iter == _pendingCommits.end() || iter->second.find(endpoint) == iter->second.end())
+		return;
+
+	std::string record(gtrid);
+	record.append(1, ' ').append(endpoint);
+	if (!appendRecord('R', record, false))
+		return;
+
+	iter->second.erase(endpoint);
+	if (iter->second.empty())
+		_pendingCommits.erase(iter);
+
+	checkCompaction();
+}
+
+bool XARecoveryLog::committed(const std::string& gtrid)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	return _pendingCommits.find(gtrid) != _pendingCommits.end();
+}
+
+void XARecoveryLog::pendingCommits(const std::string& endpoint, std::vector<std::string>& gtrids)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	for (auto& pending: _pendingCommits)
+		if (pending.second.find(endpoint) != pending.second.end())
+			gtrids.push_back(pending.first);
+}
+
+size_t XARecoveryLog::compact(const std::string& currentBootPrefix)
+{
+	size_t unresolved = 0;
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	for (auto it = _pendingCommits.begin(); it != _pendingCommits.end(); )
+	{
+		if (it->first.compare(0, currentBootPrefix.length(), currentBootPrefix) == 0)
+			it++;
+		else if (it->second.empty())
+		{
+			//-- Logged by the older version without the endpoints. All the current masters are recovered.
+			it = _pendingCommits.erase(it);
+		}
+		else
+		{
+			LOG_WARN("XA commit decision %s is unresolved. Its branches are held by the instances which are not masters now.", it->first.c_str());
+			unresolved++;
+			it++;
+		}
+	}
+	rewrite();
+	return unresolved;
+}
+
+size_t XARecoveryLog::pendingCount()
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	return _pendingCommits.size();
+}
+
+//========================================//
+//- XA Transaction
+//========================================//
+std::string XATransaction::_instancePrefix;
+std::string XATransaction::_bootPrefix;
+std::atomic<uint64_t> XATransaction::_sequence(0);
+std::atomic<bool> XATransaction::_recoveryRequired(true);
+std::atomic<int64_t> XATransaction::_recoveryRetryTime(0);
+
+std::atomic<uint64_t> XATransaction::_committedCount(0);
+std::atomic<uint64_t> XATransaction::_rolledbackCount(0);
+std::atomic<uint64_t> XATransaction::_prepareUsecSum(0);
+std::atomic<uint64_t> XATransaction::_commitUsecSum(0);
+
+void XATransaction::config(const std::string& instanceId, const std::string& recoveryLogPath)
+{
+	if (recoveryLogPath.empty())
+	{
+		LOG_INFO("XA recovery log is unconfigured. XA transaction is disabled.");
+		return;
+	}
+
+	char hash[16];
+	snprintf(hash, sizeof(hash), "%08x", (uint32_t)jenkins_hash(instanceId.data(), instanceId.length(), 0));
+
+	//-- gtrid: dbpx.<instance hash>.<boot time>.<sequence>
+	_instancePrefix.assign("dbpx.").append(hash).append(".");
+	_bootPrefix = _instancePrefix;
+	_bootPrefix.append(std::to_string(time(NULL))).append(".");
+
+	if (!XARecoveryLog::init(recoveryLogPath))
+		LOG_ERROR("Init XA recovery log failed. XA transaction is disabled.");
+	else
+		LOG_INFO("XA transaction enabled. Instance id: %s, gtrid prefix: %s", instanceId.c_str(), _instancePrefix.c_str());
+}
+
+XATransaction::XATransaction(const std::string& cluster, IAsyncAnswerPtr asyncAnswer): _cluster(cluster), _asyncAnswer(asyncAnswer), _pendingCount(0),
+	_answered(false), _errorCode(0), _beginUsec(exact_mono_usec()), _prepareUsec(0), _commitFailed(false)
+{
+	_gtrid = _bootPrefix;
+	_gtrid.append(std::to_string(++_sequence));
+}
+
+XATransaction::~XATransaction()
+{
+	if (!_answered)
+		finish(ErrorInfo::internalErrorCode, "Please try again. DBMan is exiting or refreshing.");
+}
+
+void XATransaction::sendAnswer(FPAnswerPtr answer)
+{
+	if (_answered)
+		return;
+
+	_answered = true;
+	_asyncAnswer->sendAnswer(answer);
+}
+
+void XATransaction::finish(int code, const char* errInfo)
+{
+	sendAnswer(FPAWriter::errorAnswer(_asyncAnswer->getQuest(), code, errInfo, ErrorInfo::raiser_DataRouter));
+}
+
+void XATransaction::finish(int code, int sql_index, const char* reason)
+{
+	std::string ex;
+
+	ex.append("Excepted index: ").append(std::to_string(sql_index));
+	ex.append(" Excepted SQL: ").append(_sqls[sql_index]);
+	ex.append(". Reason: ").append(reason);
+
+	sendAnswer(FPAWriter::errorAnswer(_asyncAnswer->getQuest(), code, ex, ErrorInfo::raiser_DataRouter));
+}
+
+FPAnswerPtr XATransaction::successAnswer(int64_t endUsec)
+{
+	FPAWriter aw(3, _asyncAnswer->getQuest());
+	aw.param("xid", _gtrid);
+	aw.param("prepareMsec", (_prepareUsec - _beginUsec) / 1000);
+	aw.param("commitMsec", (endUsec - _prepareUsec) / 1000);
+	return aw.take();
+}
+
+void XATransaction::addStatement(DatabaseTaskQueuePtr taskQueue, const std::string& databaseName, int sqlIndex)
+{
+	size_t idx = 0;
+	for (; idx < _branches.size(); idx++)
+		if (_branches[idx].taskQueue.get() == taskQueue.get())
+			break;
+
+	if (idx == _branches.size())
+	{
+		_branches.push_back(Branch());
+		_branches.back().taskQueue = taskQueue;
+		_branches.back().endpoint.assign(taskQueue->masterDB->host).append(":").append(std::to_string(taskQueue->masterDB->port));
+	}
+
+	Branch& branch = _branches[idx];
+	branch.sqlIndexes.push_back(sqlIndex);
+	branch.databases.push_back(databaseName);
+	branch.sqls.push_back(_sqls[sqlIndex]);
+}
+
+void XATransaction::start()
+{
+	if (_branches.empty())
+	{
+		finish(ErrorInfo::disabledCode, "Invalid transaction.");
+		return;
+	}
+
+	_pendingCount = _branches.size();
+	bool onePhase = (_branches.size() == 1);
+
+	for (size_t i = 0; i < _branches.size(); i++)
+	{
+		Branch& branch = _branches[i];
+		TaskPackagePtr task = std::make_shared<XABranchTask>(shared_from_this(), i, XABranchTask::Prepare, &branch.databases, &branch.sqls, onePhase);
+
+		branch.taskQueue->queue.push(task, false);
+		branch.taskQueue->masterDB->wakeUp();
+	}
+}
+
+std::string XATransaction::branchXid(size_t branchIndex)
+{
+	std::string xid("'");
+	xid.append(_gtrid).append("','").append(std::to_string(branchIndex)).append("'");
+	return xid;
+}
+
+void XATransaction::branchPrepared(size_t branchIndex, int code, int failedIndex, const std::string& error)
+{
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		if (code == 0)
+			_branches[branchIndex].prepared = true;
+		else if (_errorCode == 0)
+		{
+			_errorCode = code;
+			if (failedIndex >= 0)
+			{
+				int sqlIndex = _branches[branchIndex].sqlIndexes[failedIndex];
+				_error.append("Excepted index: ").append(std::to_string(sqlIndex));
+				_error.append(" Excepted SQL: ").append(_sqls[sqlIndex]).append(". ");
+			}
+			_error.append(error);
+		}
+
+		_pendingCount -= 1;
+		if (_pendingCount)
+			return;
+	}
+
+	decide();
+}
+
+void XATransaction::decide()
+{
+	_prepareUsec = exact_mono_usec();
+
+	if (_errorCode == 0 && _branches.size() == 1)
+	{
+		//-- One phase committed.
+		_committedCount++;
+		_prepareUsecSum += (uint64_t)(_prepareUsec - _beginUsec);
+		recordSession();
+		sendAnswer(successAnswer(_prepareUsec));
+		return;
+	}
+
+	if (_errorCode == 0)
+	{
+		std::set<std::string> endpoints;
+		for (auto& branch: _branches)
+			endpoints.insert(branch.endpoint);
+
+		if (XARecoveryLog::logCommitDecision(_gtrid, endpoints))
+		{
+			dispatchPhaseTwo(true);
+			return;
+		}
+
+		_errorCode = ErrorInfo::internalErrorCode;
+		_error = "Write XA recovery log failed.";
+	}
+
+	_rolledbackCount++;
+	dispatchPhaseTwo(false);
+
+	const char* raiser = (_errorCode == ErrorInfo::MySQLExceptionCode) ? ErrorInfo::raiser_MySQL : ErrorInfo::raiser_DataRouter;
+	sendAnswer(FPAWriter::errorAnswer(_asyncAnswer->getQuest(), _errorCode, _error, raiser));
+}
+
+void XATransaction::dispatchPhaseTwo(bool commit)
+{
+	std::vector<size_t> targets;
+	for (size_t i = 0; i < _branches.size(); i++)
+		if (_branches[i].prepared)
+			targets.push_back(i);
+
+	if (targets.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_pendingCount = targets.size();
+	}
+
+	XABranchTask::Phase phase = commit ? XABranchTask::Commit : XABranchTask::Rollback;
+	for (size_t idx: targets)
+	{
+		TaskPackagePtr task = std::make_shared<XABranchTask>(shared_from_this(), idx, phase);
+
+		_branches[idx].taskQueue->queue.push(task, false);
+		_branches[idx].taskQueue->masterDB->wakeUp();
+	}
+}
+
+void XATransaction::branchCompleted(size_t branchIndex, bool commit, bool success)
+{
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		if (!success)
+		{
+			if (commit)
+				_commitFailed = true;
+			else
+				_recoveryRequired = true;	//-- Prepared branch rollback failed. Let recovery resolve it.
+		}
+
+		_pendingCount -= 1;
+		if (_pendingCount)
+			return;
+	}
+
+	if (commit)
+		completed();
+}
+
+void XATransaction::completed()
+{
+	int64_t endUsec = exact_mono_usec();
+
+	if (_commitFailed)
+	{
+		//-- Commit decision is logged. The failed branches will be committed by recovery.
+		LOG_ERROR("XA transaction %s committed partially. The remaining branches will be committed when recovering.", _gtrid.c_str());
+		_recoveryRequired = true;
+	}
+	else
+		XARecoveryLog::logCompleted(_gtrid);
+
+	_committedCount++;
+	_prepareUsecSum += (uint64_t)(_prepareUsec - _beginUsec);
+	_commitUsecSum += (uint64_t)(endUsec - _prepareUsec);
+
+	recordSession();
+	sendAnswer(successAnswer(endUsec));
+}
+
+//-- The GTIDs of the branches are not tracked. The following reads of the session go to the masters.
+void XATransaction::recordSession()
+{
+	if (_session.empty())
+		return;
+
+	for (auto& branch: _branches)
+		GTIDTracker::recordUntracked(_session, branch.taskQueue->masterDB->serverId);
+}
+
+void XATransaction::recover(TableManagerPtr tableManager)
+{
+	if (!enabled() || !tableManager || !_recoveryRequired)
+		return;
+
+	int64_t now = slack_mono_sec();
+	if (now < _recoveryRetryTime)
+		return;
+
+	if (!_recoveryRequired.exchange(false))
+		return;
+
+	_recoveryRetryTime = now + XA_RECOVERY_RETRY_INTERVAL_SECONDS;
+
+	std::vector<DatabaseTaskQueuePtr> queues;
+	tableManager->masterTaskQueues(queues);
+
+	if (queues.empty())
+	{
+		recoveryFinished(true);
+		return;
+	}
+
+	XARecoveryTask::RecoveryStatePtr state = std::make_shared<XARecoveryTask::RecoveryState>((int)queues.size());
+	for (auto& queue: queues)
+	{
+		std::string endpoint(queue->masterDB->host);
+		endpoint.append(":").append(std::to_string(queue->masterDB->port));
+
+		TaskPackagePtr task = std::make_shared<XARecoveryTask>(state, endpoint);
+		queue->queue.push(task, false);
+		queue->masterDB->wakeUp();
+	}
+}
+
+void XATransaction::recoveryFinished(bool success)
+{
+	if (success)
+	{
+		size_t unresolved = XARecoveryLog::compact(_bootPrefix);
+		if (unresolved == 0)
+			LOG_INFO("XA recovery finished.");
+		else
+		{
+			//-- Retry until the instances holding the branches are attached again.
+			_recoveryRequired = true;
+			LOG_ERROR("XA recovery finished with %d unresolved commit decisions. It will be retried %d seconds later.",
+				(int)unresolved, XA_RECOVERY_RETRY_INTERVAL_SECONDS);
+		}
+	}
+	else
+	{
+		_recoveryRequired = true;
+		LOG_ERROR("XA recovery incompleted. It will be retried %d seconds later.", XA_RECOVERY_RETRY_INTERVAL_SECONDS);
+	}
+}
+
+bool XATransaction::resolveInDoubt(MySQLClient *mySQL, const std::string& endpoint)
+{
+	//-- Taken before XA RECOVER: the branches of these decisions are prepared, and will be listed if not committed.
+	std::vector<std::string> pendings;
+	XARecoveryLog::pendingCommits(endpoint, pendings);
+
+	std::string error;
+	std::vector<std::pair<std::string, std::string>> xids;
+	if (!mySQL->xaRecover(xids, error))
+	{
+		LOG_ERROR("XA RECOVER failed. %s", error.c_str());
+		return false;
+	}
+
+	bool status = true;
+	for (auto& xidPair: xids)
+	{
+		const std::string& gtrid = xidPair.first;
+		if (gtrid.compare(0, _instancePrefix.length(), _instancePrefix) != 0)
+			continue;
+
+		bool commit = XARecoveryLog::committed(gtrid);
+
+		//-- Prepared branches of the current running process maybe still in progress.
+		if (!commit && gtrid.compare(0, _bootPrefix.length(), _bootPrefix) == 0)
+			continue;
+
+		std::string xid("'");
+		xid.append(gtrid).append("','").append(xidPair.second).append("'");
+
+		bool success = commit ? mySQL->xaCommit(xid, error) : mySQL->xaRollback(xid, error);
+		if (success)
+			LOG_INFO("Recover in-doubt XA branch %s: %s.", xid.c_str(), commit ? "committed" : "rolled back");
+		else
+		{
+			LOG_ERROR("Recover in-doubt XA branch %s failed. %s", xid.c_str(), error.c_str());
+			status = false;
+		}
+	}
+
+	if (status)
+		for (auto& gtrid: pendings)
+			XARecoveryLog::logResolved(gtrid, endpoint);
+
+	return status;
+}
+
+std::string XATransaction::statusInJSON()
+{
+	uint64_t committed = _committedCount;
+	uint64_t rolledback = _rolledbackCount;
+
+	std::ostringstream oss;
+	oss<<"{\"enabled\":"<<(enabled() ? "true" : "false");
+	oss<<",\"committed\":"<<committed;
+	oss<<",\"rolledback\":"<<rolledback;
+	oss<<",\"avgPrepareMsec\":"<<(committed ? _prepareUsecSum / committed / 1000 : 0);
+	oss<<",\"avgCommitMsec\":"<<(committed ? _commitUsecSum / committed / 1000 : 0);
+	oss<<",\"pendingCommitDecisions\":"<<(enabled() ? XARecoveryLog::pendingCount() : 0);
+	oss<<"}";
+
+	return oss.str();
+}
+
+//========================================//
+//- XA Branch Task
+//========================================//
+XABranchTask::~XABranchTask()
+{
+	if (_reported)
+		return;
+
+	if (_phase == Prepare)
+		report(ErrorInfo::internalErrorCode, -1, "Please try again. DBMan is exiting or refreshing.");
+	else
+		_transaction->branchCompleted(_branchIndex, _phase == Commit, false);
+}
+
+void XABranchTask::report(int code, int failedIndex, const std::string& error)
+{
+	_reported = true;
+	_transaction->branchPrepared(_branchIndex, code, failedIndex, error);
+}
+
+void XABranchTask::processTask(MySQLClient *mySQL) throw ()
+{
+	try
+	{
+		if (!prepareConnection(mySQL))
+		{
+			if (_phase == Prepare)
+				report(ErrorInfo::internalErrorCode, -1, "Database connection lost.");
+			return;
+		}
+
+		std::string error;
+		std::string xid = _transaction->branchXid(_branchIndex);
+
+		if (_phase == Prepare)
+		{
+			int failedIndex;
+			if (mySQL->xaPrepare(xid, *_databases, *_sqls, _onePhase, failedIndex, error))
+				report(0, -1, error);
+			else
+				report(ErrorInfo::MySQLExceptionCode, failedIndex, error);
+		}
+		else
+		{
+			bool commit = (_phase == Commit);
+			bool success = commit ? mySQL->xaCommit(xid, error) : mySQL->xaRollback(xid, error);
+			if (!success)
+				LOG_ERROR("XA %s %s failed. %s", commit ? "COMMIT" : "ROLLBACK", xid.c_str(), error.c_str());
+
+			_reported = true;
+			_transaction->branchCompleted(_branchIndex, commit, success);
+		}
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR("XA branch task exception: %s", e.what());
+	}
+}
+
+//========================================//
+//- XA Recovery Task
+//========================================//
+XARecoveryTask::~XARecoveryTask()
+{
+	if (!_success)
+		_state->success = false;
+
+	if (--(_state->pending) == 0)
+		XATransaction::recoveryFinished(_state->success);
+}
+
+void XARecoveryTask::processTask(MySQLClient *mySQL) throw ()
+{
+	try
+	{
+		if (prepareConnection(mySQL))
+			_success = XATransaction::resolveInDoubt(mySQL, _endpoint);
+		else
+			LOG_ERROR("XA recovery: database connection lost.");
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR("XA recovery task exception: %s", e.what());
+	}
+}
@@ -0,0 +1,187 @@
+#ifndef XA_Transaction_H
+#define XA_Transaction_H
+
+#include <set>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include "TableManager.h"
+
+//========================================//
+//- XA Recovery Log
+//========================================//
+/*
+	Presumed abort: only the commit decisions are logged (and fsynced) before phase two.
+	Prepared branches which are not logged as committed, will be rolled back when recovering.
+
+	A commit decision records the MySQL instances of the branches. It is kept, across restarts,
+	until each instance is recovered or the transaction is completed.
+*/
+class XARecoveryLog
+{
+	static std::mutex _mutex;
+	static int _fd;
+	static std::string _path;
+	static size_t _logSize;
+	static std::map<std::string, std::set<std::string>> _pendingCommits;		//-- gtrid => endpoints of the unconfirmed branches.
+
+	static bool appendRecord(char type, const std::string& record, bool sync);
+	static bool rewrite();
+	static void checkCompaction();
+
+public:
+	static bool init(const std::string& path);
+	static inline bool enabled() { return _fd >= 0; }
+
+	static bool logCommitDecision(const std::string& gtrid, const std::set<std::string>& endpoints);
+	static void logCompleted(const std::string& gtrid);
+	static void logResolved(const std::string& gtrid, const std::string& endpoint);
+	static bool committed(const std::string& gtrid);
+	static void pendingCommits(const std::string& endpoint, std::vector<std::string>& gtrids);
+	//-- Returns the count of the commit decisions of the previous boots, which are still unresolved.
+	static size_t compact(const std::string& currentBootPrefix);
+	static size_t pendingCount();
+};
+
+//========================================//
+//- XA Transaction
+//========================================//
+class XATransaction: public std::enable_shared_from_this<XATransaction>
+{
+	struct Branch
+	{
+		DatabaseTaskQueuePtr taskQueue;
+		std::string endpoint;
+		std::vector<int> sqlIndexes;
+		std::vector<std::string> databases;
+		std::vector<std::string> sqls;
+		bool prepared;
+
+		Branch(): prepared(false) {}
+	};
+
+	std::mutex _mutex;
+	std::string _cluster;
+	IAsyncAnswerPtr _asyncAnswer;
+	std::string _session;		//-- Read-your-writes session.
+	std::string _gtrid;
+	std::vector<Branch> _branches;
+	size_t _pendingCount;
+	bool _answered;
+
+	int _errorCode;
+	std::string _error;
+
+	int64_t _beginUsec;
+	int64_t _prepareUsec;
+	bool _commitFailed;
+
+	static std::string _instancePrefix;
+	static std::string _bootPrefix;
+	static std::atomic<uint64_t> _sequence;
+	static std::atomic<bool> _recoveryRequired;
+	static std::atomic<int64_t> _recoveryRetryTime;
+
+	static std::atomic<uint64_t> _committedCount;
+	static std::atomic<uint64_t> _rolledbackCount;
+	static std::atomic<uint64_t> _prepareUsecSum;
+	static std::atomic<uint64_t> _commitUsecSum;
+
+	void sendAnswer(FPAnswerPtr answer);
+	FPAnswerPtr successAnswer(int64_t endUsec);
+	void decide();
+	void dispatchPhaseTwo(bool commit);
+	void completed();
+	void recordSession();
+
+public:
+	std::vector<int64_t> _hintIds;
+	std::vector<std::string> _tableNames;
+	std::vector<std::string> _sqls;
+
+	XATransaction(const std::string& cluster, IAsyncAnswerPtr asyncAnswer);
+	~XATransaction();
+
+	const std::string& cluster() { return _cluster; }
+
+	void finish(int code, const char* errInfo);
+	void finish(int code, int sql_index, const char* reason);
+	inline void setSession(const std::string& session) { _session = session; }
+
+	void addStatement(DatabaseTaskQueuePtr taskQueue, const std::string& databaseName, int sqlIndex);
+	void start();
+
+	std::string branchXid(size_t branchIndex);
+	void branchPrepared(size_t branchIndex, int code, int failedIndex, const std::string& error);
+	void branchCompleted(size_t branchIndex, bool commit, bool success);
+
+	static void config(const std::string& instanceId, const std::string& recoveryLogPath);
+	static inline bool enabled() { return XARecoveryLog::enabled(); }
+	static void recover(TableManagerPtr tableManager);
+	static void recoveryFinished(bool success);
+	static bool resolveInDoubt(MySQLClient *mySQL, const std::string& endpoint);
+	static std::string statusInJSON();
+};
+typedef std::shared_ptr<XATransaction> XATransactionPtr;
+
+//========================================//
+//- XA Branch Task
+//========================================//
+class XABranchTask: public TaskPackage
+{
+public:
+	enum Phase
+	{
+		Prepare,
+		Commit,
+		Rollback,
+	};
+
+private:
+	enum Phase _phase;
+	size_t _branchIndex;
+	bool _onePhase;
+	bool _reported;
+	XATransactionPtr _transaction;
+	const std::vector<std::string>* _databases;
+	const std::vector<std::string>* _sqls;
+
+public:
+	XABranchTask(XATransactionPtr transaction, size_t branchIndex, enum Phase phase,
+		const std::vector<std::string>* databases = NULL, const std::vector<std::string>* sqls = NULL, bool onePhase = false):
+		TaskPackage(transaction->cluster(), nullptr), _phase(phase), _branchIndex(branchIndex), _onePhase(onePhase), _reported(false),
+		_transaction(transaction), _databases(databases), _sqls(sqls) {}
+	virtual ~XABranchTask();
+
+	void report(int code, int failedIndex, const std::string& error);
+	virtual void processTask(MySQLClient *mySQL) throw ();
+};
+
+//========================================//
+//- XA Recovery Task
+//========================================//
+class XARecoveryTask: public TaskPackage
+{
+public:
+	struct RecoveryState
+	{
+		std::atomic<int> pending;
+		std::atomic<bool> success;
+
+		RecoveryState(int count): pending(count), success(true) {}
+	};
+	typedef std::shared_ptr<RecoveryState> RecoveryStatePtr;
+
+private:
+	RecoveryStatePtr _state;
+	std::string _endpoint;
+	bool _success;
+
+public:
+	XARecoveryTask(RecoveryStatePtr state, const std::string& endpoint): TaskPackage(std::string(), nullptr), _state(state), _endpoint(endpoint), _success(false) {}
+	virtual ~XARecoveryTask();
+
+	virtual void processTask(MySQLClient *mySQL) throw ();
+};
+
+#endif
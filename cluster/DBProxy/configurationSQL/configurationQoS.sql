@@ -0,0 +1,19 @@
+----------------------------------
+-- Rate limits and QoS classes
+-- Reloaded with the table config when "DBProxy config data update" in variable_setting is changed.
+----------------------------------
+
+use dbproxy_config;
+
+CREATE TABLE IF NOT EXISTS qos_rule (
+	id int unsigned not null primary key auto_increment,
+	rule_type tinyint not null,				-- 0: client address, 1: table name.
+	target varchar(255) not null,
+	rate int unsigned not null default 0,	-- Requests per second. 0 means unlimited.
+	burst int unsigned not null default 0,	-- 0 means same as rate.
+	qos_class tinyint not null default 0,	-- 0: interactive, 1: batch, 2: background.
+	unique key (rule_type, target)
+)ENGINE=InnoDB DEFAULT CHARSET=utf8;
+
+-- Scheduling weights of the interactive, batch and background classes.
+INSERT INTO variable_setting (name, value) VALUES ("QoS class weights", "8,3,1");
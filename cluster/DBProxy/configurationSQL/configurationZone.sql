@@ -0,0 +1,9 @@
+----------------------------------
+-- Zones of the MySQL instances
+-- Loaded only when DBProxy.zone is configured.
+----------------------------------
+
+use dbproxy_config;
+
+-- Empty zone means the instance is treated as in the same zone of every DBProxy.
+ALTER TABLE server_info ADD COLUMN zone varchar(64) not null default '';
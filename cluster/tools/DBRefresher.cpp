@@ -1,43 +1,140 @@
 #include <iostream>
+#include <fstream>
+#include <vector>
 #include <string.h>
 #include <stdlib.h>
 #include "ignoreSignals.h"
 #include "TCPClient.h"
+#include "FPZKClient.h"
 
 using namespace fpnn;
 
-void refresh(const char *endpoint)
+bool refresh(const std::string& endpoint, int64_t updateTime)
 {
-	const char* colon = strchr(endpoint, ':');
-	if (!colon)
+	size_t colon = endpoint.find_last_of(':');
+	if (colon == std::string::npos)
 	{
 		std::cout<<"  invalid endpoint "<<endpoint<<std::endl;
-		return;
+		return false;
 	}
-	std::string host(endpoint, colon - endpoint);
-	int port = atoi(colon + 1);
+	std::string host = endpoint.substr(0, colon);
+	int port = atoi(endpoint.c_str() + colon + 1);
 
 	std::shared_ptr<TCPClient> client = TCPClient::createClient(host, port);
-	FPQuestPtr quest = FPQWriter::emptyQuest("refresh");
+	FPQuestPtr quest;
+	if (updateTime > 0)
+	{
+		FPQWriter qw(1, "refresh");
+		qw.param("updateTime", updateTime);
+		quest = qw.take();
+	}
+	else
+		quest = FPQWriter::emptyQuest("refresh");
+
 	FPAnswerPtr answer = client->sendQuest(quest);
 	if (answer->status())
-		std::cout<<"Refresh error!"<<std::endl;
-	else
-		std::cout<<"Refresh finished."<<std::endl;
+	{
+		std::cout<<"["<<endpoint<<"] Refresh error!"<<std::endl;
+		return false;
+	}
+
+	std::cout<<"["<<endpoint<<"] Refresh finished."<<std::endl;
+	return true;
+}
+
+bool loadEndpointsFile(const char* path, std::vector<std::string>& endpoints)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cout<<"Open endpoints file "<<path<<" failed."<<std::endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t begin = line.find_first_not_of(" \t\r");
+		if (begin == std::string::npos || line[begin] == '#')
+			continue;
+
+		size_t end = line.find_last_not_of(" \t\r");
+		endpoints.push_back(line.substr(begin, end - begin + 1));
+	}
+	return true;
+}
+
+void usage(const char* program)
+{
+	std::cout<<"Usage: "<<std::endl;
+	std::cout<<"\t"<<program<<" [-t updateTime] host:port ..."<<std::endl;
+	std::cout<<"\t"<<program<<" [-t updateTime] -f endpoints_file"<<std::endl;
+	std::cout<<"\t"<<program<<" [-t updateTime] -z fpzk_server_list project_name project_token service_name"<<std::endl;
+	std::cout<<std::endl;
+	std::cout<<"\tupdateTime: the changed value of 'DBProxy config data update' in variable_setting."<<std::endl;
+	std::cout<<"\t\tThe DBProxy which loaded it ignores the notification. Without it, the DBProxies always reload."<<std::endl;
+	std::cout<<"\tendpoints_file: one host:port per line."<<std::endl;
 }
 
 int main(int argc, const char* argv[])
 {
-	if (argc < 2)
+	int64_t updateTime = 0;
+	int argIdx = 1;
+
+	if (argc > 2 && strcmp(argv[argIdx], "-t") == 0)
+	{
+		updateTime = atoll(argv[argIdx + 1]);
+		argIdx += 2;
+	}
+
+	if (argIdx >= argc)
 	{
-		std::cout<<"Usage: "<<std::endl;
-		std::cout<<"\t"<<argv[0]<<" host:port ..."<<std::endl;
+		usage(argv[0]);
 		return 0;
 	}
 
 	ignoreSignals();
-	for (int i = 1; i < argc; i++)
-		refresh(argv[i]);
 
-	return 0;
+	std::vector<std::string> endpoints;
+	if (strcmp(argv[argIdx], "-f") == 0)
+	{
+		if (argIdx + 2 != argc)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+
+		if (!loadEndpointsFile(argv[argIdx + 1], endpoints))
+			return 1;
+	}
+	else if (strcmp(argv[argIdx], "-z") == 0)
+	{
+		if (argIdx + 5 != argc)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+
+		FPZKClientPtr fpzk = FPZKClient::create(argv[argIdx + 1], argv[argIdx + 2], argv[argIdx + 3]);
+		endpoints = fpzk->getServiceEndpoints(argv[argIdx + 4]);
+	}
+	else
+	{
+		for (int i = argIdx; i < argc; i++)
+			endpoints.push_back(argv[i]);
+	}
+
+	if (endpoints.empty())
+	{
+		std::cout<<"No DBProxy found."<<std::endl;
+		return 1;
+	}
+
+	size_t failed = 0;
+	for (size_t i = 0; i < endpoints.size(); i++)
+		if (!refresh(endpoints[i], updateTime))
+			failed += 1;
+
+	std::cout<<"Notified "<<(endpoints.size() - failed)<<" of "<<endpoints.size()<<" DBProxies."<<std::endl;
+	return failed ? 1 : 0;
 }
@@ -1,4 +1,9 @@
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <string.h>
 #include "hex.h"
+#include "msec.h"
 #include "sha256.h"
 #include "Setting.h"
 #include "FPLog.h"
@@ -8,6 +13,13 @@
 #include "AutoRelease.h"
 #include "ConfigMonitor.h"
 #include "TaskPackage.h"
+#include "XATransaction.h"
+#include "AsyncWriteSpool.h"
+#include "SQLStatementCache.h"
+#include "SharedWorkerPool.h"
+#include "HealthChecker.h"
+#include "QoSController.h"
+#include "GTIDTracker.h"
 
 FPNN_(FpnnLogicError, InvalidConfigError)
 
@@ -53,7 +65,104 @@ bool ConfigMonitor::ConfuseDecryptor::decrypt(std::string& user, std::string& pa
 	return true;
 }
 
-ConfigMonitor::ConfigMonitor(const std::string& project): _needRefresh(false), _willExit(false)
+//========================================//
+//- Table Manager Snapshot
+//========================================//
+struct ReaderSlotHolder
+{
+	int index;		//-- -1: unassigned.
+	ReaderSlotHolder(): index(-1) {}
+	~ReaderSlotHolder();
+};
+
+static std::mutex _readerSlotMutex;
+static std::vector<int> _freeReaderSlots;
+static int _usedReaderSlotCount = 0;
+static thread_local ReaderSlotHolder _readerSlotHolder;
+
+ReaderSlotHolder::~ReaderSlotHolder()
+{
+	if (index >= 0)
+	{
+		std::lock_guard<std::mutex> lck (_readerSlotMutex);
+		_freeReaderSlots.push_back(index);
+	}
+}
+
+TableManagerSnapshot::TableManagerSnapshot(TableManagerSnapshot&& r): _tableManager(r._tableManager),
+	_readerEpoch(r._readerEpoch), _sharedTableManager(std::move(r._sharedTableManager))
+{
+	r._tableManager = NULL;
+	r._readerEpoch = NULL;
+}
+
+TableManagerSnapshot::~TableManagerSnapshot()
+{
+	if (_readerEpoch)
+		_readerEpoch->store(0, std::memory_order_release);
+}
+
+std::atomic<uint64_t> ConfigMonitor::_epoch(1);
+ConfigMonitor::ReaderSlot ConfigMonitor::_readerSlots[FPNN_DBPROXY_TABLE_MANAGER_READER_SLOTS];
+
+ConfigMonitor::ReaderSlot* ConfigMonitor::readerSlot()
+{
+	if (_readerSlotHolder.index < 0)
+	{
+		std::lock_guard<std::mutex> lck (_readerSlotMutex);
+		if (!_freeReaderSlots.empty())
+		{
+			_readerSlotHolder.index = _freeReaderSlots.back();
+			_freeReaderSlots.pop_back();
+		}
+		else if (_usedReaderSlotCount < FPNN_DBPROXY_TABLE_MANAGER_READER_SLOTS)
+			_readerSlotHolder.index = _usedReaderSlotCount++;
+		else
+			return NULL;
+	}
+	return &_readerSlots[_readerSlotHolder.index];
+}
+
+uint64_t ConfigMonitor::minReaderEpoch()
+{
+	uint64_t minEpoch = UINT64_MAX;
+	for (int i = 0; i < FPNN_DBPROXY_TABLE_MANAGER_READER_SLOTS; i++)
+	{
+		uint64_t epoch = _readerSlots[i].epoch.load();
+		if (epoch && epoch < minEpoch)
+			minEpoch = epoch;
+	}
+	return minEpoch;
+}
+
+TableManagerSnapshot ConfigMonitor::getTableManager()
+{
+	TableManagerSnapshot snapshot;
+	ReaderSlot* slot = readerSlot();
+	if (slot == NULL)
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		snapshot._sharedTableManager = _tableManager;
+		snapshot._tableManager = _tableManager.get();
+		return snapshot;
+	}
+
+	//-- Nested snapshots are protected by the outermost one, and must not outlive it.
+	if (slot->epoch.load(std::memory_order_relaxed) == 0)
+	{
+		slot->epoch.store(_epoch.load());
+		snapshot._readerEpoch = &(slot->epoch);
+	}
+
+	snapshot._tableManager = _currentTableManager.load();
+	return snapshot;
+}
+
+//========================================//
+//- Config Monitor
+//========================================//
+ConfigMonitor::ConfigMonitor(const std::string& project): _currentTableManager(NULL), _needRefresh(false),
+	_refreshSeq(0), _notifiedUpdateTime(0), _configCacheReady(false), _changeLogExpiredId(0), _qosRulesLoaded(false), _willExit(false)
 {
 	std::string hosts = Setting::getString("DBProxy.ConfigureDB.host");
 
@@ -65,6 +174,11 @@ ConfigMonitor::ConfigMonitor(const std::string& project): _needRefresh(false), _
 	_cfgDBInfo.password = Setting::getString("DBProxy.ConfigureDB.password");
 	_cfgDBInfo.checkInterval = Setting::getInt("DBProxy.ConfigureDB.checkInterval", 900);
 	_cfgDBInfo.enableConfuse = Setting::getBool("DBProxy.ConfigureDB.enableConfuse", false);
+	_cfgDBInfo.enableChangeLog = Setting::getBool("DBProxy.ConfigureDB.changeLog.enable", false);
+	_cfgDBInfo.fullReloadInterval = Setting::getInt("DBProxy.ConfigureDB.changeLog.fullReloadInterval", 86400);
+	_cfgDBInfo.changeLogGapTimeout = Setting::getInt("DBProxy.ConfigureDB.changeLog.gapTimeout", 300);
+	_cfgDBInfo.snapshotFile = Setting::getString("DBProxy.ConfigureDB.snapshotFile");
+	_cfgDBInfo.notifyFile = Setting::getString("DBProxy.ConfigureDB.notifyFile");
 	
 	int perThreadPoolInitCount = Setting::getInt("DBProxy.perThreadPool.InitThreadCount", 10);
 	int perThreadPoolAppendCount = Setting::getInt("DBProxy.perThreadPool.AppendThreadCount", 5);
@@ -78,27 +192,102 @@ ConfigMonitor::ConfigMonitor(const std::string& project): _needRefresh(false), _
 
 	MySQLClient::setDefaultConnectionCharacterSetName(Setting::getString("DBProxy.connection.characterSet.name", "utf8"));
 
+	std::string xaInstanceId = Setting::getString("DBProxy.XA.instanceId");
+	if (xaInstanceId.empty())
+	{
+		char hostname[256] = {0};
+		gethostname(hostname, sizeof(hostname) - 1);
+		xaInstanceId.assign(hostname).append(":").append(Setting::getString("FPNN.server.listening.port"));
+	}
+	XATransaction::config(xaInstanceId, Setting::getString("DBProxy.XA.recoveryLog"));
+
+	GroupCommitCollector::config(Setting::getString("DBProxy.groupCommit.tables"), Setting::getString("DBProxy.counterCombining.tables"),
+		Setting::getInt("DBProxy.groupCommit.windowMsec", 2), Setting::getInt("DBProxy.groupCommit.maxSize", 32));
+
+	SQLStatementCache::config(Setting::getInt("DBProxy.SQLCache.capacity", 4096));
+
+	if (Setting::getBool("DBProxy.admission.enable", false))
+		SojournMonitor::config(Setting::getInt("DBProxy.admission.targetMsec", 100), Setting::getInt("DBProxy.admission.intervalMsec", 1000),
+			Setting::getInt("DBProxy.admission.interactiveTargetMsec", 0));
+
+	TaskQueue::configAffinity(Setting::getInt("DBProxy.databaseAffinity.window", 0));
+
+	QueryTask::configReadRetry(Setting::getInt("DBProxy.readRetry.maxRetries", 0), Setting::getInt("DBProxy.readRetry.delayMsec", 20),
+		Setting::getInt("DBProxy.readRetry.budgetPerSecond", 100));
+
+	if (Setting::getBool("DBProxy.readYourWrites.enable", false))
+		GTIDTracker::config(Setting::getInt("DBProxy.readYourWrites.waitTimeoutMsec", 50),
+			Setting::getInt("DBProxy.readYourWrites.sessionTTLSeconds", 60));
+
+	std::string spoolDirectory = Setting::getString("DBProxy.asyncWrite.spoolDirectory");
+	if (spoolDirectory.length() && !AsyncWriteSpool::config(spoolDirectory, Setting::getBool("DBProxy.asyncWrite.fsync", false),
+		Setting::getInt("DBProxy.asyncWrite.segmentSizeMB", 64), Setting::getInt("DBProxy.asyncWrite.maxSpoolSizeMB", 1024),
+		Setting::getInt("DBProxy.asyncWrite.batchSize", 256)))
+	{
+		LOG_FATAL("Init async write spool %s failed.", spoolDirectory.c_str());
+		exit(1);
+	}
+
 	LOG_INFO("INFO: Load %d hosts", _cfgDBInfo.hosts.size());
 	if (_cfgDBInfo.hosts.size() == 0)
 		exit(1);
 
 	TaskPackage::setMySQLRepingInterval(mySQLPingInterval);
 	TableManager::config(perThreadPoolReadQueueMaxLength, perThreadPoolWriteQueueMaxLength);
+
+	std::string zone = Setting::getString("DBProxy.zone");
+	if (zone.length())
+		ConfigurationCache::enableServerZone();		//-- server_info must have the zone column.
+	TableManager::configZone(zone, Setting::getInt("DBProxy.zone.spillQueueLength", 100));
+
 	TableManagerBuilder::config(perThreadPoolInitCount, perThreadPoolAppendCount, perThreadPoolPerfectCount, perThreadPoolMaxCount, perThreadPoolTempThreadLatencySeconds);
+	TableManagerBuilder::configWarmUp(Setting::getInt("DBProxy.warmUp.connectionsPerInstance", 0),
+		Setting::getInt("DBProxy.warmUp.threadCount", 32), Setting::getInt("DBProxy.warmUp.slowMsec", 1000));
 		
 	MySQLClient::MySQLClientInit();
 	
+	if (Setting::getBool("DBProxy.healthCheck.enable", false))
+		HealthChecker::config(Setting::getInt("DBProxy.healthCheck.interval", 3),
+			Setting::getInt("DBProxy.healthCheck.failureThreshold", 3), Setting::getInt("DBProxy.healthCheck.connectTimeout", 2),
+			Setting::getInt("DBProxy.healthCheck.probeThreads", 8));
+
+	if (Setting::getBool("DBProxy.sharedWorkerPool.enable", false))
+		SharedWorkerPool::start(Setting::getInt("DBProxy.sharedWorkerPool.threadCount", 64),
+			Setting::getInt("DBProxy.sharedWorkerPool.maxConnectionsPerInstance", 0));
+
+	if (_cfgDBInfo.snapshotFile.length())
+		loadConfigurationSnapshot();
+	
+	//-- The existing notify file is not a notification.
+	memset(&_notifyFileStat, 0, sizeof(_notifyFileStat));
+	if (_cfgDBInfo.notifyFile.length())
+		stat(_cfgDBInfo.notifyFile.c_str(), &_notifyFileStat);
+	
 	_monitor = std::thread(&ConfigMonitor::monitor_thread, this);
+	HealthChecker::start();
+	GroupCommitCollector::start();
+	TableManager::startRetryTimer();
+	AsyncWriteSpool::start([this]() { return getSharedTableManager(); });
 }
 
 ConfigMonitor::~ConfigMonitor()
 {
-	_willExit = true;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_willExit = true;
+		_refreshCondition.notify_one();
+	}
 	_monitor.join();
+	AsyncWriteSpool::stop();
+	GroupCommitCollector::stop();
+	TableManager::stopRetryTimer();
 
+	_currentTableManager.store(NULL);
 	_recycledTableManagers.clear();
 	_tableManager.reset();
 
+	SharedWorkerPool::stop();
+	HealthChecker::stop();
 	MySQLClient::MySQLClientEnd();
 }
 
@@ -107,34 +296,76 @@ void ConfigMonitor::recycleTableManagers()
 	if (_recycledTableManagers.empty())
 		return;
 		
-	std::list<TableManagerPtr> tmpList;
-	while (!_recycledTableManagers.empty())
-	{
-		TableManagerPtr tmp = _recycledTableManagers.front();
-		_recycledTableManagers.pop_front();
+	//-- The tasks queued by the readers pinned before the retirement.
+	TableManagerPtr currentTableManager = getSharedTableManager();
+	for (auto& recycled: _recycledTableManagers)
+		migrateQueuedTasks(recycled.tableManager.get(), currentTableManager.get());
+
+	//-- The readers pinned after the retirement cannot get the recycled ones.
+	uint64_t minEpoch = minReaderEpoch();
 		
-		if (!tmp->deletable())
-			tmpList.push_back(tmp);
+	std::list<RecycledTableManager> releasedList;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		for (auto iter = _recycledTableManagers.begin(); iter != _recycledTableManagers.end(); )
+		{
+			auto curr = iter++;
+			if (curr->retiredEpoch < minEpoch && curr->tableManager->deletable())
+				releasedList.splice(releasedList.end(), _recycledTableManagers, curr);
+		}
 	}
-	_recycledTableManagers.swap(tmpList);
 }
 
-bool ConfigMonitor::fetchDBConfiguration_DatabaseInfo(MySQLClient *mySQL, TableManagerBuilder& builder)
+void ConfigMonitor::migrateQueuedTasks(TableManager* retiredTableManager, TableManager* currentTableManager)
 {
-	ConfuseDecryptor* decrypt = NULL;
-	if (_cfgDBInfo.enableConfuse)
-		decrypt = new ConfuseDecryptor(_cfgDBInfo.username, _cfgDBInfo.password);
+	size_t migratedCount = 0;
+	size_t vanishedCount = 0;
 
-	AutoDeleteGuard<ConfuseDecryptor> adg(decrypt);
+	retiredTableManager->migrateQueuedTasks(*currentTableManager, migratedCount, vanishedCount);
+	if (migratedCount == 0 && vanishedCount == 0)
+		return;
 
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_reloadStatus.migratedTasks += migratedCount;
+		_reloadStatus.vanishedTasks += vanishedCount;
+	}
+
+	LOG_INFO("Migrate queued tasks to new table config. Migrated: %llu, failed for targets removed: %llu.",
+		(unsigned long long)migratedCount, (unsigned long long)vanishedCount);
+}
+
+bool ConfigMonitor::fetchConfigurationRows(MySQLClient *mySQL, ConfigurationCache::TableType type, int64_t lastId,
+	const std::vector<int64_t>* ids, std::set<TableInfoKey>* affectedTables, size_t* fetchedRows)
+{
+	//-- Rows are fetched by pages after lastId, or by batches of ids when ids is not NULL.
 	const size_t limit = 10000;
-	int lastDBid = 0;
+	const size_t batchSize = 1000;
+	size_t idPos = 0;
+
+	if (ids && ids->empty())
+		return true;
+
 	while (true)
 	{
 		std::ostringstream oss;
-		oss<<"select server_id, master_sid, host, port, user, passwd, timeout, default_database_name from server_info";
-		oss<<" where server_id > "<<lastDBid<<" order by server_id asc limit "<<limit;
-		
+		oss<<"select "<<ConfigurationCache::fields(type)<<" from "<<ConfigurationCache::tableName(type)<<" where "<<ConfigurationCache::keyField(type);
+		if (ids)
+		{
+			size_t end = std::min(idPos + batchSize, ids->size());
+			oss<<" in (";
+			for (size_t i = idPos; i < end; i++)
+			{
+				if (i > idPos)
+					oss<<",";
+				oss<<(*ids)[i];
+			}
+			oss<<")";
+			idPos = end;
+		}
+		else
+			oss<<" > "<<lastId<<" order by "<<ConfigurationCache::keyField(type)<<" asc limit "<<limit;
+
 		std::string sql = oss.str();
 		QueryResult queryResult;
 		std::vector<std::vector<std::string>> &result = queryResult.rows;
@@ -142,185 +373,241 @@ bool ConfigMonitor::fetchDBConfiguration_DatabaseInfo(MySQLClient *mySQL, TableM
 			return false;
 
 		for (size_t i = 0; i < result.size(); i++)
+			lastId = _configCache.loadRow(type, result[i], affectedTables);
+
+		if (fetchedRows)
+			*fetchedRows += result.size();
+
+		if (ids)
 		{
-			DatabaseInfo *di = new DatabaseInfo;
-			
-			try
-			{
-				di->serverId = atoi(result[i][0].c_str());
-				di->master_id = atoi(result[i][1].c_str());
-				di->host = result[i][2];
-				di->port = atoi(result[i][3].c_str());
-				di->username = result[i][4];
-				di->password = result[i][5];
-				di->timeout = atoi(result[i][6].c_str());
-				di->databaseName = result[i][7];
-
-				if (decrypt)
-					if (!decrypt->decrypt(di->username, di->password))
-						return false;
-				
-				builder.addDatabaseInfo(di);
-				lastDBid = di->serverId;
-			}
-			catch (...)
-			{
-				delete di;
-				throw;
-			}
+			if (idPos >= ids->size())
+				return true;
 		}
-		
-		if (result.size() < limit)
+		else if (result.size() < limit)
 			return true;
 	}
 }
 
-bool ConfigMonitor::fetchDBConfiguration_TableInfo(MySQLClient *mySQL, TableManagerBuilder& builder)
+bool ConfigMonitor::fetchConfigurationTables(MySQLClient *mySQL, const std::string& host)
 {
-	const size_t limit = 10000;
-	int lastTableId = 0;
-	while (true)
+	//-- server_info is fetched by mySQL, and the other tables are fetched in parallel by the temporary connections.
+	bool fetched[ConfigurationCache::TableTypeCount] = { false };
+	std::vector<std::thread> threads;
+
+	for (int i = ConfigurationCache::TableInfoTable; i < ConfigurationCache::TableTypeCount; i++)
 	{
-		std::ostringstream oss;
-		oss<<"select id, table_name, split_type, range_span, database_category, secondary_split, secondary_split_span, table_count, hint_field";
-		oss<<" from table_info where id > "<<lastTableId<<" order by id asc limit "<<limit;
-		
-		std::string sql = oss.str();
-		QueryResult queryResult;
-		std::vector<std::vector<std::string>> &result = queryResult.rows;
-		if (!mySQL->query(_cfgDBInfo.database, sql, queryResult))
-			return false;
-			
-		for (size_t i = 0; i < result.size(); i++)
-		{
-			TableInfo *ti = new TableInfo;
-			
+		threads.push_back(std::thread([this, &host, &fetched, i]() {
 			try
 			{
-				lastTableId = atoi(result[i][0].c_str());
-				
-				ti->tableName = result[i][1];
-				ti->splitByRange = (bool)atoi(result[i][2].c_str());
-
-				ti->splitSpan = atoll(result[i][3].c_str());
-				ti->databaseCategory = result[i][4];
-				ti->secondarySplit = (bool)atoi(result[i][5].c_str());
-				ti->seconddarySplitSpan = atoll(result[i][6].c_str());
-
-				ti->tableCount = atoi(result[i][7].c_str());
-				ti->splitHint = result[i][8];
-					
-				if (!builder.addTableInfo(ti))
-				{
-					delete ti;
-					return false;
-				}
+				MySQLClient client(host, _cfgDBInfo.port, _cfgDBInfo.username, _cfgDBInfo.password, _cfgDBInfo.database, _cfgDBInfo.timeout);
+				if (client.connected())
+					fetched[i] = fetchConfigurationRows(&client, (ConfigurationCache::TableType)i, 0);
 			}
-			catch (...)
+			catch (const std::exception& ex)
 			{
-				delete ti;
-				throw;
+				LOG_ERROR("EXCEPTION: Fetch config table %s failed. %s", ConfigurationCache::tableName((ConfigurationCache::TableType)i), ex.what());
 			}
-		}
-		
-		if (result.size() < limit)
-			return true;
+		}));
+	}
+
+	try
+	{
+		fetched[ConfigurationCache::ServerInfoTable] = fetchConfigurationRows(mySQL, ConfigurationCache::ServerInfoTable, 0);
+	}
+	catch (...)
+	{
+		for (auto& thread: threads)
+			thread.join();
+		throw;
+	}
+
+	for (auto& thread: threads)
+		thread.join();
+
+	if (!fetched[ConfigurationCache::ServerInfoTable])
+		return false;
+
+	for (int i = ConfigurationCache::TableInfoTable; i < ConfigurationCache::TableTypeCount; i++)
+	{
+		if (fetched[i])
+			continue;
+
+		LOG_WARN("Fetch config table %s in parallel failed, retry with the main connection.", ConfigurationCache::tableName((ConfigurationCache::TableType)i));
+		if (!fetchConfigurationRows(mySQL, (ConfigurationCache::TableType)i, 0))
+			return false;
 	}
+	return true;
 }
 
-bool ConfigMonitor::fetchDBConfiguration_SplitTableInfo(MySQLClient *mySQL, TableManagerBuilder& builder)
+bool ConfigMonitor::fetchConfigurationChanges(MySQLClient *mySQL, std::set<TableInfoKey>& rebuiltTables, size_t& changedRows)
 {
+	//-- The log ids restart when config_change_log is truncated or recreated, and the changes between are lost.
+	int64_t maxLogId = getChangeLogMaxId(mySQL);
+	if (maxLogId < _configCache.changeLogId)
+	{
+		LOG_WARN("config_change_log is reset or unavailable, reload all config tables.");
+		return false;
+	}
+
+	//-- The log ids are allocated before the transactions committed, so the ids of the slow transactions are committed out of order.
+	//-- The missing ids are rescanned in the gap timeout, from the last applied id before the first one. The replayed rows are fetched again.
+	int64_t now = slack_mono_msec();
+	int64_t timeoutMsec = (int64_t)(_cfgDBInfo.changeLogGapTimeout > 0 ? _cfgDBInfo.changeLogGapTimeout : 0) * 1000;
+	_changeLogScans.push_back(std::make_pair(maxLogId, now));
+	while (_changeLogScans.size() && _changeLogScans.front().second + timeoutMsec <= now)
+	{
+		_changeLogExpiredId = std::max(_changeLogExpiredId, _changeLogScans.front().first);
+		_changeLogScans.pop_front();
+	}
+
+	std::set<int64_t> changedIds[ConfigurationCache::TableTypeCount];
 	const size_t limit = 10000;
-	int lastSplitTableId = 0;
-	while (true)
+	int64_t lastLogId = _configCache.changeLogId;
+	int64_t firstMissingId = 0;
+	while (lastLogId < maxLogId)
 	{
 		std::ostringstream oss;
-		oss<<"select id, table_name, table_number, server_id, database_name from split_table_info where id > ";
-		oss<<lastSplitTableId<<" order by id asc limit "<<limit;
-		
+		oss<<"select id, table_name, row_id from config_change_log where id > "<<lastLogId<<" and id <= "<<maxLogId;
+		oss<<" order by id asc limit "<<limit;
+
 		std::string sql = oss.str();
 		QueryResult queryResult;
 		std::vector<std::vector<std::string>> &result = queryResult.rows;
 		if (!mySQL->query(_cfgDBInfo.database, sql, queryResult))
 			return false;
-			
+
 		for (size_t i = 0; i < result.size(); i++)
 		{
-			TableSplittingInfo *tsi = new TableSplittingInfo;
-			
-			try
-			{
-				lastSplitTableId = atoi(result[i][0].c_str());
-				
-				tsi->tableName = result[i][1];
-				tsi->tableNumber = atoi(result[i][2].c_str());
-				tsi->serverId = atoi(result[i][3].c_str());
-				tsi->databaseName = result[i][4];
-				
-				builder.addTableSplittingInfo(tsi);
-			}
-			catch (...)
-			{
-				delete tsi;
-				throw;
-			}
+			int64_t logId = atoll(result[i][0].c_str());
+			if (firstMissingId == 0 && logId > lastLogId + 1 && logId - 1 > _changeLogExpiredId)
+				firstMissingId = std::max(lastLogId + 1, _changeLogExpiredId + 1);
+
+			lastLogId = logId;
+
+			ConfigurationCache::TableType type;
+			if (ConfigurationCache::tableType(result[i][1], type))
+				changedIds[type].insert(atoll(result[i][2].c_str()));
 		}
-		
+
 		if (result.size() < limit)
-			return true;
+			break;
 	}
+
+	for (int i = 0; i < ConfigurationCache::TableTypeCount; i++)
+	{
+		ConfigurationCache::TableType type = (ConfigurationCache::TableType)i;
+		int64_t lastId = _configCache.maxId(type);
+
+		//-- The rows after lastId are fetched by the stepwise ids, includes the ones appended without logging.
+		std::vector<int64_t> ids;
+		for (int64_t id: changedIds[i])
+		{
+			if (id > lastId)
+				break;
+
+			ids.push_back(id);
+			_configCache.eraseRow(type, id, &rebuiltTables);
+		}
+
+		changedRows += ids.size();
+		if (!fetchConfigurationRows(mySQL, type, 0, &ids, &rebuiltTables))
+			return false;
+
+		if (!fetchConfigurationRows(mySQL, type, lastId, NULL, &rebuiltTables, &changedRows))
+			return false;
+	}
+
+	if (firstMissingId)
+	{
+		LOG_INFO("config_change_log id %lld is missing, rescan from it in the next reloading.", (long long)firstMissingId);
+		_configCache.changeLogId = firstMissingId - 1;
+	}
+	else
+		_configCache.changeLogId = maxLogId;
+
+	return true;
 }
 
-bool ConfigMonitor::fetchDBConfiguration_SplitRangeInfo(MySQLClient *mySQL, TableManagerBuilder& builder)
+TableManagerPtr ConfigMonitor::buildTableManager(int64_t utime, TableManagerPtr currentTableManager, const std::set<TableInfoKey>* rebuiltTables)
 {
-	const size_t limit = 10000;
-	int lastSplitRangeId = 0;
-	while (true)
+	ConfuseDecryptor* decrypt = NULL;
+	if (_cfgDBInfo.enableConfuse)
+		decrypt = new ConfuseDecryptor(_cfgDBInfo.username, _cfgDBInfo.password);
+
+	AutoDeleteGuard<ConfuseDecryptor> adg(decrypt);
+
+	TableManagerBuilder builder(_configCache.splitSpan, (int)_configCache.numberBase, utime);
+
+	//-- The confused data are decrypted in order of server id.
+	for (auto& sirPair: _configCache.servers)
 	{
-		std::ostringstream oss;
-		oss<<"select id, database_category, split_index, index_type, database_name, server_id from split_range_info where id > ";
-		oss<<lastSplitRangeId<<" order by id asc limit "<<limit;
+		const ServerInfoRecord& sir = sirPair.second;
+		DatabaseInfo *di = new DatabaseInfo;
 		
-		std::string sql = oss.str();
-		QueryResult queryResult;
-		std::vector<std::vector<std::string>> &result = queryResult.rows;
-		if (!mySQL->query(_cfgDBInfo.database, sql, queryResult))
-			return false;
-			
-		for (size_t i = 0; i < result.size(); i++)
+		di->serverId = sir.serverId;
+		di->master_id = sir.masterId;
+		di->host = sir.host;
+		di->port = sir.port;
+		di->username = sir.username;
+		di->password = sir.password;
+		di->timeout = sir.timeout;
+		di->databaseName = sir.databaseName;
+		di->zone = sir.zone;
+		di->crossZone = TableManager::crossZone(sir.zone);
+
+		if (decrypt && !decrypt->decrypt(di->username, di->password))
 		{
-			RangeSplittingInfo *rsi = new RangeSplittingInfo;
+			delete di;
+			return nullptr;
+		}
+		
+		builder.addDatabaseInfo(di);
+	}
+
+	for (auto& tiPair: _configCache.tables)
+	{
+		if (rebuiltTables && rebuiltTables->find(tableInfoKey(tiPair.second)) == rebuiltTables->end())
+			continue;
+		
+		TableInfo *ti = new TableInfo(tiPair.second);
+		if (!builder.addTableInfo(ti))
+		{
+			delete ti;
+			return nullptr;
+		}
+	}
+
+	if (!rebuiltTables || rebuiltTables->size())
+	{
+		for (auto& tsiPair: _configCache.splitTables)
+		{
+			if (rebuiltTables && rebuiltTables->find(tableInfoKey(tsiPair.second)) == rebuiltTables->end())
+				continue;
 			
-			try
-			{
-				lastSplitRangeId = atoi(result[i][0].c_str());
+			builder.addTableSplittingInfo(new TableSplittingInfo(tsiPair.second));
+		}
+	}
 
-				rsi->index = atoi(result[i][2].c_str());
-				rsi->indexType = atoi(result[i][3].c_str());
-				rsi->serverId = atoi(result[i][5].c_str());
-				rsi->databaseCategory = result[i][1];
-				rsi->databaseName = result[i][4];
-				
-				if (!builder.addRangeSplittingInfo(rsi))
-				{
-					delete rsi;
-					return false;
-				}
-			}
-			catch (...)
-			{
-				delete rsi;
-				throw;
-			}
+	for (auto& rsiPair: _configCache.splitRanges)
+	{
+		RangeSplittingInfo *rsi = new RangeSplittingInfo(rsiPair.second);
+		if (!builder.addRangeSplittingInfo(rsi))
+		{
+			delete rsi;
+			return nullptr;
 		}
-		
-		if (result.size() < limit)
-			return true;
 	}
+
+	if (rebuiltTables)
+		builder.inheritTableInfos(currentTableManager, *rebuiltTables);
+
+	return builder.build(currentTableManager);
 }
 	
-TableManagerPtr ConfigMonitor::initTableManager(MySQLClient *mySQL, TableManagerPtr currentTableManager)
+TableManagerPtr ConfigMonitor::initTableManager(MySQLClient *mySQL, const std::string& host, TableManagerPtr currentTableManager)
 {
+	int64_t startMsec = exact_real_msec();
+
 	int64_t utime = getConfigurationUpdateTime(mySQL);
 	if (utime <= 0)
 	{
@@ -342,18 +629,109 @@ TableManagerPtr ConfigMonitor::initTableManager(MySQLClient *mySQL, TableManager
 		return nullptr;
 	}
 
-	TableManagerBuilder builder(splitSpan, numberBase, utime);
+	ReloadStatus status;
+	std::set<TableInfoKey> rebuiltTables;
 	
-	if (!fetchDBConfiguration_DatabaseInfo(mySQL, builder))
-		return nullptr;
-	if (!fetchDBConfiguration_TableInfo(mySQL, builder))
-		return nullptr;
-	if (!fetchDBConfiguration_SplitTableInfo(mySQL, builder))
-		return nullptr;
-	if (!fetchDBConfiguration_SplitRangeInfo(mySQL, builder))
+	status.incremental = _configCacheReady && currentTableManager && _cfgDBInfo.enableChangeLog
+		&& splitSpan == _configCache.splitSpan && numberBase == _configCache.numberBase
+		&& (_cfgDBInfo.fullReloadInterval <= 0 || startMsec - _configCache.fullLoadedMsec < (int64_t)_cfgDBInfo.fullReloadInterval * 1000);
+
+	//-- Any failure leaves the cache incomplete, and the next reloading will be a full one.
+	_configCacheReady = false;
+
+	if (status.incremental)
+		status.incremental = fetchConfigurationChanges(mySQL, rebuiltTables, status.changedRows);
+
+	if (!status.incremental)
+	{
+		_configCache.clear();
+		status.changedRows = 0;
+		rebuiltTables.clear();
+
+		//-- The changes logged during fetching, and the uncommitted ones logged in the gap timeout, are replayed by the next incremental reloading.
+		if (_cfgDBInfo.enableChangeLog)
+		{
+			_configCache.changeLogId = getChangeLogSettledId(mySQL);
+			_changeLogExpiredId = _configCache.changeLogId;
+			_changeLogScans.clear();
+		}
+
+		if (!fetchConfigurationTables(mySQL, host))
+			return nullptr;
+
+		status.changedRows = _configCache.rowCount();
+	}
+
+	_configCache.updateTime = utime;
+	_configCache.splitSpan = splitSpan;
+	_configCache.numberBase = numberBase;
+
+	int64_t fetchedMsec = exact_real_msec();
+
+	TableManagerPtr tableManager = buildTableManager(utime, currentTableManager, status.incremental ? &rebuiltTables : NULL);
+	if (tableManager == nullptr)
 		return nullptr;
 
-	return builder.build(currentTableManager);
+	status.finishedMsec = exact_real_msec();
+	status.fetchingMsec = fetchedMsec - startMsec;
+	status.buildingMsec = status.finishedMsec - fetchedMsec;
+	status.rebuiltTables = status.incremental ? rebuiltTables.size() : _configCache.tables.size();
+
+	if (!status.incremental)
+		_configCache.fullLoadedMsec = startMsec;
+
+	_configCacheReady = true;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_reloadStatus = status;
+	}
+
+	LOG_INFO("%s reload table config in %lld ms, fetching %lld ms, building %lld ms. %d rows changed, %d tables rebuilt.",
+		(status.incremental ? "Incremental" : "Full"), (long long)(status.finishedMsec - startMsec), (long long)status.fetchingMsec,
+		(long long)status.buildingMsec, (int)status.changedRows, (int)status.rebuiltTables);
+
+	if (_cfgDBInfo.snapshotFile.length())
+		_configCache.save(_cfgDBInfo.snapshotFile);
+
+	loadQoSRules(mySQL);
+
+	return tableManager;
+}
+
+void ConfigMonitor::loadConfigurationSnapshot()
+{
+	int64_t startMsec = exact_real_msec();
+	if (!_configCache.load(_cfgDBInfo.snapshotFile))
+		return;
+
+	int64_t loadedMsec = exact_real_msec();
+
+	TableManagerPtr tableManager = buildTableManager(_configCache.updateTime, nullptr, NULL);
+	if (tableManager == nullptr)
+	{
+		LOG_ERROR("Build table manager from config snapshot %s failed.", _cfgDBInfo.snapshotFile.c_str());
+		_configCache.clear();
+		return;
+	}
+
+	ReloadStatus status;
+	status.fromSnapshot = true;
+	status.finishedMsec = exact_real_msec();
+	status.fetchingMsec = loadedMsec - startMsec;
+	status.buildingMsec = status.finishedMsec - loadedMsec;
+	status.changedRows = _configCache.rowCount();
+	status.rebuiltTables = _configCache.tables.size();
+
+	_configCacheReady = true;
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_tableManager = tableManager;
+		_currentTableManager.store(tableManager.get());
+		_reloadStatus = status;
+	}
+
+	LOG_INFO("Load table config from snapshot %s in %lld ms, config update time %lld. Reconcile with config database in background.",
+		_cfgDBInfo.snapshotFile.c_str(), (long long)(status.finishedMsec - startMsec), (long long)_configCache.updateTime);
 }
 
 int64_t ConfigMonitor::getConfigurationUpdateTime(MySQLClient *mySQL)
@@ -370,6 +748,38 @@ int64_t ConfigMonitor::getConfigurationUpdateTime(MySQLClient *mySQL)
 	return 0;
 }
 
+int64_t ConfigMonitor::getChangeLogMaxId(MySQLClient *mySQL)
+{
+	QueryResult queryResult;
+	std::vector<std::vector<std::string>> &result = queryResult.rows;
+	if (!mySQL->query(_cfgDBInfo.database, "select ifnull(max(id), 0) from config_change_log", queryResult))
+		return -1;
+
+	if (result.size())
+	{
+		return atoll(result[0][0].c_str());
+	}
+	return -1;
+}
+
+//-- The max log id of the changes logged before the gap timeout. The later ones may be committed out of order.
+int64_t ConfigMonitor::getChangeLogSettledId(MySQLClient *mySQL)
+{
+	std::ostringstream oss;
+	oss<<"select ifnull(max(id), 0) from config_change_log where mtime < now() - interval "<<_cfgDBInfo.changeLogGapTimeout<<" second";
+
+	QueryResult queryResult;
+	std::vector<std::vector<std::string>> &result = queryResult.rows;
+	if (!mySQL->query(_cfgDBInfo.database, oss.str(), queryResult))
+		return -1;
+
+	if (result.size())
+	{
+		return atoll(result[0][0].c_str());
+	}
+	return -1;
+}
+
 int64_t ConfigMonitor::getSplitRangeSpan(MySQLClient *mySQL)
 {
 	QueryResult queryResult;
@@ -398,6 +808,41 @@ int64_t ConfigMonitor::getSecondaryRangeSplitNumberBase(MySQLClient *mySQL)
 	return -1;
 }
 
+void ConfigMonitor::loadQoSRules(MySQLClient *mySQL)
+{
+	QueryResult queryResult;
+	std::vector<std::vector<std::string>> &result = queryResult.rows;
+	if (!mySQL->query(_cfgDBInfo.database, "select rule_type, target, rate, burst, qos_class from qos_rule", queryResult))
+	{
+		LOG_WARN("Load QoS rules failed, the current rules are kept.");
+		return;
+	}
+	_qosRulesLoaded = true;
+
+	QoSController::RulesPtr rules = std::make_shared<QoSController::Rules>();
+	for (auto& row: result)
+	{
+		if (!rules->addRule(atoi(row[0].c_str()), row[1], atoi(row[2].c_str()), atoi(row[3].c_str()), atoi(row[4].c_str())))
+			LOG_ERROR("[Config Error] Invalid QoS rule. type: %s, target: %s, rate: %s, burst: %s, class: %s.",
+				row[0].c_str(), row[1].c_str(), row[2].c_str(), row[3].c_str(), row[4].c_str());
+	}
+	QoSController::update(rules);
+
+	queryResult.rows.clear();
+	if (mySQL->query(_cfgDBInfo.database, "select value from variable_setting where name = 'QoS class weights'", queryResult) && result.size())
+	{
+		std::vector<std::string> items;
+		StringUtil::split(result[0][0], " ,", items);
+
+		std::vector<int> weights;
+		for (auto& item: items)
+			weights.push_back(atoi(item.c_str()));
+
+		if (!TaskQueue::setClassWeights(weights))
+			LOG_ERROR("[Config Error] Invalid QoS class weights: %s.", result[0][0].c_str());
+	}
+}
+
 std::shared_ptr<MySQLClient> ConfigMonitor::createMySQLClient(int& host_index)
 {
 	std::shared_ptr<MySQLClient> my;
@@ -416,9 +861,11 @@ std::shared_ptr<MySQLClient> ConfigMonitor::createMySQLClient(int& host_index)
 void ConfigMonitor::monitor_thread()
 {
 	std::shared_ptr<TableManager> currentTableManager;
-	int sync_tick = 0;
 	int hostIndex = 0;
 	
+	//-- The config loaded from snapshot is checked at once.
+	int sync_tick = _configCacheReady ? _cfgDBInfo.checkInterval : 0;
+	
 	while (true)
 	try
 	{
@@ -432,13 +879,18 @@ void ConfigMonitor::monitor_thread()
 			continue;
 		}
 		
+		if (_cfgDBInfo.notifyFile.length())
+			checkNotifyFile();
+
 		std::shared_ptr<MySQLClient> mysql;
 		
 		int64_t new_update_time = 0;
 		bool requireUpdate;
+		uint64_t refreshSeq;
 		{
 			std::lock_guard<std::mutex> lck (_mutex);
 			requireUpdate = _needRefresh;
+			refreshSeq = _refreshSeq;
 			if (!currentTableManager)
 				currentTableManager = _tableManager;
 		}
@@ -458,6 +910,8 @@ void ConfigMonitor::monitor_thread()
 
 				if (new_update_time > currentTableManager->updateTime())
 					requireUpdate = true;
+				else if (!_qosRulesLoaded)
+					loadQoSRules(mysql.get());		//-- Started from the snapshot of the same update time.
 
 				sync_tick = 0;
 			}
@@ -468,19 +922,33 @@ void ConfigMonitor::monitor_thread()
 			if (!mysql)
 				mysql = createMySQLClient(hostIndex);
 
-			TableManagerPtr tmp = initTableManager(mysql.get(), currentTableManager);
+			TableManagerPtr tmp = initTableManager(mysql.get(), _cfgDBInfo.hosts[hostIndex], currentTableManager);
 			if (tmp != nullptr)
 			{
 				{
 					std::lock_guard<std::mutex> lck (_mutex);
 					_tableManager = tmp;
-					_needRefresh = false;
+					_currentTableManager.store(tmp.get());
+
+					//-- The notifications arrived during the loading are kept.
+					if (_refreshSeq == refreshSeq)
+					{
+						_needRefresh = false;
+						_notifiedUpdateTime = 0;
+					}
 				}
 
 				if (currentTableManager)
 				{
 					currentTableManager->signTakenOverTaskQueues(*tmp);
-					_recycledTableManagers.push_back(currentTableManager);
+					migrateQueuedTasks(currentTableManager.get(), tmp.get());
+
+					RecycledTableManager recycled;
+					recycled.tableManager = currentTableManager;
+					recycled.retiredEpoch = _epoch.fetch_add(1);
+
+					std::lock_guard<std::mutex> lck (_mutex);
+					_recycledTableManagers.push_back(recycled);
 				}
 
 				currentTableManager = tmp;
@@ -490,9 +958,9 @@ void ConfigMonitor::monitor_thread()
 				throw FPNN_ERROR_FMT(InvalidConfigError, "Invalid config info at %s.", _cfgDBInfo.hosts[hostIndex].c_str());
 		}
 
-		sleep(3);
-			
-		sync_tick += 3;
+		XATransaction::recover(currentTableManager);
+
+		sync_tick += waitRefresh(3);
 		hostIndex = 0;
 	}
 	catch (const InvalidConfigError& e)
@@ -516,16 +984,75 @@ void ConfigMonitor::monitor_thread()
 	}
 }
 
+//========================================//
+//- Change Notification
+//========================================//
+bool ConfigMonitor::notifyChanged(int64_t updateTime)
+{
+	std::lock_guard<std::mutex> lck (_mutex);
+	if (updateTime > 0)
+	{
+		if (_tableManager && updateTime <= _tableManager->updateTime())
+			return false;
+
+		if (updateTime <= _notifiedUpdateTime)
+			return false;
+
+		_notifiedUpdateTime = updateTime;
+	}
+
+	_needRefresh = true;
+	_refreshSeq += 1;
+	_refreshCondition.notify_one();
+	return true;
+}
+
+void ConfigMonitor::checkNotifyFile()
+{
+	struct stat st;
+	if (stat(_cfgDBInfo.notifyFile.c_str(), &st) != 0)
+		return;
+
+	if (st.st_ino == _notifyFileStat.st_ino && st.st_size == _notifyFileStat.st_size && st.st_mtime == _notifyFileStat.st_mtime)
+		return;
+
+	_notifyFileStat = st;
+
+	//-- The file content is the new update time. Empty or invalid content means reloading unconditionally.
+	int64_t updateTime = 0;
+	std::ifstream file(_cfgDBInfo.notifyFile);
+	if (!(file >> updateTime))
+		updateTime = 0;
+
+	if (notifyChanged(updateTime))
+		LOG_INFO("Config change notified by file %s, update time %lld.", _cfgDBInfo.notifyFile.c_str(), (long long)updateTime);
+}
+
+int ConfigMonitor::waitRefresh(int seconds)
+{
+	auto begin = std::chrono::steady_clock::now();
+	{
+		std::unique_lock<std::mutex> lck (_mutex);
+		_refreshCondition.wait_for(lck, std::chrono::seconds(seconds), [this]() { return _needRefresh || _willExit; });
+	}
+
+	//-- Rounded up, the polling fallback is never stalled by the frequent notifications.
+	auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+	return (int)((waited + 999) / 1000);
+}
+
 #include <sstream>
 std::string ConfigMonitor::statusInJSON()
 {
 	std::shared_ptr<TableManager> currTableManager;
-	std::list<std::shared_ptr<TableManager>> recyclingList;
+	std::list<RecycledTableManager> recyclingList;
+	ReloadStatus reloadStatus;
 	
 	{
 		std::lock_guard<std::mutex> lck (_mutex);
 		currTableManager = _tableManager;
 		recyclingList = _recycledTableManagers;
+		reloadStatus = _reloadStatus;
 	}
 	
 	std::ostringstream oss;
@@ -539,19 +1066,36 @@ std::string ConfigMonitor::statusInJSON()
 		#endif
 		oss<<",\"DBProxyVersion\":\"2.5.3\"";
 		oss<<",\"recyclingQueueSize\":"<<recyclingList.size();
+		oss<<",\"lastReload\":{\"fromSnapshot\":"<<(reloadStatus.fromSnapshot ? "true" : "false");
+		oss<<",\"incremental\":"<<(reloadStatus.incremental ? "true" : "false");
+		oss<<",\"finishedMsec\":"<<reloadStatus.finishedMsec<<",\"fetchingMsec\":"<<reloadStatus.fetchingMsec;
+		oss<<",\"buildingMsec\":"<<reloadStatus.buildingMsec<<",\"changedRows\":"<<reloadStatus.changedRows;
+		oss<<",\"rebuiltTables\":"<<reloadStatus.rebuiltTables;
+		oss<<",\"migratedTasks\":"<<reloadStatus.migratedTasks<<",\"vanishedTasks\":"<<reloadStatus.vanishedTasks<<"}";
 		oss<<",\"current\":"<<(currTableManager ? currTableManager->statusInJSON() : "{}");
+		oss<<",\"xa\":"<<XATransaction::statusInJSON();
+		oss<<",\"asyncWrite\":"<<AsyncWriteSpool::statusInJSON();
+		oss<<",\"SQLCache\":"<<SQLStatementCache::statusInJSON();
+		oss<<",\"workers\":"<<SharedWorkerPool::statusInJSON();
+		oss<<",\"healthCheck\":"<<HealthChecker::statusInJSON();
+		oss<<",\"admission\":"<<SojournMonitor::statusInJSON();
+		oss<<",\"databaseAffinity\":"<<TaskQueue::affinityStatusInJSON();
+		oss<<",\"readRetry\":"<<QueryTask::readRetryStatusInJSON();
+		oss<<",\"zone\":"<<TableManager::zoneStatusInJSON();
+		oss<<",\"readYourWrites\":"<<GTIDTracker::statusInJSON();
+		oss<<",\"qos\":{\"classWeights\":"<<TaskQueue::classWeightsInJSON()<<",\"rules\":"<<QoSController::statusInJSON()<<"}";
 		
 		bool comma = false;
 		oss<<",\"recycling\":";
 		oss<<"[";
-		for (std::list<std::shared_ptr<TableManager>>::iterator iter = recyclingList.begin(); iter != recyclingList.end(); iter++)
+		for (std::list<RecycledTableManager>::iterator iter = recyclingList.begin(); iter != recyclingList.end(); iter++)
 		{
 			if (comma)
 				oss<<",";
 			else
 				comma = true;
 				
-			oss<<(*iter)->statusInJSON();
+			oss<<iter->tableManager->statusInJSON();
 		}
 		oss<<"]";
 	}
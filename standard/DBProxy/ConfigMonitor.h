@@ -2,13 +2,42 @@
 #define Config_Monitor_H
 
 #include <list>
+#include <deque>
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <condition_variable>
+#include <sys/stat.h>
 #include <vector>
 #include "rijndael.h"
 #include "TableManager.h"
 #include "TableManagerBuilder.h"
+#include "ConfigurationCache.h"
+
+#define FPNN_DBPROXY_TABLE_MANAGER_READER_SLOTS 256
+
+//-- Pins the current TableManager until destructed, without locking and reference counting. Must be destructed in the same thread.
+class TableManagerSnapshot
+{
+	friend class ConfigMonitor;
+
+	TableManager* _tableManager;
+	std::atomic<uint64_t>* _readerEpoch;		//-- The reader slot to be cleared. NULL for nested & moved snapshots.
+	TableManagerPtr _sharedTableManager;		//-- Only used when the reader slots are exhausted.
+
+	TableManagerSnapshot(): _tableManager(NULL), _readerEpoch(NULL) {}
+
+public:
+	TableManagerSnapshot(TableManagerSnapshot&& r);
+	~TableManagerSnapshot();
+
+	TableManagerSnapshot(const TableManagerSnapshot&) = delete;
+	TableManagerSnapshot& operator=(const TableManagerSnapshot&) = delete;
+
+	inline TableManager* get() const { return _tableManager; }
+	inline TableManager* operator->() const { return _tableManager; }
+	inline explicit operator bool() const { return _tableManager != NULL; }
+};
 
 class ConfigMonitor
 {
@@ -22,6 +51,27 @@ class ConfigMonitor
 		std::string password;
 		int checkInterval;
 		bool enableConfuse;
+		bool enableChangeLog;
+		int fullReloadInterval;
+		int changeLogGapTimeout;
+		std::string snapshotFile;
+		std::string notifyFile;
+	};
+
+	struct ReloadStatus
+	{
+		bool fromSnapshot;
+		bool incremental;
+		int64_t finishedMsec;
+		int64_t fetchingMsec;
+		int64_t buildingMsec;
+		size_t changedRows;			//-- All rows for full reloading.
+		size_t rebuiltTables;		//-- All tables for full reloading.
+		size_t migratedTasks;		//-- Queued tasks routed again from the retired task queues.
+		size_t vanishedTasks;		//-- Queued tasks failed because their targets are removed.
+
+		ReloadStatus(): fromSnapshot(false), incremental(false), finishedMsec(0), fetchingMsec(0), buildingMsec(0), changedRows(0),
+			rebuiltTables(0), migratedTasks(0), vanishedTasks(0) {}
 	};
 
 	struct ConfuseDecryptor
@@ -36,12 +86,40 @@ class ConfigMonitor
 		bool decrypt(std::string& user, std::string& password);
 	};
 	
+	struct RecycledTableManager
+	{
+		TableManagerPtr tableManager;
+		uint64_t retiredEpoch;		//-- The readers pinned at this epoch or before may still use it.
+	};
+
+	struct alignas(64) ReaderSlot
+	{
+		std::atomic<uint64_t> epoch;		//-- 0: idle.
+		ReaderSlot(): epoch(0) {}
+	};
+
+	//-- Epoch based reclamation for the request path. Only one ConfigMonitor instance in a process.
+	static std::atomic<uint64_t> _epoch;
+	static ReaderSlot _readerSlots[FPNN_DBPROXY_TABLE_MANAGER_READER_SLOTS];
+
 	std::mutex _mutex;
 	TableManagerPtr _tableManager;
-	std::list<TableManagerPtr> _recycledTableManagers;
+	std::atomic<TableManager*> _currentTableManager;		//-- Owned by _tableManager.
+	std::list<RecycledTableManager> _recycledTableManagers;
 	
 	bool _needRefresh;
+	uint64_t _refreshSeq;				//-- Increased by each accepted notification.
+	int64_t _notifiedUpdateTime;		//-- The largest notified update time, which is not loaded.
+	std::condition_variable _refreshCondition;
 	ConfigurationDatabaseInfo _cfgDBInfo;
+	ReloadStatus _reloadStatus;
+
+	ConfigurationCache _configCache;		//-- Only used in monitor thread.
+	bool _configCacheReady;
+	std::deque<std::pair<int64_t, int64_t>> _changeLogScans;		//-- (max scanned log id, msec) in the gap timeout. Only used in monitor thread.
+	int64_t _changeLogExpiredId;			//-- The missing log ids up to it are given up. Only used in monitor thread.
+	bool _qosRulesLoaded;					//-- The QoS rules are not in the snapshot. Only used in monitor thread.
+	struct stat _notifyFileStat;			//-- Only used in monitor thread.
 	
 	std::thread _monitor;
 	std::atomic<bool> _willExit;
@@ -49,24 +127,37 @@ class ConfigMonitor
 private:
 	std::shared_ptr<MySQLClient> createMySQLClient(int& host_index);
 	
+	static ReaderSlot* readerSlot();
+	static uint64_t minReaderEpoch();
 	void recycleTableManagers();
-	bool fetchDBConfiguration_DatabaseInfo(MySQLClient *, TableManagerBuilder &);
-	bool fetchDBConfiguration_TableInfo(MySQLClient *, TableManagerBuilder &);
-	bool fetchDBConfiguration_SplitTableInfo(MySQLClient *, TableManagerBuilder &);
-	bool fetchDBConfiguration_SplitRangeInfo(MySQLClient *, TableManagerBuilder &);
+	void migrateQueuedTasks(TableManager* retiredTableManager, TableManager* currentTableManager);
+	bool fetchConfigurationRows(MySQLClient *, ConfigurationCache::TableType type, int64_t lastId,
+		const std::vector<int64_t>* ids = NULL, std::set<TableInfoKey>* affectedTables = NULL, size_t* fetchedRows = NULL);
+	bool fetchConfigurationTables(MySQLClient *, const std::string& host);
+	bool fetchConfigurationChanges(MySQLClient *, std::set<TableInfoKey>& rebuiltTables, size_t& changedRows);
+	TableManagerPtr buildTableManager(int64_t utime, TableManagerPtr currentTableManager, const std::set<TableInfoKey>* rebuiltTables);
 	
-	TableManagerPtr initTableManager(MySQLClient *, TableManagerPtr);
+	TableManagerPtr initTableManager(MySQLClient *, const std::string& host, TableManagerPtr);
+	void loadConfigurationSnapshot();
+	void checkNotifyFile();
+	int waitRefresh(int seconds);
 	int64_t getConfigurationUpdateTime(MySQLClient *);
+	int64_t getChangeLogMaxId(MySQLClient *);
+	int64_t getChangeLogSettledId(MySQLClient *);
 	int64_t getSplitRangeSpan(MySQLClient *);
 	int64_t getSecondaryRangeSplitNumberBase(MySQLClient *);
+	void loadQoSRules(MySQLClient *);
 	void monitor_thread();
 
 public:
 	ConfigMonitor(const std::string& project = std::string());
 	virtual ~ConfigMonitor();
 	
-	inline void refresh() { std::lock_guard<std::mutex> lck (_mutex); _needRefresh = true; }
-	inline TableManagerPtr getTableManager() { std::lock_guard<std::mutex> lck (_mutex); return _tableManager; }
+	//-- updateTime: 0 means reloading unconditionally. Returns false if the updateTime is loaded or pending.
+	bool notifyChanged(int64_t updateTime);
+	inline void refresh() { notifyChanged(0); }
+	TableManagerSnapshot getTableManager();		//-- For the request path.
+	inline TableManagerPtr getSharedTableManager() { std::lock_guard<std::mutex> lck (_mutex); return _tableManager; }		//-- For the long holding users.
 	
 	std::string statusInJSON();
 };
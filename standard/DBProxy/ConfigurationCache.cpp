@@ -0,0 +1,410 @@
+#include <fcntl.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "FPLog.h"
+#include "jenkins.h"
+#include "ConfigurationCache.h"
+
+#define CONFIGURATION_SNAPSHOT_MAGIC 0x44425043		//-- "CPBD"
+#define CONFIGURATION_SNAPSHOT_VERSION 1
+
+struct ConfigTableSchema
+{
+	const char* tableName;
+	const char* keyField;
+	const char* fields;
+};
+
+static const ConfigTableSchema _schemas[ConfigurationCache::TableTypeCount] = {
+	{ "server_info", "server_id", "server_id, master_sid, host, port, user, passwd, timeout, default_database_name" },
+	{ "table_info", "id", "id, table_name, split_type, range_span, database_category, secondary_split, secondary_split_span, table_count, hint_field" },
+	{ "split_table_info", "id", "id, table_name, table_number, server_id, database_name" },
+	{ "split_range_info", "id", "id, database_category, split_index, index_type, database_name, server_id" }
+};
+
+static const char* _serverZoneFields = "server_id, master_sid, host, port, user, passwd, timeout, default_database_name, zone";
+
+bool ConfigurationCache::_serverZoneEnabled = false;
+
+const char* ConfigurationCache::tableName(TableType type)
+{
+	return _schemas[type].tableName;
+}
+
+const char* ConfigurationCache::keyField(TableType type)
+{
+	return _schemas[type].keyField;
+}
+
+const char* ConfigurationCache::fields(TableType type)
+{
+	if (type == ServerInfoTable && _serverZoneEnabled)
+		return _serverZoneFields;
+
+	return _schemas[type].fields;
+}
+
+bool ConfigurationCache::tableType(const std::string& tableName, TableType& type)
+{
+	for (int i = 0; i < TableTypeCount; i++)
+	{
+		if (tableName == _schemas[i].tableName)
+		{
+			type = (TableType)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+int64_t ConfigurationCache::loadRow(TableType type, const std::vector<std::string>& row, std::set<TableInfoKey>* affectedTables)
+{
+	//-- Rows are usually loaded in ascending order of ids.
+	int64_t id = atoll(row[0].c_str());
+	eraseRow(type, id, affectedTables);
+
+	if (type == ServerInfoTable)
+	{
+		ServerInfoRecord& sir = servers.emplace_hint(servers.end(), id, ServerInfoRecord())->second;
+		sir.serverId = (int)id;
+		sir.masterId = atoi(row[1].c_str());
+		sir.host = row[2];
+		sir.port = atoi(row[3].c_str());
+		sir.username = row[4];
+		sir.password = row[5];
+		sir.timeout = atoi(row[6].c_str());
+		sir.databaseName = row[7];
+		if (row.size() > 8)
+			sir.zone = row[8];
+	}
+	else if (type == TableInfoTable)
+	{
+		TableInfo& ti = tables.emplace_hint(tables.end(), id, TableInfo())->second;
+		ti.tableName = row[1];
+		ti.splitByRange = (bool)atoi(row[2].c_str());
+
+		ti.splitSpan = atoll(row[3].c_str());
+		ti.databaseCategory = row[4];
+		ti.secondarySplit = (bool)atoi(row[5].c_str());
+		ti.seconddarySplitSpan = atoll(row[6].c_str());
+
+		ti.tableCount = atoi(row[7].c_str());
+		ti.splitHint = row[8];
+
+		if (affectedTables)
+			affectedTables->insert(tableInfoKey(ti));
+	}
+	else if (type == SplitTableInfoTable)
+	{
+		TableSplittingInfo& tsi = splitTables.emplace_hint(splitTables.end(), id, TableSplittingInfo())->second;
+		tsi.tableName = row[1];
+		tsi.tableNumber = atoi(row[2].c_str());
+		tsi.serverId = atoi(row[3].c_str());
+		tsi.databaseName = row[4];
+
+		if (affectedTables)
+			affectedTables->insert(tableInfoKey(tsi));
+	}
+	else
+	{
+		RangeSplittingInfo& rsi = splitRanges.emplace_hint(splitRanges.end(), id, RangeSplittingInfo())->second;
+		rsi.databaseCategory = row[1];
+		rsi.index = atoi(row[2].c_str());
+		rsi.indexType = atoi(row[3].c_str());
+		rsi.databaseName = row[4];
+		rsi.serverId = atoi(row[5].c_str());
+	}
+
+	return id;
+}
+
+void ConfigurationCache::eraseRow(TableType type, int64_t id, std::set<TableInfoKey>* affectedTables)
+{
+	if (type == ServerInfoTable)
+		servers.erase(id);
+	else if (type == SplitRangeInfoTable)
+		splitRanges.erase(id);
+	else if (type == TableInfoTable)
+	{
+		auto iter = tables.find(id);
+		if (iter != tables.end())
+		{
+			if (affectedTables)
+				affectedTables->insert(tableInfoKey(iter->second));
+			tables.erase(iter);
+		}
+	}
+	else
+	{
+		auto iter = splitTables.find(id);
+		if (iter != splitTables.end())
+		{
+			if (affectedTables)
+				affectedTables->insert(tableInfoKey(iter->second));
+			splitTables.erase(iter);
+		}
+	}
+}
+
+int64_t ConfigurationCache::maxId(TableType type) const
+{
+	if (type == ServerInfoTable)
+		return servers.empty() ? 0 : servers.rbegin()->first;
+	else if (type == TableInfoTable)
+		return tables.empty() ? 0 : tables.rbegin()->first;
+	else if (type == SplitTableInfoTable)
+		return splitTables.empty() ? 0 : splitTables.rbegin()->first;
+	else
+		return splitRanges.empty() ? 0 : splitRanges.rbegin()->first;
+}
+
+size_t ConfigurationCache::rowCount() const
+{
+	return servers.size() + tables.size() + splitTables.size() + splitRanges.size();
+}
+
+void ConfigurationCache::clear()
+{
+	updateTime = 0;
+	splitSpan = 0;
+	numberBase = 0;
+	changeLogId = 0;
+	fullLoadedMsec = 0;
+
+	servers.clear();
+	tables.clear();
+	splitTables.clear();
+	splitRanges.clear();
+}
+
+//========================================//
+//- Snapshot File
+//========================================//
+/*
+	Snapshot file: uint32 magic, uint32 version, uint32 body length, uint32 checksum of body, body.
+	Body: int64 updateTime, splitSpan, numberBase, changeLogId, fullLoadedMsec,
+		then for each table: string fields, uint32 row count, rows (strings in order of fields).
+	Integers are in host byte order, and strings are uint32 length + bytes.
+*/
+static void appendUInt32(std::string& buf, uint32_t value)
+{
+	buf.append((const char*)&value, sizeof(value));
+}
+
+static void appendInt64(std::string& buf, int64_t value)
+{
+	buf.append((const char*)&value, sizeof(value));
+}
+
+static void appendString(std::string& buf, const std::string& value)
+{
+	appendUInt32(buf, (uint32_t)value.length());
+	buf.append(value);
+}
+
+template<typename T>
+static bool readValue(const char*& pos, const char* end, T& value)
+{
+	if (end - pos < (ssize_t)sizeof(T))
+		return false;
+
+	memcpy(&value, pos, sizeof(T));
+	pos += sizeof(T);
+	return true;
+}
+
+static bool readString(const char*& pos, const char* end, std::string& value)
+{
+	uint32_t length;
+	if (!readValue(pos, end, length) || end - pos < (ssize_t)length)
+		return false;
+
+	value.assign(pos, length);
+	pos += length;
+	return true;
+}
+
+static void appendRow(std::string& buf, const std::vector<std::string>& row)
+{
+	for (auto& field: row)
+		appendString(buf, field);
+}
+
+static void appendTableHeader(std::string& buf, ConfigurationCache::TableType type, size_t count)
+{
+	appendString(buf, ConfigurationCache::fields(type));
+	appendUInt32(buf, (uint32_t)count);
+}
+
+//-- The renamed entry is durable after the directory is synced. The snapshot is still valid if it failed.
+static void syncParentDirectory(const std::string& path)
+{
+	size_t pos = path.find_last_of('/');
+	std::string directory = (pos == std::string::npos) ? "." : (pos == 0 ? "/" : path.substr(0, pos));
+
+	int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0 || fsync(fd) != 0)
+		LOG_WARN("Sync directory %s of config snapshot failed. errno: %d", directory.c_str(), errno);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+bool ConfigurationCache::save(const std::string& path) const
+{
+	std::string body;
+	appendInt64(body, updateTime);
+	appendInt64(body, splitSpan);
+	appendInt64(body, numberBase);
+	appendInt64(body, changeLogId);
+	appendInt64(body, fullLoadedMsec);
+
+	appendTableHeader(body, ServerInfoTable, servers.size());
+	for (auto& sirPair: servers)
+	{
+		const ServerInfoRecord& sir = sirPair.second;
+		std::vector<std::string> row { std::to_string(sirPair.first), std::to_string(sir.masterId), sir.host, std::to_string(sir.port),
+			sir.username, sir.password, std::to_string(sir.timeout), sir.databaseName };
+		if (_serverZoneEnabled)
+			row.push_back(sir.zone);
+
+		appendRow(body, row);
+	}
+
+	appendTableHeader(body, TableInfoTable, tables.size());
+	for (auto& tiPair: tables)
+	{
+		const TableInfo& ti = tiPair.second;
+		appendRow(body, { std::to_string(tiPair.first), ti.tableName, std::to_string((int)ti.splitByRange), std::to_string(ti.splitSpan),
+			ti.databaseCategory, std::to_string((int)ti.secondarySplit), std::to_string(ti.seconddarySplitSpan),
+			std::to_string(ti.tableCount), ti.splitHint });
+	}
+
+	appendTableHeader(body, SplitTableInfoTable, splitTables.size());
+	for (auto& tsiPair: splitTables)
+	{
+		const TableSplittingInfo& tsi = tsiPair.second;
+		appendRow(body, { std::to_string(tsiPair.first), tsi.tableName, std::to_string(tsi.tableNumber),
+			std::to_string(tsi.serverId), tsi.databaseName });
+	}
+
+	appendTableHeader(body, SplitRangeInfoTable, splitRanges.size());
+	for (auto& rsiPair: splitRanges)
+	{
+		const RangeSplittingInfo& rsi = rsiPair.second;
+		appendRow(body, { std::to_string(rsiPair.first), rsi.databaseCategory, std::to_string(rsi.index),
+			std::to_string(rsi.indexType), rsi.databaseName, std::to_string(rsi.serverId) });
+	}
+
+	std::string content;
+	appendUInt32(content, CONFIGURATION_SNAPSHOT_MAGIC);
+	appendUInt32(content, CONFIGURATION_SNAPSHOT_VERSION);
+	appendUInt32(content, (uint32_t)body.length());
+	appendUInt32(content, jenkins_hash(body.data(), body.length(), 0));
+	content.append(body);
+
+	std::string tmpPath = path + ".tmp";
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		LOG_ERROR("Open config snapshot %s failed. errno: %d", tmpPath.c_str(), errno);
+		return false;
+	}
+
+	bool status = (write(fd, content.data(), content.length()) == (ssize_t)content.length()) && (fsync(fd) == 0);
+	close(fd);
+
+	if (status)
+		status = (rename(tmpPath.c_str(), path.c_str()) == 0);
+
+	if (!status)
+		LOG_ERROR("Save config snapshot %s failed. errno: %d", path.c_str(), errno);
+	else
+		syncParentDirectory(path);
+
+	return status;
+}
+
+static bool decodeSnapshot(const char* pos, const char* end, ConfigurationCache& cache)
+{
+	if (!readValue(pos, end, cache.updateTime) || !readValue(pos, end, cache.splitSpan) || !readValue(pos, end, cache.numberBase)
+		|| !readValue(pos, end, cache.changeLogId) || !readValue(pos, end, cache.fullLoadedMsec))
+		return false;
+
+	std::vector<std::string> row;
+	for (int i = 0; i < ConfigurationCache::TableTypeCount; i++)
+	{
+		ConfigurationCache::TableType type = (ConfigurationCache::TableType)i;
+
+		//-- Snapshots of the other edition or the other config table structure are rejected.
+		std::string fields;
+		uint32_t count;
+		if (!readString(pos, end, fields) || fields != ConfigurationCache::fields(type) || !readValue(pos, end, count))
+			return false;
+
+		row.resize(std::count(fields.begin(), fields.end(), ',') + 1);
+		for (uint32_t j = 0; j < count; j++)
+		{
+			for (auto& field: row)
+				if (!readString(pos, end, field))
+					return false;
+
+			cache.loadRow(type, row);
+		}
+	}
+
+	return pos == end;
+}
+
+bool ConfigurationCache::load(const std::string& path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		LOG_WARN("Open config snapshot %s failed. errno: %d", path.c_str(), errno);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)(4 * sizeof(uint32_t)))
+	{
+		LOG_ERROR("Config snapshot %s is invalid.", path.c_str());
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		LOG_ERROR("Map config snapshot %s failed. errno: %d", path.c_str(), errno);
+		return false;
+	}
+
+	const char* pos = (const char*)data;
+	const char* end = pos + st.st_size;
+
+	uint32_t header[4];
+	readValue(pos, end, header);
+
+	ConfigurationCache cache;
+	bool status = (header[0] == CONFIGURATION_SNAPSHOT_MAGIC && header[1] == CONFIGURATION_SNAPSHOT_VERSION
+		&& header[2] == (uint64_t)(end - pos) && header[3] == jenkins_hash(pos, header[2], 0)
+		&& decodeSnapshot(pos, end, cache));
+
+	munmap(data, st.st_size);
+
+	if (!status)
+	{
+		LOG_ERROR("Config snapshot %s is corrupted or in unsupported version.", path.c_str());
+		return false;
+	}
+
+	*this = std::move(cache);
+	return true;
+}
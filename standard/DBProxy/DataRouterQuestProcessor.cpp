@@ -4,7 +4,13 @@
 #include "jenkins.h"
 #include "FpnnError.h"
 #include "SQLParser.h"
+#include "SQLStatementCache.h"
 #include "TaskPackage.h"
+#include "msec.h"
+#include "XATransaction.h"
+#include "AsyncWriteSpool.h"
+#include "QoSController.h"
+#include "GTIDTracker.h"
 #include "DataRouterErrorInfo.h"
 
 #define ONLY_HASH_TABLE(needCheck, quest, tableName)	{ if (needCheck) { \
@@ -14,48 +20,120 @@
 				return ErrorInfo::disabledAnswer(quest, "String hint id cannot be applied with range split type."); \
 		} else return ErrorInfo::tableNotFoundAnswer(quest); }}
 
+#define QOS_ADMIT(quest, ci, tableName, qosClass)	int qosClass = QoSInteractive; \
+		if (!QoSController::admit(ci.ip, tableName, qosClass)) \
+			return ErrorInfo::rateLimitedAnswer(quest);
+
+//-- Fan-out queries materialize the sql of each sub-table from one template.
+static SQLTemplatePtr buildSQLTemplate(const std::string& sql, const std::string& tableName)
+{
+	SQLTemplatePtr sqlTemplate = std::make_shared<SQLTemplate>();
+	if (SQLParser::buildSQLTemplate(sql, tableName, *sqlTemplate))
+		return sqlTemplate;
+
+	return nullptr;		//-- Fall back to rewriting per task, which will report the error.
+}
+
+//-- Read-your-writes session: the session token if provided, otherwise the client connection.
+static std::string readYourWritesSession(const FPReaderPtr args, const ConnectionInfo& ci)
+{
+	if (!GTIDTracker::enabled())
+		return std::string();
+
+	std::string session = args->get("session", std::string());
+	if (session.length())
+		return std::string("s:").append(session);
+
+	return std::string("c:").append(std::to_string(ci.uniqueId()));
+}
+
 std::string DataRouterQuestProcessor::infos()
 {
 	return _monitor.statusInJSON();
 }
 
-FPAnswerPtr DataRouterQuestProcessor::normalQuery(const FPQuestPtr quest, int64_t hintId, std::string& tableName, const std::string& sql, bool master, bool onlyHashTable)
+//-- Preassemble & pretreat params query with the cached parse results of the sql template if available.
+FPAnswerPtr DataRouterQuestProcessor::pretreatParamsQuery(const FPQuestPtr quest, const std::string& sql, const std::vector<std::string>& params, bool selectOnly,
+	std::string& tableName, std::string& semisql, std::vector<std::string>& restParams, bool& forceMasterTask, SQLTemplatePtr* sqlTemplate)
+{
+	ParsedStatementPtr parsed = SQLStatementCache::fetch(sql);
+	if (parsed && parsed->stable)
+	{
+		//-- Else the template is built from semisql below, as the miss path does.
+		bool fillTemplate = (sqlTemplate && parsed->templateBuilt && (tableName.empty() || tableName == parsed->tableName)
+			&& !parsed->inlinesTableName(params));
+		SQLTemplatePtr cachedTemplate = fillTemplate ? std::make_shared<SQLTemplate>() : nullptr;
+
+		if (!parsed->preassemble(params, semisql, restParams, cachedTemplate.get()))
+			return ErrorInfo::invalidParametersAnswer(quest);
+		if (!parsed->pretreat(selectOnly, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
+			return ErrorInfo::disabledAnswer(quest);
+
+		if (fillTemplate)
+		{
+			sqlTemplate->swap(cachedTemplate);
+			return nullptr;
+		}
+	}
+	else
+	{
+		if (!ParamsQueryTask::preassemble(sql, params, semisql, restParams))
+			return ErrorInfo::invalidParametersAnswer(quest);
+
+		bool pretreated = selectOnly ? SQLParser::pretreatSelectSQL(semisql, forceMasterTask, (tableName.empty() ? &tableName : NULL))
+			: SQLParser::pretreatSQL(semisql, forceMasterTask, (tableName.empty() ? &tableName : NULL));
+		if (!pretreated)
+			return ErrorInfo::disabledAnswer(quest);
+	}
+
+	if (sqlTemplate)
+		*sqlTemplate = buildSQLTemplate(semisql, tableName);
+
+	return nullptr;
+}
+
+FPAnswerPtr DataRouterQuestProcessor::normalQuery(const FPQuestPtr quest, const ConnectionInfo& ci, int64_t hintId, std::string& tableName, const std::string& sql, bool master, const std::string& session, bool onlyHashTable)
 {
 	bool forceMasterTask;
 	if (!SQLParser::pretreatSQL(sql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
 		return ErrorInfo::disabledAnswer(quest);
 	
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
 	ONLY_HASH_TABLE(onlyHashTable, quest, tableName)
+	QOS_ADMIT(quest, ci, tableName, qosClass)
 
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
 	QueryTaskPtr task = std::make_shared<QueryTask>(sql, tableName, async);
+	task->setQoSClass(qosClass);
+	task->setSession(session);
 
 	tm->query(hintId, master | forceMasterTask, task);
 	return nullptr;
 }
-FPAnswerPtr DataRouterQuestProcessor::paramsQuery(const FPQuestPtr quest, int64_t hintId, std::string& tableName, const std::string& sql, const std::vector<std::string>& params, bool master, bool onlyHashTable)
+FPAnswerPtr DataRouterQuestProcessor::paramsQuery(const FPQuestPtr quest, const ConnectionInfo& ci, int64_t hintId, std::string& tableName, const std::string& sql, const std::vector<std::string>& params, bool master, const std::string& session, bool onlyHashTable)
 {
 	std::string semisql;
 	std::vector<std::string> restParams;
 
 	bool forceMasterTask;
-	if (!ParamsQueryTask::preassemble(sql, params, semisql, restParams))
-		return ErrorInfo::invalidParametersAnswer(quest);
-	if (!SQLParser::pretreatSQL(semisql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
-		return ErrorInfo::disabledAnswer(quest);
+	FPAnswerPtr errorAnswer = pretreatParamsQuery(quest, sql, params, false, tableName, semisql, restParams, forceMasterTask);
+	if (errorAnswer)
+		return errorAnswer;
 	
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
 	ONLY_HASH_TABLE(onlyHashTable, quest, tableName)
+	QOS_ADMIT(quest, ci, tableName, qosClass)
 
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
 	ParamsQueryTaskPtr task = std::make_shared<ParamsQueryTask>(semisql, tableName, std::move(restParams), async);
+	task->setQoSClass(qosClass);
+	task->setSession(session);
 
 	tm->query(hintId, master | forceMasterTask, task);
 	return nullptr;
@@ -69,6 +147,7 @@ FPAnswerPtr DataRouterQuestProcessor::query(const FPReaderPtr args, const FPQues
 	std::string tableName = args->get("tableName", std::string());
 	std::string sql = args->want("sql", std::string());
 	bool master = args->getBool("master", false);
+	std::string session = readYourWritesSession(args, ci);
 
 	std::vector<std::string> params;
 	params = args->get("params", params);
@@ -76,11 +155,11 @@ FPAnswerPtr DataRouterQuestProcessor::query(const FPReaderPtr args, const FPQues
 	SQLParser::extractSQL(sql);
 
 	if (params.size())
-		return paramsQuery(quest, hintId, tableName, sql, params, master);
+		return paramsQuery(quest, ci, hintId, tableName, sql, params, master, session);
 	else
-		return normalQuery(quest, hintId, tableName, sql, master);
+		return normalQuery(quest, ci, hintId, tableName, sql, master, session);
 }
-AggregatedTaskPtr DataRouterQuestProcessor::generateAggregatedTask(std::shared_ptr<TableManager> tm, const FPQuestPtr quest, const std::string& tableName, const std::vector<int64_t>& hintIds, std::set<int64_t>& equivalentTableIds)
+AggregatedTaskPtr DataRouterQuestProcessor::generateAggregatedTask(TableManager* tm, const FPQuestPtr quest, const std::string& tableName, const std::vector<int64_t>& hintIds, std::set<int64_t>& equivalentTableIds)
 {
 	std::map<int64_t, std::set<int64_t>> hintMap;
 	std::set<int64_t> invalidHintIds;
@@ -111,7 +190,7 @@ AggregatedTaskPtr DataRouterQuestProcessor::generateAggregatedTask(std::shared_p
 	}
 	return aggTask;
 }
-AggregatedTaskPtr DataRouterQuestProcessor::generateAggregatedTask(std::shared_ptr<TableManager> tm, const FPQuestPtr quest, const std::string& tableName, const std::vector<std::string>& hintStrings, std::set<int64_t>& equivalentTableIds)
+AggregatedTaskPtr DataRouterQuestProcessor::generateAggregatedTask(TableManager* tm, const FPQuestPtr quest, const std::string& tableName, const std::vector<std::string>& hintStrings, std::set<int64_t>& equivalentTableIds)
 {
 	//-- hash string ids to int ids.
 	std::map<int64_t, std::set<std::string>> hashMapping;
@@ -158,72 +237,81 @@ AggregatedTaskPtr DataRouterQuestProcessor::generateAggregatedTask(std::shared_p
 	return aggTask;
 }
 template<typename T>
-FPAnswerPtr DataRouterQuestProcessor::sharedingQuery(const FPQuestPtr quest, const std::vector<T>& hintIds, std::string& tableName, const std::string& sql, bool master, bool onlyHashTable)
+FPAnswerPtr DataRouterQuestProcessor::sharedingQuery(const FPQuestPtr quest, const ConnectionInfo& ci, const std::vector<T>& hintIds, std::string& tableName, const std::string& sql, bool master, bool onlyHashTable)
 {
 	bool forceMasterTask;
 	if (!SQLParser::pretreatSelectSQL(sql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
 		return ErrorInfo::disabledAnswer(quest);
 	
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
 	ONLY_HASH_TABLE(onlyHashTable, quest, tableName)
+	QOS_ADMIT(quest, ci, tableName, qosClass)
 
 	std::set<int64_t> equivalentTableIds;
-	AggregatedTaskPtr aggTask = generateAggregatedTask(tm, quest, tableName, hintIds, equivalentTableIds);
+	AggregatedTaskPtr aggTask = generateAggregatedTask(tm.get(), quest, tableName, hintIds, equivalentTableIds);
 	if (!aggTask)
 		return ErrorInfo::tableNotFoundAnswer(quest);
 
+	SQLTemplatePtr sqlTemplate = buildSQLTemplate(sql, tableName);
 	for (auto equivalentId: equivalentTableIds)
 	{
-		QueryTaskPtr task = std::make_shared<QueryTask>(sql, tableName, equivalentId, aggTask);
+		QueryTaskPtr task = sqlTemplate ? std::make_shared<QueryTask>(sqlTemplate, tableName, equivalentId, aggTask)
+			: std::make_shared<QueryTask>(sql, tableName, equivalentId, aggTask);
+		task->setQoSClass(qosClass);
 		tm->query(equivalentId, master | forceMasterTask, task);
 	}
 	
 	return nullptr;
 }
 template<typename T>
-FPAnswerPtr DataRouterQuestProcessor::sharedingParamsQuery(const FPQuestPtr quest, const std::vector<T>& hintIds, std::string& tableName, const std::string& sql, const std::vector<std::string>& params, bool master, bool onlyHashTable)
+FPAnswerPtr DataRouterQuestProcessor::sharedingParamsQuery(const FPQuestPtr quest, const ConnectionInfo& ci, const std::vector<T>& hintIds, std::string& tableName, const std::string& sql, const std::vector<std::string>& params, bool master, bool onlyHashTable)
 {
 	std::string semisql;
 	std::vector<std::string> restParams;
 
 	bool forceMasterTask;
-	if (!ParamsQueryTask::preassemble(sql, params, semisql, restParams))
-		return ErrorInfo::invalidParametersAnswer(quest);
-	if (!SQLParser::pretreatSelectSQL(semisql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
-		return ErrorInfo::disabledAnswer(quest);
+	SQLTemplatePtr sqlTemplate;
+	FPAnswerPtr errorAnswer = pretreatParamsQuery(quest, sql, params, true, tableName, semisql, restParams, forceMasterTask, &sqlTemplate);
+	if (errorAnswer)
+		return errorAnswer;
 
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
 	ONLY_HASH_TABLE(onlyHashTable, quest, tableName)
+	QOS_ADMIT(quest, ci, tableName, qosClass)
 
 	std::set<int64_t> equivalentTableIds;
-	AggregatedTaskPtr aggTask = generateAggregatedTask(tm, quest, tableName, hintIds, equivalentTableIds);
+	AggregatedTaskPtr aggTask = generateAggregatedTask(tm.get(), quest, tableName, hintIds, equivalentTableIds);
 	if (!aggTask)
 		return ErrorInfo::tableNotFoundAnswer(quest);
 
 	for (auto equivalentId: equivalentTableIds)
 	{
-		ParamsQueryTaskPtr task = std::make_shared<ParamsQueryTask>(semisql, tableName, restParams, equivalentId, aggTask);
+		ParamsQueryTaskPtr task = sqlTemplate ? std::make_shared<ParamsQueryTask>(sqlTemplate, tableName, restParams, equivalentId, aggTask)
+			: std::make_shared<ParamsQueryTask>(semisql, tableName, restParams, equivalentId, aggTask);
+		task->setQoSClass(qosClass);
 		tm->query(equivalentId, master | forceMasterTask, task);
 	}
 	
 	return nullptr;
 }
-FPAnswerPtr DataRouterQuestProcessor::sharedingAllTablesQuery(const FPQuestPtr quest, std::string& tableName, const std::string& sql, bool master)
+FPAnswerPtr DataRouterQuestProcessor::sharedingAllTablesQuery(const FPQuestPtr quest, const ConnectionInfo& ci, std::string& tableName, const std::string& sql, bool master)
 {
 	bool forceMasterTask;
 	if (!SQLParser::pretreatSelectSQL(sql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
 		return ErrorInfo::disabledAnswer(quest);
 	
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
+	QOS_ADMIT(quest, ci, tableName, qosClass)
+
 	std::set<int64_t> equivalentTableIds;
 	if (!tm->getAllSplitTablesHintIds(tableName, equivalentTableIds))
 		return ErrorInfo::tableNotFoundAnswer(quest);
@@ -231,29 +319,34 @@ FPAnswerPtr DataRouterQuestProcessor::sharedingAllTablesQuery(const FPQuestPtr q
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
 	AggregatedTaskPtr aggTask(new AggregatedTask(async, equivalentTableIds));
 	
+	SQLTemplatePtr sqlTemplate = buildSQLTemplate(sql, tableName);
 	for (auto equivalentId: equivalentTableIds)
 	{
-		QueryTaskPtr task = std::make_shared<QueryTask>(sql, tableName, equivalentId, aggTask);
+		QueryTaskPtr task = sqlTemplate ? std::make_shared<QueryTask>(sqlTemplate, tableName, equivalentId, aggTask)
+			: std::make_shared<QueryTask>(sql, tableName, equivalentId, aggTask);
+		task->setQoSClass(qosClass);
 		tm->query(equivalentId, master | forceMasterTask, task);
 	}
 	
 	return nullptr;
 }
-FPAnswerPtr DataRouterQuestProcessor::sharedingAllTablesParamsQuery(const FPQuestPtr quest, std::string& tableName, const std::string& sql, const std::vector<std::string>& params, bool master)
+FPAnswerPtr DataRouterQuestProcessor::sharedingAllTablesParamsQuery(const FPQuestPtr quest, const ConnectionInfo& ci, std::string& tableName, const std::string& sql, const std::vector<std::string>& params, bool master)
 {
 	std::string semisql;
 	std::vector<std::string> restParams;
 
 	bool forceMasterTask;
-	if (!ParamsQueryTask::preassemble(sql, params, semisql, restParams))
-		return ErrorInfo::invalidParametersAnswer(quest);
-	if (!SQLParser::pretreatSelectSQL(semisql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
-		return ErrorInfo::disabledAnswer(quest);
+	SQLTemplatePtr sqlTemplate;
+	FPAnswerPtr errorAnswer = pretreatParamsQuery(quest, sql, params, true, tableName, semisql, restParams, forceMasterTask, &sqlTemplate);
+	if (errorAnswer)
+		return errorAnswer;
 
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
+	QOS_ADMIT(quest, ci, tableName, qosClass)
+
 	std::set<int64_t> equivalentTableIds;
 	if (!tm->getAllSplitTablesHintIds(tableName, equivalentTableIds))
 		return ErrorInfo::tableNotFoundAnswer(quest);
@@ -263,7 +356,9 @@ FPAnswerPtr DataRouterQuestProcessor::sharedingAllTablesParamsQuery(const FPQues
 	
 	for (auto equivalentId: equivalentTableIds)
 	{
-		ParamsQueryTaskPtr task = std::make_shared<ParamsQueryTask>(semisql, tableName, restParams, equivalentId, aggTask);
+		ParamsQueryTaskPtr task = sqlTemplate ? std::make_shared<ParamsQueryTask>(sqlTemplate, tableName, restParams, equivalentId, aggTask)
+			: std::make_shared<ParamsQueryTask>(semisql, tableName, restParams, equivalentId, aggTask);
+		task->setQoSClass(qosClass);
 		tm->query(equivalentId, master | forceMasterTask, task);
 	}
 	
@@ -275,6 +370,7 @@ FPAnswerPtr DataRouterQuestProcessor::iQuery(const FPReaderPtr args, const FPQue
 	std::string tableName = args->get("tableName", std::string());
 	std::string sql = args->want("sql", std::string());
 	bool master = args->getBool("master", false);
+	std::string session = readYourWritesSession(args, ci);
 
 	std::vector<std::string> params;
 	params = args->get("params", params);
@@ -290,23 +386,23 @@ FPAnswerPtr DataRouterQuestProcessor::iQuery(const FPReaderPtr args, const FPQue
 	if (hintIds.size() == 1)
 	{
 		if (params.size())
-			return paramsQuery(quest, hintIds[0], tableName, sql, params, master);
+			return paramsQuery(quest, ci, hintIds[0], tableName, sql, params, master, session);
 		else
-			return normalQuery(quest, hintIds[0], tableName, sql, master);
+			return normalQuery(quest, ci, hintIds[0], tableName, sql, master, session);
 	}
 	if (hintIds.size())
 	{
 		if (params.size())
-			return sharedingParamsQuery(quest, hintIds, tableName, sql, params, master);
+			return sharedingParamsQuery(quest, ci, hintIds, tableName, sql, params, master);
 		else
-			return sharedingQuery(quest, hintIds, tableName, sql, master);
+			return sharedingQuery(quest, ci, hintIds, tableName, sql, master);
 	}
 	else
 	{
 		if (params.size())
-			return sharedingAllTablesParamsQuery(quest, tableName, sql, params, master);
+			return sharedingAllTablesParamsQuery(quest, ci, tableName, sql, params, master);
 		else
-			return sharedingAllTablesQuery(quest, tableName, sql, master);
+			return sharedingAllTablesQuery(quest, ci, tableName, sql, master);
 	}
 
 	return nullptr;
@@ -317,6 +413,7 @@ FPAnswerPtr DataRouterQuestProcessor::sQuery(const FPReaderPtr args, const FPQue
 	std::string tableName = args->get("tableName", std::string());
 	std::string sql = args->want("sql", std::string());
 	bool master = args->getBool("master", false);
+	std::string session = readYourWritesSession(args, ci);
 
 	std::vector<std::string> params;
 	params = args->get("params", params);
@@ -328,23 +425,23 @@ FPAnswerPtr DataRouterQuestProcessor::sQuery(const FPReaderPtr args, const FPQue
 		int64_t hash = (int64_t)jenkins_hash(hintIds[0].c_str(), hintIds[0].length(), 0);
 
 		if (params.size())
-			return paramsQuery(quest, hash, tableName, sql, params, master, true);
+			return paramsQuery(quest, ci, hash, tableName, sql, params, master, session, true);
 		else
-			return normalQuery(quest, hash, tableName, sql, master, true);
+			return normalQuery(quest, ci, hash, tableName, sql, master, session, true);
 	}
 	if (hintIds.size())
 	{
 		if (params.size())
-			return sharedingParamsQuery(quest, hintIds, tableName, sql, params, master, true);
+			return sharedingParamsQuery(quest, ci, hintIds, tableName, sql, params, master, true);
 		else
-			return sharedingQuery(quest, hintIds, tableName, sql, master, true);
+			return sharedingQuery(quest, ci, hintIds, tableName, sql, master, true);
 	}
 	else
 	{
 		if (params.size())
-			return sharedingAllTablesParamsQuery(quest, tableName, sql, params, master);
+			return sharedingAllTablesParamsQuery(quest, ci, tableName, sql, params, master);
 		else
-			return sharedingAllTablesQuery(quest, tableName, sql, master);
+			return sharedingAllTablesQuery(quest, ci, tableName, sql, master);
 	}
 
 	return nullptr;
@@ -352,7 +449,7 @@ FPAnswerPtr DataRouterQuestProcessor::sQuery(const FPReaderPtr args, const FPQue
 FPAnswerPtr DataRouterQuestProcessor::splitInfo(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
 	std::string tableName = args->want("tableName", std::string());
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
@@ -382,7 +479,7 @@ FPAnswerPtr DataRouterQuestProcessor::splitInfo(const FPReaderPtr args, const FP
 FPAnswerPtr DataRouterQuestProcessor::categoryInfo(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
 	std::string category = args->want("databaseCategory", std::string());
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
@@ -417,7 +514,7 @@ FPAnswerPtr DataRouterQuestProcessor::reformHintIds(const FPReaderPtr args, cons
 		return aw.take();
 	}
 
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
@@ -447,7 +544,7 @@ FPAnswerPtr DataRouterQuestProcessor::reformHintIds(const FPReaderPtr args, cons
 FPAnswerPtr DataRouterQuestProcessor::getAllSplitTablesHintIds(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
 	std::string tableName = args->want("tableName", std::string());
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (!tm)
 		return ErrorInfo::unconfiguredAnswer(quest);
 
@@ -467,10 +564,11 @@ FPAnswerPtr DataRouterQuestProcessor::getAllSplitTablesHintIds(const FPReaderPtr
 }
 FPAnswerPtr DataRouterQuestProcessor::refresh(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
-	_monitor.refresh();
+	//-- The notifications with the loaded or pending update time are ignored, so they can be fanned out repeatedly.
+	_monitor.notifyChanged(args->getInt("updateTime", 0));
 	return FPAWriter::emptyAnswer(quest);
 }
-void DataRouterQuestProcessor::uniformTransactionQuery(const FPQuestPtr quest, TransactionTaskPtr task)
+void DataRouterQuestProcessor::uniformTransactionQuery(const FPQuestPtr quest, const ConnectionInfo& ci, TransactionTaskPtr task)
 {
 	if (task->_sqls.empty() || task->_hintIds.size() != task->_tableNames.size() || task->_hintIds.size() != task->_sqls.size())
 	{
@@ -489,7 +587,15 @@ void DataRouterQuestProcessor::uniformTransactionQuery(const FPQuestPtr quest, T
 		}
 	}
 
-	std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+	int qosClass = QoSInteractive;
+	if (!QoSController::admit(ci.ip, task->_tableNames, qosClass))
+	{
+		task->finish(ErrorInfo::serverBusyCode, "Rate limit exceeded.");
+		return;
+	}
+	task->setQoSClass(qosClass);
+
+	TableManagerSnapshot tm = _monitor.getTableManager();
 	if (tm)
 		tm->transaction(task);
 	else
@@ -499,6 +605,7 @@ FPAnswerPtr DataRouterQuestProcessor::transaction(const FPReaderPtr args, const
 {
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
 	TransactionTaskPtr task = std::make_shared<TransactionTask>(async);
+	task->setSession(readYourWritesSession(args, ci));
 
 	task->_hintIds = args->want("hintIds", std::vector<int64_t>());
 	task->_tableNames = args->want("tableNames", std::vector<std::string>());
@@ -510,13 +617,14 @@ FPAnswerPtr DataRouterQuestProcessor::transaction(const FPReaderPtr args, const
 			return ErrorInfo::negativeHintIdAnswer(quest);
 	}
 
-	uniformTransactionQuery(quest, task);
+	uniformTransactionQuery(quest, ci, task);
 	return nullptr;
 }
 FPAnswerPtr DataRouterQuestProcessor::sTransaction(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
 {
 	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
 	TransactionTaskPtr task = std::make_shared<TransactionTask>(async);
+	task->setSession(readYourWritesSession(args, ci));
 
 	std::vector<std::string> hintStrings = args->want("hintIds", std::vector<std::string>());
 	if (hintStrings.size() > 0)
@@ -532,7 +640,7 @@ FPAnswerPtr DataRouterQuestProcessor::sTransaction(const FPReaderPtr args, const
 		task->_sqls = args->want("sqls", std::vector<std::string>());
 
 		//-- Check table split type.
-		std::shared_ptr<TableManager> tm = _monitor.getTableManager();
+		TableManagerSnapshot tm = _monitor.getTableManager();
 		if (!tm)
 			task->finish(ErrorInfo::unconfiguredAnswer(quest));
 
@@ -555,6 +663,208 @@ FPAnswerPtr DataRouterQuestProcessor::sTransaction(const FPReaderPtr args, const
 		}
 	}
 
-	uniformTransactionQuery(quest, task);
+	uniformTransactionQuery(quest, ci, task);
 	return nullptr;
 }
+void DataRouterQuestProcessor::multiQueryItem(TableManager* tm, MultiQueryTaskPtr multiTask, int index, int64_t hintId, std::string& tableName, std::string& sql, std::vector<std::string>& params, bool master, const std::string& session, int qosClass)
+{
+	if (hintId < 0)
+	{
+		multiTask->fillError(index, ErrorInfo::invalidParametersCode, "HintId cannot be negative value.");
+		return;
+	}
+
+	SQLParser::extractSQL(sql);
+
+	bool forceMasterTask;
+	if (params.empty())
+	{
+		if (!SQLParser::pretreatSQL(sql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
+		{
+			multiTask->fillError(index, ErrorInfo::disabledCode, "Disabled SQL statement type.");
+			return;
+		}
+
+		if (!QoSController::admitTable(tableName, qosClass))
+		{
+			multiTask->fillError(index, ErrorInfo::serverBusyCode, "Rate limit exceeded.");
+			return;
+		}
+
+		QueryTaskPtr task = std::make_shared<QueryTask>(sql, tableName, index, multiTask);
+		task->setQoSClass(qosClass);
+		task->setSession(session);
+		tm->query(hintId, master | forceMasterTask, task);
+		return;
+	}
+
+	std::string semisql;
+	std::vector<std::string> restParams;
+
+	if (!ParamsQueryTask::preassemble(sql, params, semisql, restParams))
+	{
+		multiTask->fillError(index, ErrorInfo::invalidParametersCode, "Invalid parameters.");
+		return;
+	}
+	if (!SQLParser::pretreatSQL(semisql, forceMasterTask, (tableName.empty() ? &tableName : NULL)))
+	{
+		multiTask->fillError(index, ErrorInfo::disabledCode, "Disabled SQL statement type.");
+		return;
+	}
+
+	if (!QoSController::admitTable(tableName, qosClass))
+	{
+		multiTask->fillError(index, ErrorInfo::serverBusyCode, "Rate limit exceeded.");
+		return;
+	}
+
+	ParamsQueryTaskPtr task = std::make_shared<ParamsQueryTask>(semisql, tableName, std::move(restParams), index, multiTask);
+	task->setQoSClass(qosClass);
+	task->setSession(session);
+	tm->query(hintId, master | forceMasterTask, task);
+}
+FPAnswerPtr DataRouterQuestProcessor::multiQuery(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	std::vector<int64_t> hintIds = args->want("hintIds", std::vector<int64_t>());
+	std::vector<std::string> tableNames = args->want("tableNames", std::vector<std::string>());
+	std::vector<std::string> sqls = args->want("sqls", std::vector<std::string>());
+
+	std::vector<std::vector<std::string>> params;
+	params = args->get("params", params);
+
+	std::vector<bool> masters;
+	masters = args->get("masters", masters);
+
+	if (sqls.empty() || hintIds.size() != sqls.size() || tableNames.size() != sqls.size()
+		|| (params.size() && params.size() != sqls.size()) || (masters.size() && masters.size() != sqls.size()))
+		return ErrorInfo::invalidParametersAnswer(quest);
+
+	TableManagerSnapshot tm = _monitor.getTableManager();
+	if (!tm)
+		return ErrorInfo::unconfiguredAnswer(quest);
+
+	int qosClass = QoSInteractive;
+	if (!QoSController::admitClient(ci.ip, qosClass))
+		return ErrorInfo::rateLimitedAnswer(quest);
+
+	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
+	MultiQueryTaskPtr multiTask = std::make_shared<MultiQueryTask>(async, sqls.size());
+	std::string session = readYourWritesSession(args, ci);
+
+	std::vector<std::string> emptyParams;
+	for (size_t i = 0; i < sqls.size(); i++)
+	{
+		multiQueryItem(tm.get(), multiTask, (int)i, hintIds[i], tableNames[i], sqls[i],
+			(params.size() ? params[i] : emptyParams), (masters.size() ? masters[i] : false), session, qosClass);
+	}
+
+	return nullptr;
+}
+FPAnswerPtr DataRouterQuestProcessor::xaTransaction(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	if (!XATransaction::enabled())
+		return ErrorInfo::disabledAnswer(quest, "XA transaction is disabled.");
+
+	std::shared_ptr<IAsyncAnswer> async = genAsyncAnswer(quest);
+	XATransactionPtr xa = std::make_shared<XATransaction>(async);
+
+	xa->_hintIds = args->want("hintIds", std::vector<int64_t>());
+	xa->_tableNames = args->want("tableNames", std::vector<std::string>());
+	xa->_sqls = args->want("sqls", std::vector<std::string>());
+	xa->setSession(readYourWritesSession(args, ci));
+
+	for (int64_t hintId: xa->_hintIds)
+	{
+		if (hintId < 0)
+		{
+			xa->finish(ErrorInfo::invalidParametersCode, "HintId cannot be negative value.");
+			return nullptr;
+		}
+	}
+
+	if (xa->_sqls.empty() || xa->_hintIds.size() != xa->_tableNames.size() || xa->_hintIds.size() != xa->_sqls.size())
+	{
+		xa->finish(ErrorInfo::disabledCode, "Invalid transaction. Parameters cannot matched.");
+		return nullptr;
+	}
+
+	bool tmp;
+	for (size_t i = 0; i < xa->_sqls.size(); i++)
+	{
+		SQLParser::extractSQL(xa->_sqls[i]);
+		if (!SQLParser::pretreatSQL(xa->_sqls[i], tmp, NULL))
+		{
+			xa->finish(ErrorInfo::disabledCode, i, "Invalid statement.");
+			return nullptr;
+		}
+	}
+
+	int qosClass = QoSInteractive;
+	if (!QoSController::admit(ci.ip, xa->_tableNames, qosClass))
+	{
+		xa->finish(ErrorInfo::serverBusyCode, "Rate limit exceeded.");
+		return nullptr;
+	}
+
+	TableManagerSnapshot tm = _monitor.getTableManager();
+	if (tm)
+		tm->xaTransaction(xa);
+	else
+		xa->finish(ErrorInfo::unconfiguredCode, "DB unconfigured.");
+
+	return nullptr;
+}
+
+FPAnswerPtr DataRouterQuestProcessor::asyncWrite(const FPReaderPtr args, const FPQuestPtr quest, const ConnectionInfo& ci)
+{
+	if (!AsyncWriteSpool::enabled())
+		return ErrorInfo::disabledAnswer(quest, "Async write is disabled.");
+
+	AsyncWriteSpool::Record record;
+	record.hintId = args->wantInt("hintId");
+	if (record.hintId < 0)
+		return ErrorInfo::negativeHintIdAnswer(quest);
+
+	record.tableName = args->get("tableName", std::string());
+	std::string sql = args->want("sql", std::string());
+
+	std::vector<std::string> params;
+	params = args->get("params", params);
+
+	SQLParser::extractSQL(sql);
+
+	if (params.size())
+	{
+		if (!ParamsQueryTask::preassemble(sql, params, record.sql, record.params))
+			return ErrorInfo::invalidParametersAnswer(quest);
+	}
+	else
+		record.sql.swap(sql);
+
+	bool forceMasterTask;
+	if (!SQLParser::isDataModificationSQL(record.sql)
+		|| !SQLParser::pretreatSQL(record.sql, forceMasterTask, (record.tableName.empty() ? &record.tableName : NULL)))
+		return ErrorInfo::disabledAnswer(quest, "Only update, insert, replace and delete can be written asynchronously.");
+
+	TableManagerSnapshot tm = _monitor.getTableManager();
+	if (!tm)
+		return ErrorInfo::unconfiguredAnswer(quest);
+
+	bool splitByRange;
+	if (!tm->splitType(record.tableName, splitByRange))
+		return ErrorInfo::tableNotFoundAnswer(quest);
+
+	int qosClass = QoSInteractive;
+	if (!QoSController::admit(ci.ip, record.tableName, qosClass))
+		return ErrorInfo::rateLimitedAnswer(quest);
+
+	record.appendMsec = exact_real_msec();
+
+	int code = AsyncWriteSpool::append(record);
+	if (code == ErrorInfo::serverBusyCode)
+		return FPAWriter::errorAnswer(quest, code, "Async write spool is full.", ErrorInfo::raiser_DataRouter);
+	else if (code)
+		return FPAWriter::errorAnswer(quest, code, "Append to async write spool failed.", ErrorInfo::raiser_DataRouter);
+
+	return FPAWriter::emptyAnswer(quest);
+}
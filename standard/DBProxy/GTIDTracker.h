@@ -0,0 +1,73 @@
+#ifndef GTID_Tracker_H
+#define GTID_Tracker_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+class MySQLClient;
+
+//========================================//
+//- GTID Tracker
+//========================================//
+/*
+	Read-your-writes consistency. The GTID of the last write of a session is recorded per master instance,
+	by session_track_gtids = OWN_GTID. A session is a client connection, or a session token provided by the client.
+	The reads of the session executed by the replicas wait for the replica applying the recorded GTID,
+	and are enqueued to the master if the replica is not caught up in time.
+	The executed positions confirmed by the replicas are cached, so the following reads need not wait again.
+*/
+class GTIDTracker
+{
+	struct Position		//-- Waiting for uuid:1-number. Empty uuid means the GTID of the write is unknown.
+	{
+		std::string uuid;
+		int64_t number;
+
+		Position(): number(0) {}
+	};
+
+	struct Session
+	{
+		std::map<int, Position> positions;		//-- master server id => position
+		int64_t expireMsec;
+	};
+
+	static bool _enabled;
+	static int _waitTimeoutMsec;
+	static int64_t _sessionTTLMsec;
+
+	static std::mutex _mutex;
+	static std::unordered_map<std::string, Session> _sessions;
+	static int64_t _nextSweepMsec;
+
+	static std::mutex _executedMutex;
+	static std::unordered_map<std::string, std::unordered_map<std::string, int64_t>> _executed;	//-- replica endpoint => uuid => executed number
+
+	static std::atomic<uint64_t> _recordedCount;
+	static std::atomic<uint64_t> _untrackedCount;
+	static std::atomic<uint64_t> _cachedCount;
+	static std::atomic<uint64_t> _waitedCount;
+	static std::atomic<uint64_t> _fallbackCount;
+
+	static bool parse(const std::string& gtid, Position& position);
+	static void update(const std::string& session, int masterServerId, const Position& position);
+	static bool required(const std::string& session, int masterServerId, Position& position);
+
+public:
+	static void config(int waitTimeoutMsec, int sessionTTLSeconds);
+	static inline bool enabled() { return _enabled; }
+
+	//-- Called after a write of the session is executed by the master, and before it is answered.
+	static void record(const std::string& session, int masterServerId, MySQLClient* mySQL);
+	//-- For the writes whose GTID can not be tracked, such as XA and multi-query. The reads of the session go to the master.
+	static void recordUntracked(const std::string& session, int masterServerId);
+	//-- Returns false if the replica is not caught up with the session, and the read should be executed by the master.
+	static bool caughtUp(const std::string& session, int masterServerId, MySQLClient* mySQL);
+
+	static std::string statusInJSON();
+};
+
+#endif
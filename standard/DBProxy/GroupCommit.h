@@ -0,0 +1,113 @@
+#ifndef Group_Commit_H
+#define Group_Commit_H
+
+#include <set>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include "TaskPackage.h"
+
+class GroupCommitCollector;
+
+//========================================//
+//- Group Commit Task
+//========================================//
+class GroupCommitTask: public TaskPackage
+{
+	bool _sealed;			//-- Protected by the mutex of the collector.
+	std::chrono::steady_clock::time_point _sealTime;
+	GroupCommitCollector* _collector;
+	std::vector<QueryTaskPtr> _tasks;
+
+	friend class GroupCommitCollector;
+
+	//-- owners: indexes of tasks for each statement. Return the count of the statements merged into others.
+	size_t combine(const std::vector<QueryTaskPtr>& tasks, std::vector<std::string>& sqls,
+		std::vector<std::vector<size_t>>& owners, size_t& combinableCount);
+
+public:
+	GroupCommitTask(GroupCommitCollector* collector, QueryTaskPtr task);
+	virtual ~GroupCommitTask() {}
+
+	virtual void processTask(MySQLClient *mySQL) throw ();
+};
+typedef std::shared_ptr<GroupCommitTask> GroupCommitTaskPtr;
+
+//========================================//
+//- Group Commit Collector
+//========================================//
+/*
+	Small writes to the same database of a DatabaseTaskQueue, arrived within the window,
+	are executed by one worker in one transaction. If a statement failed before COMMIT and
+	the transaction is rolled back, they will be executed one by one, so that a failed statement
+	only fails itself. If the COMMIT or the rollback failed, the writes may be applied, all of
+	them are answered with the error, and never executed again.
+
+	A group is pushed into the write queue when it is full, or by the seal thread when the window
+	is expired. The workers never wait for the window.
+
+	For the counter combining tables, additive updates on the same key and sub-table in a group
+	are merged into one statement with the summed delta.
+*/
+class GroupCommitCollector
+{
+	std::mutex _mutex;
+	std::map<std::string, GroupCommitTaskPtr> _openGroups;		//-- key: database name.
+	std::function<void (GroupCommitTaskPtr)> _dispatcher;		//-- Push the group sealed by timer into the write queue.
+	std::atomic<int> _timedGroups;		//-- Groups referred by the seal thread.
+
+	std::atomic<uint64_t> _groupCount;
+	std::atomic<uint64_t> _groupedTaskCount;
+	std::atomic<uint64_t> _fallbackCount;
+	std::atomic<uint64_t> _uncertainCount;
+	std::atomic<uint64_t> _combinableCount;
+	std::atomic<uint64_t> _mergedCount;
+
+	int64_t _lastStatusMsec;
+	uint64_t _lastMergedCount;
+
+	static std::set<std::string> _tables;
+	static std::set<std::string> _counterTables;
+	static int _windowMsec;
+	static size_t _maxStatements;		//-- Statements per group.
+
+	static std::mutex _timerMutex;
+	static std::condition_variable _timerCondition;
+	static std::multimap<std::chrono::steady_clock::time_point, GroupCommitTaskPtr> _timers;
+	static std::thread _sealThread;
+	static std::atomic<bool> _sealing;
+	static bool _willExit;
+
+	static void sealThread();
+	void seal(GroupCommitTaskPtr group);
+
+public:
+	GroupCommitCollector(): _timedGroups(0), _groupCount(0), _groupedTaskCount(0), _fallbackCount(0), _uncertainCount(0),
+		_combinableCount(0), _mergedCount(0), _lastStatusMsec(0), _lastMergedCount(0) {}
+
+	inline void setDispatcher(std::function<void (GroupCommitTaskPtr)> dispatcher) { _dispatcher = dispatcher; }
+	inline bool idle() { return _timedGroups == 0; }
+
+	//-- Return the sealed group which should be pushed into the write queue, or nullptr if the task is held by an opened group.
+	GroupCommitTaskPtr add(QueryTaskPtr task);
+	void executed(size_t taskCount, MySQLClient::GroupTransactionStatus status);
+	void combined(size_t combinableCount, size_t mergedCount);
+	std::string statusInJSON();
+
+	static void config(const std::string& tables, const std::string& counterTables, int windowMsec, int maxSize);
+	static void start();
+	static void stop();		//-- The opened groups are pushed into the write queues.
+	static inline bool configured() { return !_tables.empty() || !_counterTables.empty(); }
+	static inline bool enabled(const std::string& tableName)
+	{
+		return _tables.find(tableName) != _tables.end() || _counterTables.find(tableName) != _counterTables.end();
+	}
+	static inline bool counterCombining(const std::string& tableName) { return _counterTables.find(tableName) != _counterTables.end(); }
+	static inline int windowMsec() { return _windowMsec; }
+};
+
+#endif
@@ -0,0 +1,308 @@
+#include <list>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "msec.h"
+#include "FPLog.h"
+#include "MySQLClient.h"
+#include "TableManager.h"
+#include "HealthChecker.h"
+
+//========================================//
+//- Circuit Breaker
+//========================================//
+static const char* stateNames[] = { "closed", "open", "halfOpen" };
+
+CircuitBreaker::CircuitBreaker(const DatabaseInfo* dbInfo): _state(Closed), _failures(0), _openedTime(0), _openedCount(0),
+	host(dbInfo->host), port(dbInfo->port), username(dbInfo->username), password(dbInfo->password)
+{
+}
+
+void CircuitBreaker::transit(int fromState, int toState)
+{
+	if (!_state.compare_exchange_strong(fromState, toState))
+		return;
+
+	if (toState == Open)
+	{
+		_openedTime = slack_real_sec();
+		_openedCount++;
+		LOG_ERROR("Circuit breaker of MySQL %s:%d is opened. Consecutive connection failures: %d.", host.c_str(), port, (int)_failures);
+	}
+	else
+	{
+		LOG_INFO("Circuit breaker of MySQL %s:%d is %s.", host.c_str(), port, stateNames[toState]);
+
+		std::list<std::shared_ptr<CircuitBreakerListener>> listeners;
+		{
+			std::lock_guard<std::mutex> lck (_listenerMutex);
+			for (auto iter = _listeners.begin(); iter != _listeners.end(); )
+			{
+				std::shared_ptr<CircuitBreakerListener> listener = iter->lock();
+				if (listener)
+				{
+					listeners.push_back(listener);
+					iter++;
+				}
+				else
+					iter = _listeners.erase(iter);
+			}
+		}
+
+		for (auto& listener: listeners)
+			listener->breakerAvailable();
+	}
+}
+
+void CircuitBreaker::subscribe(std::weak_ptr<CircuitBreakerListener> listener)
+{
+	std::lock_guard<std::mutex> lck (_listenerMutex);
+	for (auto iter = _listeners.begin(); iter != _listeners.end(); )
+	{
+		if (iter->expired())
+			iter = _listeners.erase(iter);
+		else
+			iter++;
+	}
+	_listeners.push_back(listener);
+}
+
+void CircuitBreaker::reportSuccess()
+{
+	_failures = 0;
+	if (_state == HalfOpen)
+		transit(HalfOpen, Closed);
+}
+
+void CircuitBreaker::reportFailure()
+{
+	int failures = ++_failures;
+	int state = _state;
+
+	if (state == HalfOpen || (state == Closed && failures >= HealthChecker::failureThreshold()))
+		transit(state, Open);
+}
+
+void CircuitBreaker::probed(bool success)
+{
+	if (!success)
+		reportFailure();
+	else if (_state == Open)
+	{
+		_failures = 0;
+		transit(Open, HalfOpen);
+	}
+	else
+		reportSuccess();
+}
+
+std::string CircuitBreaker::endpoint()
+{
+	return host + ":" + std::to_string(port);
+}
+
+std::string CircuitBreaker::infos()
+{
+	std::ostringstream oss;
+	oss<<"{\"state\":\""<<stateNames[_state]<<"\"";
+	oss<<",\"failures\":"<<_failures;
+	oss<<",\"openedCount\":"<<_openedCount;
+	oss<<",\"lastOpenedTime\":"<<_openedTime<<"}";
+	return oss.str();
+}
+
+//========================================//
+//- Health Checker
+//========================================//
+std::mutex HealthChecker::_mutex;
+std::condition_variable HealthChecker::_condition;
+std::map<std::string, std::weak_ptr<CircuitBreaker>> HealthChecker::_breakers;
+std::thread HealthChecker::_checkThread;
+bool HealthChecker::_willExit = false;
+int HealthChecker::_checkInterval = 0;
+int HealthChecker::_failureThreshold = 3;
+int HealthChecker::_connectTimeout = 2;
+int HealthChecker::_probeThreadCount = 8;
+
+void HealthChecker::config(int checkInterval, int failureThreshold, int connectTimeout, int probeThreadCount)
+{
+	_checkInterval = checkInterval > 0 ? checkInterval : 0;
+	_failureThreshold = failureThreshold > 0 ? failureThreshold : 1;
+	_connectTimeout = connectTimeout > 0 ? connectTimeout : 1;
+	_probeThreadCount = probeThreadCount > 0 ? probeThreadCount : 1;
+}
+
+void HealthChecker::start()
+{
+	if (!enabled() || _checkThread.joinable())
+		return;
+
+	_willExit = false;
+	_checkThread = std::thread(&HealthChecker::checkThread);
+	LOG_INFO("Health checker started. Interval: %d seconds, failure threshold: %d, probe threads: %d.", _checkInterval, _failureThreshold, _probeThreadCount);
+}
+
+void HealthChecker::stop()
+{
+	if (!_checkThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		_willExit = true;
+		_condition.notify_all();
+	}
+	_checkThread.join();
+}
+
+std::string HealthChecker::breakerKey(const DatabaseInfo* dbInfo)
+{
+	std::string key(dbInfo->host);
+	key.append(":").append(std::to_string(dbInfo->port));
+	key.append("\n").append(dbInfo->username);
+	key.append("\n").append(dbInfo->password);
+	return key;
+}
+
+CircuitBreakerPtr HealthChecker::circuitBreaker(const DatabaseInfo* dbInfo)
+{
+	if (!enabled())
+		return nullptr;
+
+	std::string key = breakerKey(dbInfo);
+
+	std::lock_guard<std::mutex> lck (_mutex);
+	CircuitBreakerPtr breaker = _breakers[key].lock();
+	if (!breaker)
+	{
+		breaker = std::make_shared<CircuitBreaker>(dbInfo);
+		_breakers[key] = breaker;
+	}
+	return breaker;
+}
+
+void HealthChecker::probe(CircuitBreakerPtr breaker, MySQLClient*& client)
+{
+	bool success;
+	if (!client)
+	{
+		client = new MySQLClient(breaker->host, breaker->port, breaker->username, breaker->password, std::string(), _connectTimeout);
+		success = client->connected();
+	}
+	else if (client->connected() && client->ping())
+		success = true;
+	else
+	{
+		client->cleanup();
+		success = client->connect();
+	}
+
+	//-- The instance answered. The rejected credentials are reported by the workers as the task errors.
+	if (!success && client->authenticationFailed())
+	{
+		LOG_WARN("Health checker: MySQL %s:%d rejected the authentication of user %s.", breaker->host.c_str(), breaker->port, breaker->username.c_str());
+		success = true;
+	}
+
+	breaker->probed(success);
+}
+
+void HealthChecker::checkThread()
+{
+	mysql_thread_init();
+
+	//-- Probing connections, only used in this thread.
+	std::map<std::string, MySQLClient*> clients;
+
+	while (true)
+	{
+		std::list<std::pair<std::string, CircuitBreakerPtr>> breakers;
+		{
+			std::unique_lock<std::mutex> lck (_mutex);
+			if (!_willExit)
+				_condition.wait_for(lck, std::chrono::seconds(_checkInterval));
+
+			if (_willExit)
+				break;
+
+			for (auto iter = _breakers.begin(); iter != _breakers.end(); )
+			{
+				CircuitBreakerPtr breaker = iter->second.lock();
+				if (breaker)
+				{
+					breakers.push_back(std::make_pair(iter->first, breaker));
+					iter++;
+				}
+				else
+				{
+					auto cit = clients.find(iter->first);
+					if (cit != clients.end())
+					{
+						delete cit->second;
+						clients.erase(cit);
+					}
+					iter = _breakers.erase(iter);
+				}
+			}
+		}
+
+		if (breakers.empty())
+			continue;
+
+		//-- Probed in parallel, so a slow or dead instance only holds up its own probe.
+		//-- The slots of the clients map are created here. Each one is only touched by the thread probing it.
+		std::vector<std::pair<CircuitBreakerPtr, MySQLClient**>> probes;
+		for (auto& breakerPair: breakers)
+			probes.push_back(std::make_pair(breakerPair.second, &clients[breakerPair.first]));
+
+		std::atomic<size_t> nextIndex(0);
+		auto probeFunc = [&]() {
+			mysql_thread_init();
+			while (true)
+			{
+				size_t idx = nextIndex++;
+				if (idx >= probes.size())
+					break;
+
+				probe(probes[idx].first, *(probes[idx].second));
+			}
+			mysql_thread_end();
+		};
+
+		std::vector<std::thread> threads;
+		size_t threadCount = std::min((size_t)_probeThreadCount, probes.size());
+		for (size_t i = 0; i < threadCount; i++)
+			threads.push_back(std::thread(probeFunc));
+
+		for (auto& thread: threads)
+			thread.join();
+	}
+
+	for (auto& clientPair: clients)
+		delete clientPair.second;
+
+	mysql_thread_end();
+}
+
+std::string HealthChecker::statusInJSON()
+{
+	int counts[3] = { 0, 0, 0 };
+	{
+		std::lock_guard<std::mutex> lck (_mutex);
+		for (auto& breakerPair: _breakers)
+		{
+			CircuitBreakerPtr breaker = breakerPair.second.lock();
+			if (breaker)
+				counts[breaker->state()] += 1;
+		}
+	}
+
+	std::ostringstream oss;
+	oss<<"{\"enabled\":"<<(enabled() ? "true" : "false");
+	oss<<",\"interval\":"<<_checkInterval;
+	oss<<",\"failureThreshold\":"<<_failureThreshold;
+	oss<<",\"closed\":"<<counts[CircuitBreaker::Closed];
+	oss<<",\"open\":"<<counts[CircuitBreaker::Open];
+	oss<<",\"halfOpen\":"<<counts[CircuitBreaker::HalfOpen]<<"}";
+	return oss.str();
+}
@@ -0,0 +1,127 @@
+#ifndef Health_Checker_H
+#define Health_Checker_H
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <condition_variable>
+
+struct DatabaseInfo;
+class MySQLClient;
+
+//-- Notified when the breaker becomes available, out of the locks of the breaker.
+class CircuitBreakerListener
+{
+public:
+	virtual ~CircuitBreakerListener() {}
+	virtual void breakerAvailable() = 0;
+};
+
+//========================================//
+//- Circuit Breaker
+//========================================//
+/*
+	One breaker per MySQL instance and credentials. Shared by the DatabaseInfos of the same endpoint and account,
+	and kept across config reloading. The changed password of the account gets a new breaker.
+	Closed: available. The consecutive connection failures reaching the threshold open it.
+		The rejected authentications are not connection failures.
+	Open: unavailable. The workers stop taking tasks, and the new tasks are fast-failed or left to the other replicas.
+		A successful probe of the health checker half-opens it.
+	HalfOpen: available for trial. A success closes it, and a failure opens it again.
+	The listeners are notified when it is half-opened or closed, so the tasks queued while it is open are taken again.
+*/
+class CircuitBreaker
+{
+public:
+	enum State
+	{
+		Closed = 0,
+		Open = 1,
+		HalfOpen = 2
+	};
+
+private:
+	std::atomic<int> _state;
+	std::atomic<int> _failures;				//-- Consecutive connection failures.
+	std::atomic<int64_t> _openedTime;
+	std::atomic<uint64_t> _openedCount;
+
+	std::mutex _listenerMutex;
+	std::list<std::weak_ptr<CircuitBreakerListener>> _listeners;
+
+	void transit(int fromState, int toState);
+
+public:
+	const std::string host;
+	const int port;
+	const std::string username;
+	const std::string password;
+
+	CircuitBreaker(const DatabaseInfo* dbInfo);
+
+	inline int state() { return _state; }
+	inline bool available() { return _state != Open; }
+
+	void reportSuccess();
+	void reportFailure();
+	inline void report(bool success)
+	{
+		if (success)
+		{
+			if (_failures || _state != Closed)
+				reportSuccess();
+		}
+		else
+			reportFailure();
+	}
+	void probed(bool success);		//-- Called by the health checker.
+	void subscribe(std::weak_ptr<CircuitBreakerListener> listener);
+
+	std::string endpoint();
+	std::string infos();
+};
+typedef std::shared_ptr<CircuitBreaker> CircuitBreakerPtr;
+
+//========================================//
+//- Health Checker
+//========================================//
+/*
+	Background thread probes every attached MySQL instance in each interval, with a dedicated connection.
+	The instances are probed in parallel by at most probeThreadCount threads, joined before the next interval.
+	The worker threads report the connection lost of the executed tasks to the breakers.
+*/
+class HealthChecker
+{
+	static std::mutex _mutex;
+	static std::condition_variable _condition;
+	static std::map<std::string, std::weak_ptr<CircuitBreaker>> _breakers;		//-- Key: endpoint and credentials.
+	static std::thread _checkThread;
+	static bool _willExit;
+
+	static int _checkInterval;			//-- 0 means disabled.
+	static int _failureThreshold;
+	static int _connectTimeout;
+	static int _probeThreadCount;
+
+	static void checkThread();
+	static void probe(CircuitBreakerPtr breaker, MySQLClient*& client);
+	static std::string breakerKey(const DatabaseInfo* dbInfo);
+
+public:
+	static void config(int checkInterval, int failureThreshold, int connectTimeout, int probeThreadCount);
+	static void start();
+	static void stop();
+
+	static inline bool enabled() { return _checkInterval > 0; }
+	static inline int failureThreshold() { return _failureThreshold; }
+
+	//-- Returns nullptr if disabled.
+	static CircuitBreakerPtr circuitBreaker(const DatabaseInfo* dbInfo);
+	static std::string statusInJSON();
+};
+
+#endif
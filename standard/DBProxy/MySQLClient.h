@@ -2,11 +2,13 @@
 #define MySQL_Client_h_
 
 #include <mutex>
+#include <atomic>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <mysql.h>
 #include <errmsg.h>
+#include <mysqld_error.h>
 #include "FPWriter.h"
 
 using fpnn::FPAnswerPtr;
@@ -26,6 +28,7 @@ struct QueryResult
 	std::vector<std::vector<std::string>> rows;
 	int affectedRows;
 	int64_t insertId;
+	std::string errorInfo;
 
 	QueryResult(): type(ErrorType), affectedRows(0), insertId(0) {}
 };
@@ -43,13 +46,22 @@ class MySQLClient
 	int _timeout_seconds;
 	
 	time_t _lastOperated;
+	unsigned long _gtidTrackedThreadId;		//-- The auto reconnected session needs tracking again.
+	unsigned long _xaDetachedThreadId;		//-- The session checked xa_detach_on_prepare = ON.
+	unsigned int _connectErrno;				//-- Error of the last failed connecting.
 
-	static std::mutex _mutex;
 	static std::string _default_connection_charset;
+	static std::atomic<uint64_t> _selectDBCount;
+	static bool _trackGTIDs;
 	
 private:
 	FPAnswerPtr generateExceptionAnswer(const FPQuestPtr quest);
 	FPAnswerPtr generateExceptionAnswer(const FPQuestPtr quest, int index, const std::string& sql);
+	bool recordException(QueryResult &result);
+	std::string exceptionInfo();
+	bool executeStatement(const std::string& sql, std::string& error);
+	void trackGTIDs();
+	bool xaDetachOnPrepare(std::string& error);
 	
 	inline void cleanCheck(unsigned int mySQLErrno)
 	{
@@ -61,9 +73,17 @@ private:
 	FPAnswerPtr executeTranscationStatement(const std::string& sql, const FPQuestPtr quest, int index);
 	
 public:
+	enum GroupTransactionStatus
+	{
+		GroupCommitted,
+		GroupRolledBack,
+		GroupCommitUnknown
+	};
+
 	static void MySQLClientInit();
 	static void MySQLClientEnd();
 	static void setDefaultConnectionCharacterSetName(const std::string& connCharacterSetName);
+	static void enableGTIDTracking() { _trackGTIDs = true; }		//-- session_track_gtids = OWN_GTID for the new connections.
 	
 	MySQLClient(const std::string &host, int port, const std::string &username, const std::string &password, const std::string &database = std::string(), int timeout_seconds = 0);
 	~MySQLClient();
@@ -72,13 +92,44 @@ public:
 	void cleanup();
 	
 	inline time_t lastOperatedTime() { return _lastOperated; }
+	inline const std::string& currentDatabase() { return _database; }
+	inline std::string endpoint() { return _host + ":" + std::to_string(_port); }
+	static inline uint64_t selectDBCount() { return _selectDBCount; }
 	inline bool connected() { return (_client != NULL); }
+	inline unsigned int lastErrno() { return (_client ? mysql_errno(_client) : CR_SERVER_LOST); }
+	//-- The instance is reachable, but rejected the credentials. Not a connection failure of the instance.
+	inline bool authenticationFailed()
+	{
+		return !_client && (_connectErrno == ER_DBACCESS_DENIED_ERROR || _connectErrno == ER_ACCESS_DENIED_ERROR
+			|| _connectErrno == ER_NOT_SUPPORTED_AUTH_MODE || _connectErrno == ER_MUST_CHANGE_PASSWORD_LOGIN);
+	}
+	inline bool connectionLost()
+	{
+		unsigned int mySQLErrno = lastErrno();
+		return (mySQLErrno == CR_SERVER_GONE_ERROR || mySQLErrno == CR_SERVER_LOST);
+	}
 	bool ping();
 	void escapeStrings(std::vector<std::string>& strings);
 
+	//-- GTID of the last committed statement. Returns false if it is not tracked.
+	bool ownGTID(std::string& gtid);
+	//-- Returns false if the statement failed, otherwise executed is setted.
+	bool waitForExecutedGTIDSet(const std::string& gtidSet, int timeoutMsec, bool& executed);
+
 	FPAnswerPtr query(const std::string& database, const std::string& sql, const FPQuestPtr quest);
 	bool query(const std::string& database, const std::string& sql, QueryResult &result);
 	FPAnswerPtr transaction(const std::string& database, const std::vector<std::string>& sqls, const FPQuestPtr quest);
+	//-- If any statement failed, the whole transaction is rollbacked, and results will be cleared.
+	//-- GroupRolledBack: nothing is applied. GroupCommitUnknown: the commit or the rollback failed, the writes may be applied.
+	GroupTransactionStatus groupTransaction(const std::string& database, const std::vector<std::string>& sqls,
+		std::vector<QueryResultPtr>& results, std::string& error);
+
+	//-- XA functions. xid format: 'gtrid','bqual'
+	bool xaPrepare(const std::string& xid, const std::vector<std::string>& databases, const std::vector<std::string>& sqls,
+		bool onePhase, int& failedIndex, std::string& error);
+	bool xaCommit(const std::string& xid, std::string& error);
+	bool xaRollback(const std::string& xid, std::string& error);
+	bool xaRecover(std::vector<std::pair<std::string, std::string>>& xids, std::string& error);	//-- pair: gtrid, bqual
 };
 
 #endif
@@ -5,6 +5,7 @@
   INCLUDES AND VARIABLE DEFINITIONS
   =============================================================================== */
 #include <mutex>
+#include <atomic>
 #include <list>
 #include <memory>
 #include <thread>
@@ -15,6 +16,7 @@
   CLASS & STRUCTURE DEFINITIONS
   =============================================================================== */
 struct DatabaseInfo;
+class MySQLClient;
 
 class MySQLTaskThreadPool
 {
@@ -35,19 +37,24 @@ class MySQLTaskThreadPool
 
 		IMySQLTaskQueue*		_taskQueue;
 		std::list<std::thread>	_threadList;
+		std::list<MySQLClient*>	_warmedClients;			//-- Taken by the work threads before connecting new ones.
 
 		bool					_inited;
 		bool					_willExit;
 
 		DatabaseInfo*			_dbInfo;
 
+		static std::atomic<uint64_t>	_executedTaskCount;		//-- All pools.
+
 		void					ReviseDataRelation();
 		bool					append();
+		MySQLClient*			takeConnection();
 		void					process();
 		void					temporaryProcess();
 
 	public:
 		bool					init(int32_t initCount, int32_t perAppendCount, int32_t perfectCount, int32_t maxCount, size_t tempThreadLatencySeconds);
+		void					adoptConnections(std::list<MySQLClient*>& clients);		//-- Call before init().
 		bool					wakeUp();
 		bool					isBusy();
 		void					release();
@@ -64,6 +71,11 @@ class MySQLTaskThreadPool
 			return _willExit;
 		}
 
+		static inline uint64_t executedTaskCount()
+		{
+			return _executedTaskCount;
+		}
+
 		MySQLTaskThreadPool(IMySQLTaskQueue *taskQueue, DatabaseInfo* dbInfo):
 			_initCount(0), _appendCount(0), _perfectCount(0), _maxCount(0), _tempThreadLatencySeconds(0),
 			_normalThreadCount(0), _busyThreadCount(0), _tempThreadCount(0),
@@ -0,0 +1,94 @@
+#ifndef QoS_Controller_H
+#define QoS_Controller_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+//========================================//
+//- Token Bucket
+//========================================//
+class TokenBucket
+{
+	std::mutex _mutex;
+	double _tokens;
+	int64_t _lastMsec;
+
+public:
+	const int rate;			//-- Tokens per second.
+	const int burst;
+	std::atomic<uint64_t> limitedCount;
+
+	TokenBucket(int rate_, int burst_);
+	bool take();
+	void refund();			//-- Returns the token taken by a rejected request.
+};
+typedef std::shared_ptr<TokenBucket> TokenBucketPtr;
+
+//========================================//
+//- QoS Controller
+//========================================//
+/*
+	Rules are loaded from the qos_rule table of the config database, and checked before the tasks are enqueued.
+	Client rules are keyed by the client address, and table rules by the table name.
+	The task takes the lowest priority class of the matched rules, and the task queues schedule the classes by weights.
+*/
+enum QoSClass
+{
+	QoSInteractive = 0,
+	QoSBatch = 1,
+	QoSBackground = 2,
+	QoSClassCount
+};
+
+struct QoSRule
+{
+	int qosClass;
+	TokenBucketPtr bucket;		//-- nullptr means unlimited.
+};
+
+class QoSController
+{
+public:
+	enum RuleType
+	{
+		ClientRule = 0,
+		TableRule = 1,
+		RuleTypeCount
+	};
+
+	struct Rules
+	{
+		std::unordered_map<std::string, QoSRule> rules[RuleTypeCount];
+
+		//-- rate: requests per second, 0 means unlimited. burst: 0 means same as rate.
+		bool addRule(int type, const std::string& target, int rate, int burst, int qosClass);
+	};
+	typedef std::shared_ptr<Rules> RulesPtr;
+
+private:
+	static RulesPtr _rules;
+	static std::atomic<bool> _configured;
+	static std::atomic<uint64_t> _limitedCount;
+
+	//-- taken: the buckets whose tokens are taken, for refunding if the later rules reject.
+	static bool admit(Rules* rules, RuleType type, const std::string& key, int& qosClass, std::vector<TokenBucket*>* taken = NULL);
+	static void refund(std::vector<TokenBucket*>& taken);
+
+public:
+	//-- The buckets of the unchanged rules are kept.
+	static void update(RulesPtr rules);
+
+	//-- Returns false if the rate limit is exceeded. qosClass is lowered by the matched rules.
+	static bool admitClient(const std::string& client, int& qosClass);
+	static bool admitTable(const std::string& tableName, int& qosClass);
+	static bool admit(const std::string& client, const std::string& tableName, int& qosClass);
+	static bool admit(const std::string& client, const std::vector<std::string>& tableNames, int& qosClass);
+
+	static std::string statusInJSON();
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "SQLLexer.h"
+#include "SQLScanner.h"
+
+static const uint8_t SQL_lexerSpace = 0x1;
+static const uint8_t SQL_lexerWord = 0x2;
+static const uint8_t SQL_lexerMark = 0x4;		//-- "?'\"`/-#"
+
+//-- The gaps between placeholders are usually short. The kernel is used after the inline scanning of the short range.
+static const int SQL_lexerInlineScanLength = 16;
+
+static uint8_t _charClassMap[256];
+
+void SQLLexer::init()
+{
+	const char* spaces = " \t\n\r\f\v";
+	for (const char* c = spaces; *c; c++)
+		_charClassMap[(uint8_t)*c] = SQL_lexerSpace;
+
+	for (int c = 0; c < 256; c++)
+		if (isalnum(c) || c == '_' || c == '$' || c >= 0x80)
+			_charClassMap[c] = SQL_lexerWord;
+
+	const char* marks = "?'\"`/-#";
+	for (const char* c = marks; *c; c++)
+		_charClassMap[(uint8_t)*c] = SQL_lexerMark;
+
+	SQLScanner::init();
+}
+
+void SQLLexer::skipQuoted(char quote)
+{
+	//-- _s is the opening quote.
+	_s += 1;
+	while (true)
+	{
+		_s = SQLScanner::findQuoteOrEscape(_s, _end, quote);
+		if (_s == _end)
+		{
+			_unterminated = true;
+			return;
+		}
+
+		if (*_s == '\\' && quote != '`')
+		{
+			_s += 2;
+			if (_s >= _end)
+			{
+				_s = _end;
+				_unterminated = true;
+				return;
+			}
+			continue;
+		}
+
+		if (*_s != quote)		//-- backslash in quoted identifier.
+		{
+			_s += 1;
+			continue;
+		}
+
+		_s += 1;
+		if (_s < _end && *_s == quote)		//-- doubled quote.
+		{
+			_s += 1;
+			continue;
+		}
+		return;
+	}
+}
+
+bool SQLLexer::skipComment()
+{
+	char c = *_s;
+	if (c == '/')
+	{
+		if (_s + 1 >= _end || _s[1] != '*')
+			return false;
+
+		const char* s = _s + 2;
+		while (true)
+		{
+			s = (const char*)memchr(s, '*', _end - s);
+			if (s == NULL || s + 1 >= _end)
+			{
+				_s = _end;
+				_unterminated = true;
+				return true;
+			}
+			if (s[1] == '/')
+			{
+				_s = s + 2;
+				return true;
+			}
+			s += 1;
+		}
+	}
+
+	if (c == '-')
+	{
+		//-- MySQL requires a space or control char after "--".
+		if (_s + 1 >= _end || _s[1] != '-')
+			return false;
+
+		if (_s + 2 < _end && (uint8_t)_s[2] > ' ')
+			return false;
+	}
+	else if (c != '#')
+		return false;
+
+	const char* s = (const char*)memchr(_s, '\n', _end - _s);
+	_s = s ? s + 1 : _end;
+	return true;
+}
+
+bool SQLLexer::next(SQLToken& token)
+{
+	while (_s < _end && _charClassMap[(uint8_t)*_s] == SQL_lexerSpace)
+		_s += 1;
+
+	token.offset = (size_t)(_s - _header);
+	if (_s == _end)
+	{
+		token.type = SQLToken::End;
+		token.length = 0;
+		return false;
+	}
+
+	char c = *_s;
+	if (_charClassMap[(uint8_t)c] == SQL_lexerWord)
+	{
+		token.type = SQLToken::Word;
+
+		_s = SQLScanner::findWordEnd(_s + 1, _end);
+	}
+	else if (c == '\'' || c == '"')
+	{
+		token.type = SQLToken::String;
+		skipQuoted(c);
+	}
+	else if (c == '`')
+	{
+		token.type = SQLToken::QuotedIdentifier;
+		skipQuoted(c);
+	}
+	else if (c == '?')
+	{
+		token.type = SQLToken::Placeholder;
+		_s += 1;
+	}
+	else if ((c == '/' || c == '-' || c == '#') && skipComment())
+		token.type = SQLToken::Comment;
+	else
+	{
+		token.type = SQLToken::Symbol;
+		_s += 1;
+	}
+
+	token.length = (size_t)(_s - _header) - token.offset;
+	return true;
+}
+
+bool SQLLexer::nextSignificant(SQLToken& token)
+{
+	while (next(token))
+		if (token.type != SQLToken::Comment)
+			return true;
+
+	return false;
+}
+
+bool SQLLexer::nextIsSymbol(char c) const
+{
+	const char* s = _s;
+	while (s < _end && _charClassMap[(uint8_t)*s] == SQL_lexerSpace)
+		s += 1;
+
+	if (s == _end)
+		return false;
+
+	if (*s == c)
+		return true;
+
+	if (*s != '/' && *s != '-' && *s != '#')
+		return false;
+
+	SQLLexer lookahead(*this);
+	SQLToken token;
+	return lookahead.nextSignificant(token) && isSymbol(token, c);
+}
+
+bool SQLLexer::nextPlaceholder(size_t& offset, bool& quoted)
+{
+	//-- Words and symbols never contain the lexical marks, so only the marks are examined.
+	const char* s = _s;
+	while (true)
+	{
+		const char* limit = (_end - s > SQL_lexerInlineScanLength) ? s + SQL_lexerInlineScanLength : _end;
+		while (s < limit && _charClassMap[(uint8_t)*s] != SQL_lexerMark)
+			s += 1;
+
+		if (s == limit)
+		{
+			s = SQLScanner::findLexicalMark(s, _end);
+			if (s == _end)
+			{
+				_s = s;
+				return false;
+			}
+		}
+
+		char c = *s;
+		if (c == '?')
+		{
+			offset = (size_t)(s - _header);
+			quoted = false;
+			_s = s + 1;
+			return true;
+		}
+
+		if (c == '\'' && _end - s >= 3 && s[1] == '?' && s[2] == '\'' && (_end - s == 3 || s[3] != '\''))
+		{
+			offset = (size_t)(s + 1 - _header);
+			quoted = true;
+			_s = s + 3;
+			return true;
+		}
+
+		_s = s;
+		if (c == '\'' || c == '"' || c == '`')
+			skipQuoted(c);
+		else if (!skipComment())
+			_s += 1;
+
+		s = _s;
+	}
+}
+
+bool SQLLexer::isKeyword(const SQLToken& token, const char* keyword, size_t len) const
+{
+	return token.type == SQLToken::Word && token.length == len && strncasecmp(_header + token.offset, keyword, len) == 0;
+}
+
+bool SQLLexer::identifierEquals(const SQLToken& token, const std::string& name) const
+{
+	if (token.type == SQLToken::Word)
+		return token.length == name.length() && memcmp(_header + token.offset, name.data(), name.length()) == 0;
+
+	if (token.type == SQLToken::QuotedIdentifier)
+		return identifier(token) == name;
+
+	return false;
+}
+
+std::string SQLLexer::identifier(const SQLToken& token) const
+{
+	if (token.type != SQLToken::QuotedIdentifier)
+		return std::string(_header + token.offset, token.length);
+
+	std::string name;
+	const char* s = _header + token.offset + 1;
+	const char* end = _header + identifierEnd(token);
+	for (; s < end; s++)
+	{
+		name.push_back(*s);
+		if (*s == '`')		//-- doubled backtick.
+			s += 1;
+	}
+	return name;
+}
+
+size_t SQLLexer::identifierEnd(const SQLToken& token) const
+{
+	size_t end = token.offset + token.length;
+	if (token.type == SQLToken::QuotedIdentifier && token.length >= 2 && _header[end - 1] == '`')
+		return end - 1;
+
+	return end;
+}
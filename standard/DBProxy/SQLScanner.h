@@ -0,0 +1,40 @@
+#ifndef SQL_Scanner_H
+#define SQL_Scanner_H
+
+#include <string>
+
+//========================================//
+//- SQL Scanner
+//========================================//
+/*
+	Character class scanning kernels for SQLLexer.
+	AVX2 or SSE4.2 kernels are selected at runtime by CPU features, and the scalar kernels are used on other platforms.
+	All kernels are bounded by end, and never read beyond it.
+*/
+class SQLScanner
+{
+public:
+	typedef const char* (*ScanFunction)(const char* s, const char* end);
+	typedef const char* (*QuoteScanFunction)(const char* s, const char* end, char quote);
+
+private:
+	static ScanFunction _findWordEnd;
+	static ScanFunction _findLexicalMark;
+	static QuoteScanFunction _findQuoteOrEscape;
+	static const char* _kernelName;
+
+public:
+	static void init();
+	static inline const char* kernelName() { return _kernelName; }
+
+	//-- Word chars: alphanumeric, '_', '$' and the bytes of multibyte chars. Return the first non-word char in [s, end), or end.
+	static inline const char* findWordEnd(const char* s, const char* end) { return _findWordEnd(s, end); }
+
+	//-- Lexical marks: "?'\"`/-#". Return the first mark in [s, end), or end.
+	static inline const char* findLexicalMark(const char* s, const char* end) { return _findLexicalMark(s, end); }
+
+	//-- Return the first quote or '\\' in [s, end), or end.
+	static inline const char* findQuoteOrEscape(const char* s, const char* end, char quote) { return _findQuoteOrEscape(s, end, quote); }
+};
+
+#endif
@@ -1,13 +1,16 @@
+#include <chrono>
+#include <thread>
 #include <algorithm>
 #include <sstream>
 #include "FPLog.h"
 #include "SQLParser.h"
 #include "DataRouterErrorInfo.h"
 #include "TableManager.h"
+#include "XATransaction.h"
 //=============================================//
 //-	DatabaseInfo
 //=============================================//
-DatabaseInfo::DatabaseInfo(): port(0), master_id(0), _threadPool(0)
+DatabaseInfo::DatabaseInfo(): port(0), master_id(0), crossZone(false), _threadPool(0)
 {
 }
 
@@ -15,30 +18,79 @@ DatabaseInfo::~DatabaseInfo()
 {
 	if (_threadPool)
 		delete _threadPool;
+
+	if (_sharedWorkerUnit)
+		_sharedWorkerUnit->release();
 }
 
-void DatabaseInfo::enableThreadPool(IMySQLTaskQueue* taskQueue, int32_t initCount, int32_t perAppendCount, int32_t perfectCount, int32_t maxCount, size_t tempThreadLatencySeconds)
+void DatabaseInfo::enableThreadPool(IMySQLTaskQueue* taskQueue, int32_t initCount, int32_t perAppendCount, int32_t perfectCount, int32_t maxCount, size_t tempThreadLatencySeconds,
+	std::list<MySQLClient*>& warmedClients)
 {
-	if (!_threadPool)
+	if (!_circuitBreaker)
+		_circuitBreaker = HealthChecker::circuitBreaker(this);
+
+	if (SharedWorkerPool::enabled())
+	{
+		if (!_sharedWorkerUnit)
+		{
+			_sharedWorkerUnit = std::make_shared<SharedWorkerUnit>(taskQueue, this, SharedWorkerPool::maxConnectionsPerInstance());
+			_sharedWorkerUnit->adoptConnections(warmedClients);
+			if (_circuitBreaker)
+				_circuitBreaker->subscribe(_sharedWorkerUnit);
+		}
+	}
+	else if (!_threadPool)
 	{
 		_threadPool = new MySQLTaskThreadPool(taskQueue, this);
+		_threadPool->adoptConnections(warmedClients);
 		_threadPool->init(initCount, perAppendCount, perfectCount, maxCount, tempThreadLatencySeconds);
 	}
+
+	for (MySQLClient* client: warmedClients)
+		delete client;
+	warmedClients.clear();
 }
 
 std::string DatabaseInfo::threadPoolInfos()
 {
-	if (_threadPool)
+	if (_sharedWorkerUnit)
+		return _sharedWorkerUnit->infos();
+	else if (_threadPool)
 		return _threadPool->infos();
 	else
 		return std::string();
 }
 
+bool ZoneGate::open(size_t readQueueSize) const
+{
+	if (localCount == 0 || TableManager::zoneSpilling(readQueueSize))
+		return true;
+
+	//-- The local instances without circuit breaker are always available.
+	if ((int)localBreakers.size() < localCount)
+		return false;
+
+	for (auto& breaker: localBreakers)
+		if (breaker->available())
+			return false;
+
+	return true;
+}
+
 //=============================================//
 //-	TableManager
 //=============================================//
 size_t TableManager::_perThreadPoolReadQueueMaxLength = 200000;
 size_t TableManager::_perThreadPoolWriteQueueMaxLength = 200000;
+std::string TableManager::_zone;
+size_t TableManager::_zoneSpillQueueLength = 0;
+std::atomic<uint64_t> TableManager::_localZoneReads(0);
+std::atomic<uint64_t> TableManager::_crossZoneReads(0);
+std::mutex TableManager::_retryMutex;
+std::condition_variable TableManager::_retryCondition;
+std::multimap<std::chrono::steady_clock::time_point, QueryTaskPtr> TableManager::_delayedRetries;
+std::thread TableManager::_retryThread;
+bool TableManager::_retryTimerRunning = false;
 
 void TableManager::config(int perThreadPoolReadQueueMaxLength, int perThreadPoolWriteQueueMaxLength)
 {
@@ -46,6 +98,27 @@ void TableManager::config(int perThreadPoolReadQueueMaxLength, int perThreadPool
 	_perThreadPoolWriteQueueMaxLength = (size_t)perThreadPoolWriteQueueMaxLength;
 }
 
+void TableManager::configZone(const std::string& zone, int spillQueueLength)
+{
+	_zone = zone;
+	_zoneSpillQueueLength = spillQueueLength > 0 ? (size_t)spillQueueLength : 0;
+}
+
+std::string TableManager::zoneStatusInJSON()
+{
+	uint64_t localReads = _localZoneReads;
+	uint64_t crossReads = _crossZoneReads;
+	uint64_t total = localReads + crossReads;
+
+	std::ostringstream oss;
+	oss<<"{\"zone\":\""<<_zone<<"\"";
+	oss<<",\"spillQueueLength\":"<<_zoneSpillQueueLength;
+	oss<<",\"localReads\":"<<localReads;
+	oss<<",\"crossZoneReads\":"<<crossReads;
+	oss<<",\"crossZoneRatio\":"<<(total ? (double)crossReads / total : 0.0)<<"}";
+	return oss.str();
+}
+
 TableManager::TableManager(int64_t range_span, int secondary_split_table_number_base, int64_t update_time):
 	_splitSpan(range_span), _secondaryTableNumberBase(secondary_split_table_number_base), _update_time(update_time)
 {
@@ -91,8 +164,23 @@ bool TableManager::deletable()
 	return true;
 }
 
+//-- The template built for the plain sql is kept by the caller, so that the unsuffixed sql can be restored.
+static bool addTableSuffix(const std::string& tableName, std::string& sql, const char* suffix, SQLTemplatePtr* sqlTemplate)
+{
+	if (sqlTemplate && !*sqlTemplate)
+	{
+		SQLTemplatePtr built = std::make_shared<SQLTemplate>();
+		if (!SQLParser::buildSQLTemplate(sql, tableName, *built))
+			return false;
+
+		*sqlTemplate = built;
+	}
+
+	return TaskPackage::setSuffix(tableName, sql, suffix, sqlTemplate ? sqlTemplate->get() : NULL);
+}
+
 DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, int64_t hintId,
-	const std::string& tableName, std::string& sql, std::string* databaseName)
+	const std::string& tableName, std::string& sql, std::string* databaseName, SQLTemplatePtr* sqlTemplate)
 {
 	std::unordered_map<std::string, TableInfo*>::const_iterator iter = _tableInfos.find(tableName);
 	if (iter == _tableInfos.end())
@@ -145,7 +233,7 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 						snprintf(suffix, 32, "%ld", suffixId + _secondaryTableNumberBase);
 #endif
 						
-						if (!TaskPackage::setSuffix(tableName, sql, suffix))
+						if (!addTableSuffix(tableName, sql, suffix, sqlTemplate))
 						{
 							LOG_ERROR("Parse SQL [%s] failed. Cannot find the table name [%s] in sql.", sql.c_str(), tableName.c_str());
 							return nullptr;
@@ -170,11 +258,10 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 		else if (hintId >= count)
 			hintId = hintId % count;
 
-		TableTaskHint tth(tableInfo->tableName, (int)hintId);
-		std::map<TableTaskHint, DatabaseTaskQueuePtr>::const_iterator it = _tableTaskQueues.find(tth);
-		if (it != _tableTaskQueues.end())
+		if (hintId >= 0 && hintId < (int64_t)tableInfo->hashRoutes.size() && tableInfo->hashRoutes[hintId].taskQueueIndex >= 0)
 		{
-			databaseQueuePtr = it->second;
+			const HashRoute& route = tableInfo->hashRoutes[hintId];
+			databaseQueuePtr = _hashTaskQueues[route.taskQueueIndex];
 
 			if (count > 1)
 			{
@@ -185,7 +272,7 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 				snprintf(suffix, 32, "_%ld", hintId);
 #endif
 				
-				if (!TaskPackage::setSuffix(tableName, sql, suffix))
+				if (!addTableSuffix(tableName, sql, suffix, sqlTemplate))
 				{
 					LOG_ERROR("Parse SQL [%s] failed. Cannot find the table name [%s] in sql.", sql.c_str(), tableName.c_str());
 					return nullptr;
@@ -193,18 +280,23 @@ DatabaseTaskQueuePtr TableManager::findDatabaseTaskQueue(TaskPackagePtr task, in
 			}
 
 			if (task)
-				task->setDatabaseName(it->first.databaseName);
+				task->setDatabaseName(_databaseNames[route.databaseNameIndex]);
 			else
-				*databaseName = it->first.databaseName;
+				*databaseName = _databaseNames[route.databaseNameIndex];
 		}
 	}
 
+	//-- Tasks built from the template carry no sql until routed.
+	if (databaseQueuePtr && sqlTemplate && *sqlTemplate && sql.empty())
+		sql = (*sqlTemplate)->sql;
+
 	return databaseQueuePtr;
 }
 
 bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 {
-	DatabaseTaskQueuePtr databaseQueuePtr = findDatabaseTaskQueue(task, hintId, task->tableName(), task->sql(), NULL);
+	task->setRoute(hintId, master);
+	DatabaseTaskQueuePtr databaseQueuePtr = findDatabaseTaskQueue(task, hintId, task->tableName(), task->sql(), NULL, &(task->sqlTemplate()));
 
 	if (databaseQueuePtr == nullptr)
 	{
@@ -212,7 +304,15 @@ bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 		LOG_ERROR("EXCEPTION: Database or table not found. Table: %s, hintId: %lld.", task->tableName().c_str(), hintId);
 		return false;
 	}
-		
+
+	return enqueue(databaseQueuePtr.get(), master, task);
+}
+
+bool TableManager::enqueue(DatabaseTaskQueue* databaseQueuePtr, bool master, QueryTaskPtr task)
+{
+	task->setTaskQueue(databaseQueuePtr);
+	task->setMasterServerId(databaseQueuePtr->masterDB->serverId);
+
 	if (!master && databaseQueuePtr->databaseList.size() > 1)
 	{
 		if (databaseQueuePtr->queue.readQueueSize() >= _perThreadPoolReadQueueMaxLength)
@@ -221,20 +321,32 @@ bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 			return false;
 		}
 
+		if (!databaseQueuePtr->available())
+		{
+			task->finish(ErrorInfo::unavailableCode, "All corresponding database instances are unavailable.");
+			return false;
+		}
+
+		//-- The lower classes are shed first. The interactive reads are shed only above the interactive target.
+		if (databaseQueuePtr->queue.readMonitor().shedding(task->qosClass()))
+		{
+			databaseQueuePtr->queue.readMonitor().shed(task->qosClass());
+			task->finish(ErrorInfo::serverBusyCode, "Corresponding query queue is overloaded.");
+			return false;
+		}
+
 		databaseQueuePtr->queue.push(task, true);
 		size_t v = ((uint64_t)task.get()/16) % databaseQueuePtr->databaseList.size();
 		
-		for (size_t i = 0; i < databaseQueuePtr->databaseList.size(); i++)
+		//-- The replicas in the same zone are preferred. The other zones are woken when no local replica is available, or the reads are piled up.
+		if (wakeUpReplicas(databaseQueuePtr, v, false))
 		{
-			DatabaseInfoPtr dip = databaseQueuePtr->databaseList[v];
-			if (dip->wakeUp())
-				return true;
+			if (zoneSpilling(databaseQueuePtr->queue.readQueueSize()))
+				wakeUpReplicas(databaseQueuePtr, v, true);
 				
-			v++;
-			if (v == databaseQueuePtr->databaseList.size())
-				v = 0;
+			return true;
 		}
-		return false;
+		return wakeUpReplicas(databaseQueuePtr, v, true);
 	}
 	else
 	{
@@ -244,11 +356,171 @@ bool TableManager::query(int64_t hintId, bool master, QueryTaskPtr task)
 			return false;
 		}
 
-		databaseQueuePtr->queue.push(task, false);
+		if (!databaseQueuePtr->masterDB->available())
+		{
+			task->finish(ErrorInfo::unavailableCode, "Corresponding database instance is unavailable.");
+			return false;
+		}
+
+		//-- Only the reads are shed. The writes are limited by the queue length.
+		if (databaseQueuePtr->queue.writeMonitor().shedding(task->qosClass()) && !SQLParser::isDataModificationSQL(task->sql()))
+		{
+			databaseQueuePtr->queue.writeMonitor().shed(task->qosClass());
+			task->finish(ErrorInfo::serverBusyCode, "Corresponding query queue is overloaded.");
+			return false;
+		}
+
+		if (GroupCommitCollector::enabled(task->tableName()) && SQLParser::isDataModificationSQL(task->sql()))
+		{
+			GroupCommitTaskPtr group = databaseQueuePtr->groupCommitCollector.add(task);
+			if (!group)
+				return true;
+
+			databaseQueuePtr->queue.push(group, false);
+		}
+		else
+			databaseQueuePtr->queue.push(task, false);
+
 		return databaseQueuePtr->masterDB->wakeUp();
 	}
 }
 
+bool TableManager::wakeUpReplicas(DatabaseTaskQueue* databaseQueuePtr, size_t start, bool crossZone)
+{
+	size_t count = databaseQueuePtr->databaseList.size();
+	for (size_t i = 0; i < count; i++)
+	{
+		DatabaseInfoPtr dip = databaseQueuePtr->databaseList[(start + i) % count];
+		if (dip->crossZone == crossZone && dip->wakeUp())
+			return true;
+	}
+	return false;
+}
+
+void TableManager::retry(TaskPackagePtr task)
+{
+	QueryTaskPtr queryTask = std::dynamic_pointer_cast<QueryTask>(task);
+	if (!queryTask || !queryTask->taskQueue())
+		return;
+
+	int delay = queryTask->retryDelayMsec();
+	if (delay > 0)
+	{
+		std::lock_guard<std::mutex> lck (_retryMutex);
+		if (_retryTimerRunning)
+		{
+			queryTask->taskQueue()->delayedRetries++;
+			_delayedRetries.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), queryTask));
+			_retryCondition.notify_one();
+			return;
+		}
+	}
+
+	//-- The read queue is shared by the replicas, so the task may be taken by another instance, or a fresh connection.
+	enqueue(queryTask->taskQueue(), queryTask->master(), queryTask);
+}
+
+void TableManager::startRetryTimer()
+{
+	if (!QueryTask::readRetryDelayed() || _retryThread.joinable())
+		return;
+
+	_retryTimerRunning = true;
+	_retryThread = std::thread(&TableManager::retryThread);
+}
+
+void TableManager::stopRetryTimer()
+{
+	if (!_retryThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lck (_retryMutex);
+		_retryTimerRunning = false;
+		_retryCondition.notify_all();
+	}
+	_retryThread.join();
+}
+
+void TableManager::retryThread()
+{
+	std::unique_lock<std::mutex> lck (_retryMutex);
+	while (true)
+	{
+		if (_delayedRetries.empty())
+		{
+			if (!_retryTimerRunning)
+				break;
+
+			_retryCondition.wait(lck);
+			continue;
+		}
+
+		auto iter = _delayedRetries.begin();
+		if (_retryTimerRunning && iter->first > std::chrono::steady_clock::now())
+		{
+			_retryCondition.wait_until(lck, iter->first);
+			continue;
+		}
+
+		QueryTaskPtr queryTask = iter->second;
+		_delayedRetries.erase(iter);
+
+		lck.unlock();
+		DatabaseTaskQueue* taskQueue = queryTask->taskQueue();
+		enqueue(taskQueue, queryTask->master(), queryTask);
+		taskQueue->delayedRetries--;
+		lck.lock();
+	}
+}
+
+void TableManager::migrateQueuedTasks(TableManager& newTableManager, size_t& migratedCount, size_t& vanishedCount)
+{
+	for (auto& dbQueuePtr: _usedTaskQueues)
+	{
+		if (_takenTaskQueues.find(dbQueuePtr) != _takenTaskQueues.end())
+			continue;
+
+		//-- The popped tasks are not started. The started ones are finished by the retired thread pools.
+		std::vector<TaskPackagePtr> unmigratableTasks;
+		while (true)
+		{
+			TaskPackagePtr task = dbQueuePtr->queue.pop();
+			if (!task)
+				break;
+
+			QueryTaskPtr queryTask = std::dynamic_pointer_cast<QueryTask>(task);
+			if (!queryTask || !queryTask->unroute())
+			{
+				unmigratableTasks.push_back(task);
+				continue;
+			}
+
+			DatabaseTaskQueuePtr newQueuePtr = newTableManager.findDatabaseTaskQueue(queryTask, queryTask->hintId(),
+				queryTask->tableName(), queryTask->sql(), NULL, &(queryTask->sqlTemplate()));
+
+			if (newQueuePtr == nullptr)
+			{
+				queryTask->finish(ErrorInfo::notFoundCode, "Target database or table not found after config changed.");
+				vanishedCount += 1;
+				continue;
+			}
+
+			enqueue(newQueuePtr.get(), queryTask->master(), queryTask);
+			migratedCount += 1;
+		}
+
+		//-- Group commits, transactions, XA branches and async write batches are kept, and executed by the retired thread pools.
+		if (unmigratableTasks.size())
+		{
+			for (auto& task: unmigratableTasks)
+				dbQueuePtr->queue.push(task, false);
+
+			dbQueuePtr->masterDB->wakeUp();
+		}
+	}
+}
+
 bool TableManager::splitType(const std::string &table_name, bool& splitByRange)
 {
 	std::unordered_map<std::string, TableInfo*>::const_iterator iter = _tableInfos.find(table_name);
@@ -496,11 +768,69 @@ bool TableManager::transaction(TransactionTaskPtr task)
 		return false;
 	}
 
+	if (!dbTaskQueue->masterDB->available())
+	{
+		task->finish(ErrorInfo::unavailableCode, "Corresponding database instance is unavailable.");
+		return false;
+	}
+
 	task->setDatabaseName(databaseName);
+	task->setMasterServerId(dbTaskQueue->masterDB->serverId);
 	dbTaskQueue->queue.push(task, false);
 	return dbTaskQueue->masterDB->wakeUp();
 }
 
+bool TableManager::xaTransaction(XATransactionPtr xa)
+{
+	for (size_t i = 0; i < xa->_sqls.size(); i++)
+	{
+		std::string databaseName;
+		DatabaseTaskQueuePtr taskQueue = findDatabaseTaskQueue(nullptr, xa->_hintIds[i],
+			xa->_tableNames[i], xa->_sqls[i], &databaseName);
+
+		if (!taskQueue)
+		{
+			xa->finish(ErrorInfo::notFoundCode, i, "Target database or table not found.");
+			return false;
+		}
+
+		if (taskQueue->queue.writeQueueSize() >= _perThreadPoolWriteQueueMaxLength)
+		{
+			xa->finish(ErrorInfo::serverBusyCode, "Corresponding query queue caught limitation.");
+			return false;
+		}
+
+		if (!taskQueue->masterDB->available())
+		{
+			xa->finish(ErrorInfo::unavailableCode, i, "Corresponding database instance is unavailable.");
+			return false;
+		}
+
+		xa->addStatement(taskQueue, databaseName, (int)i);
+	}
+
+	xa->start();
+	return true;
+}
+
+void TableManager::masterTaskQueues(std::vector<DatabaseTaskQueuePtr>& queues)
+{
+	std::set<std::string> masters;
+	for (auto& dtqp: _usedTaskQueues)
+	{
+		std::string endpoint(dtqp->masterDB->host);
+		endpoint.append(":").append(std::to_string(dtqp->masterDB->port));
+
+		if (masters.insert(endpoint).second)
+			queues.push_back(dtqp);
+	}
+}
+
+DatabaseTaskQueuePtr TableManager::writeTaskQueue(int64_t hintId, const std::string& tableName, std::string& sql, std::string& databaseName)
+{
+	return findDatabaseTaskQueue(nullptr, hintId, tableName, sql, &databaseName);
+}
+
 std::string TableManager::statusInJSON()
 {	
 	std::ostringstream oss;
@@ -520,6 +850,15 @@ std::string TableManager::statusInJSON()
 			oss<<"\"masterDB\":\""<<dtqp->masterDB->host<<":"<<dtqp->masterDB->port<<"\"";
 			oss<<",\"readQueueSize\":"<<dtqp->queue.readQueueSize();
 			oss<<",\"writeQueueSize\":"<<dtqp->queue.writeQueueSize();
+			if (GroupCommitCollector::configured())
+				oss<<",\"groupCommit\":"<<dtqp->groupCommitCollector.statusInJSON();
+			if (SojournMonitor::enabled())
+			{
+				oss<<",\"readOverloadLevel\":"<<dtqp->queue.readMonitor().overloadLevel();
+				oss<<",\"writeOverloadLevel\":"<<dtqp->queue.writeMonitor().overloadLevel();
+				oss<<",\"readShed\":"<<dtqp->queue.readMonitor().shedCount();
+				oss<<",\"writeShed\":"<<dtqp->queue.writeMonitor().shedCount();
+			}
 		
 			oss<<",\"dbInfos\":";
 			oss<<"[";
@@ -534,6 +873,8 @@ std::string TableManager::statusInJSON()
 					
 				oss<<"{\"dbHost\":\""<<dip->host<<":"<<dip->port<<"\"";
 				oss<<","<<dip->threadPoolInfos();
+				if (dip->circuitBreaker())
+					oss<<",\"circuitBreaker\":"<<dip->circuitBreaker()->infos();
 				oss<<"}";
 			}
 			oss<<"]";
@@ -2,13 +2,24 @@
 #define TableManager_h_
 
 #include <set>
+#include <atomic>
 #include <map>
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
 #include <unordered_map>
 #include <memory>
 #include <string>
 #include <vector>
 #include "MySQLTaskThreadPool.h"
+#include "SharedWorkerPool.h"
+#include "HealthChecker.h"
 #include "TaskQueue.h"
+#include "GroupCommit.h"
+
+struct ZoneGate;
 
 struct DatabaseInfo
 {
@@ -20,27 +31,74 @@ struct DatabaseInfo
 	std::string password;
 	int timeout;
 	int master_id;
+	std::string zone;
+	bool crossZone;			//-- Both the proxy and the instance zones are configured, and they are different.
+	std::shared_ptr<ZoneGate> zoneGate;		//-- Only for the cross-zone replicas of the groups with local instances.
 	
 private:
 	MySQLTaskThreadPool* _threadPool;
+	SharedWorkerUnitPtr _sharedWorkerUnit;		//-- Instead of _threadPool, when the shared worker pool is enabled.
+	CircuitBreakerPtr _circuitBreaker;			//-- Only when the health checker is enabled.
 	
 public:
 	DatabaseInfo();
 	~DatabaseInfo();
 	
-	inline bool wakeUp() { return (_threadPool ? _threadPool->wakeUp() : false); }
-	inline bool threadPoolBusy() { return (_threadPool ? _threadPool->isBusy() : false); }
-	void enableThreadPool(IMySQLTaskQueue* taskQueue, int32_t initCount, int32_t perAppendCount, int32_t perfectCount, int32_t maxCount, size_t tempThreadLatencySeconds);
+	inline CircuitBreakerPtr circuitBreaker() const { return _circuitBreaker; }
+	inline bool available() { return (_circuitBreaker ? _circuitBreaker->available() : true); }
+	inline void reportConnection(bool connected)
+	{
+		if (_circuitBreaker)
+			_circuitBreaker->report(connected);
+	}
+	inline bool wakeUp()
+	{
+		if (!available())
+			return false;
+		if (_sharedWorkerUnit)
+			return _sharedWorkerUnit->wakeUp();
+		return (_threadPool ? _threadPool->wakeUp() : false);
+	}
+	inline bool threadPoolBusy()
+	{
+		if (_sharedWorkerUnit)
+			return _sharedWorkerUnit->isBusy();
+		return (_threadPool ? _threadPool->isBusy() : false);
+	}
+	//-- The warmed connections are adopted by the thread pool or the shared worker unit, and the rest are closed.
+	void enableThreadPool(IMySQLTaskQueue* taskQueue, int32_t initCount, int32_t perAppendCount, int32_t perfectCount, int32_t maxCount, size_t tempThreadLatencySeconds,
+		std::list<MySQLClient*>& warmedClients);
 	
 	std::string threadPoolInfos();
 	bool operator == (const DatabaseInfo &r) const		//-- equivalent function.
 	{
 		//-- Basic only: (host == r.host && port == r.port).
-		return (host == r.host && port == r.port && username == r.username && password == r.password && timeout == r.timeout);
+		return (host == r.host && port == r.port && username == r.username && password == r.password && timeout == r.timeout && zone == r.zone);
 	}
 };
 typedef std::shared_ptr<DatabaseInfo> DatabaseInfoPtr;
 
+/*
+	Checked by the workers of the cross-zone replicas before taking the shared read queue.
+	They only take the reads while the queue spills over, or no instance of the group in the proxy zone is available.
+*/
+struct ZoneGate
+{
+	int localCount;
+	std::vector<CircuitBreakerPtr> localBreakers;		//-- Empty when the health checker is disabled.
+
+	ZoneGate(): localCount(0) {}
+	bool open(size_t readQueueSize) const;
+};
+
+struct HashRoute
+{
+	int taskQueueIndex;		//-- index of TableManager::_hashTaskQueues
+	int databaseNameIndex;	//-- index of TableManager::_databaseNames
+
+	HashRoute(): taskQueueIndex(-1), databaseNameIndex(-1) {}
+};
+
 struct TableInfo
 {
 	std::string tableName;
@@ -55,6 +113,7 @@ struct TableInfo
 	//---- for hash split ------
 	int tableCount;
 	std::string splitHint;
+	std::vector<HashRoute> hashRoutes;	//-- index: table number. Filled by TableManagerBuilder.
 };
 
 struct TableSplittingInfo
@@ -127,10 +186,18 @@ struct DatabaseTaskQueue
 {
 	bool inited;
 	RWTaskQueue	queue;
+	GroupCommitCollector groupCommitCollector;
 	DatabaseInfoPtr masterDB;	//-- masterDB also in databaseList.
 	std::vector<DatabaseInfoPtr> databaseList;
+	std::atomic<int> delayedRetries;		//-- The read retries waiting for the backoff timer.
 	
-	DatabaseTaskQueue(): inited(false) {}
+	DatabaseTaskQueue(): inited(false), delayedRetries(0)
+	{
+		groupCommitCollector.setDispatcher([this](GroupCommitTaskPtr group) {
+			queue.push(group, false);
+			masterDB->wakeUp();
+		});
+	}
 	~DatabaseTaskQueue()
 	{
 		masterDB.reset();
@@ -139,7 +206,8 @@ struct DatabaseTaskQueue
 
 	bool deletable()
 	{
-		if (queue.size() > 0)
+		//-- Checked before the queue: the group sealed by timer, and the delayed retry, are pushed into the queue before counted out.
+		if (!groupCommitCollector.idle() || delayedRetries > 0 || queue.size() > 0)
 			return false;
 
 		for (auto& dbiPtr: databaseList)
@@ -149,6 +217,15 @@ struct DatabaseTaskQueue
 		return true;
 	}
 
+	bool available()		//-- Any instance available for reading.
+	{
+		for (auto& dbiPtr: databaseList)
+			if (dbiPtr->available())
+				return true;
+
+		return false;
+	}
+
 	bool operator == (const DatabaseTaskQueue &r) const		//-- equivalent function.
 	{
 		if (databaseList.size() != r.databaseList.size())
@@ -220,6 +297,9 @@ struct DatabaseCategoryInfo
 	std::vector<int> oddEvenIndexes;
 };
 
+class XATransaction;
+typedef std::shared_ptr<XATransaction> XATransactionPtr;
+
 class TableManager
 {	
 	int64_t _splitSpan;
@@ -228,16 +308,30 @@ class TableManager
 
 	static size_t _perThreadPoolReadQueueMaxLength;
 	static size_t _perThreadPoolWriteQueueMaxLength;
+	static std::string _zone;
+	static size_t _zoneSpillQueueLength;
+	static std::atomic<uint64_t> _localZoneReads;
+	static std::atomic<uint64_t> _crossZoneReads;
+
+	static std::mutex _retryMutex;
+	static std::condition_variable _retryCondition;
+	static std::multimap<std::chrono::steady_clock::time_point, QueryTaskPtr> _delayedRetries;
+	static std::thread _retryThread;
+	static bool _retryTimerRunning;
+	static void retryThread();
 	
 	std::unordered_map<std::string, TableInfo*>	_tableInfos;
-	std::map<TableTaskHint, DatabaseTaskQueuePtr> _tableTaskQueues;		//-- for hash
+	std::vector<DatabaseTaskQueuePtr> _hashTaskQueues;		//-- for hash, interned by TableManagerBuilder.
+	std::vector<std::string> _databaseNames;				//-- for hash, interned by TableManagerBuilder.
 	std::unordered_map<std::string, std::vector<RangeDatabaseNode*>> _rangedTaskQueues;
 	std::set<DatabaseTaskQueuePtr> _usedTaskQueues;
 	std::set<DatabaseTaskQueuePtr> _takenTaskQueues;
 
 	friend class TableManagerBuilder;
 	DatabaseTaskQueuePtr findDatabaseTaskQueue(TaskPackagePtr task, int64_t hintId,
-		const std::string& tableName, std::string& sql, std::string* databaseName);
+		const std::string& tableName, std::string& sql, std::string* databaseName, SQLTemplatePtr* sqlTemplate = NULL);
+	static bool enqueue(DatabaseTaskQueue* databaseQueuePtr, bool master, QueryTaskPtr task);
+	static bool wakeUpReplicas(DatabaseTaskQueue* databaseQueuePtr, size_t start, bool crossZone);
 	
 public:
 	TableManager(int64_t range_span, int secondary_split_table_number_base, int64_t update_time);
@@ -246,6 +340,8 @@ public:
 	inline int64_t updateTime() { return _update_time; }
 	void signTakenOverTaskQueues(TableManager& newTableManager);
 	bool deletable();	//-- just used for check deletable when stop push new task.
+	//-- Route the queued query tasks of the task queues not taken over again by newTableManager.
+	void migrateQueuedTasks(TableManager& newTableManager, size_t& migratedCount, size_t& vanishedCount);
 	bool splitType(const std::string &table_name, bool& splitByRange);	//-- using internal.
 	
 	bool query(int64_t hintId, bool master, QueryTaskPtr task);
@@ -256,9 +352,24 @@ public:
 		std::map<int64_t, std::set<int64_t>>& hintMap, std::set<int64_t>& invalidHintIds);
 	
 	bool transaction(TransactionTaskPtr task);
+	bool xaTransaction(XATransactionPtr xa);
+	void masterTaskQueues(std::vector<DatabaseTaskQueuePtr>& queues);	//-- One queue per master instance.
+	DatabaseTaskQueuePtr writeTaskQueue(int64_t hintId, const std::string& tableName, std::string& sql, std::string& databaseName);	//-- Table suffix will be added into sql.
 
 	std::string statusInJSON();
 	static void config(int perThreadPoolReadQueueMaxLength, int perThreadPoolWriteQueueMaxLength);
+	//-- Called by the workers before the thread pools are idle, so the task queue is still alive.
+	//-- The backoff is waited by the retry timer, and the task queue is kept undeletable until the task is enqueued again.
+	static void retry(TaskPackagePtr task);
+	static void startRetryTimer();
+	static void stopRetryTimer();		//-- The waiting retries are enqueued at once.
+
+	//-- spillQueueLength: the read queue length waking the replicas in the other zones. 0 means only when no local replica is available.
+	static void configZone(const std::string& zone, int spillQueueLength);
+	static inline bool crossZone(const std::string& instanceZone) { return _zone.length() && instanceZone.length() && instanceZone != _zone; }
+	static inline bool zoneSpilling(size_t readQueueSize) { return _zoneSpillQueueLength && readQueueSize >= _zoneSpillQueueLength; }
+	static inline void readExecuted(bool crossZone) { crossZone ? _crossZoneReads++ : _localZoneReads++; }
+	static std::string zoneStatusInJSON();
 };
 typedef std::shared_ptr<TableManager> TableManagerPtr;
 
@@ -1,4 +1,7 @@
+#include <atomic>
+#include <thread>
 #include <algorithm>
+#include "msec.h"
 #include "AutoRelease.h"
 #include "FPLog.h"
 #include "TableManagerBuilder.h"
@@ -8,6 +11,9 @@ int TableManagerBuilder::_perThreadPoolAppendCount = 2;
 int TableManagerBuilder::_perThreadPoolPerfectCount = 20;
 int TableManagerBuilder::_perThreadPoolMaxCount = 20;
 int TableManagerBuilder::_perThreadPoolTempThreadLatencySeconds = 60;
+int TableManagerBuilder::_warmUpConnections = 0;
+int TableManagerBuilder::_warmUpThreadCount = 32;
+int TableManagerBuilder::_warmUpSlowMsec = 1000;
 
 void TableManagerBuilder::config(int perThreadPoolInitCount, int perThreadPoolAppendCount, int perThreadPoolPerfectCount, int perThreadPoolMaxCount, int perThreadPoolTempThreadLatencySeconds)
 {
@@ -18,6 +24,13 @@ void TableManagerBuilder::config(int perThreadPoolInitCount, int perThreadPoolAp
 	_perThreadPoolTempThreadLatencySeconds = perThreadPoolTempThreadLatencySeconds;
 }
 
+void TableManagerBuilder::configWarmUp(int connectionsPerInstance, int threadCount, int slowMsec)
+{
+	_warmUpConnections = connectionsPerInstance > 0 ? connectionsPerInstance : 0;
+	_warmUpThreadCount = threadCount > 0 ? threadCount : 1;
+	_warmUpSlowMsec = slowMsec > 0 ? slowMsec : 0;
+}
+
 //=============================================//
 //-	TableManagerBuilder::ConstructureInfo
 //=============================================//
@@ -93,6 +106,23 @@ bool TableManagerBuilder::addTableInfo(TableInfo * ti)
 	_tableInfos[ti->tableName] = ti;
 	return true;
 }
+
+size_t TableManagerBuilder::inheritTableInfos(TableManagerPtr baseTableManager, const std::set<TableInfoKey>& rebuiltTables)
+{
+	_baseTableManager = baseTableManager;
+
+	for (auto& tiPair: baseTableManager->_tableInfos)
+	{
+		if (rebuiltTables.find(tiPair.first) != rebuiltTables.end() || _tableInfos.find(tiPair.first) != _tableInfos.end())
+			continue;
+
+		TableInfo* ti = new TableInfo(*(tiPair.second));
+		_tableInfos[ti->tableName] = ti;
+		_inheritedTableInfos.push_back(ti);
+	}
+	return _inheritedTableInfos.size();
+}
+
 void TableManagerBuilder::addTableSplittingInfo(TableSplittingInfo *tsi)
 {
 	TableTaskHint tth(*tsi);
@@ -134,7 +164,7 @@ bool TableManagerBuilder::init_status_check()
 		LOG_ERROR("[Config Error] table_info is empty or all invalid!");
 		return false;
 	}
-	if (_constructureInfo->_tableSplittingInfos.empty() && _constructureInfo->_rangeSplittingInfos.empty())
+	if (_constructureInfo->_tableSplittingInfos.empty() && _constructureInfo->_rangeSplittingInfos.empty() && _inheritedTableInfos.empty())
 	{
 		LOG_ERROR("[Config Error] All tables and categories infos are empty or invalid!");
 		return false;
@@ -183,7 +213,7 @@ bool TableManagerBuilder::init_step5_dbCollection_to_dbTaskQueues(TableManagerPt
 			DatabaseTaskQueuePtr equivalent;
 			for (auto taskQueue: oldTableManager->_usedTaskQueues)
 			{
-				if (taskPair.second == taskQueue)
+				if (*taskPair.second == *taskQueue)
 				{
 					equivalent = taskQueue;
 					break;
@@ -203,20 +233,38 @@ bool TableManagerBuilder::init_step5_dbCollection_to_dbTaskQueues(TableManagerPt
 
 bool TableManagerBuilder::init_step6_tableSplittingInfos_dbTaskQueues_to_tableTaskQueues()
 {
+	std::map<DatabaseTaskQueuePtr, int> taskQueueIndexes;
+	std::unordered_map<std::string, int> databaseNameIndexes;
+
+	for (auto& tiPair: _tableInfos)
+		if (!tiPair.second->splitByRange && tiPair.second->tableCount > 0)
+			tiPair.second->hashRoutes.resize(tiPair.second->tableCount);
+
 	for (auto& tsiPair: _constructureInfo->_tableSplittingInfos)
 	{
-		if (_tableTaskQueues.find(tsiPair.first) != _tableTaskQueues.end())
+		TableSplittingInfo* tsi = tsiPair.second;
+
+		//-- Sub-tables of the unknown or ranged tables are unreachable.
+		auto iter = _tableInfos.find(tsi->tableName);
+		if (iter == _tableInfos.end() || iter->second->splitByRange)
+			continue;
+
+		std::vector<HashRoute>& routes = iter->second->hashRoutes;
+		if (tsi->tableNumber < 0 || tsi->tableNumber >= (int)routes.size())
+			continue;
+
+		HashRoute& route = routes[tsi->tableNumber];
+		if (route.taskQueueIndex >= 0)
 		{
-			LOG_ERROR("[Config Error] Database for split table %s, table number %d is duplicated.", tsiPair.first.tableName.c_str(), tsiPair.first.tableNumber);
+			LOG_ERROR("[Config Error] Database for split table %s, table number %d is duplicated.", tsi->tableName.c_str(), tsi->tableNumber);
 			return false;
 		}
 		
-		TableSplittingInfo* tsi = tsiPair.second;
 		DatabaseTaskQueuePtr dtq = _constructureInfo->findDatabaseTaskQueue(tsi->serverId);
 		if (dtq)
 		{
-			_tableTaskQueues.insert(std::make_pair(tsiPair.first, dtq));
-			_usedTaskQueues.insert(dtq);
+			route.taskQueueIndex = internHashTaskQueue(taskQueueIndexes, dtq);
+			route.databaseNameIndex = internDatabaseName(databaseNameIndexes, tsi->databaseName);
 		}
 		else
 		{
@@ -225,9 +273,81 @@ bool TableManagerBuilder::init_step6_tableSplittingInfos_dbTaskQueues_to_tableTa
 			return false;
 		}
 	}
+
+	return init_step6_inheritedTableInfos_to_tableTaskQueues(taskQueueIndexes, databaseNameIndexes);
+}
+
+bool TableManagerBuilder::init_step6_inheritedTableInfos_to_tableTaskQueues(std::map<DatabaseTaskQueuePtr, int>& taskQueueIndexes,
+	std::unordered_map<std::string, int>& databaseNameIndexes)
+{
+	if (_inheritedTableInfos.empty())
+		return true;
+
+	//-- Indexes of the base table manager => indexes of the new one. -1: unmapped.
+	std::vector<int> queueIndexMap(_baseTableManager->_hashTaskQueues.size(), -1);
+	std::vector<int> nameIndexMap(_baseTableManager->_databaseNames.size(), -1);
+
+	for (TableInfo* ti: _inheritedTableInfos)
+	{
+		for (size_t i = 0; i < ti->hashRoutes.size(); i++)
+		{
+			HashRoute& route = ti->hashRoutes[i];
+			if (route.taskQueueIndex < 0)
+				continue;
+
+			int& queueIndex = queueIndexMap[route.taskQueueIndex];
+			if (queueIndex < 0)
+			{
+				int serverId = _baseTableManager->_hashTaskQueues[route.taskQueueIndex]->masterDB->serverId;
+				DatabaseTaskQueuePtr dtq = _constructureInfo->findDatabaseTaskQueue(serverId);
+				if (!dtq)
+				{
+					LOG_ERROR("[Config Error] Split table: %s, number %d, the host master database's id %d is not found.",
+						ti->tableName.c_str(), (int)i, serverId);
+					return false;
+				}
+				queueIndex = internHashTaskQueue(taskQueueIndexes, dtq);
+			}
+
+			int& nameIndex = nameIndexMap[route.databaseNameIndex];
+			if (nameIndex < 0)
+				nameIndex = internDatabaseName(databaseNameIndexes, _baseTableManager->_databaseNames[route.databaseNameIndex]);
+
+			route.taskQueueIndex = queueIndex;
+			route.databaseNameIndex = nameIndex;
+		}
+	}
+
+	_inheritedTableInfos.clear();
+	_baseTableManager.reset();
 	return true;
 }
 
+int TableManagerBuilder::internHashTaskQueue(std::map<DatabaseTaskQueuePtr, int>& taskQueueIndexes, DatabaseTaskQueuePtr dtq)
+{
+	auto iter = taskQueueIndexes.find(dtq);
+	if (iter != taskQueueIndexes.end())
+		return iter->second;
+
+	int index = (int)_hashTaskQueues.size();
+	taskQueueIndexes[dtq] = index;
+	_hashTaskQueues.push_back(dtq);
+	_usedTaskQueues.insert(dtq);
+	return index;
+}
+
+int TableManagerBuilder::internDatabaseName(std::unordered_map<std::string, int>& databaseNameIndexes, const std::string& databaseName)
+{
+	auto iter = databaseNameIndexes.find(databaseName);
+	if (iter != databaseNameIndexes.end())
+		return iter->second;
+
+	int index = (int)_databaseNames.size();
+	databaseNameIndexes[databaseName] = index;
+	_databaseNames.push_back(databaseName);
+	return index;
+}
+
 bool rangeSplittingInfoComp(const RangeSplittingInfo* a, const RangeSplittingInfo* b)
 {
 	if (a->index == b->index)
@@ -339,13 +459,134 @@ bool TableManagerBuilder::init_step7_rangeSplittingInfos_dbTaskQueues_to_rangedT
 	return true;
 }
 
+void TableManagerBuilder::attachZoneGate(std::vector<DatabaseInfoPtr>& databaseList)
+{
+	std::shared_ptr<ZoneGate> zoneGate;
+	for (auto& dbInfoPtr: databaseList)
+	{
+		if (dbInfoPtr->crossZone)
+			continue;
+
+		if (!zoneGate)
+			zoneGate = std::make_shared<ZoneGate>();
+
+		zoneGate->localCount += 1;
+		CircuitBreakerPtr breaker = HealthChecker::circuitBreaker(dbInfoPtr.get());
+		if (breaker)
+			zoneGate->localBreakers.push_back(breaker);
+	}
+
+	//-- The master takes the writes from the same queue, so it is never gated.
+	for (auto& dbInfoPtr: databaseList)
+		if (dbInfoPtr->crossZone && dbInfoPtr->master_id != 0)
+			dbInfoPtr->zoneGate = zoneGate;
+}
+
+void TableManagerBuilder::warmUpConnections(std::map<DatabaseInfo*, WarmedConnections>& warmedConnections)
+{
+	int perInstance = std::min(_warmUpConnections, SharedWorkerPool::enabled() ? SharedWorkerPool::maxConnectionsPerInstance() : _perThreadPoolInitCount);
+	if (perInstance <= 0)
+		return;
+
+	std::vector<DatabaseInfo*> instances;
+	for (auto& taskQueuePtr: _usedTaskQueues)
+	{
+		if (taskQueuePtr->inited)
+			continue;
+
+		for (auto& dbInfoPtr: taskQueuePtr->databaseList)
+			instances.push_back(dbInfoPtr.get());
+	}
+
+	if (instances.empty())
+		return;
+
+	//-- Connection i is for instances[i / perInstance].
+	size_t connectionCount = instances.size() * perInstance;
+	std::vector<MySQLClient*> clients(connectionCount, NULL);
+	std::vector<int64_t> costs(connectionCount, 0);
+	std::vector<char> rejected(connectionCount, 0);
+	std::atomic<size_t> nextIndex(0);
+
+	auto connectFunc = [&]() {
+		while (true)
+		{
+			size_t idx = nextIndex++;
+			if (idx >= connectionCount)
+				break;
+
+			DatabaseInfo* dbInfo = instances[idx / perInstance];
+			int64_t begin = exact_real_msec();
+			MySQLClient* client = new MySQLClient(dbInfo->host, dbInfo->port, dbInfo->username, dbInfo->password, dbInfo->databaseName, dbInfo->timeout);
+			costs[idx] = exact_real_msec() - begin;
+
+			if (client->connected())
+				clients[idx] = client;
+			else
+			{
+				rejected[idx] = client->authenticationFailed();
+				delete client;
+			}
+		}
+		mysql_thread_end();
+	};
+
+	int64_t startTime = exact_real_msec();
+	std::vector<std::thread> threads;
+	size_t threadCount = std::min((size_t)_warmUpThreadCount, connectionCount);
+	for (size_t i = 0; i < threadCount; i++)
+		threads.push_back(std::thread(connectFunc));
+
+	for (auto& thread: threads)
+		thread.join();
+
+	int failedInstances = 0;
+	int slowInstances = 0;
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		DatabaseInfo* dbInfo = instances[i];
+		WarmedConnections& warmed = warmedConnections[dbInfo];
+		int64_t slowest = 0;
+
+		for (size_t idx = i * perInstance; idx < (i + 1) * perInstance; idx++)
+		{
+			if (clients[idx])
+				warmed.clients.push_back(clients[idx]);
+			else
+			{
+				warmed.failed += 1;
+				if (rejected[idx])
+					warmed.rejected += 1;
+			}
+
+			slowest = std::max(slowest, costs[idx]);
+		}
+
+		if (warmed.failed)
+		{
+			failedInstances += 1;
+			LOG_ERROR("Warm up connections to server %d (%s:%d) failed. Connected: %d, failed: %d, authentication rejected: %d.",
+				dbInfo->serverId, dbInfo->host.c_str(), dbInfo->port, (int)warmed.clients.size(), warmed.failed, warmed.rejected);
+		}
+		else if (_warmUpSlowMsec && slowest >= _warmUpSlowMsec)
+		{
+			slowInstances += 1;
+			LOG_WARN("Warm up connections to server %d (%s:%d) is slow. The slowest connecting costs %d msec.",
+				dbInfo->serverId, dbInfo->host.c_str(), dbInfo->port, (int)slowest);
+		}
+	}
+
+	LOG_INFO("Warm up %d connections for %d instances in %d msec. Failed instances: %d, slow instances: %d.",
+		(int)connectionCount, (int)instances.size(), (int)(exact_real_msec() - startTime), failedInstances, slowInstances);
+}
+
 TableManagerPtr TableManagerBuilder::build(TableManagerPtr oldTableManager)
 {
 	/*
 		5. _dbCollection => _dbTaskQueues
-		6. _tableSplittingInfos + _dbTaskQueues => _tableTaskQueues
+		6. _tableSplittingInfos + _dbTaskQueues => TableInfo::hashRoutes
 		7. _rangeSplittingInfos + _dbTaskQueues => _rangedTaskQueues
-		8. _dbInfos => enable Thread Pool
+		8. _dbInfos => warm up connections, enable Thread Pool
 		9. clean _constructureInfo
 	*/
 
@@ -356,7 +597,7 @@ TableManagerPtr TableManagerBuilder::build(TableManagerPtr oldTableManager)
 	if (!init_step5_dbCollection_to_dbTaskQueues(oldTableManager))
 		return nullptr;
 	
-	/* 6. _tableSplittingInfos + _dbTaskQueues => _tableTaskQueues */
+	/* 6. _tableSplittingInfos + _dbTaskQueues => TableInfo::hashRoutes */
 	if (!init_step6_tableSplittingInfos_dbTaskQueues_to_tableTaskQueues())
 		return nullptr;
 
@@ -364,20 +605,34 @@ TableManagerPtr TableManagerBuilder::build(TableManagerPtr oldTableManager)
 	if (!init_step7_rangeSplittingInfos_dbTaskQueues_to_rangedTaskQueues())
 		return nullptr;
 
-	/* 8. _tableTaskQueues.databaseList => enable Thread Pool */
+	/* 8. _usedTaskQueues.databaseList => warm up connections, enable Thread Pool */
+	std::map<DatabaseInfo*, WarmedConnections> warmedConnections;
+	warmUpConnections(warmedConnections);
+
 	for (auto& taskQueuePtr: _usedTaskQueues)
 	{
 		if (taskQueuePtr->inited)
 			continue;
 
+		attachZoneGate(taskQueuePtr->databaseList);
+
 		for (auto& dbInfoPtr: taskQueuePtr->databaseList)
 		{
+			WarmedConnections& warmed = warmedConnections[dbInfoPtr.get()];
+			int unreachedCount = warmed.failed - warmed.rejected;
+			bool unreachable = (unreachedCount > 0 && warmed.clients.empty());
+
 			if (dbInfoPtr->master_id == 0)
 				dbInfoPtr->enableThreadPool(&(taskQueuePtr->queue), _perThreadPoolInitCount, _perThreadPoolAppendCount,
-					_perThreadPoolPerfectCount, _perThreadPoolMaxCount, _perThreadPoolTempThreadLatencySeconds);
+					_perThreadPoolPerfectCount, _perThreadPoolMaxCount, _perThreadPoolTempThreadLatencySeconds, warmed.clients);
 			else
 				dbInfoPtr->enableThreadPool(taskQueuePtr->queue.readQueue(), _perThreadPoolInitCount, _perThreadPoolAppendCount,
-					_perThreadPoolPerfectCount, _perThreadPoolMaxCount, _perThreadPoolTempThreadLatencySeconds);
+					_perThreadPoolPerfectCount, _perThreadPoolMaxCount, _perThreadPoolTempThreadLatencySeconds, warmed.clients);
+
+			//-- Open the circuit breaker before the instance receives traffic.
+			if (unreachable)
+				for (int i = 0; i < unreachedCount; i++)
+					dbInfoPtr->reportConnection(false);
 		}
 
 		taskQueuePtr->inited = true;
@@ -388,7 +643,8 @@ TableManagerPtr TableManagerBuilder::build(TableManagerPtr oldTableManager)
 	_constructureInfo = NULL;
 
 	_tableManager->_tableInfos.swap(_tableInfos);
-	_tableManager->_tableTaskQueues.swap(_tableTaskQueues);
+	_tableManager->_hashTaskQueues.swap(_hashTaskQueues);
+	_tableManager->_databaseNames.swap(_databaseNames);
 	_tableManager->_rangedTaskQueues.swap(_rangedTaskQueues);
 	_tableManager->_usedTaskQueues.swap(_usedTaskQueues);
 
@@ -1,7 +1,12 @@
+#include <random>
+#include <sstream>
+#include "msec.h"
 #include "FPLog.h"
 #include "FPWriter.h"
+#include "SQLLexer.h"
 #include "SQLParser.h"
 #include "TaskPackage.h"
+#include "GTIDTracker.h"
 #include "DataRouterErrorInfo.h"
 
 using fpnn::FPAWriter;
@@ -130,6 +135,37 @@ void AggregatedTask::finish()
 
 	_asyncAnswer->sendAnswer(answer);
 }
+//========================================//
+//- Multi-Query Task
+//========================================//
+void MultiQueryTask::finish()
+{
+	FPAWriter aw(1, _asyncAnswer->getQuest());
+	aw.paramArray("results", _results.size());
+
+	for (auto& item: _results)
+	{
+		aw.paramMap(2);
+		if (!item.result)
+		{
+			aw.param("code", item.code);
+			aw.param("ex", item.error);
+		}
+		else if (item.result->type == QueryResult::SelectType)
+		{
+			aw.param("fields", item.result->fields);
+			aw.param("rows", item.result->rows);
+		}
+		else
+		{
+			aw.param("affectedRows", item.result->affectedRows);
+			aw.param("insertId", item.result->insertId);
+		}
+	}
+
+	_asyncAnswer->sendAnswer(aw.take());
+}
+
 //=============================================//
 //-	TaskPackage
 //=============================================//
@@ -142,16 +178,22 @@ TaskPackage::~TaskPackage()
 
 void TaskPackage::finish(const char* errInfo)
 {
-	if (_processed || !_asyncAnswer)
-		return;
-		
-	FPAnswerPtr answer = FPAWriter::errorAnswer(_asyncAnswer->getQuest(), ErrorInfo::internalErrorCode, errInfo, ErrorInfo::raiser_DataRouter);
-	finish(answer);
+	finish(ErrorInfo::internalErrorCode, errInfo);
 }
 
 void TaskPackage::finish(int code, const char* errInfo)
 {
-	if (_processed || !_asyncAnswer)
+	if (_processed)
+		return;
+
+	if (_multiQueryTask)
+	{
+		_multiQueryTask->fillError(_multiQueryIndex, code, errInfo);
+		_processed = true;
+		return;
+	}
+
+	if (!_asyncAnswer)
 		return;
 		
 	FPAnswerPtr answer = FPAWriter::errorAnswer(_asyncAnswer->getQuest(), code, errInfo, ErrorInfo::raiser_DataRouter);
@@ -166,49 +208,208 @@ void TaskPackage::finish(FPAnswerPtr answer)
 	_processed = _asyncAnswer->sendAnswer(answer);
 }
 
+void TaskPackage::finish(QueryResultPtr result)
+{
+	if (_processed)
+		return;
+
+	if (_multiQueryTask)
+	{
+		_multiQueryTask->fillResult(_multiQueryIndex, result);
+		_processed = true;
+	}
+	else if (_aggregatedTask)
+	{
+		_aggregatedTask->fillResult(_aggregatedTableHintId, result);
+		_processed = true;
+	}
+	else if (_asyncAnswer)
+	{
+		FPAWriter aw(2, _asyncAnswer->getQuest());
+		if (result->type == QueryResult::SelectType)
+		{
+			aw.param("fields", result->fields);
+			aw.param("rows", result->rows);
+		}
+		else
+		{
+			aw.param("affectedRows", result->affectedRows);
+			aw.param("insertId", result->insertId);
+		}
+		finish(aw.take());
+	}
+}
+
 void TaskPackage::setMySQLRepingInterval(int interval)
 {
 	_mySQLRepingInterval = interval;
 }
 
-bool TaskPackage::setSuffix(const std::string& tableName, std::string& sql, const char* suffix)
+bool TaskPackage::prepareConnection(MySQLClient *mySQL)
 {
+	bool connected = mySQL->connected();
+	if (connected)
+	{
+		if (time(NULL) - mySQL->lastOperatedTime() >= _mySQLRepingInterval)
+			connected = mySQL->ping();
+	}
+	if (!connected)
+	{
+		mySQL->cleanup();
+		return mySQL->connect();
+	}
+	return true;
+}
+
+void TaskPackage::recordGTID(MySQLClient *mySQL)
+{
+	if (_session.empty() || mySQL->lastErrno())
+		return;
+
+	GTIDTracker::record(_session, _masterServerId, mySQL);
+}
+
+bool TaskPackage::setSuffix(const std::string& tableName, std::string& sql, const char* suffix, const SQLTemplate* sqlTemplate)
+{
+	if (sqlTemplate)
+	{
+		sqlTemplate->materialize(suffix, sql);
+		return true;
+	}
+
 	return SQLParser::addTableSuffix(sql, tableName, suffix);
 }
 
 //=============================================//
 //-	QueryTask
 //=============================================//
+int QueryTask::_readRetryLimit = 0;
+int QueryTask::_readRetryDelayMsec = 20;
+TokenBucketPtr QueryTask::_readRetryBudget;
+std::atomic<uint64_t> QueryTask::_readRetriedCount(0);
+std::atomic<uint64_t> QueryTask::_readRecoveredCount(0);
+std::atomic<uint64_t> QueryTask::_readRetryExhaustedCount(0);
+
+void QueryTask::configReadRetry(int maxRetries, int delayMsec, int budgetPerSecond)
+{
+	_readRetryLimit = maxRetries > 0 ? maxRetries : 0;
+	_readRetryDelayMsec = delayMsec > 0 ? delayMsec : 0;
+	if (budgetPerSecond > 0)
+		_readRetryBudget = std::make_shared<TokenBucket>(budgetPerSecond, budgetPerSecond);
+	else
+		_readRetryBudget = nullptr;
+}
+
+std::string QueryTask::readRetryStatusInJSON()
+{
+	std::ostringstream oss;
+	oss<<"{\"maxRetries\":"<<_readRetryLimit;
+	oss<<",\"retried\":"<<_readRetriedCount;
+	oss<<",\"recovered\":"<<_readRecoveredCount;
+	oss<<",\"exhausted\":"<<_readRetryExhaustedCount;
+	oss<<",\"budgetLimited\":"<<(_readRetryBudget ? (uint64_t)_readRetryBudget->limitedCount : 0);
+	oss<<"}";
+	return oss.str();
+}
+
+bool QueryTask::retryRead(MySQLClient *mySQL)
+{
+	if (!mySQL->connectionLost())
+	{
+		if (_retries)
+			_readRecoveredCount++;
+		return false;
+	}
+
+	if (_readRetryLimit == 0 || _taskQueue == NULL || !SQLParser::isReadSQL(_sql))
+		return false;
+
+	//-- The lost connection is reconnected by the next task.
+	mySQL->cleanup();
+
+	if (_retries >= _readRetryLimit || (_readRetryBudget && !_readRetryBudget->take()))
+	{
+		_readRetryExhaustedCount++;
+		return false;
+	}
+
+	_retries += 1;
+	_retryPending = true;
+	_readRetriedCount++;
+	return true;
+}
+
+bool QueryTask::fallBackToMaster(MySQLClient *mySQL)
+{
+	//-- Only the reads taken from the read queue shared by the replicas.
+	if (_session.empty() || !_readQueued || _taskQueue == NULL)
+		return false;
+
+	if (GTIDTracker::caughtUp(_session, _masterServerId, mySQL))
+		return false;
+
+	_master = true;
+	_retryPending = true;
+	return true;
+}
+
+int QueryTask::retryDelayMsec()
+{
+	if (_readRetryDelayMsec == 0 || _retries == 0)
+		return 0;
+
+	static thread_local std::minstd_rand random((unsigned int)(uintptr_t)&random ^ (unsigned int)slack_mono_msec());
+	int64_t ceiling = (int64_t)_readRetryDelayMsec << std::min(_retries - 1, 10);
+	return (int)(random() % (ceiling + 1));
+}
+
 void QueryTask::processTask(MySQLClient *mySQL) throw ()
 {
 	try
 	{
-		bool connected = mySQL->connected();
-		if (connected)
+		if (!prepareConnection(mySQL))
 		{
-			if (time(NULL) - mySQL->lastOperatedTime() >= _mySQLRepingInterval)
-				connected = mySQL->ping();
-		}
-		if (!connected)
-		{
-			mySQL->cleanup();
-			if (!mySQL->connect())
-			{
+			if (!retryRead(mySQL))
 				finish("Database connection lost.");
-				return;
-			}
+			return;
 		}
+
+		if (fallBackToMaster(mySQL))
+			return;
 		
 		if (_asyncAnswer)
 		{
 			FPAnswerPtr answer = mySQL->query(_databaseName, _sql, _asyncAnswer->getQuest());
-			finish(answer);
+			if (!retryRead(mySQL))
+			{
+				if (_session.length() && !SQLParser::isReadSQL(_sql))
+					recordGTID(mySQL);
+				finish(answer);
+			}
+		}
+		else if (_multiQueryTask)
+		{
+			QueryResultPtr result(new QueryResult);
+			bool succeeded = mySQL->query(_databaseName, _sql, *result);
+			if (retryRead(mySQL))
+				return;
+
+			if (_session.length() && !SQLParser::isReadSQL(_sql))
+				GTIDTracker::recordUntracked(_session, _masterServerId);
+
+			if (succeeded)
+				finish(result);
+			else
+				finish(ErrorInfo::MySQLExceptionCode, result->errorInfo.c_str());
 		}
 		else
 		{
 			QueryResultPtr result(new QueryResult);
+			bool succeeded = mySQL->query(_databaseName, _sql, *result);
+			if (retryRead(mySQL))
+				return;
 
-			if (mySQL->query(_databaseName, _sql, *result))
+			if (succeeded)
 				_aggregatedTask->fillResult(_aggregatedTableHintId, result);
 			else
 				LOG_ERROR("Aggregated task: table id %d, database: %s, sql:[%s] failed.",
@@ -226,76 +427,70 @@ void QueryTask::processTask(MySQLClient *mySQL) throw ()
 //=============================================//
 bool ParamsQueryTask::assemble(MySQLClient *mySQL)
 {
+	if (_assembled)
+		return true;
+
 	mySQL->escapeStrings(_params);
+
+	size_t length = _sql.length();
+	for (auto& param: _params)
+		length += param.length();
+
 	std::string realSql;
+	realSql.reserve(length);
 
 	size_t index = 0;
 	size_t begin = 0;
-	size_t pos = 0;
-	while (true)
-	{
-		if (begin >= _sql.length())
-		{
-			_sql.swap(realSql);
-			return true;
-		}
-
-		pos = _sql.find_first_of('?', begin);
-		if (pos == std::string::npos)
-		{
-			if (index != _params.size())
-				return false;
-
-			realSql += _sql.substr(begin, std::string::npos);
-			_sql.swap(realSql);
-			return true;
-		}
+	size_t pos;
+	bool quoted;
 
+	SQLLexer lexer(_sql);
+	while (lexer.nextPlaceholder(pos, quoted))
+	{
 		if (index == _params.size())
 			return false;
 
-		realSql += _sql.substr(begin, pos - begin);
+		realSql.append(_sql, begin, pos - begin);
 		realSql.append(_params[index]);
 
 		begin = pos + 1;
 		index += 1;
 	}
+
+	if (index != _params.size())
+		return false;
+
+	realSql.append(_sql, begin, std::string::npos);
+	_sql.swap(realSql);
+	_assembled = true;
+	return true;
 }
 
 bool ParamsQueryTask::preassemble(const std::string& sql, const std::vector<std::string>& params, std::string& semisql, std::vector<std::string>& restParams)
 {
+	size_t length = sql.length();
+	for (auto& param: params)
+		length += param.length();
+
 	semisql.clear();
+	semisql.reserve(length);
 	restParams.clear();
-	size_t index = 0;
 
+	size_t index = 0;
 	size_t begin = 0;
-	size_t pos = 0;
-	while (true)
-	{
-		if (begin >= sql.length())
-		{
-			if (index < params.size())
-				return false;
-			else
-				return true;
-		}
-
-		pos = sql.find_first_of('?', begin);
-		if (pos == std::string::npos)
-		{
-			if (index != params.size())
-				return false;
-
-			semisql += sql.substr(begin, std::string::npos);
-			return true;
-		}
+	size_t pos;
+	bool quoted;
 
+	//-- '?' in string literals, quoted identifiers and comments are not placeholders.
+	SQLLexer lexer(sql);
+	while (lexer.nextPlaceholder(pos, quoted))
+	{
 		if (index == params.size())
 			return false;
 
-		semisql += sql.substr(begin, pos - begin);
+		semisql.append(sql, begin, pos - begin);
 
-		if (pos > 0 && (sql.at(pos - 1) == '\'') && (sql.at(pos+1) == '\''))
+		if (quoted)
 		{
 			restParams.push_back(params[index]);
 			semisql.append("?");
@@ -308,46 +503,73 @@ bool ParamsQueryTask::preassemble(const std::string& sql, const std::vector<std:
 		begin = pos + 1;
 		index += 1;
 	}
+
+	if (index != params.size())
+		return false;
+
+	semisql.append(sql, begin, std::string::npos);
+	return true;
 }
 
 void ParamsQueryTask::processTask(MySQLClient *mySQL) throw ()
 {
 	try
 	{
-		bool connected = mySQL->connected();
-		if (connected)
+		if (!prepareConnection(mySQL))
 		{
-			if (time(NULL) - mySQL->lastOperatedTime() >= _mySQLRepingInterval)
-				connected = mySQL->ping();
-		}
-		if (!connected)
-		{
-			mySQL->cleanup();
-			if (!mySQL->connect())
-			{
+			if (!retryRead(mySQL))
 				finish("Database connection lost.");
-				return;
-			}
+			return;
 		}
+
+		if (fallBackToMaster(mySQL))
+			return;
 		
 		if (_asyncAnswer)
 		{
-			FPAnswerPtr answer;
-
 			if (assemble(mySQL))
-				answer = mySQL->query(_databaseName, _sql, _asyncAnswer->getQuest());
+			{
+				FPAnswerPtr answer = mySQL->query(_databaseName, _sql, _asyncAnswer->getQuest());
+				if (!retryRead(mySQL))
+				{
+					if (_session.length() && !SQLParser::isReadSQL(_sql))
+						recordGTID(mySQL);
+					finish(answer);
+				}
+			}
 			else
-				answer = ErrorInfo::invalidParametersAnswer(_asyncAnswer->getQuest());
+				finish(ErrorInfo::invalidParametersAnswer(_asyncAnswer->getQuest()));
+		}
+		else if (_multiQueryTask)
+		{
+			if (assemble(mySQL))
+			{
+				QueryResultPtr result(new QueryResult);
+				bool succeeded = mySQL->query(_databaseName, _sql, *result);
+				if (retryRead(mySQL))
+					return;
+
+				if (_session.length() && !SQLParser::isReadSQL(_sql))
+					GTIDTracker::recordUntracked(_session, _masterServerId);
 
-			finish(answer);
+				if (succeeded)
+					finish(result);
+				else
+					finish(ErrorInfo::MySQLExceptionCode, result->errorInfo.c_str());
+			}
+			else
+				finish(ErrorInfo::invalidParametersCode, "Invalid parameters.");
 		}
 		else
 		{
 			if (assemble(mySQL))
 			{
 				QueryResultPtr result(new QueryResult);
+				bool succeeded = mySQL->query(_databaseName, _sql, *result);
+				if (retryRead(mySQL))
+					return;
 
-				if (mySQL->query(_databaseName, _sql, *result))
+				if (succeeded)
 					_aggregatedTask->fillResult(_aggregatedTableHintId, result);
 				else
 					LOG_ERROR("Aggregated task: table id %d, database: %s, sql:[%s] failed.",
@@ -383,23 +605,14 @@ void TransactionTask::processTask(MySQLClient *mySQL) throw ()
 {
 	try
 	{
-		bool connected = mySQL->connected();
-		if (connected)
-		{
-			if (time(NULL) - mySQL->lastOperatedTime() >= _mySQLRepingInterval)
-				connected = mySQL->ping();
-		}
-		if (!connected)
+		if (!prepareConnection(mySQL))
 		{
-			mySQL->cleanup();
-			if (!mySQL->connect())
-			{
-				finish("Database connection lost.");
-				return;
-			}
+			finish("Database connection lost.");
+			return;
 		}
 		
 		FPAnswerPtr answer = mySQL->transaction(_databaseName, _sqls, _asyncAnswer->getQuest());
+		recordGTID(mySQL);
 		finish(answer);
 	}
 	catch (const std::exception &e)
@@ -1,28 +1,118 @@
 #ifndef Task_Queue_h
 #define Task_Queue_h
 
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "msec.h"
 #include "SafeQueue.hpp"
 #include "TaskPackage.h"
 #include "IMySQLTaskQueue.h"
+#include "QoSController.h"
 
 using namespace fpnn;
 
+//---------------------------------------------//
+//-	Sojourn Monitor
+//---------------------------------------------//
+/*
+	CoDel style overload detection. If the sojourn time of the dequeued tasks stays above the target for an interval,
+	the queue is overloaded, until a task is dequeued under the target, or the queue is emptied.
+	The new tasks are shed by QoS class: level 1 sheds the background tasks, level 2 (above the target for two intervals)
+	sheds the batch tasks too, and level 3 (above the interactive target for an interval) sheds all.
+*/
+class SojournMonitor
+{
+	std::atomic<int64_t> _aboveTime;				//-- Since when the sojourn time is above the target.
+	std::atomic<int64_t> _interactiveAboveTime;
+	std::atomic<int> _overloadLevel;
+	std::atomic<uint64_t> _shedCount;
+
+	static int64_t _targetMsec;			//-- 0 means disabled.
+	static int64_t _interactiveTargetMsec;
+	static int64_t _intervalMsec;
+	static std::atomic<uint64_t> _totalShedCount[QoSClassCount];
+
+public:
+	SojournMonitor(): _aboveTime(0), _interactiveAboveTime(0), _overloadLevel(0), _shedCount(0) {}
+
+	void dequeued(const TaskPackagePtr& task, bool emptied);
+	inline int overloadLevel() { return _overloadLevel; }
+	inline bool shedding(int qosClass) { return qosClass >= QoSClassCount - _overloadLevel; }
+	inline void shed(int qosClass) { _shedCount++; _totalShedCount[qosClass]++; }
+	inline uint64_t shedCount() { return _shedCount; }
+
+	//-- interactiveTargetMsec: less than targetMsec means 4 times of targetMsec.
+	static void config(int targetMsec, int intervalMsec, int interactiveTargetMsec);
+	static inline bool enabled() { return _targetMsec > 0; }
+	static std::string statusInJSON();
+};
+
 //---------------------------------------------//
 //-	Task Queue
 //---------------------------------------------//
+/*
+	One sub-queue per QoS class. The classes are popped by weighted round robin, and the empty classes are skipped.
+
+	Database affinity: a worker looks ahead at most affinityWindow tasks for the database of its connection, to avoid
+	mysql_select_db. The skipped tasks are deferred, and taken first by the next pops without a matched task.
+	The oldest deferred task is also taken once affinityWindow pops have passed it, so its waiting is bounded.
+	The sojourn time is reported when the task is handed to the worker, includes the deferred time.
+
+	FIFO queue: the write queue of the master. Neither the class weights nor the database affinity reorders the writes.
+*/
 class TaskQueue: public IMySQLTaskQueue
 {
-	SafeQueue<TaskPackagePtr> *_queue;
+	SafeQueue<TaskPackagePtr> _queues[QoSClassCount];		//-- Only _queues[0] is used by the FIFO queue.
+	SojournMonitor _monitor;
+	std::atomic<uint32_t> _round;
+	const bool _fifo;
+
+	std::mutex _deferredMutex;
+	std::list<TaskPackagePtr> _deferredTasks;
+	std::atomic<size_t> _deferredCount;
+	std::atomic<size_t> _deferredPasses;		//-- Pops since the oldest deferred task was taken.
+
+	static std::atomic<uint32_t> _weightBounds[QoSClassCount];		//-- Accumulated weights.
+	static size_t _affinityWindow;				//-- 0 means disabled.
+	static std::atomic<uint64_t> _affinityHits;
+
+	TaskPackagePtr popQueued();
+	TaskPackagePtr popDeferred(const std::string* database);
+	inline TaskPackagePtr handOut(TaskPackagePtr task)
+	{
+		if (task)
+			_monitor.dequeued(task, empty());
+		return task;
+	}
 	
 public:
-	TaskQueue(SafeQueue<TaskPackagePtr> *queue): _queue(queue) {}
-	virtual ~TaskQueue() {}
+	TaskQueue(bool fifo = false): _round(0), _fifo(fifo), _deferredCount(0), _deferredPasses(0) {}
+	virtual ~TaskQueue();
 	
-	virtual bool empty() { return _queue->empty(); }
-	virtual size_t size() { return _queue->size(); }
+	virtual bool empty();
+	virtual size_t size();
 	virtual void clear() {}	//-- do nothing. Because many thread pool will sharing a queue.
 
 	virtual TaskPackagePtr pop() throw ();
+	virtual TaskPackagePtr pop(const std::string& database) throw ();
+	inline void push(TaskPackagePtr task)
+	{
+		if (SojournMonitor::enabled())
+			task->setEnqueuedTime(slack_mono_msec());
+
+		_queues[_fifo ? 0 : task->qosClass()].push(task);
+	}
+
+	SojournMonitor& monitor() { return _monitor; }
+
+	//-- Weights of interactive, batch and background classes. Invalid weights are ignored.
+	static bool setClassWeights(const std::vector<int>& weights);
+	static std::string classWeightsInJSON();
+
+	static void configAffinity(int window) { _affinityWindow = window > 0 ? (size_t)window : 0; }
+	static std::string affinityStatusInJSON();
 };
 
 //---------------------------------------------//
@@ -30,14 +120,12 @@ public:
 //---------------------------------------------//
 class RWTaskQueue: public IMySQLTaskQueue
 {
-	SafeQueue<TaskPackagePtr> _rqueue;
-	SafeQueue<TaskPackagePtr> _wqueue;
-	
-	TaskQueue _rqueueWrapper;
+	TaskQueue _rqueue;
+	TaskQueue _wqueue;
 	
 public:
-	RWTaskQueue(): _rqueue(), _wqueue(), _rqueueWrapper(&_rqueue) {}
-	virtual ~RWTaskQueue();
+	RWTaskQueue(): _rqueue(), _wqueue(true) {}
+	virtual ~RWTaskQueue() {}
 	
 	virtual bool empty() { return _rqueue.empty() ? _wqueue.empty() : false; }
 	virtual size_t size() { return _rqueue.size() + _wqueue.size(); }
@@ -46,12 +134,17 @@ public:
 	virtual void clear() {} //-- do nothing. Because many thread pool will sharing this queue.
 
 	virtual TaskPackagePtr pop() throw ();
+	virtual TaskPackagePtr pop(const std::string& database) throw ();
 	inline void push(TaskPackagePtr task, bool readTask)
 	{
+		task->setReadQueued(readTask);
 		readTask ? _rqueue.push(task) : _wqueue.push(task);
 	}
 	
-	TaskQueue* readQueue() { return &_rqueueWrapper; }
+	TaskQueue* readQueue() { return &_rqueue; }
+	TaskQueue* writeQueue() { return &_wqueue; }
+	SojournMonitor& readMonitor() { return _rqueue.monitor(); }
+	SojournMonitor& writeMonitor() { return _wqueue.monitor(); }
 };
 
 #endif
@@ -0,0 +1,50 @@
+----------------------------------
+-- Change log for incremental reloading
+-- Enabled by DBProxy.ConfigureDB.changeLog.enable
+----------------------------------
+
+use dbproxy_config;
+
+CREATE TABLE IF NOT EXISTS config_change_log (
+	id bigint unsigned not null primary key auto_increment,
+	table_name varchar(64) not null,	-- server_info, table_info, split_table_info or split_range_info.
+	row_id int unsigned not null,		-- server_id for server_info, id for the others.
+	mtime timestamp not null default CURRENT_TIMESTAMP
+)ENGINE=InnoDB DEFAULT CHARSET=utf8;
+
+-- The old rows can be deleted at any time, but DO NOT truncate or recreate the table,
+-- which restarts the ids, and makes DBProxy reload all config tables.
+-- Changing "DBProxy config data update" in variable_setting is still required to trigger the reloading,
+-- and it should be done after the changes of the config tables are committed.
+
+----------------------------------
+-- Triggers
+----------------------------------
+
+CREATE TRIGGER server_info_insert_log AFTER INSERT ON server_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('server_info', NEW.server_id);
+CREATE TRIGGER server_info_update_log AFTER UPDATE ON server_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('server_info', OLD.server_id), ('server_info', NEW.server_id);
+CREATE TRIGGER server_info_delete_log AFTER DELETE ON server_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('server_info', OLD.server_id);
+
+CREATE TRIGGER table_info_insert_log AFTER INSERT ON table_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('table_info', NEW.id);
+CREATE TRIGGER table_info_update_log AFTER UPDATE ON table_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('table_info', OLD.id), ('table_info', NEW.id);
+CREATE TRIGGER table_info_delete_log AFTER DELETE ON table_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('table_info', OLD.id);
+
+CREATE TRIGGER split_table_info_insert_log AFTER INSERT ON split_table_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('split_table_info', NEW.id);
+CREATE TRIGGER split_table_info_update_log AFTER UPDATE ON split_table_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('split_table_info', OLD.id), ('split_table_info', NEW.id);
+CREATE TRIGGER split_table_info_delete_log AFTER DELETE ON split_table_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('split_table_info', OLD.id);
+
+CREATE TRIGGER split_range_info_insert_log AFTER INSERT ON split_range_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('split_range_info', NEW.id);
+CREATE TRIGGER split_range_info_update_log AFTER UPDATE ON split_range_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('split_range_info', OLD.id), ('split_range_info', NEW.id);
+CREATE TRIGGER split_range_info_delete_log AFTER DELETE ON split_range_info FOR EACH ROW
+	INSERT INTO config_change_log (table_name, row_id) VALUES ('split_range_info', OLD.id);